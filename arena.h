@@ -31,9 +31,17 @@ extern "C"
 
     typedef struct Arena
     {
-        unsigned char* base;
-        size_t pos;
-        size_t size;
+        unsigned char* base; /* Current chunk */
+        size_t pos;          /* Offset into the current chunk */
+        size_t size;         /* Size of the current chunk */
+        size_t high_water;   /* Highest held byte count rewound from; see arena_high_water() */
+        /* Chunk chaining (ARENA_FLAG_GROW); a plain arena keeps one chunk */
+        size_t chunk_offset; /* Mark of the current chunk's first byte */
+        size_t held_before;  /* Bytes in use in the earlier chunks */
+        size_t reserved;     /* Bytes reserved by all chunks */
+        size_t chunk_size;   /* Reserve of each chunk added by growth */
+        unsigned chunks;     /* Chunks in the chain, this one included */
+        unsigned flags;      /* ARENA_FLAG_* */
 #ifdef ARENA_ENABLE_COMMIT
         size_t commit;
 #endif
@@ -42,6 +50,26 @@ extern "C"
 #endif
     } Arena;
 
+/* Flags for arena_create_ex() */
+#define ARENA_FLAG_GROW 1u       /* Chain another chunk when one fills instead of failing */
+#define ARENA_FLAG_HUGE_PAGES 2u /* Ask for transparent huge pages (a hint; Linux only) */
+#define ARENA_FLAG_SCRATCH 4u    /* Set on the per-thread scratch arenas */
+
+    /* Rewind point taken by arena_temp_begin() and restored by arena_temp_end() */
+    typedef struct
+    {
+        Arena* arena;
+        size_t mark;
+    } ArenaTemp;
+
+    typedef struct
+    {
+        size_t held;       /* Bytes in use now */
+        size_t high_water; /* Most bytes in use at once */
+        size_t reserved;   /* Address space reserved by all chunks */
+        unsigned chunks;
+    } ArenaStats;
+
 #define KiB(x) ((size_t)(x) << 10)
 #define MiB(x) ((size_t)(x) << 20)
 #define GiB(x) ((size_t)(x) << 30)
@@ -50,10 +78,39 @@ extern "C"
 
     ARENA_API void arena_clear(Arena* a);
     ARENA_API void arena_destroy(Arena* a);
+    /* One fixed chunk of reserve bytes; pushes past it fail */
     ARENA_API Arena arena_create(size_t reserve);
+    /* With ARENA_FLAG_GROW, chunks of reserve bytes (or larger, for one big push)
+     * are chained as needed; marks taken in any chunk stay valid */
+    ARENA_API Arena arena_create_ex(size_t reserve, unsigned flags);
     ARENA_API void* arena_push_size(Arena* a, size_t size, size_t align);
     ARENA_API size_t arena_get_mark(Arena* a);
     ARENA_API void arena_set_mark(Arena* a, size_t mark);
+    /* Most bytes the arena has held at once since creation */
+    ARENA_API size_t arena_high_water(const Arena* a);
+    ARENA_API ArenaStats arena_stats(const Arena* a);
+
+    /* Scoped rewinds: everything pushed after begin is released by end.
+     * end is idempotent and takes a pointer so it can be a cleanup handler. */
+    ARENA_API ArenaTemp arena_temp_begin(Arena* a);
+    ARENA_API void arena_temp_end(ArenaTemp* temp);
+
+    /*
+     * Per-thread scratch arenas (growable, created on first use, released
+     * when the thread exits). Returns one that is not conflict, so a function
+     * handed an arena can take scratch space without burying the caller's
+     * allocations. Only the calling thread may use it.
+     */
+    ARENA_API Arena* arena_scratch(const Arena* conflict);
+    /* arena_temp_begin() on arena_scratch(conflict) */
+    ARENA_API ArenaTemp arena_scratch_begin(const Arena* conflict);
+    /* Highest high-water mark any thread's scratch arena reached, as of the
+     * scopes closed so far */
+    ARENA_API size_t arena_scratch_high_water(void);
+    /* Grow or shrink the most recent allocation in place. Returns 0, leaving
+     * the arena untouched, if ptr is not the top allocation or space runs out.
+     * Bytes gained by growing are not zeroed. */
+    ARENA_API int arena_resize_last(Arena* a, void* ptr, size_t old_size, size_t new_size);
 
 #define arena_push(arena, T) ((T*)arena_push_size((arena), sizeof(T), __alignof__(T)))
 #define arena_push_array(arena, T, count)                                                          \
@@ -63,6 +120,14 @@ extern "C"
 #define arena_push_array_safe(arena, T, count)                                                     \
     ((T*)arena_push_size_safe((arena), sizeof(T) * (count), __alignof__(T)))
 
+/* RAII-style scope: name's allocations are released when it leaves scope */
+#if defined(__GNUC__) || defined(__clang__)
+#define ARENA_TEMP_SCOPE(name, arena)                                                              \
+    ArenaTemp name __attribute__((cleanup(arena_temp_end))) = arena_temp_begin(arena)
+#define ARENA_SCRATCH_SCOPE(name, conflict)                                                        \
+    ArenaTemp name __attribute__((cleanup(arena_temp_end))) = arena_scratch_begin(conflict)
+#endif
+
     ARENA_API char* arena_strdup(Arena* a, const char* s);
     ARENA_API char* arena_strdup_safe(Arena* a, const char* s);
     ARENA_API void* arena_push_size_safe(Arena* a, size_t size, size_t align);
@@ -73,6 +138,7 @@ extern "C"
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #else
+#include <pthread.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #endif
@@ -86,77 +152,170 @@ extern "C"
         return (p + (a - 1)) & ~(a - 1);
     }
 
-    ARENA_API Arena arena_create(size_t reserve)
+    /* Header at the start of every chained chunk: the state of the chunk before it */
+    typedef struct ArenaChunk
     {
-        Arena a = {0};
-#ifdef _WIN32
-        a.base = VirtualAlloc(NULL, reserve, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-        if (!a.base)
-            return a;
-        a.size = reserve;
-#ifdef ARENA_ENABLE_COMMIT
-        a.commit = reserve;
+        unsigned char* base;
+        size_t pos;
+        size_t size;
+        size_t chunk_offset;
+        size_t held_before;
+#ifndef _WIN32
+        int is_mmap;
 #endif
+    } ArenaChunk;
+
+    /* Reserve size bytes; *is_mmap says how they must be released */
+    static unsigned char* arena_map(size_t size, unsigned flags, int* is_mmap)
+    {
+        (void)flags;
+#ifdef _WIN32
+        *is_mmap = 1;
+        return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 #else
         int prot = PROT_READ | PROT_WRITE;
-        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-        void* ptr = mmap(NULL, reserve, prot, flags, -1, 0);
+        int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        void* ptr = mmap(NULL, size, prot, map_flags, -1, 0);
         if (ptr == MAP_FAILED)
         {
-            ptr = malloc(reserve);
-            if (!ptr)
-                return a;
-            a.base = ptr;
-            a.size = reserve;
-            a.is_mmap = 0; /* Allocated via malloc */
-#ifdef ARENA_ENABLE_COMMIT
-            a.commit = reserve;
-#endif
+            *is_mmap = 0; /* Allocated via malloc */
+            return malloc(size);
         }
+#ifdef MADV_HUGEPAGE
+        /* WHY: a hint only; the kernel backs aligned 2 MiB runs as they are touched */
+        if (flags & ARENA_FLAG_HUGE_PAGES)
+            madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+        *is_mmap = 1;
+        return ptr;
+#endif
+    }
+
+    static void arena_unmap(unsigned char* base, size_t size, int is_mmap)
+    {
+#ifdef _WIN32
+        (void)size;
+        (void)is_mmap;
+        VirtualFree(base, 0, MEM_RELEASE);
+#else
+        if (is_mmap)
+            munmap(base, size);
         else
-        {
-            a.base = ptr;
-            a.size = reserve;
-            a.is_mmap = 1; /* Allocated via mmap */
+            free(base);
+#endif
+    }
+
+    ARENA_API Arena arena_create_ex(size_t reserve, unsigned flags)
+    {
+        Arena a = {0};
+        int is_mmap = 0;
+        a.base = arena_map(reserve, flags, &is_mmap);
+        if (!a.base)
+            return a;
+        a.size = reserve;
+        a.reserved = reserve;
+        a.chunk_size = reserve;
+        a.chunks = 1;
+        a.flags = flags;
 #ifdef ARENA_ENABLE_COMMIT
-            a.commit = reserve;
+        a.commit = reserve;
 #endif
-        }
+#ifndef _WIN32
+        a.is_mmap = is_mmap;
+#else
+        (void)is_mmap;
 #endif
         return a;
     }
 
+    ARENA_API Arena arena_create(size_t reserve)
+    {
+        return arena_create_ex(reserve, 0);
+    }
+
+    static void arena_note_high_water(Arena* a)
+    {
+        size_t held = a->held_before + a->pos;
+        if (held > a->high_water)
+            a->high_water = held;
+    }
+
+    /* Drop the current chunk and resume the one before it */
+    static void arena_pop_chunk(Arena* a)
+    {
+        ArenaChunk prev = *(ArenaChunk*)a->base;
+#ifdef _WIN32
+        arena_unmap(a->base, a->size, 1);
+#else
+        arena_unmap(a->base, a->size, a->is_mmap);
+        a->is_mmap = prev.is_mmap;
+#endif
+        a->reserved -= a->size;
+        a->base = prev.base;
+        a->pos = prev.pos;
+        a->size = prev.size;
+        a->chunk_offset = prev.chunk_offset;
+        a->held_before = prev.held_before;
+        a->chunks--;
+    }
+
+    /* Chain a chunk with room for size bytes at align; 0 if it cannot be had */
+    static int arena_push_chunk(Arena* a, size_t size, size_t align)
+    {
+        size_t header = arena_align_forward(sizeof(ArenaChunk), 16);
+        size_t need = header + size + (align > 16 ? align : 0);
+        if (need < size)
+            return 0;
+        size_t chunk = a->chunk_size > need ? a->chunk_size : need;
+        int is_mmap = 0;
+        unsigned char* base = arena_map(chunk, a->flags, &is_mmap);
+        if (!base)
+            return 0;
+
+        arena_note_high_water(a);
+        ArenaChunk* prev = (ArenaChunk*)base;
+        prev->base = a->base;
+        prev->pos = a->pos;
+        prev->size = a->size;
+        prev->chunk_offset = a->chunk_offset;
+        prev->held_before = a->held_before;
+#ifndef _WIN32
+        prev->is_mmap = a->is_mmap;
+        a->is_mmap = is_mmap;
+#endif
+        /* WHY: marks are chunk_offset + pos; starting past the whole previous
+         * chunk keeps every mark taken there below this chunk's marks */
+        a->chunk_offset += a->size;
+        a->held_before += a->pos;
+        a->base = base;
+        a->size = chunk;
+        a->pos = header;
+        a->reserved += chunk;
+        a->chunks++;
+        return 1;
+    }
+
     ARENA_API void arena_destroy(Arena* a)
     {
         if (!a || !a->base)
             return;
+        while (a->chunks > 1)
+            arena_pop_chunk(a);
 #ifdef _WIN32
-        VirtualFree(a->base, 0, MEM_RELEASE);
+        arena_unmap(a->base, a->size, 1);
 #else
-        if (a->is_mmap)
-        {
-            munmap(a->base, a->size);
-        }
-        else
-        {
-            free(a->base);
-        }
-#endif
-        a->base = NULL;
-        a->pos = 0;
-        a->size = 0;
-#ifdef ARENA_ENABLE_COMMIT
-        a->commit = 0;
-#endif
-#ifndef _WIN32
-        a->is_mmap = 0;
+        arena_unmap(a->base, a->size, a->is_mmap);
 #endif
+        memset(a, 0, sizeof(*a));
     }
 
     ARENA_API void arena_clear(Arena* a)
     {
         if (!a)
             return;
+        arena_note_high_water(a);
+        while (a->chunks > 1)
+            arena_pop_chunk(a);
         a->pos = 0;
 #ifdef ARENA_ENABLE_COMMIT
 #endif
@@ -168,8 +327,13 @@ extern "C"
             return NULL;
         size_t p = arena_align_forward(a->pos, align);
         size_t new_pos = p + size;
-        if (new_pos > a->size)
-            return NULL;
+        if (new_pos > a->size || new_pos < p)
+        {
+            if (!(a->flags & ARENA_FLAG_GROW) || !arena_push_chunk(a, size, align))
+                return NULL;
+            p = arena_align_forward(a->pos, align);
+            new_pos = p + size;
+        }
         void* ptr = a->base + p;
         memset(ptr, 0, size);
         a->pos = new_pos;
@@ -178,12 +342,151 @@ extern "C"
 
     ARENA_API size_t arena_get_mark(Arena* a)
     {
-        return a ? a->pos : 0;
+        return a ? a->chunk_offset + a->pos : 0;
     }
     ARENA_API void arena_set_mark(Arena* a, size_t mark)
     {
-        if (a)
-            a->pos = mark;
+        if (!a)
+            return;
+        /* WHY: tracked on rewind rather than on every push, keeping the hot path untouched */
+        arena_note_high_water(a);
+        while (a->chunks > 1 && mark < a->chunk_offset)
+            arena_pop_chunk(a);
+        a->pos = mark - a->chunk_offset;
+    }
+
+    ARENA_API size_t arena_high_water(const Arena* a)
+    {
+        if (!a)
+            return 0;
+        size_t held = a->held_before + a->pos;
+        return held > a->high_water ? held : a->high_water;
+    }
+
+    ARENA_API ArenaStats arena_stats(const Arena* a)
+    {
+        ArenaStats stats = {0};
+        if (!a)
+            return stats;
+        stats.held = a->held_before + a->pos;
+        stats.high_water = arena_high_water(a);
+        stats.reserved = a->reserved;
+        stats.chunks = a->chunks;
+        return stats;
+    }
+
+    ARENA_API int arena_resize_last(Arena* a, void* ptr, size_t old_size, size_t new_size)
+    {
+        if (!a || !ptr)
+            return 0;
+        unsigned char* p = (unsigned char*)ptr;
+        if (p < a->base || p + old_size != a->base + a->pos)
+            return 0;
+        size_t start = (size_t)(p - a->base);
+        if (new_size > a->size - start)
+            return 0;
+        arena_note_high_water(a);
+        a->pos = start + new_size;
+        return 1;
+    }
+
+    /* Peak over all scratch arenas, updated as their scopes close */
+    static size_t g_arena_scratch_peak = 0;
+
+    ARENA_API ArenaTemp arena_temp_begin(Arena* a)
+    {
+        ArenaTemp temp = {a, arena_get_mark(a)};
+        return temp;
+    }
+
+    ARENA_API void arena_temp_end(ArenaTemp* temp)
+    {
+        if (!temp || !temp->arena)
+            return;
+        Arena* a = temp->arena;
+        if (a->flags & ARENA_FLAG_SCRATCH)
+        {
+            size_t held = a->held_before + a->pos;
+            size_t peak = __atomic_load_n(&g_arena_scratch_peak, __ATOMIC_RELAXED);
+            while (held > peak && !__atomic_compare_exchange_n(&g_arena_scratch_peak, &peak, held,
+                                                              1, __ATOMIC_RELAXED,
+                                                              __ATOMIC_RELAXED))
+            {
+            }
+        }
+        arena_set_mark(a, temp->mark);
+        temp->arena = NULL;
+    }
+
+    ARENA_API size_t arena_scratch_high_water(void)
+    {
+        return __atomic_load_n(&g_arena_scratch_peak, __ATOMIC_RELAXED);
+    }
+
+#define ARENA_SCRATCH_COUNT 2 /* Enough to always find one that is not the conflict */
+#define ARENA_SCRATCH_CHUNK MiB(64)
+
+#ifdef _WIN32
+    static __declspec(thread) Arena g_arena_scratch[ARENA_SCRATCH_COUNT];
+    static Arena* arena_scratch_slots(void)
+    {
+        return g_arena_scratch;
+    }
+#else
+    static pthread_key_t g_arena_scratch_key;
+    static pthread_once_t g_arena_scratch_once = PTHREAD_ONCE_INIT;
+
+    static void arena_scratch_release(void* slots)
+    {
+        Arena* scratch = (Arena*)slots;
+        for (int i = 0; i < ARENA_SCRATCH_COUNT; i++)
+            arena_destroy(&scratch[i]);
+        free(scratch);
+    }
+
+    static void arena_scratch_make_key(void)
+    {
+        pthread_key_create(&g_arena_scratch_key, arena_scratch_release);
+    }
+
+    /* WHY: a pthread key rather than __thread storage so each thread's
+     * chunks are unmapped when it exits, not leaked */
+    static Arena* arena_scratch_slots(void)
+    {
+        pthread_once(&g_arena_scratch_once, arena_scratch_make_key);
+        Arena* scratch = (Arena*)pthread_getspecific(g_arena_scratch_key);
+        if (!scratch)
+        {
+            scratch = (Arena*)calloc(ARENA_SCRATCH_COUNT, sizeof(Arena));
+            if (!scratch || pthread_setspecific(g_arena_scratch_key, scratch) != 0)
+            {
+                fprintf(stderr, "FATAL: Out of memory creating scratch arenas\n");
+                abort();
+            }
+        }
+        return scratch;
+    }
+#endif
+
+    ARENA_API Arena* arena_scratch(const Arena* conflict)
+    {
+        Arena* scratch = arena_scratch_slots();
+        Arena* pick = &scratch[0] == conflict ? &scratch[1] : &scratch[0];
+        if (!pick->base)
+        {
+            *pick = arena_create_ex(ARENA_SCRATCH_CHUNK, ARENA_FLAG_GROW | ARENA_FLAG_SCRATCH);
+            if (!pick->base)
+            {
+                fprintf(stderr, "FATAL: Out of memory creating scratch arena\n");
+                abort();
+            }
+        }
+        return pick;
+    }
+
+    ARENA_API ArenaTemp arena_scratch_begin(const Arena* conflict)
+    {
+        return arena_temp_begin(arena_scratch(conflict));
     }
 
     /* Safe version that aborts on failure */
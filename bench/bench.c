@@ -0,0 +1,501 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * llm_ctx benchmark suite
+ *
+ * Generates deterministic synthetic repositories (wide and deep trees, a
+ * heavy .gitignore in every directory, mixed text and binary files), runs
+ * llm_ctx over each of them several times, and reports the median and p95 of
+ * every phase the binary times through LLM_CTX_TIMINGS_JSON, plus wall time,
+ * as JSON. The same seed always produces the same tree, so results from two
+ * builds can be diffed directly.
+ */
+
+#define BENCH_MAX_SIZES 8
+#define BENCH_MAX_RUNS 101
+#define BENCH_GITIGNORE_RULES 24
+
+/* Phase keys written by the binary (timings.c), then the wall clock */
+static const char* const k_phases[] = {"config",   "gitignore",   "walk",        "rank",
+                                       "assemble", "tokenize",    "diagnostics", "save_prompt",
+                                       "total"};
+#define BENCH_PHASES (sizeof(k_phases) / sizeof(k_phases[0]))
+
+static const char* const k_words[] = {
+    "parser", "token",  "cache",   "arena",  "buffer", "index",  "value",  "return", "static",
+    "struct", "const",  "size",    "count",  "length", "offset", "result", "error",  "status",
+    "config", "option", "path",    "file",   "tree",   "node",   "child",  "parent", "string",
+    "char",   "int",    "double",  "void",   "while",  "for",    "if",     "else",   "switch",
+    "case",   "break",  "include", "define", "budget", "rank",   "score",  "query",  "match",
+    "word",   "line",   "range",   "stream", "output", "input",  "read",   "write",  "open",
+};
+#define BENCH_WORDS (sizeof(k_words) / sizeof(k_words[0]))
+
+typedef enum
+{
+    SHAPE_WIDE,
+    SHAPE_DEEP
+} TreeShape;
+
+typedef struct
+{
+    const char* name;
+    const char* args; /* llm_ctx arguments, run from the repository root */
+} BenchMode;
+
+static const BenchMode k_modes[] = {
+    /* Everything assembled and counted */
+    {"full", "-o --no-cache -b 1000000000 -f ."},
+    /* FileRank over the same tree, packing the default budget */
+    {"ranked", "-o --no-cache -r -c 'token cache parser' -f ."},
+};
+#define BENCH_MODES (sizeof(k_modes) / sizeof(k_modes[0]))
+
+static uint64_t g_rng;
+
+static uint64_t rng_next(void)
+{
+    /* splitmix64 */
+    uint64_t z = (g_rng += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t hash_name(const char* s)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; s++)
+    {
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static void die(const char* what, const char* path)
+{
+    fprintf(stderr, "bench: %s %s: %s\n", what, path, strerror(errno));
+    exit(1);
+}
+
+static void write_gitignore(const char* dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.gitignore", dir);
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+    {
+        die("cannot create", path);
+    }
+    /* A few rules that match generated files, the rest realistic noise */
+    fprintf(fp, "*.log\nbuild/\n*.tmp\n!keep.log\n");
+    for (int i = 4; i < BENCH_GITIGNORE_RULES; i++)
+    {
+        switch (rng_next() % 5)
+        {
+        case 0:
+            fprintf(fp, "*.%s%d\n", k_words[rng_next() % BENCH_WORDS], i);
+            break;
+        case 1:
+            fprintf(fp, "/%s_%d/\n", k_words[rng_next() % BENCH_WORDS], i);
+            break;
+        case 2:
+            fprintf(fp, "**/%s-cache/*\n", k_words[rng_next() % BENCH_WORDS]);
+            break;
+        case 3:
+            fprintf(fp, "docs/*.%s\n", k_words[rng_next() % BENCH_WORDS]);
+            break;
+        default:
+            fprintf(fp, "%s[0-9].o\n", k_words[rng_next() % BENCH_WORDS]);
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+/** mkdir -p for the directories of path below root, with a .gitignore in each new one */
+static void make_parent_dirs(const char* path, size_t root_len)
+{
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char* p = buf + root_len + 1; *p; p++)
+    {
+        if (*p != '/')
+        {
+            continue;
+        }
+        *p = '\0';
+        if (mkdir(buf, 0755) == 0)
+        {
+            write_gitignore(buf);
+        }
+        else if (errno != EEXIST)
+        {
+            die("cannot create", buf);
+        }
+        *p = '/';
+    }
+}
+
+static void write_text_file(const char* path, size_t target)
+{
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+    {
+        die("cannot create", path);
+    }
+    size_t len = 0;
+    int col = 0;
+    while (len < target)
+    {
+        const char* w = k_words[rng_next() % BENCH_WORDS];
+        int n = fprintf(fp, "%s%s", col > 0 ? " " : "", w);
+        len += (size_t)n;
+        col += n;
+        if (col > 60 + (int)(rng_next() % 30))
+        {
+            fputc('\n', fp);
+            len++;
+            col = 0;
+        }
+    }
+    fputc('\n', fp);
+    fclose(fp);
+}
+
+static void write_binary_file(const char* path, size_t len)
+{
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+    {
+        die("cannot create", path);
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        fputc(i % 7 == 0 ? 0 : (int)(rng_next() & 0xff), fp);
+    }
+    fclose(fp);
+}
+
+/** Directory of file k, relative to the root */
+static void file_dir(TreeShape shape, int k, char* out, size_t size)
+{
+    if (shape == SHAPE_WIDE)
+    {
+        /* 64 files per leaf, 32 leaves per top-level directory */
+        snprintf(out, size, "d%03d/s%02d", k / (64 * 32), (k / 64) % 32);
+        return;
+    }
+    /* Binary fan-out, 2 to 15 levels deep */
+    size_t len = 0;
+    int depth = 2 + k % 14;
+    out[0] = '\0';
+    for (int d = 0; d < depth && len + 8 < size; d++)
+    {
+        len += (size_t)snprintf(out + len, size - len, "%sn%d", d > 0 ? "/" : "", (k >> d) & 1);
+    }
+}
+
+/** Build the tree under root unless a complete one is already there */
+static void generate_repo(const char* root, const char* name, TreeShape shape, int files)
+{
+    char stamp[PATH_MAX + 32];
+    snprintf(stamp, sizeof(stamp), "%s/.bench_complete", root);
+    if (access(stamp, F_OK) == 0)
+    {
+        return;
+    }
+
+    fprintf(stderr, "bench: generating %s (%d files)\n", name, files);
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+    if (system(cmd) != 0)
+    {
+        die("cannot clear", root);
+    }
+    if (mkdir(root, 0755) != 0)
+    {
+        die("cannot create", root);
+    }
+    g_rng = hash_name(name);
+    write_gitignore(root);
+
+    size_t root_len = strlen(root);
+    for (int k = 0; k < files; k++)
+    {
+        char dir[PATH_MAX / 2];
+        file_dir(shape, k, dir, sizeof(dir));
+        uint64_t kind = rng_next() % 100;
+        char path[PATH_MAX];
+        if (kind < 8)
+        {
+            snprintf(path, sizeof(path), "%s/%s/blob%d.bin", root, dir, k);
+            make_parent_dirs(path, root_len);
+            write_binary_file(path, 256 + rng_next() % 4096);
+        }
+        else if (kind < 14)
+        {
+            /* Ignored by the .gitignore rules */
+            snprintf(path, sizeof(path), "%s/%s/%s%d.%s", root, dir, kind < 11 ? "trace" : "build/out",
+                     k, kind < 11 ? "log" : "c");
+            make_parent_dirs(path, root_len);
+            write_text_file(path, 200 + rng_next() % 800);
+        }
+        else
+        {
+            static const char* const exts[] = {"c", "h", "md", "txt", "py"};
+            snprintf(path, sizeof(path), "%s/%s/%s_%d.%s", root, dir,
+                     k_words[rng_next() % BENCH_WORDS], k, exts[rng_next() % 5]);
+            make_parent_dirs(path, root_len);
+            /* Mostly small files with a long tail */
+            size_t len = rng_next() % 8 == 0 ? 2000 + rng_next() % 12000 : 100 + rng_next() % 900;
+            write_text_file(path, len);
+        }
+    }
+
+    FILE* fp = fopen(stamp, "w");
+    if (!fp)
+    {
+        die("cannot create", stamp);
+    }
+    fclose(fp);
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/** Run llm_ctx once from root; fills samples[phase] and returns false on failure */
+static bool run_once(const char* llm_ctx, const char* root, const char* args, const char* timings,
+                     const char* config_home, const char* lib_dir, uint64_t* samples)
+{
+    unlink(timings);
+    char cmd[PATH_MAX * 2];
+    snprintf(cmd, sizeof(cmd), "exec '%s' %s >/dev/null 2>&1", llm_ctx, args);
+
+    uint64_t start = now_us();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        return false;
+    }
+    if (pid == 0)
+    {
+        if (chdir(root) != 0)
+        {
+            _exit(127);
+        }
+        setenv("LLM_CTX_NO_CONFIG", "1", 1);
+        setenv("LLM_CTX_NO_CACHE", "1", 1);
+        setenv("LLM_CTX_TIMINGS_JSON", timings, 1);
+        /* Keep saved prompts out of the user's config directory */
+        setenv("XDG_CONFIG_HOME", config_home, 1);
+        setenv("LD_LIBRARY_PATH", lib_dir, 1);
+        execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return false;
+    }
+    samples[BENCH_PHASES - 1] = now_us() - start;
+
+    /* WHY: every run saves its prompt; at 100k files these add up to gigabytes */
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s/llm_ctx/prompts'", config_home);
+    if (system(cmd) != 0)
+    {
+        return false;
+    }
+
+    FILE* fp = fopen(timings, "r");
+    if (!fp)
+    {
+        return false;
+    }
+    char line[1024] = "";
+    bool ok = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+    for (size_t p = 0; ok && p + 1 < BENCH_PHASES; p++)
+    {
+        char key[64];
+        snprintf(key, sizeof(key), "\"%s_us\": ", k_phases[p]);
+        const char* at = strstr(line, key);
+        samples[p] = at ? strtoull(at + strlen(key), NULL, 10) : 0;
+        ok = at != NULL;
+    }
+    return ok;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const uint64_t* sorted, int n, int pct)
+{
+    int rank = (pct * n + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: bench [--llm-ctx PATH] [--sizes N,N,...] [--runs N] [--work DIR] "
+                    "[--out FILE]\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* llm_ctx = "./bench/llm_ctx";
+    const char* sizes_arg = "1000,10000,100000";
+    const char* work = "./tmp/bench";
+    const char* out_path = NULL;
+    int runs = 5;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            usage();
+        }
+        if (strcmp(argv[i], "--llm-ctx") == 0)
+            llm_ctx = argv[++i];
+        else if (strcmp(argv[i], "--sizes") == 0)
+            sizes_arg = argv[++i];
+        else if (strcmp(argv[i], "--runs") == 0)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--work") == 0)
+            work = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0)
+            out_path = argv[++i];
+        else
+            usage();
+    }
+    if (runs < 1 || runs > BENCH_MAX_RUNS)
+    {
+        fprintf(stderr, "bench: --runs must be between 1 and %d\n", BENCH_MAX_RUNS);
+        return 2;
+    }
+
+    int sizes[BENCH_MAX_SIZES];
+    int num_sizes = 0;
+    for (const char* p = sizes_arg; *p && num_sizes < BENCH_MAX_SIZES;)
+    {
+        sizes[num_sizes] = atoi(p);
+        if (sizes[num_sizes] <= 0)
+        {
+            usage();
+        }
+        num_sizes++;
+        p += strcspn(p, ",");
+        p += *p == ',';
+    }
+
+    /* Absolute paths, since every run changes into its repository */
+    char exe[PATH_MAX], cwd[PATH_MAX / 2], work_abs[PATH_MAX];
+    if (!realpath(llm_ctx, exe) || !getcwd(cwd, sizeof(cwd)))
+    {
+        die("cannot resolve", llm_ctx);
+    }
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "mkdir -p '%s'", work);
+    if (system(cmd) != 0 || !realpath(work, work_abs) || strlen(work_abs) >= PATH_MAX / 2)
+    {
+        die("cannot create", work);
+    }
+    char timings[PATH_MAX], config_home[PATH_MAX], lib_dir[PATH_MAX];
+    snprintf(timings, sizeof(timings), "%s/timings.json", work_abs);
+    snprintf(config_home, sizeof(config_home), "%s/config", work_abs);
+    snprintf(lib_dir, sizeof(lib_dir), "%s/tokenizer", cwd);
+    mkdir(config_home, 0755);
+
+    FILE* out = stdout;
+    if (out_path && !(out = fopen(out_path, "w")))
+    {
+        die("cannot create", out_path);
+    }
+
+    fprintf(out, "{\n  \"runs\": %d,\n  \"scenarios\": [", runs);
+    bool first = true;
+    for (int s = 0; s < num_sizes; s++)
+    {
+        for (int shape = SHAPE_WIDE; shape <= SHAPE_DEEP; shape++)
+        {
+            char name[64], root[PATH_MAX];
+            if (sizes[s] % 1000 == 0)
+                snprintf(name, sizeof(name), "%s-%dk", shape == SHAPE_WIDE ? "wide" : "deep",
+                         sizes[s] / 1000);
+            else
+                snprintf(name, sizeof(name), "%s-%d", shape == SHAPE_WIDE ? "wide" : "deep",
+                         sizes[s]);
+            snprintf(root, sizeof(root), "%s/%s", work_abs, name);
+            generate_repo(root, name, (TreeShape)shape, sizes[s]);
+
+            for (size_t m = 0; m < BENCH_MODES; m++)
+            {
+                static uint64_t samples[BENCH_PHASES][BENCH_MAX_RUNS];
+                uint64_t one[BENCH_PHASES];
+                /* The first run only warms the page cache */
+                for (int r = -1; r < runs; r++)
+                {
+                    if (!run_once(exe, root, k_modes[m].args, timings, config_home, lib_dir, one))
+                    {
+                        fprintf(stderr, "bench: %s failed on %s (%s)\n", exe, name,
+                                k_modes[m].name);
+                        return 1;
+                    }
+                    for (size_t p = 0; r >= 0 && p < BENCH_PHASES; p++)
+                    {
+                        samples[p][r] = one[p];
+                    }
+                }
+
+                fprintf(out, "%s\n    {\"name\": \"%s\", \"mode\": \"%s\", \"files\": %d, "
+                             "\"phases\": {",
+                        first ? "" : ",", name, k_modes[m].name, sizes[s]);
+                first = false;
+                fprintf(stderr, "%-10s %-7s", name, k_modes[m].name);
+                for (size_t p = 0; p < BENCH_PHASES; p++)
+                {
+                    qsort(samples[p], (size_t)runs, sizeof(uint64_t), compare_u64);
+                    uint64_t median = percentile(samples[p], runs, 50);
+                    uint64_t p95 = percentile(samples[p], runs, 95);
+                    fprintf(out, "%s\"%s\": {\"median_us\": %llu, \"p95_us\": %llu}",
+                            p > 0 ? ", " : "", k_phases[p], (unsigned long long)median,
+                            (unsigned long long)p95);
+                    fprintf(stderr, "  %s %.1fms", k_phases[p], median / 1000.0);
+                }
+                fprintf(out, "}}");
+                fprintf(stderr, "\n");
+            }
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+    {
+        fclose(out);
+        fprintf(stderr, "bench: results written to %s\n", out_path);
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "chunker.h"
+#include <stdbool.h>
+#include <string.h>
+#include "filemeta.h"
+
+static bool is_space_byte(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static bool is_blank_line(const char* line, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!is_space_byte(line[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** "# Title" through "###### Title" */
+static bool is_heading_line(const char* line, size_t len)
+{
+    size_t hashes = 0;
+    while (hashes < len && hashes < 7 && line[hashes] == '#')
+    {
+        hashes++;
+    }
+    return hashes >= 1 && hashes <= 6 && hashes < len && line[hashes] == ' ';
+}
+
+/** Grow *chunks to hold one more range */
+static ChunkRange* push_chunk(Arena* arena, ChunkRange* chunks, int count, int* cap)
+{
+    if (count < *cap)
+    {
+        return chunks;
+    }
+    int new_cap = *cap ? *cap * 2 : 64;
+    ChunkRange* grown = arena_push_array_safe(arena, ChunkRange, (size_t)new_cap);
+    if (count > 0)
+    {
+        memcpy(grown, chunks, (size_t)count * sizeof(ChunkRange));
+    }
+    *cap = new_cap;
+    return grown;
+}
+
+int chunk_lines(const char* data, size_t len, int max_lines, Arena* arena, ChunkRange** chunks)
+{
+    *chunks = NULL;
+    if (len == 0)
+    {
+        return 0;
+    }
+    if (max_lines < 1)
+    {
+        max_lines = 1;
+    }
+
+    /* WHY: most files are short; finding that out stops after max_lines
+     * newlines and never classifies a line */
+    size_t skipped;
+    if (skip_lines(data, len, (size_t)max_lines, &skipped) == len &&
+        (skipped < (size_t)max_lines || data[len - 1] == '\n'))
+    {
+        *chunks = arena_push_safe(arena, ChunkRange);
+        (*chunks)->start_line = 1;
+        (*chunks)->end_line = (int)skipped + (data[len - 1] != '\n');
+        return 1;
+    }
+    int min_lines = max_lines / CHUNK_MIN_DIVISOR > 0 ? max_lines / CHUNK_MIN_DIVISOR : 1;
+
+    ChunkRange* out = NULL;
+    int count = 0;
+    int cap = 0;
+
+    int start = 1;      /* First line of the open chunk */
+    int last_blank = 0; /* Last blank line of the open chunk, 0 if none */
+    bool prev_blank = false;
+    bool after_close = false; /* Only blank lines since a line opening with '}' */
+    const char* p = data;
+    const char* end = data + len;
+    int line = 1;
+    for (; p < end; line++)
+    {
+        const char* nl = memchr(p, '\n', (size_t)(end - p));
+        size_t line_len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        bool blank = is_blank_line(p, line_len);
+        bool top_level = !blank && !is_space_byte(p[0]) && p[0] != '}' && p[0] != ')' &&
+                         p[0] != ']';
+        /* WHY: the blank lines after a closing brace stay with it, so the
+         * next chunk opens on the code that follows */
+        bool boundary = (after_close && !blank) || (prev_blank && top_level) ||
+                        is_heading_line(p, line_len);
+
+        int held = line - start;
+        int cut = 0;
+        if (held >= min_lines && boundary)
+        {
+            cut = line;
+        }
+        else if (held >= max_lines)
+        {
+            /* WHY: a blank line is the next best place to cut; one in the
+             * first half would leave a short chunk and a long remainder */
+            cut = last_blank - start + 1 >= max_lines / 2 ? last_blank + 1 : line;
+        }
+        if (cut > 0)
+        {
+            out = push_chunk(arena, out, count, &cap);
+            out[count].start_line = start;
+            out[count].end_line = cut - 1;
+            count++;
+            start = cut;
+            last_blank = 0;
+        }
+
+        if (blank)
+        {
+            last_blank = line;
+        }
+        prev_blank = blank;
+        after_close = (line_len > 0 && p[0] == '}') || (after_close && blank);
+        p = nl ? nl + 1 : end;
+    }
+
+    /* A short tail joins the chunk before it when the two still fit */
+    int total = line - 1;
+    if (count > 0 && total - start + 1 < min_lines &&
+        total - out[count - 1].start_line + 1 <= max_lines)
+    {
+        out[count - 1].end_line = total;
+    }
+    else
+    {
+        out = push_chunk(arena, out, count, &cap);
+        out[count].start_line = start;
+        out[count].end_line = total;
+        count++;
+    }
+
+    *chunks = out;
+    return count;
+}
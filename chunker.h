@@ -0,0 +1,40 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <stddef.h>
+#include "arena.h"
+
+/**
+ * Line-range chunking of source and prose files
+ *
+ * Splits a file into consecutive chunks at structural boundaries so FileRank
+ * can rank and include the parts of a large file rather than the whole of
+ * it. A boundary falls after a line opening with '}' at column 0 (the end of
+ * a function or type), before a line at column 0 that follows a blank line
+ * (the next top-level declaration or paragraph), or before a Markdown
+ * heading. A chunk only ends at a boundary once it has max_lines /
+ * CHUNK_MIN_DIVISOR lines; one that reaches max_lines without one is cut at
+ * its last blank line, or at max_lines if there is none in its second half.
+ */
+
+/* Default --chunks size in lines */
+#define CHUNK_DEFAULT_LINES 120
+/* Chunks shorter than max_lines / CHUNK_MIN_DIVISOR are not ended at a boundary */
+#define CHUNK_MIN_DIVISOR 4
+
+typedef struct
+{
+    int start_line; /* 1-based, inclusive */
+    int end_line;   /* 1-based, inclusive */
+} ChunkRange;
+
+/**
+ * Split data[0, len) into chunks of at most max_lines lines
+ *
+ * Stores the chunks, in order and covering every line, in an array from
+ * arena and returns how many there are. Content of max_lines lines or fewer
+ * is one chunk; empty content has none.
+ */
+int chunk_lines(const char* data, size_t len, int max_lines, Arena* arena, ChunkRange** chunks);
+
+#endif /* CHUNKER_H */
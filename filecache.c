@@ -0,0 +1,555 @@
+#include "filecache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILECACHE_MAGIC "LLMCACH1"
+#define FILECACHE_VERSION 1
+#define FILECACHE_INITIAL_RECORDS 4096
+/* Past this the table starts over instead of growing; stale entries for
+ * deleted files and old queries are never evicted individually. */
+#define FILECACHE_MAX_RECORDS (1u << 18)
+#define FILECACHE_HEADER_SIZE 64
+
+enum
+{
+    FC_KIND_FILE = 1,
+    FC_KIND_TERM = 2
+};
+
+enum
+{
+    FC_HAS_TOKENS = 1u << 0,
+    FC_HAS_WORDS = 1u << 1,
+    FC_BINARY = 1u << 2
+};
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity; /* Power of two */
+    uint64_t count;
+} FileCacheHeader;
+
+typedef struct
+{
+    uint64_t key;   /* Identity hash; 0 marks an empty slot */
+    uint64_t check; /* Checksum of the rest; a mismatch is a torn or corrupt record */
+    uint32_t kind;
+    uint32_t flags;
+    FileSig sig;
+    uint64_t model;   /* FILE: hash of the model the token count is for */
+    uint64_t out_len; /* FILE: fragment length the token count is for */
+    uint64_t tokens;  /* FILE: fragment token count */
+    uint64_t value;   /* FILE: FileRank word count; TERM: hits */
+} FileCacheRecord;
+
+static struct
+{
+    bool enabled;
+    char* path;
+    int fd;
+    unsigned char* map;
+    size_t map_len;
+    FileCacheRecord* records;
+    uint64_t capacity;
+    /* Updates made by this run, written by filecache_close() */
+    FileCacheRecord* pending;
+    size_t num_pending;
+    size_t pending_cap;
+    int* pending_slots; /* Hash index into pending, -1 if empty */
+    size_t pending_slots_cap;
+} g_cache = {.fd = -1};
+
+static uint64_t fnv64(uint64_t h, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+#define FNV64_OFFSET 14695981039346656037ull
+
+static uint64_t record_checksum(const FileCacheRecord* r)
+{
+    uint64_t h = fnv64(FNV64_OFFSET, &r->key, sizeof(r->key));
+    h = fnv64(h, &r->kind, sizeof(*r) - offsetof(FileCacheRecord, kind));
+    return h ? h : 1;
+}
+
+static uint64_t record_key(uint32_t kind, const char* path, int start_line, int end_line,
+                           const char* term)
+{
+    uint64_t h = fnv64(FNV64_OFFSET, &kind, sizeof(kind));
+    h = fnv64(h, path, strlen(path) + 1);
+    h = fnv64(h, &start_line, sizeof(start_line));
+    h = fnv64(h, &end_line, sizeof(end_line));
+    if (term)
+    {
+        h = fnv64(h, term, strlen(term));
+    }
+    return h ? h : 1;
+}
+
+void file_sig_from_stat(const struct stat* st, FileSig* sig)
+{
+    memset(sig, 0, sizeof(*sig));
+    sig->dev = (uint64_t)st->st_dev;
+    sig->ino = (uint64_t)st->st_ino;
+    sig->size = (int64_t)st->st_size;
+#ifdef __APPLE__
+    sig->mtime_ns = (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+    sig->ctime_ns = (int64_t)st->st_ctimespec.tv_sec * 1000000000 + st->st_ctimespec.tv_nsec;
+#else
+    sig->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    sig->ctime_ns = (int64_t)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+#endif
+}
+
+bool file_sig_for(const char* path, FileSig* sig)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return false;
+    }
+    file_sig_from_stat(&st, sig);
+    return true;
+}
+
+static bool header_valid(const FileCacheHeader* hdr, size_t file_size)
+{
+    return memcmp(hdr->magic, FILECACHE_MAGIC, 8) == 0 && hdr->version == FILECACHE_VERSION &&
+           hdr->record_size == sizeof(FileCacheRecord) && hdr->capacity > 0 &&
+           (hdr->capacity & (hdr->capacity - 1)) == 0 &&
+           file_size == FILECACHE_HEADER_SIZE + hdr->capacity * sizeof(FileCacheRecord);
+}
+
+/** Slot holding key, or the empty slot where it would go */
+static uint64_t find_slot(const FileCacheRecord* records, uint64_t capacity, uint64_t key)
+{
+    uint64_t mask = capacity - 1;
+    for (uint64_t i = key & mask;; i = (i + 1) & mask)
+    {
+        uint64_t k = __atomic_load_n(&records[i].key, __ATOMIC_ACQUIRE);
+        if (k == key || k == 0)
+        {
+            return i;
+        }
+    }
+}
+
+/** Store r in the table; returns true if it took an empty slot */
+static bool table_store(FileCacheRecord* records, uint64_t capacity, const FileCacheRecord* r)
+{
+    uint64_t i = find_slot(records, capacity, r->key);
+    bool fresh = records[i].key == 0;
+    FileCacheRecord copy = *r;
+    copy.check = record_checksum(&copy);
+    /* WHY: readers do not lock; the key goes in last so a half-written new
+     * record is never found, and an overwritten one fails its checksum. */
+    uint64_t key = copy.key;
+    records[i].check = copy.check;
+    memcpy(&records[i].kind, &copy.kind, sizeof(copy) - offsetof(FileCacheRecord, kind));
+    __atomic_store_n(&records[i].key, key, __ATOMIC_RELEASE);
+    return fresh;
+}
+
+static bool table_load(const FileCacheRecord* records, uint64_t capacity, uint64_t key,
+                       FileCacheRecord* out)
+{
+    uint64_t i = find_slot(records, capacity, key);
+    memcpy(out, &records[i], sizeof(*out));
+    return out->key == key && out->check == record_checksum(out);
+}
+
+/**
+ * Write a new cache file of the given capacity holding the valid records of
+ * old (may be NULL) plus the pending updates, and rename it over path
+ */
+static bool cache_rebuild(const char* path, const FileCacheRecord* old, uint64_t old_capacity,
+                          uint64_t capacity)
+{
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid()) >= (int)sizeof(tmp))
+    {
+        return false;
+    }
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    size_t len = FILECACHE_HEADER_SIZE + capacity * sizeof(FileCacheRecord);
+    if (ftruncate(fd, (off_t)len) != 0)
+    {
+        close(fd);
+        unlink(tmp);
+        return false;
+    }
+    unsigned char* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        unlink(tmp);
+        return false;
+    }
+
+    FileCacheHeader* hdr = (FileCacheHeader*)map;
+    FileCacheRecord* records = (FileCacheRecord*)(map + FILECACHE_HEADER_SIZE);
+    uint64_t count = 0;
+    for (uint64_t i = 0; old && i < old_capacity; i++)
+    {
+        FileCacheRecord r = old[i];
+        if (r.key != 0 && r.check == record_checksum(&r))
+        {
+            count += table_store(records, capacity, &r);
+        }
+    }
+    for (size_t i = 0; i < g_cache.num_pending; i++)
+    {
+        count += table_store(records, capacity, &g_cache.pending[i]);
+    }
+
+    memcpy(hdr->magic, FILECACHE_MAGIC, 8);
+    hdr->version = FILECACHE_VERSION;
+    hdr->record_size = sizeof(FileCacheRecord);
+    hdr->capacity = capacity;
+    hdr->count = count;
+    munmap(map, len);
+
+    if (rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+/** Map an existing, valid cache file */
+static bool cache_map(const char* path)
+{
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < FILECACHE_HEADER_SIZE)
+    {
+        close(fd);
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    unsigned char* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    const FileCacheHeader* hdr = (const FileCacheHeader*)map;
+    if (!header_valid(hdr, len))
+    {
+        munmap(map, len);
+        close(fd);
+        return false;
+    }
+    g_cache.fd = fd;
+    g_cache.map = map;
+    g_cache.map_len = len;
+    g_cache.capacity = hdr->capacity;
+    g_cache.records = (FileCacheRecord*)(map + FILECACHE_HEADER_SIZE);
+    return true;
+}
+
+bool filecache_open(const char* path)
+{
+    if (g_cache.enabled || !path)
+    {
+        return g_cache.enabled;
+    }
+    if (!cache_map(path))
+    {
+        /* Missing or unusable (e.g. older format): start a fresh table */
+        if (!cache_rebuild(path, NULL, 0, FILECACHE_INITIAL_RECORDS) || !cache_map(path))
+        {
+            return false;
+        }
+    }
+    g_cache.path = strdup(path);
+    if (!g_cache.path)
+    {
+        munmap(g_cache.map, g_cache.map_len);
+        close(g_cache.fd);
+        g_cache.fd = -1;
+        return false;
+    }
+    g_cache.enabled = true;
+    return true;
+}
+
+bool filecache_enabled(void)
+{
+    return g_cache.enabled;
+}
+
+static int* pending_index_slot(uint64_t key)
+{
+    size_t mask = g_cache.pending_slots_cap - 1;
+    for (size_t i = key & mask;; i = (i + 1) & mask)
+    {
+        int* slot = &g_cache.pending_slots[i];
+        if (*slot < 0 || g_cache.pending[*slot].key == key)
+        {
+            return slot;
+        }
+    }
+}
+
+static bool pending_grow(void)
+{
+    if (g_cache.num_pending == g_cache.pending_cap)
+    {
+        size_t cap = g_cache.pending_cap ? g_cache.pending_cap * 2 : 256;
+        FileCacheRecord* pending = realloc(g_cache.pending, cap * sizeof(FileCacheRecord));
+        if (!pending)
+        {
+            return false;
+        }
+        g_cache.pending = pending;
+        g_cache.pending_cap = cap;
+    }
+    if ((g_cache.num_pending + 1) * 2 > g_cache.pending_slots_cap)
+    {
+        size_t cap = g_cache.pending_slots_cap ? g_cache.pending_slots_cap * 2 : 512;
+        int* slots = malloc(cap * sizeof(int));
+        if (!slots)
+        {
+            return false;
+        }
+        memset(slots, 0xff, cap * sizeof(int));
+        free(g_cache.pending_slots);
+        g_cache.pending_slots = slots;
+        g_cache.pending_slots_cap = cap;
+        for (size_t i = 0; i < g_cache.num_pending; i++)
+        {
+            *pending_index_slot(g_cache.pending[i].key) = (int)i;
+        }
+    }
+    return true;
+}
+
+/** Current record for key: this run's update if any, else the mapped one */
+static bool cache_load(uint64_t key, uint32_t kind, const FileSig* sig, FileCacheRecord* out)
+{
+    if (!g_cache.enabled)
+    {
+        return false;
+    }
+    bool found = false;
+    if (g_cache.pending_slots_cap > 0)
+    {
+        int idx = *pending_index_slot(key);
+        if (idx >= 0)
+        {
+            *out = g_cache.pending[idx];
+            found = true;
+        }
+    }
+    if (!found)
+    {
+        found = table_load(g_cache.records, g_cache.capacity, key, out);
+    }
+    return found && out->kind == kind && memcmp(&out->sig, sig, sizeof(*sig)) == 0;
+}
+
+/** This run's update for key, seeded from the stored record when that is still current */
+static FileCacheRecord* cache_update(uint64_t key, uint32_t kind, const FileSig* sig)
+{
+    if (!g_cache.enabled)
+    {
+        return NULL;
+    }
+    FileCacheRecord current;
+    bool have = cache_load(key, kind, sig, &current);
+    if (!pending_grow())
+    {
+        /* Out of memory: silently stop caching */
+        g_cache.enabled = false;
+        return NULL;
+    }
+    int* slot = pending_index_slot(key);
+    if (*slot < 0)
+    {
+        *slot = (int)g_cache.num_pending++;
+    }
+    FileCacheRecord* r = &g_cache.pending[*slot];
+    if (have)
+    {
+        *r = current;
+    }
+    else
+    {
+        memset(r, 0, sizeof(*r));
+        r->key = key;
+        r->kind = kind;
+        r->sig = *sig;
+    }
+    return r;
+}
+
+bool filecache_get_tokens(const char* path, int start_line, int end_line, const FileSig* sig,
+                          const char* model, size_t out_len, size_t* tokens)
+{
+    FileCacheRecord r;
+    if (!cache_load(record_key(FC_KIND_FILE, path, start_line, end_line, NULL), FC_KIND_FILE,
+                    sig, &r))
+    {
+        return false;
+    }
+    if (!(r.flags & FC_HAS_TOKENS) || r.model != fnv64(FNV64_OFFSET, model, strlen(model)) ||
+        r.out_len != out_len)
+    {
+        return false;
+    }
+    *tokens = (size_t)r.tokens;
+    return true;
+}
+
+void filecache_put_tokens(const char* path, int start_line, int end_line, const FileSig* sig,
+                          const char* model, size_t out_len, size_t tokens)
+{
+    FileCacheRecord* r =
+        cache_update(record_key(FC_KIND_FILE, path, start_line, end_line, NULL), FC_KIND_FILE, sig);
+    if (r)
+    {
+        r->flags |= FC_HAS_TOKENS;
+        r->model = fnv64(FNV64_OFFSET, model, strlen(model));
+        r->out_len = out_len;
+        r->tokens = tokens;
+    }
+}
+
+bool filecache_get_words(const char* path, int start_line, int end_line, const FileSig* sig,
+                         size_t* words, bool* binary)
+{
+    FileCacheRecord r;
+    if (!cache_load(record_key(FC_KIND_FILE, path, start_line, end_line, NULL), FC_KIND_FILE,
+                    sig, &r) ||
+        !(r.flags & FC_HAS_WORDS))
+    {
+        return false;
+    }
+    *words = (size_t)r.value;
+    *binary = (r.flags & FC_BINARY) != 0;
+    return true;
+}
+
+void filecache_put_words(const char* path, int start_line, int end_line, const FileSig* sig,
+                         size_t words, bool binary)
+{
+    FileCacheRecord* r =
+        cache_update(record_key(FC_KIND_FILE, path, start_line, end_line, NULL), FC_KIND_FILE, sig);
+    if (r)
+    {
+        r->flags |= FC_HAS_WORDS;
+        r->flags = binary ? (r->flags | FC_BINARY) : (r->flags & ~FC_BINARY);
+        r->value = words;
+    }
+}
+
+bool filecache_get_term(const char* path, int start_line, int end_line, const FileSig* sig,
+                        const char* term, int* hits)
+{
+    FileCacheRecord r;
+    if (!cache_load(record_key(FC_KIND_TERM, path, start_line, end_line, term), FC_KIND_TERM, sig,
+                    &r))
+    {
+        return false;
+    }
+    *hits = (int)r.value;
+    return true;
+}
+
+void filecache_put_term(const char* path, int start_line, int end_line, const FileSig* sig,
+                        const char* term, int hits)
+{
+    FileCacheRecord* r =
+        cache_update(record_key(FC_KIND_TERM, path, start_line, end_line, term), FC_KIND_TERM, sig);
+    if (r)
+    {
+        r->value = (uint64_t)hits;
+    }
+}
+
+/** Write the pending updates; the caller holds the exclusive lock */
+static void cache_flush_locked(void)
+{
+    /* A concurrent run may have replaced the file; our updates then lose */
+    struct stat by_path, by_fd;
+    if (stat(g_cache.path, &by_path) != 0 || fstat(g_cache.fd, &by_fd) != 0 ||
+        by_path.st_ino != by_fd.st_ino || by_path.st_dev != by_fd.st_dev)
+    {
+        return;
+    }
+
+    FileCacheHeader* hdr = (FileCacheHeader*)g_cache.map;
+    uint64_t needed = hdr->count + g_cache.num_pending;
+    if (needed * 10 <= g_cache.capacity * 7)
+    {
+        for (size_t i = 0; i < g_cache.num_pending; i++)
+        {
+            hdr->count += table_store(g_cache.records, g_cache.capacity, &g_cache.pending[i]);
+        }
+        return;
+    }
+
+    uint64_t capacity = g_cache.capacity * 2;
+    while (needed * 10 > capacity * 7)
+    {
+        capacity *= 2;
+    }
+    if (capacity <= FILECACHE_MAX_RECORDS)
+    {
+        cache_rebuild(g_cache.path, g_cache.records, g_cache.capacity, capacity);
+        return;
+    }
+
+    /* Too big: keep only what this run saw */
+    capacity = FILECACHE_INITIAL_RECORDS;
+    while (g_cache.num_pending * 10 > capacity * 7)
+    {
+        capacity *= 2;
+    }
+    cache_rebuild(g_cache.path, NULL, 0, capacity);
+}
+
+void filecache_close(void)
+{
+    if (g_cache.fd >= 0)
+    {
+        if (g_cache.enabled && g_cache.num_pending > 0 && flock(g_cache.fd, LOCK_EX) == 0)
+        {
+            cache_flush_locked();
+            flock(g_cache.fd, LOCK_UN);
+        }
+        munmap(g_cache.map, g_cache.map_len);
+        close(g_cache.fd);
+    }
+    free(g_cache.pending);
+    free(g_cache.pending_slots);
+    free(g_cache.path);
+    memset(&g_cache, 0, sizeof(g_cache));
+    g_cache.fd = -1;
+}
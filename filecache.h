@@ -0,0 +1,68 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Persistent per-file cache
+ *
+ * A memory-mapped hash table in the config directory remembers what earlier
+ * runs learned about each (path, line range): the token count of its output
+ * fragment, its FileRank word count, whether it is binary, and its hit count
+ * for every query term it was ranked against. Entries are only trusted while
+ * the file's stat signature is unchanged, so a warm rerun reads and tokenizes
+ * just the files that changed.
+ *
+ * Lookups never lock: each record carries a checksum and a torn read is a
+ * miss. Updates are buffered and written under an exclusive flock() by
+ * filecache_close(). The cache is best effort; any failure disables it.
+ * Not thread-safe: call it from one thread.
+ */
+
+/** What stat() says about a file; any change invalidates its entries */
+typedef struct
+{
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+} FileSig;
+
+struct stat;
+
+/** Fill sig from stat(path). Returns false if the file cannot be stat'ed */
+bool file_sig_for(const char* path, FileSig* sig);
+
+/** Fill sig from a stat() or fstat() result the caller already has */
+void file_sig_from_stat(const struct stat* st, FileSig* sig);
+
+/** Open (creating if needed) the cache at path. Returns false and stays disabled on failure */
+bool filecache_open(const char* path);
+
+/** Write buffered updates and unmap the cache */
+void filecache_close(void);
+
+bool filecache_enabled(void);
+
+/** Token count of the fragment of out_len bytes emitted for this file under model */
+bool filecache_get_tokens(const char* path, int start_line, int end_line, const FileSig* sig,
+                          const char* model, size_t out_len, size_t* tokens);
+void filecache_put_tokens(const char* path, int start_line, int end_line, const FileSig* sig,
+                          const char* model, size_t out_len, size_t tokens);
+
+/** FileRank word count of the file's content and whether it is binary */
+bool filecache_get_words(const char* path, int start_line, int end_line, const FileSig* sig,
+                         size_t* words, bool* binary);
+void filecache_put_words(const char* path, int start_line, int end_line, const FileSig* sig,
+                         size_t words, bool binary);
+
+/** Whole-word hits of one lowercase query term in the file's content */
+bool filecache_get_term(const char* path, int start_line, int end_line, const FileSig* sig,
+                        const char* term, int* hits);
+void filecache_put_term(const char* path, int start_line, int end_line, const FileSig* sig,
+                        const char* term, int hits);
+
+#endif /* FILECACHE_H */
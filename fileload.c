@@ -0,0 +1,768 @@
+#include "fileload.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "timings.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FILE_LOAD_IO_URING 1
+#endif
+#endif
+
+#ifdef FILE_LOAD_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+/* Cap on the thread pool; past it more threads only add contention */
+#define FILE_LOAD_MAX_THREADS 32
+
+typedef enum
+{
+    SLOT_QUEUED = 0, /* Not yet submitted or claimed */
+    SLOT_OPENING,
+    SLOT_STATING,
+    SLOT_READING,
+    SLOT_DONE, /* ok tells whether it worked */
+    SLOT_ATTACHED /* Handed to its FileMeta */
+} SlotState;
+
+typedef struct
+{
+    FileMeta* meta;
+    const char* path;
+    int state;
+    bool ok;
+    int fd;          /* Open until attached when the content is to be mapped */
+    struct stat st;
+    char* buf;       /* Content read so far, NULL when mapped */
+    size_t got;
+#ifdef FILE_LOAD_IO_URING
+    struct statx stx;
+#endif
+} LoadSlot;
+
+struct FileLoader
+{
+    OutputVec* owner;
+    LoadSlot* slots;
+    int count;
+    int depth;
+    bool uring;
+    bool slots_leaked; /* The kernel may still write to slots; never freed */
+
+#ifdef FILE_LOAD_IO_URING
+    /* io_uring: slots [0, next) are queued, in_flight of them not done;
+     * unsubmitted requests sit in the submission ring */
+    int ring_fd;
+    int next;
+    int in_flight;
+    unsigned unsubmitted;
+    void* sq_ring;
+    size_t sq_ring_len;
+    void* cq_ring;
+    size_t cq_ring_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+#endif
+
+    /* Thread pool: workers claim slots in order and signal done */
+    pthread_t* threads;
+    int thread_count;
+    int claim;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+/** Start reading a slot whose fd and st are set; or finish it if nothing is to be read */
+static bool slot_wants_read(LoadSlot* slot)
+{
+    size_t size = (size_t)slot->st.st_size;
+    if (size == 0)
+    {
+        return false;
+    }
+    if (size > FILE_LOAD_READ_MAX)
+    {
+        /* WHY: large files stay mapped, as before; the hint starts their
+         * readahead now so the first page faults find the pages cached */
+        posix_fadvise(slot->fd, 0, 0, POSIX_FADV_WILLNEED);
+        return false;
+    }
+    slot->buf = malloc(size);
+    if (!slot->buf)
+    {
+        fprintf(stderr, "Error: Out of memory loading files\n");
+        exit(1);
+    }
+    slot->got = 0;
+    return true;
+}
+
+/** Record a finished load, closing what it no longer needs; the caller marks it done */
+static void slot_read_done(LoadSlot* slot, bool ok)
+{
+    if (!ok)
+    {
+        free(slot->buf);
+        slot->buf = NULL;
+    }
+    if (slot->buf || !ok)
+    {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    slot->ok = ok;
+}
+
+/* --- Thread pool --- */
+
+/** The blocking open, fstat and read of one slot; the caller marks it done */
+static void load_slot_blocking(LoadSlot* slot)
+{
+    slot->fd = open(slot->path, O_RDONLY | O_CLOEXEC);
+    timing_count(COUNTER_OPEN, 1);
+    if (slot->fd < 0)
+    {
+        slot->ok = false;
+        return;
+    }
+    if (fstat(slot->fd, &slot->st) != 0 || !S_ISREG(slot->st.st_mode))
+    {
+        slot_read_done(slot, false);
+        return;
+    }
+    if (!slot_wants_read(slot))
+    {
+        slot_read_done(slot, true);
+        return;
+    }
+    size_t size = (size_t)slot->st.st_size;
+    while (slot->got < size)
+    {
+        ssize_t n = pread(slot->fd, slot->buf + slot->got, size - slot->got, (off_t)slot->got);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            slot_read_done(slot, false);
+            return;
+        }
+        slot->got += (size_t)n;
+    }
+    slot_read_done(slot, true);
+}
+
+static void* load_worker(void* arg)
+{
+    FileLoader* loader = arg;
+    for (;;)
+    {
+        int i = __atomic_fetch_add(&loader->claim, 1, __ATOMIC_RELAXED);
+        if (i >= loader->count)
+        {
+            return NULL;
+        }
+        LoadSlot* slot = &loader->slots[i];
+        load_slot_blocking(slot);
+        pthread_mutex_lock(&loader->lock);
+        __atomic_store_n(&slot->state, SLOT_DONE, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&loader->done);
+        pthread_mutex_unlock(&loader->lock);
+    }
+}
+
+static bool pool_start(FileLoader* loader)
+{
+    int threads = loader->depth < FILE_LOAD_MAX_THREADS ? loader->depth : FILE_LOAD_MAX_THREADS;
+    if (threads > loader->count)
+    {
+        threads = loader->count;
+    }
+    loader->threads = calloc((size_t)threads, sizeof(pthread_t));
+    if (!loader->threads)
+    {
+        return false;
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&loader->threads[i], NULL, load_worker, loader) != 0)
+        {
+            break;
+        }
+        loader->thread_count++;
+    }
+    return loader->thread_count > 0;
+}
+
+/** Block until the worker that claimed slot i is done with it */
+static void pool_wait(FileLoader* loader, int i)
+{
+    LoadSlot* slot = &loader->slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) >= SLOT_DONE)
+    {
+        return;
+    }
+    pthread_mutex_lock(&loader->lock);
+    while (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) < SLOT_DONE)
+    {
+        pthread_cond_wait(&loader->done, &loader->lock);
+    }
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static void pool_stop(FileLoader* loader)
+{
+    for (int i = 0; i < loader->thread_count; i++)
+    {
+        pthread_join(loader->threads[i], NULL);
+    }
+    free(loader->threads);
+}
+
+/* --- io_uring --- */
+
+#ifdef FILE_LOAD_IO_URING
+
+static int uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+/** Whether the kernel knows every opcode the loader submits */
+static bool uring_supports_ops(int fd)
+{
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, len);
+    if (!probe)
+    {
+        return false;
+    }
+    bool ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    const int ops[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ};
+    for (size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+static bool uring_start(FileLoader* loader)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = uring_setup((unsigned)loader->depth, &params);
+    if (fd < 0)
+    {
+        /* ENOSYS, or io_uring disabled by sysctl or a seccomp filter */
+        return false;
+    }
+    if (!uring_supports_ops(fd))
+    {
+        close(fd);
+        return false;
+    }
+    loader->ring_fd = fd;
+    loader->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    loader->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && loader->cq_ring_len > loader->sq_ring_len)
+    {
+        loader->sq_ring_len = loader->cq_ring_len;
+    }
+    loader->sq_ring = mmap(NULL, loader->sq_ring_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    loader->cq_ring = single ? loader->sq_ring
+                             : mmap(NULL, loader->cq_ring_len, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    loader->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    loader->sqes = mmap(NULL, loader->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQES);
+    if (loader->sq_ring == MAP_FAILED || loader->cq_ring == MAP_FAILED ||
+        loader->sqes == MAP_FAILED)
+    {
+        /* Unmapping in uring_stop() skips the failed ones */
+        return false;
+    }
+
+    char* sq = loader->sq_ring;
+    char* cq = loader->cq_ring;
+    loader->sq_head = (unsigned*)(sq + params.sq_off.head);
+    loader->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    loader->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    loader->sq_array = (unsigned*)(sq + params.sq_off.array);
+    loader->cq_head = (unsigned*)(cq + params.cq_off.head);
+    loader->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    loader->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    loader->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    /* WHY: each slot has at most one request in flight, so depth slots never
+     * overflow a ring of depth entries (rounded up by the kernel) */
+    if (loader->depth > (int)params.sq_entries)
+    {
+        loader->depth = (int)params.sq_entries;
+    }
+    return true;
+}
+
+static void uring_stop(FileLoader* loader)
+{
+    if (loader->sqes && loader->sqes != MAP_FAILED)
+    {
+        munmap(loader->sqes, loader->sqes_len);
+    }
+    if (loader->cq_ring && loader->cq_ring != MAP_FAILED && loader->cq_ring != loader->sq_ring)
+    {
+        munmap(loader->cq_ring, loader->cq_ring_len);
+    }
+    if (loader->sq_ring && loader->sq_ring != MAP_FAILED)
+    {
+        munmap(loader->sq_ring, loader->sq_ring_len);
+    }
+    if (loader->ring_fd >= 0)
+    {
+        close(loader->ring_fd);
+    }
+}
+
+/** Queue the next request of slot i; submitted on the next uring_enter() */
+static void uring_queue(FileLoader* loader, int i)
+{
+    LoadSlot* slot = &loader->slots[i];
+    unsigned tail = *loader->sq_tail;
+    unsigned index = tail & *loader->sq_mask;
+    struct io_uring_sqe* sqe = &loader->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)i;
+    switch (slot->state)
+    {
+    case SLOT_OPENING:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)slot->path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        timing_count(COUNTER_OPEN, 1);
+        break;
+    case SLOT_STATING:
+        /* WHY: the signature comes from the descriptor that is read, as in
+         * file_meta_load(), so a file replaced mid-run is never taken for
+         * the one that was cached */
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = slot->fd;
+        sqe->addr = (uint64_t)(uintptr_t) "";
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = (uint64_t)(uintptr_t)&slot->stx;
+        sqe->statx_flags = AT_EMPTY_PATH;
+        break;
+    default:
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot->fd;
+        sqe->addr = (uint64_t)(uintptr_t)(slot->buf + slot->got);
+        sqe->len = (unsigned)((size_t)slot->st.st_size - slot->got);
+        sqe->off = slot->got;
+        break;
+    }
+    loader->sq_array[index] = index;
+    __atomic_store_n(loader->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    loader->unsubmitted++;
+    timing_count(COUNTER_IO_URING_OPS, 1);
+}
+
+/** The struct stat fields FileSig and the loader read, from a statx() */
+static void stat_from_statx(const struct statx* stx, struct stat* st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_mode = stx->stx_mode;
+    st->st_size = (off_t)stx->stx_size;
+    st->st_ino = stx->stx_ino;
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/** Advance slot i on the result of its request; returns true if it queued another */
+static bool uring_advance(FileLoader* loader, int i, int res)
+{
+    LoadSlot* slot = &loader->slots[i];
+    switch (slot->state)
+    {
+    case SLOT_OPENING:
+        if (res < 0)
+        {
+            slot->ok = false;
+            slot->state = SLOT_DONE;
+            return false;
+        }
+        slot->fd = res;
+        slot->state = SLOT_STATING;
+        break;
+    case SLOT_STATING:
+        stat_from_statx(&slot->stx, &slot->st);
+        if (res < 0 || !S_ISREG(slot->st.st_mode))
+        {
+            slot_read_done(slot, false);
+            slot->state = SLOT_DONE;
+            return false;
+        }
+        if (!slot_wants_read(slot))
+        {
+            slot_read_done(slot, true);
+            slot->state = SLOT_DONE;
+            return false;
+        }
+        slot->state = SLOT_READING;
+        break;
+    default:
+        if (res == -EINTR || res == -EAGAIN)
+        {
+            break;
+        }
+        if (res <= 0)
+        {
+            /* An error, or the file shrank since its statx() */
+            slot_read_done(slot, false);
+            slot->state = SLOT_DONE;
+            return false;
+        }
+        slot->got += (size_t)res;
+        if (slot->got == (size_t)slot->st.st_size)
+        {
+            slot_read_done(slot, true);
+            slot->state = SLOT_DONE;
+            return false;
+        }
+        break;
+    }
+    uring_queue(loader, i);
+    return true;
+}
+
+/** Hand the queued requests to the kernel, waiting for min_complete completions */
+static bool uring_submit(FileLoader* loader, unsigned min_complete)
+{
+    for (;;)
+    {
+        if (loader->unsubmitted == 0 && min_complete == 0)
+        {
+            return true;
+        }
+        int n = uring_enter(loader->ring_fd, loader->unsubmitted, min_complete,
+                            min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return false;
+        }
+        loader->unsubmitted -= (unsigned)n < loader->unsubmitted ? (unsigned)n : loader->unsubmitted;
+        if (loader->unsubmitted == 0 || n == 0)
+        {
+            return true;
+        }
+        min_complete = 0;
+    }
+}
+
+/**
+ * Top the ring up to depth files, submit, and handle what has completed
+ *
+ * Waits for at least one completion when wait is set. Requests that the
+ * completions lead to (a statx() after an open, a read after a statx()) are
+ * submitted before returning, so they progress while the caller works.
+ * Returns false if the ring failed.
+ */
+static bool uring_pump(FileLoader* loader, bool wait)
+{
+    while (loader->in_flight < loader->depth && loader->next < loader->count)
+    {
+        int i = loader->next++;
+        loader->slots[i].state = SLOT_OPENING;
+        uring_queue(loader, i);
+        loader->in_flight++;
+    }
+    if (!uring_submit(loader, wait && loader->in_flight > 0 ? 1 : 0))
+    {
+        return false;
+    }
+
+    unsigned head = *loader->cq_head;
+    unsigned tail = __atomic_load_n(loader->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        const struct io_uring_cqe* cqe = &loader->cqes[head & *loader->cq_mask];
+        if (!uring_advance(loader, (int)cqe->user_data, cqe->res))
+        {
+            loader->in_flight--;
+        }
+    }
+    __atomic_store_n(loader->cq_head, head, __ATOMIC_RELEASE);
+    return uring_submit(loader, 0);
+}
+
+/**
+ * Wait until the kernel holds no request of the loader's, after the ring failed
+ *
+ * Requests still in the submission ring are never handed over now; every
+ * other slot in flight has one completion coming. An openat that completes
+ * records its descriptor so it is closed. Returns false if the ring cannot
+ * even be waited on.
+ */
+static bool uring_drain(FileLoader* loader)
+{
+    unsigned queued = *loader->sq_tail - __atomic_load_n(loader->sq_head, __ATOMIC_ACQUIRE);
+    int owed = loader->in_flight - (int)queued;
+    while (owed > 0)
+    {
+        unsigned head = *loader->cq_head;
+        unsigned tail = __atomic_load_n(loader->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, owed--)
+        {
+            const struct io_uring_cqe* cqe = &loader->cqes[head & *loader->cq_mask];
+            LoadSlot* slot = &loader->slots[cqe->user_data];
+            if (slot->state == SLOT_OPENING && cqe->res >= 0)
+            {
+                slot->fd = cqe->res;
+            }
+        }
+        __atomic_store_n(loader->cq_head, head, __ATOMIC_RELEASE);
+        if (owed > 0 && uring_enter(loader->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+            errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Load every unfinished slot the blocking way once the ring stops working
+ *
+ * WHY: a ring that fails must not lose files, and a slot is only reused once
+ * the kernel is done with it. If the ring cannot be drained, what the kernel
+ * may still write to is left to it: those buffers, descriptors and the slot
+ * array leak.
+ */
+static void uring_fall_back(FileLoader* loader)
+{
+    fprintf(stderr, "Warning: io_uring failed (%s); loading files directly\n", strerror(errno));
+    bool drained = uring_drain(loader);
+    loader->uring = false;
+    loader->slots_leaked = !drained;
+    for (int k = 0; k < loader->count; k++)
+    {
+        LoadSlot* slot = &loader->slots[k];
+        if (slot->state >= SLOT_DONE)
+        {
+            continue;
+        }
+        if (slot->state != SLOT_QUEUED && !drained)
+        {
+            slot->fd = -1;
+            slot->buf = NULL;
+        }
+        else
+        {
+            if (slot->fd >= 0)
+            {
+                close(slot->fd);
+            }
+            free(slot->buf);
+            slot->buf = NULL;
+        }
+        slot->got = 0;
+        load_slot_blocking(slot);
+        slot->state = SLOT_DONE;
+    }
+    /* Nothing is left for a thread pool to claim */
+    loader->claim = loader->count;
+}
+
+#endif /* FILE_LOAD_IO_URING */
+
+/** Wait for slot i to finish, on whichever backend runs */
+static void loader_wait_slot(FileLoader* loader, int i)
+{
+    if (!loader->uring)
+    {
+        pool_wait(loader, i);
+        return;
+    }
+#ifdef FILE_LOAD_IO_URING
+    bool wait = false;
+    while (loader->slots[i].state < SLOT_DONE)
+    {
+        if (!uring_pump(loader, wait))
+        {
+            uring_fall_back(loader);
+            return;
+        }
+        wait = true;
+    }
+    /* Keep the ring full while the caller works on this file */
+    if (!wait)
+    {
+        uring_pump(loader, false);
+    }
+#endif
+}
+
+static void loader_attach(FileLoader* loader, LoadSlot* slot)
+{
+    if (slot->state == SLOT_ATTACHED)
+    {
+        return;
+    }
+    FileMeta* meta = slot->meta;
+    if (!slot->ok || !file_meta_attach(meta, &slot->st, slot->fd, slot->buf, loader->owner))
+    {
+        memset(meta, 0, sizeof(*meta));
+        meta->loaded = true;
+    }
+    if (slot->fd >= 0)
+    {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    slot->buf = NULL;
+    slot->state = SLOT_ATTACHED;
+}
+
+FileLoader* file_loader_start(FileMeta* const* metas, const char* const* paths, int count,
+                              OutputVec* owner, int queue_depth)
+{
+    if (queue_depth <= 0 || count <= 0)
+    {
+        return NULL;
+    }
+    FileLoader* loader = calloc(1, sizeof(*loader));
+    LoadSlot* slots = calloc((size_t)count, sizeof(LoadSlot));
+    if (!loader || !slots)
+    {
+        free(loader);
+        free(slots);
+        return NULL;
+    }
+    int n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (!metas[i] || metas[i]->loaded || metas[i]->loader)
+        {
+            continue;
+        }
+        slots[n].meta = metas[i];
+        slots[n].path = paths[i];
+        slots[n].fd = -1;
+        metas[i]->loader = loader;
+        metas[i]->load_slot = n;
+        n++;
+    }
+    loader->owner = owner;
+    loader->slots = slots;
+    loader->count = n;
+    loader->depth = queue_depth;
+    if (n == 0)
+    {
+        free(slots);
+        free(loader);
+        return NULL;
+    }
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->done, NULL);
+
+#ifdef FILE_LOAD_IO_URING
+    loader->ring_fd = -1;
+    const char* no_uring = getenv("LLM_CTX_NO_IO_URING");
+    if (!(no_uring && *no_uring && strcmp(no_uring, "0") != 0))
+    {
+        loader->uring = uring_start(loader);
+        if (!loader->uring)
+        {
+            uring_stop(loader);
+            loader->ring_fd = -1;
+            loader->sq_ring = loader->cq_ring = NULL;
+            loader->sqes = NULL;
+        }
+    }
+    if (loader->uring && !uring_pump(loader, false))
+    {
+        uring_fall_back(loader);
+    }
+#endif
+    if (!loader->uring && loader->claim < loader->count && !pool_start(loader))
+    {
+        /* No threads either: load everything now */
+        loader->claim = loader->count;
+        for (int i = 0; i < loader->count; i++)
+        {
+            load_slot_blocking(&loader->slots[i]);
+            loader->slots[i].state = SLOT_DONE;
+        }
+    }
+    timing_count(COUNTER_IO_QUEUE_DEPTH, (uint64_t)loader->depth);
+    return loader;
+}
+
+bool file_loader_uses_io_uring(const FileLoader* loader)
+{
+    return loader && loader->uring;
+}
+
+bool file_loader_wait(FileLoader* loader, FileMeta* meta)
+{
+    LoadSlot* slot = &loader->slots[meta->load_slot];
+    loader_wait_slot(loader, meta->load_slot);
+    loader_attach(loader, slot);
+    return meta->readable;
+}
+
+void file_loader_finish(FileLoader* loader)
+{
+    if (!loader)
+    {
+        return;
+    }
+    for (int i = 0; i < loader->count; i++)
+    {
+        loader_wait_slot(loader, i);
+        loader_attach(loader, &loader->slots[i]);
+    }
+#ifdef FILE_LOAD_IO_URING
+    uring_stop(loader);
+#endif
+    pool_stop(loader);
+    pthread_mutex_destroy(&loader->lock);
+    pthread_cond_destroy(&loader->done);
+    if (!loader->slots_leaked)
+    {
+        free(loader->slots);
+    }
+    free(loader);
+}
@@ -0,0 +1,55 @@
+#ifndef FILELOAD_H
+#define FILELOAD_H
+
+#include <stdbool.h>
+#include "filemeta.h"
+#include "output.h"
+
+/**
+ * Batched, asynchronous loading of file content
+ *
+ * Fills the FileMeta of a whole candidate list with up to a queue depth of
+ * files in flight, so ranking and assembly stop paying one open, stat and
+ * read latency after another on NFS or a cold disk. On Linux the opens,
+ * statx() calls and reads go through io_uring; elsewhere, or when the kernel
+ * refuses a ring, a pool of threads does the same work with blocking calls.
+ * Consumers need not know: file_meta_load() on a meta of the list waits for
+ * that one file, reaping whatever else has completed meanwhile. Files are
+ * submitted in list order, which is the order FileRank and assembly read
+ * them, so the file being worked on overlaps with the reads of those after
+ * it. Loaded metas are identical to what file_meta_load() produces alone.
+ */
+
+/* Default --queue-depth */
+#define FILE_LOAD_DEFAULT_DEPTH 64
+/* Files larger than this are mapped after a readahead hint instead of read */
+#define FILE_LOAD_READ_MAX (256 * 1024)
+
+typedef struct FileLoader FileLoader;
+
+/**
+ * Start loading metas[0, count) from paths[0, count) into owner
+ *
+ * Entries already loaded or already queued are skipped; the arrays are copied.
+ * Returns NULL when there is nothing to load or queue_depth is 0, in which
+ * case every file loads on first use as before. Set LLM_CTX_NO_IO_URING=1 to
+ * force the thread pool.
+ */
+FileLoader* file_loader_start(FileMeta* const* metas, const char* const* paths, int count,
+                              OutputVec* owner, int queue_depth);
+
+/** Whether the loader runs on io_uring rather than the thread pool */
+bool file_loader_uses_io_uring(const FileLoader* loader);
+
+/**
+ * Wait until meta, queued by this loader, is loaded; returns meta->readable
+ *
+ * Called by file_meta_load(); must be called from the thread that started
+ * the loader.
+ */
+bool file_loader_wait(FileLoader* loader, FileMeta* meta);
+
+/** Wait for everything still queued, load it, and release the loader */
+void file_loader_finish(FileLoader* loader);
+
+#endif /* FILELOAD_H */
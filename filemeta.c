@@ -0,0 +1,217 @@
+#include "filemeta.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fileload.h"
+#include "timings.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+bool file_meta_load(FileMeta* meta, const char* path, OutputVec* owner)
+{
+    if (meta->loaded)
+    {
+        return meta->readable;
+    }
+    if (meta->loader)
+    {
+        return file_loader_wait(meta->loader, meta);
+    }
+    memset(meta, 0, sizeof(*meta));
+    meta->loaded = true;
+
+    int fd = open(path, O_RDONLY);
+    timing_count(COUNTER_OPEN, 1);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    /* WHY: the signature comes from the descriptor that is mapped, so a
+     * change made mid-run can only make a cached entry look stale, never
+     * make stale content look current. */
+    struct stat st;
+    bool readable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                    file_meta_attach(meta, &st, fd, NULL, owner);
+    close(fd);
+    return readable;
+}
+
+bool file_meta_attach(FileMeta* meta, const struct stat* st, int fd, void* buf,
+                      OutputVec* owner)
+{
+    memset(meta, 0, sizeof(*meta));
+    meta->loaded = true;
+    file_sig_from_stat(st, &meta->sig);
+    meta->size = (size_t)st->st_size;
+    if (buf)
+    {
+        outvec_adopt(owner, buf, meta->size, &meta->data);
+        meta->readable = true;
+    }
+    else
+    {
+        meta->readable = outvec_map_fd(owner, fd, meta->size, &meta->data);
+    }
+    if (!meta->readable)
+    {
+        meta->data = NULL;
+        meta->size = 0;
+        return false;
+    }
+
+    meta->binary = is_binary_buffer(meta->data,
+                                    meta->size < BINARY_CHECK_SIZE ? meta->size : BINARY_CHECK_SIZE);
+    return true;
+}
+
+bool is_binary_buffer(const char* buffer, size_t len)
+{
+    /* WHY: a byte test rather than isprint() avoids locale dependence */
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)buffer[i];
+        if (c == '\0' || (c < 0x20 && c != '\t' && c != '\n' && c != '\r'))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void file_meta_free(FileMeta* meta)
+{
+    free(meta->line_offsets);
+    meta->line_offsets = NULL;
+    meta->line_offsets_count = 0;
+    meta->line_offsets_cap = 0;
+    meta->lines_complete = false;
+    meta->cursor_line = 0;
+}
+
+size_t skip_lines(const char* data, size_t len, size_t n, size_t* skipped)
+{
+    size_t pos = 0;
+    size_t seen = 0;
+#ifdef __SSE2__
+    /* WHY: one compare and movemask per 16 bytes counts every newline in a
+     * block at once; per-line memchr() pays a call per short line */
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (seen < n && pos + 64 <= len)
+    {
+        const __m128i* p = (const __m128i*)(data + pos);
+        uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p), nl));
+        uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 1), nl));
+        uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), nl));
+        uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 3), nl));
+        uint64_t mask = m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+        size_t count = (size_t)__builtin_popcountll(mask);
+        if (seen + count >= n)
+        {
+            /* The target newline is in this block: drop the ones before it */
+            for (size_t k = n - seen; k > 1; k--)
+            {
+                mask &= mask - 1;
+            }
+            *skipped = n;
+            return pos + (size_t)__builtin_ctzll(mask) + 1;
+        }
+        seen += count;
+        pos += 64;
+    }
+#endif
+    while (seen < n && pos < len)
+    {
+        const char* nl_at = memchr(data + pos, '\n', len - pos);
+        if (!nl_at)
+        {
+            pos = len;
+            break;
+        }
+        pos = (size_t)(nl_at - data) + 1;
+        seen++;
+    }
+    *skipped = seen;
+    return pos;
+}
+
+static void line_index_push(FileMeta* meta, size_t offset)
+{
+    if (meta->line_offsets_count == meta->line_offsets_cap)
+    {
+        size_t cap = meta->line_offsets_cap ? meta->line_offsets_cap * 2 : 16;
+        size_t* grown = realloc(meta->line_offsets, cap * sizeof(size_t));
+        if (!grown)
+        {
+            fprintf(stderr, "Error: Out of memory indexing lines\n");
+            exit(1);
+        }
+        meta->line_offsets = grown;
+        meta->line_offsets_cap = cap;
+    }
+    meta->line_offsets[meta->line_offsets_count++] = offset;
+}
+
+/** Byte offset where 1-based line starts, or the file size past the last line */
+static size_t line_start(FileMeta* meta, size_t line)
+{
+    size_t entry = (line - 1) / LINE_INDEX_STRIDE;
+    if (meta->line_offsets_count == 0)
+    {
+        line_index_push(meta, 0);
+    }
+    while (meta->line_offsets_count <= entry && !meta->lines_complete)
+    {
+        size_t from = meta->line_offsets[meta->line_offsets_count - 1];
+        size_t skipped;
+        size_t next = from + skip_lines(meta->data + from, meta->size - from, LINE_INDEX_STRIDE,
+                                        &skipped);
+        if (skipped < LINE_INDEX_STRIDE)
+        {
+            meta->lines_complete = true;
+            break;
+        }
+        line_index_push(meta, next);
+    }
+    if (entry >= meta->line_offsets_count)
+    {
+        entry = meta->line_offsets_count - 1;
+    }
+
+    size_t pos = meta->line_offsets[entry];
+    size_t pos_line = entry * LINE_INDEX_STRIDE + 1;
+    if (meta->cursor_line > pos_line && meta->cursor_line <= line)
+    {
+        pos = meta->cursor_offset;
+        pos_line = meta->cursor_line;
+    }
+    size_t skipped;
+    pos += skip_lines(meta->data + pos, meta->size - pos, line - pos_line, &skipped);
+    if (skipped == line - pos_line)
+    {
+        meta->cursor_line = line;
+        meta->cursor_offset = pos;
+    }
+    return pos;
+}
+
+void file_meta_line_range(FileMeta* meta, int start_line, int end_line, size_t* from,
+                          size_t* to)
+{
+    if (!meta->readable)
+    {
+        *from = *to = 0;
+        return;
+    }
+    *from = start_line > 1 ? line_start(meta, (size_t)start_line) : 0;
+    *to = end_line > 0 ? line_start(meta, (size_t)end_line + 1) : meta->size;
+    if (*to < *from)
+    {
+        *to = *from;
+    }
+}
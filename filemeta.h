@@ -0,0 +1,94 @@
+#ifndef FILEMETA_H
+#define FILEMETA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "filecache.h"
+#include "output.h"
+
+/**
+ * Per-file metadata shared across a run
+ *
+ * One record per collected file, filled on first touch by a single open(),
+ * fstat() and mapping, then read by FileRank, assembly and the token cache
+ * alike, so no phase opens, stats or binary-probes the file again. The
+ * content is mapped through the output vector that will reference it and
+ * stays valid until that vector is freed.
+ */
+
+/* Leading bytes inspected when deciding whether content is binary */
+#define BINARY_CHECK_SIZE 1024
+/* Lines between entries of the sparse line index */
+#define LINE_INDEX_STRIDE 1024
+
+struct FileLoader;
+
+typedef struct
+{
+    FileSig sig;      /* From the fstat() of the descriptor that was mapped */
+    const char* data; /* Whole file content; NULL unless readable */
+    size_t size;
+    bool loaded;      /* file_meta_load() has run, successfully or not */
+    bool readable;    /* A regular file whose content is in data/size */
+    bool binary;      /* Binary-looking content, skipped by FileRank and assembly */
+    /* Sparse line index: line_offsets[k] is where line k * LINE_INDEX_STRIDE + 1
+     * starts. Extended only as far as a requested line, so a range near the
+     * top of a huge file never scans the rest. */
+    size_t* line_offsets;
+    size_t line_offsets_count;
+    size_t line_offsets_cap;
+    bool lines_complete; /* The index reaches the end of the file */
+    /* Start of the last line looked up, so lookups in increasing line order
+     * (the chunks of a file) each scan only the lines since the previous one */
+    size_t cursor_line;
+    size_t cursor_offset;
+    /* Batch loader the file is queued on (see fileload.h), NULL once loaded */
+    struct FileLoader* loader;
+    int load_slot;
+} FileMeta;
+
+/**
+ * Fill meta from path unless already loaded; owner keeps the mapping alive
+ *
+ * Returns meta->readable. A failure is remembered and not retried.
+ */
+bool file_meta_load(FileMeta* meta, const char* path, OutputVec* owner);
+
+/**
+ * Fill meta from the fstat() of a regular file and its content
+ *
+ * The content is buf, size st->st_size bytes from malloc() that owner frees
+ * from then on, or when buf is NULL the open fd, which is mapped (the caller
+ * still closes fd). For loaders that did the open and read themselves.
+ * Returns meta->readable.
+ */
+bool file_meta_attach(FileMeta* meta, const struct stat* st, int fd, void* buf,
+                      OutputVec* owner);
+
+/** Release the line index; the content belongs to the owning output vector */
+void file_meta_free(FileMeta* meta);
+
+/**
+ * Byte range [*from, *to) covering lines start_line..end_line of a loaded file
+ *
+ * Lines are 1-based and inclusive; 0 means the start or the end of the file.
+ * Ranges past the end are clamped to it. Repeated lookups in the same file
+ * cost a few index steps plus at most LINE_INDEX_STRIDE lines of scanning,
+ * or only the lines since the previous lookup when lines increase.
+ */
+void file_meta_line_range(FileMeta* meta, int start_line, int end_line, size_t* from,
+                          size_t* to);
+
+/**
+ * Offset just past the n-th newline in data, or len if there are fewer
+ *
+ * *skipped gets the number of newlines passed. Scans 64 bytes per step with
+ * SSE2 where available.
+ */
+size_t skip_lines(const char* data, size_t len, size_t n, size_t* skipped);
+
+/** True if buffer contains NUL bytes or C0 control codes other than common whitespace */
+bool is_binary_buffer(const char* buffer, size_t len);
+
+#endif /* FILEMETA_H */
@@ -0,0 +1,420 @@
+#include "filetree.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct FileTreeEdge
+{
+    const FileTreeNode* parent; /* NULL if the slot is empty */
+    const char* name;
+    FileTreeNode* child;
+} FileTreeEdge;
+
+/* One rendering level: the node being listed and where its listing stands */
+typedef struct
+{
+    FileTreeNode* node;
+    int next;       /* Next child to visit */
+    int last;       /* Last child with files below it */
+    size_t indent;  /* Bytes of the indent string used by this level */
+} TreeFrame;
+
+static void tree_oom(void)
+{
+    fprintf(stderr, "Error: Out of memory building file tree\n");
+    exit(1);
+}
+
+static size_t edge_hash(const FileTreeNode* parent, const char* name)
+{
+    /* WHY: Names are interned, so the pair of pointers identifies the edge */
+    uint64_t h = (uint64_t)(uintptr_t)parent * 0x9e3779b97f4a7c15ULL;
+    h ^= (uint64_t)(uintptr_t)name * 0xc2b2ae3d27d4eb4fULL;
+    return (size_t)(h ^ (h >> 31));
+}
+
+static FileTreeEdge* edge_slot(const FileTree* tree, const FileTreeNode* parent, const char* name)
+{
+    size_t mask = tree->edge_cap - 1;
+    for (size_t i = edge_hash(parent, name) & mask;; i = (i + 1) & mask)
+    {
+        FileTreeEdge* e = &tree->edges[i];
+        if (!e->parent || (e->parent == parent && e->name == name))
+        {
+            return e;
+        }
+    }
+}
+
+static void edges_grow(FileTree* tree)
+{
+    FileTreeEdge* old = tree->edges;
+    size_t old_cap = tree->edge_cap;
+    size_t cap = old_cap ? old_cap * 2 : 256;
+    tree->edges = arena_push_array(tree->arena, FileTreeEdge, cap);
+    if (!tree->edges)
+    {
+        tree_oom();
+    }
+    tree->edge_cap = cap;
+    for (size_t i = 0; i < old_cap; i++)
+    {
+        if (old[i].parent)
+        {
+            *edge_slot(tree, old[i].parent, old[i].name) = old[i];
+        }
+    }
+}
+
+static void node_append_child(FileTree* tree, FileTreeNode* parent, FileTreeNode* child)
+{
+    if (parent->child_count == parent->child_cap)
+    {
+        int cap = parent->child_cap ? parent->child_cap * 2 : 4;
+        FileTreeNode** children = arena_push_array(tree->arena, FileTreeNode*, cap);
+        if (!children)
+        {
+            tree_oom();
+        }
+        if (parent->child_count > 0)
+        {
+            memcpy(children, parent->children, (size_t)parent->child_count * sizeof(*children));
+        }
+        parent->children = children;
+        parent->child_cap = cap;
+    }
+    parent->children[parent->child_count++] = child;
+    parent->sorted = false;
+}
+
+/** Child named name (interned), or NULL */
+static FileTreeNode* node_child(const FileTree* tree, const FileTreeNode* parent, const char* name)
+{
+    if (tree->edge_count == 0)
+    {
+        return NULL;
+    }
+    return edge_slot(tree, parent, name)->child;
+}
+
+static FileTreeNode* node_child_create(FileTree* tree, FileTreeNode* parent, const char* name)
+{
+    FileTreeNode* child = node_child(tree, parent, name);
+    if (child)
+    {
+        return child;
+    }
+    if ((tree->edge_count + 1) * 2 > tree->edge_cap)
+    {
+        edges_grow(tree);
+    }
+    child = arena_push_array(tree->arena, FileTreeNode, 1);
+    if (!child)
+    {
+        tree_oom();
+    }
+    child->name = name;
+    child->parent = parent;
+    child->sorted = true;
+    FileTreeEdge* e = edge_slot(tree, parent, name);
+    e->parent = parent;
+    e->name = name;
+    e->child = child;
+    tree->edge_count++;
+    node_append_child(tree, parent, child);
+    return child;
+}
+
+/** Skip any leading "./" */
+static const char* strip_dot_prefix(const char* path)
+{
+    while (path[0] == '.' && path[1] == '/')
+    {
+        path += 2;
+        while (*path == '/')
+        {
+            path++;
+        }
+    }
+    return path;
+}
+
+/**
+ * Walk path's components from the root, creating nodes if create is set
+ *
+ * Returns the entry's node, or NULL if it does not exist. "." names the root.
+ */
+static FileTreeNode* tree_walk(FileTree* tree, const char* path, bool create, int* depth)
+{
+    const char* p = strip_dot_prefix(path);
+    size_t len = strlen(p);
+    while (len > 0 && p[len - 1] == '/')
+    {
+        len--;
+    }
+    if (len == 1 && p[0] == '.')
+    {
+        len = 0;
+    }
+
+    FileTreeNode* node = &tree->root;
+    char component[4096];
+    size_t start = 0;
+    int components = 0;
+    while (len > 0 && start <= len)
+    {
+        const char* slash = memchr(p + start, '/', len - start);
+        size_t end = slash ? (size_t)(slash - p) : len;
+        size_t n = end - start;
+        if (n >= sizeof(component))
+        {
+            n = sizeof(component) - 1;
+        }
+        memcpy(component, p + start, n);
+        component[n] = '\0';
+
+        const char* name;
+        if (create)
+        {
+            path_set_insert(&tree->names, component, 0, 0, &name);
+            node->is_dir = true;
+            node = node_child_create(tree, node, name);
+        }
+        else
+        {
+            /* An unseen name cannot have an edge */
+            if (!path_set_contains(&tree->names, component, 0, 0))
+            {
+                return NULL;
+            }
+            path_set_insert(&tree->names, component, 0, 0, &name);
+            node = node_child(tree, node, name);
+            if (!node)
+            {
+                return NULL;
+            }
+        }
+        components++;
+        start = end + 1;
+    }
+    if (depth)
+    {
+        *depth = components;
+    }
+    return node;
+}
+
+void file_tree_init(FileTree* tree, Arena* arena)
+{
+    memset(tree, 0, sizeof(*tree));
+    tree->arena = arena;
+    tree->root.name = "";
+    tree->root.sorted = true;
+    path_set_init(&tree->names, arena);
+}
+
+bool file_tree_add(FileTree* tree, const char* path, bool is_dir)
+{
+    int depth = 0;
+    FileTreeNode* node = tree_walk(tree, path, true, &depth);
+    if (node->is_entry)
+    {
+        return false;
+    }
+
+    node->is_entry = true;
+    node->is_dir = node->is_dir || is_dir;
+    if (!is_dir)
+    {
+        for (FileTreeNode* n = node; n; n = n->parent)
+        {
+            n->files++;
+        }
+    }
+    if (tree->count == 0)
+    {
+        tree->first_path = arena_strdup(tree->arena, path);
+        if (!tree->first_path)
+        {
+            tree_oom();
+        }
+    }
+    tree->count++;
+    tree->dotted += strip_dot_prefix(path) != path;
+    if (depth > tree->height)
+    {
+        tree->height = depth;
+    }
+    return true;
+}
+
+bool file_tree_contains(const FileTree* tree, const char* path)
+{
+    /* WHY: Lookups only intern names that already exist, so the const cast
+     * never changes what the tree holds. */
+    FileTreeNode* node = tree_walk((FileTree*)tree, path, false, NULL);
+    return node && node->is_entry;
+}
+
+/** Deepest node under which every entry lies strictly */
+static const FileTreeNode* common_node(const FileTree* tree, int* components)
+{
+    const FileTreeNode* node = &tree->root;
+    int n = 0;
+    while (!node->is_entry && node->child_count == 1)
+    {
+        const FileTreeNode* child = node->children[0];
+        if (child->is_entry || child->child_count == 0)
+        {
+            break;
+        }
+        node = child;
+        n++;
+    }
+    *components = n;
+    return node;
+}
+
+char* file_tree_root(const FileTree* tree, Arena* arena)
+{
+    int components;
+    const FileTreeNode* node = common_node(tree, &components);
+    bool dotted = tree->count > 0 && tree->dotted == tree->count;
+
+    if (components == 0)
+    {
+        return arena_strdup(arena, ".");
+    }
+    if (components == 1 && node->name[0] == '\0')
+    {
+        return arena_strdup(arena, "/"); /* Absolute paths with nothing else in common */
+    }
+
+    size_t len = dotted ? 2 : 0;
+    for (const FileTreeNode* n = node; n != &tree->root; n = n->parent)
+    {
+        len += strlen(n->name) + 1;
+    }
+    char* root = arena_push_size(arena, len, 1);
+    if (!root)
+    {
+        tree_oom();
+    }
+    /* Fill from the end: each component is preceded by '/' except the first */
+    size_t pos = len - 1;
+    root[pos] = '\0';
+    for (const FileTreeNode* n = node; n != &tree->root; n = n->parent)
+    {
+        size_t name_len = strlen(n->name);
+        pos -= name_len;
+        memcpy(root + pos, n->name, name_len);
+        if (pos > 0)
+        {
+            root[--pos] = '/';
+        }
+    }
+    if (dotted)
+    {
+        root[0] = '.';
+        root[1] = '/';
+    }
+    return root;
+}
+
+static bool node_lists_as_dir(const FileTreeNode* node)
+{
+    return node->is_dir || node->child_count > 0;
+}
+
+/* WHY: Siblings must come out in the order strcmp() puts their full paths,
+ * so a directory compares as its name followed by '/'. */
+static int compare_tree_nodes(const void* a, const void* b)
+{
+    const FileTreeNode* x = *(const FileTreeNode* const*)a;
+    const FileTreeNode* y = *(const FileTreeNode* const*)b;
+    const unsigned char* p = (const unsigned char*)x->name;
+    const unsigned char* q = (const unsigned char*)y->name;
+    while (*p && *p == *q)
+    {
+        p++;
+        q++;
+    }
+    int cp = *p ? *p : (node_lists_as_dir(x) ? '/' : 0);
+    int cq = *q ? *q : (node_lists_as_dir(y) ? '/' : 0);
+    return cp - cq;
+}
+
+static void frame_enter(TreeFrame* frame, FileTreeNode* node, size_t indent)
+{
+    if (!node->sorted)
+    {
+        qsort(node->children, (size_t)node->child_count, sizeof(*node->children),
+              compare_tree_nodes);
+        node->sorted = true;
+    }
+    frame->node = node;
+    frame->next = 0;
+    frame->indent = indent;
+    frame->last = node->child_count - 1;
+    while (frame->last >= 0 && node->children[frame->last]->files == 0)
+    {
+        frame->last--;
+    }
+}
+
+void file_tree_render(FileTree* tree, OutputVec* out, int max_depth)
+{
+    int components;
+    const FileTreeNode* start = common_node(tree, &components);
+    int levels = tree->height - components;
+    if (levels > max_depth)
+    {
+        levels = max_depth;
+    }
+    if (levels < 1)
+    {
+        levels = 1;
+    }
+
+    /* Scratch is taken up front so the lines below coalesce in the arena */
+    TreeFrame* stack = arena_push_array(tree->arena, TreeFrame, levels);
+    char* indent = arena_push_size(tree->arena, (size_t)levels * 6 + 1, 1);
+    char* root = file_tree_root(tree, tree->arena);
+    if (!stack || !indent || !root)
+    {
+        tree_oom();
+    }
+
+    outvec_printf(out, "%s\n", root);
+
+    int depth = 0;
+    frame_enter(&stack[0], (FileTreeNode*)start, 0);
+    while (depth >= 0)
+    {
+        TreeFrame* frame = &stack[depth];
+        if (frame->next > frame->last)
+        {
+            depth--;
+            continue;
+        }
+        FileTreeNode* child = frame->node->children[frame->next++];
+        if (child->files == 0)
+        {
+            continue; /* Only directories, no files to show */
+        }
+
+        bool is_last = frame->next > frame->last;
+        outvec_printf(out, "%.*s%s%s\n", (int)frame->indent, indent,
+                      is_last ? "└── " : "├── ", child->name);
+
+        if (child->child_count > 0 && depth + 1 < levels)
+        {
+            const char* branch = is_last ? "    " : "│   ";
+            size_t branch_len = strlen(branch);
+            memcpy(indent + frame->indent, branch, branch_len);
+            depth++;
+            frame_enter(&stack[depth], child, frame->indent + branch_len);
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef FILETREE_H
+#define FILETREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "output.h"
+#include "pathset.h"
+
+/**
+ * Path trie behind the <file_tree> section
+ *
+ * Entries are inserted as they are discovered, one node per path component.
+ * Component names are interned, children are found through a hash keyed on
+ * (parent, name) and sorted once when rendered, in the order strcmp() gives
+ * the full paths. Rendering is an iterative depth-first walk that appends
+ * straight to an OutputVec, so deep trees cost no stack and no temp file.
+ *
+ * A leading "./" is dropped, so "./a.c" and "a.c" are the same entry. All
+ * storage comes from the arena.
+ */
+typedef struct FileTreeNode
+{
+    const char* name; /* Interned component; "" for the root */
+    struct FileTreeNode* parent;
+    struct FileTreeNode** children;
+    int child_count;
+    int child_cap;
+    int files; /* Non-directory entries at or below this node */
+    bool is_entry;
+    bool is_dir;
+    bool sorted;
+} FileTreeNode;
+
+typedef struct
+{
+    Arena* arena;
+    FileTreeNode root;
+    PathSet names;
+    struct FileTreeEdge* edges; /* (parent, name) -> child */
+    size_t edge_cap;
+    size_t edge_count;
+    int count;              /* Distinct entries */
+    int dotted;             /* Entries given with a leading "./" */
+    int height;             /* Components in the deepest entry */
+    const char* first_path; /* First entry as given */
+} FileTree;
+
+void file_tree_init(FileTree* tree, Arena* arena);
+
+/** Add an entry; returns false if it was already present. Exits on allocation failure */
+bool file_tree_add(FileTree* tree, const char* path, bool is_dir);
+
+bool file_tree_contains(const FileTree* tree, const char* path);
+
+/**
+ * Directory under which every entry lies
+ *
+ * The longest run of components each entry starts with and extends past,
+ * spelled with "./" if every entry was, or "." if there is none.
+ */
+char* file_tree_root(const FileTree* tree, Arena* arena);
+
+/** Append the root line and the files below it, max_depth levels deep */
+void file_tree_render(FileTree* tree, OutputVec* out, int max_depth);
+
+#endif /* FILETREE_H */
@@ -1,88 +1,220 @@
 #include "gitignore.h"
+#include "timings.h"
+#include <fcntl.h>
+#include <pthread.h>
 
-IgnorePattern ignore_patterns[MAX_IGNORE_PATTERNS];
+IgnorePattern* ignore_patterns = NULL;
 int num_ignore_patterns = 0;
 bool respect_gitignore = true;
 
-void reset_gitignore_patterns(void)
+/*
+ * Compiled pattern index
+ *
+ * WHY: checking every entry against every pattern with fnmatch() made the walk
+ * O(entries x patterns). Most real .gitignore lines are plain names ("build"),
+ * extensions ("*.o") or fixed paths ("docs/_site"), which a hash lookup
+ * answers directly; only true globs still go through fnmatch().
+ *
+ * Matching keeps the original semantics: the highest-index pattern that
+ * matches the path (FNM_PATHNAME) or its basename decides, and a negation
+ * un-ignores. Each set slot therefore remembers the last pattern index for
+ * its key, split by whether the pattern is directory-only.
+ */
+typedef struct PatternSlot
 {
-    num_ignore_patterns = 0;
-    respect_gitignore = true;
-    assert(num_ignore_patterns == 0);
-    assert(respect_gitignore == true);
-}
+    const char* key; /* Points into IgnorePattern.pattern */
+    int last_any;    /* Highest index applying to files and directories, or -1 */
+    int last_dir;    /* Highest index of a directory-only pattern, or -1 */
+} PatternSlot;
 
-int should_ignore_path(const char* path)
+/* Patterns from the CWD and its ancestors; ignore_patterns views its array */
+static IgnoreList g_root_list;
+
+/* Identity of every .gitignore already in g_root_list, so a walk that starts
+ * at the CWD does not load it a second time as a scope */
+typedef struct
 {
-    assert(path != NULL);
+    dev_t dev;
+    ino_t ino;
+} FileId;
 
-    if (!respect_gitignore || num_ignore_patterns == 0)
+static FileId* g_root_files = NULL;
+static int g_num_root_files = 0;
+
+/* Every scope created during walks; freed by ignore_scopes_release() */
+typedef struct ScopeNode
+{
+    struct ScopeNode* next;
+    IgnoreScope scope;
+} ScopeNode;
+
+static ScopeNode* g_scopes = NULL;
+static pthread_mutex_t g_scopes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* xrealloc(void* ptr, size_t size)
+{
+    void* p = realloc(ptr, size);
+    if (!p)
     {
-        return 0;
+        fprintf(stderr, "Error: Out of memory loading ignore patterns\n");
+        exit(1);
     }
+    return p;
+}
 
-    const char* basename = strrchr(path, '/');
-    if (basename)
+static uint64_t hash_key(const char* key)
+{
+    /* FNV-1a */
+    uint64_t h = 1469598103934665603ULL;
+    while (*key)
     {
-        basename++;
-        assert(*(basename - 1) == '/');
+        h ^= (unsigned char)*key++;
+        h *= 1099511628211ULL;
     }
-    else
+    return h;
+}
+
+static PatternSlot* pattern_set_find(const PatternSet* set, const char* key)
+{
+    if (set->count == 0)
     {
-        basename = path;
+        return NULL;
     }
-
-    assert(basename != NULL);
-
-    struct stat path_stat;
-    bool is_dir = false;
-    if (lstat(path, &path_stat) == 0)
+    size_t mask = set->cap - 1;
+    for (size_t i = hash_key(key) & mask;; i = (i + 1) & mask)
     {
-        is_dir = S_ISDIR(path_stat.st_mode);
+        PatternSlot* slot = &set->slots[i];
+        if (!slot->key)
+        {
+            return NULL;
+        }
+        if (strcmp(slot->key, key) == 0)
+        {
+            return slot;
+        }
     }
+}
 
-    bool negated = false;
-
-    for (int i = num_ignore_patterns - 1; i >= 0; i--)
+static void pattern_set_insert(PatternSet* set, const char* key, int index, bool dir_only)
+{
+    /* Keep the load factor at or below one half */
+    if ((set->count + 1) * 2 > set->cap)
     {
-        if (ignore_patterns[i].match_only_dir && !is_dir)
+        size_t cap = set->cap ? set->cap * 2 : 64;
+        PatternSlot* slots = calloc(cap, sizeof(PatternSlot));
+        if (!slots)
         {
-            continue;
+            fprintf(stderr, "Error: Out of memory indexing ignore patterns\n");
+            exit(1);
         }
-
-        int path_match = fnmatch(ignore_patterns[i].pattern, path, FNM_PATHNAME) == 0;
-        int basename_match = fnmatch(ignore_patterns[i].pattern, basename, 0) == 0;
-
-        assert(path_match == (fnmatch(ignore_patterns[i].pattern, path, FNM_PATHNAME) == 0));
-        assert(basename_match == (fnmatch(ignore_patterns[i].pattern, basename, 0) == 0));
-
-        if (path_match || basename_match)
+        for (size_t i = 0; i < set->cap; i++)
         {
-            if (ignore_patterns[i].is_negation)
+            if (set->slots[i].key)
             {
-                return 0;
+                size_t j = hash_key(set->slots[i].key) & (cap - 1);
+                while (slots[j].key)
+                {
+                    j = (j + 1) & (cap - 1);
+                }
+                slots[j] = set->slots[i];
             }
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->cap = cap;
+    }
 
-            if (!negated)
-            {
-                return 1;
-            }
+    size_t mask = set->cap - 1;
+    size_t i = hash_key(key) & mask;
+    while (set->slots[i].key && strcmp(set->slots[i].key, key) != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    PatternSlot* slot = &set->slots[i];
+    if (!slot->key)
+    {
+        slot->key = key;
+        slot->last_any = -1;
+        slot->last_dir = -1;
+        set->count++;
+    }
+    if (dir_only)
+    {
+        slot->last_dir = index;
+    }
+    else
+    {
+        slot->last_any = index;
+    }
+}
+
+static void pattern_set_clear(PatternSet* set)
+{
+    free(set->slots);
+    set->slots = NULL;
+    set->cap = 0;
+    set->count = 0;
+}
+
+/** Highest pattern index in set that matches key for an entry of this type, or best */
+static int pattern_set_best(const PatternSet* set, const char* key, bool is_dir, int best)
+{
+    const PatternSlot* slot = pattern_set_find(set, key);
+    if (slot)
+    {
+        if (slot->last_any > best)
+        {
+            best = slot->last_any;
+        }
+        if (is_dir && slot->last_dir > best)
+        {
+            best = slot->last_dir;
         }
     }
+    return best;
+}
 
-    return 0;
+static bool has_glob_chars(const char* s)
+{
+    return strpbrk(s, "*?[\\") != NULL;
 }
 
-// Add pattern to ignore list with whitespace trimming and negation support
-void add_ignore_pattern(char* pattern)
+static IgnorePatternKind classify_pattern(const char* pattern, bool match_path)
 {
-    assert(pattern != NULL);
-    assert(num_ignore_patterns < MAX_IGNORE_PATTERNS);
+    if (!match_path && pattern[0] == '*' && pattern[1] == '.' && !has_glob_chars(pattern + 1))
+    {
+        return IGNORE_SUFFIX;
+    }
+    if (has_glob_chars(pattern))
+    {
+        return IGNORE_GLOB;
+    }
+    return match_path ? IGNORE_PATH : IGNORE_LITERAL;
+}
 
-    if (num_ignore_patterns >= MAX_IGNORE_PATTERNS)
+static void ignore_list_clear(IgnoreList* list)
+{
+    for (int i = 0; i < list->count; i++)
     {
-        return;
+        free(list->patterns[i].pattern);
     }
+    free(list->patterns);
+    free(list->glob_indices);
+    pattern_set_clear(&list->basename_set);
+    pattern_set_clear(&list->suffix_set);
+    pattern_set_clear(&list->path_set);
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * Parse one .gitignore line into list. Trims whitespace, skips blanks and
+ * comments, and handles '!' negation and trailing '/' (directory only).
+ * anchored: strip a leading '/' so the pattern matches relative to the scope.
+ * Returns true if a pattern was added.
+ */
+static bool ignore_list_add(IgnoreList* list, char* pattern, bool anchored)
+{
+    assert(pattern != NULL);
 
     while (*pattern && isspace(*pattern))
     {
@@ -97,7 +229,7 @@ void add_ignore_pattern(char* pattern)
 
     if (*pattern == '\0' || *pattern == '#')
     {
-        return;
+        return false;
     }
 
     bool is_negation = false;
@@ -115,33 +247,192 @@ void add_ignore_pattern(char* pattern)
         pattern[len - 1] = '\0';
     }
 
-    IgnorePattern new_pattern = {
-        .pattern = "", .is_negation = is_negation, .match_only_dir = match_only_dir};
-    strncpy(new_pattern.pattern, pattern, MAX_PATH - 1);
-    new_pattern.pattern[MAX_PATH - 1] = '\0';
-    ignore_patterns[num_ignore_patterns] = new_pattern;
+    /* In a nested .gitignore a leading or inner '/' anchors the pattern to
+     * that directory, so it is matched against the relative path */
+    bool match_path = strchr(pattern, '/') != NULL;
+    if (anchored && *pattern == '/')
+    {
+        pattern++;
+    }
+
+    if (list->count == list->cap)
+    {
+        list->cap = list->cap ? list->cap * 2 : 64;
+        list->patterns = xrealloc(list->patterns, (size_t)list->cap * sizeof(IgnorePattern));
+        list->glob_indices = xrealloc(list->glob_indices, (size_t)list->cap * sizeof(int));
+    }
+
+    char* copy = strdup(pattern);
+    if (!copy)
+    {
+        fprintf(stderr, "Error: Out of memory loading ignore patterns\n");
+        exit(1);
+    }
 
-    assert(num_ignore_patterns < MAX_IGNORE_PATTERNS);
-    num_ignore_patterns++;
+    int index = list->count++;
+    IgnorePattern* p = &list->patterns[index];
+    p->pattern = copy;
+    p->is_negation = is_negation;
+    p->match_only_dir = match_only_dir;
+    p->match_path = match_path;
+    p->kind = classify_pattern(copy, match_path);
 
-    assert(strcmp(ignore_patterns[num_ignore_patterns - 1].pattern, pattern) == 0);
-    assert(ignore_patterns[num_ignore_patterns - 1].is_negation == is_negation);
-    assert(ignore_patterns[num_ignore_patterns - 1].match_only_dir == match_only_dir);
+    /* Keys point at the heap copy, which stays put when patterns[] grows */
+    switch (p->kind)
+    {
+    case IGNORE_LITERAL:
+        pattern_set_insert(&list->basename_set, copy, index, match_only_dir);
+        break;
+    case IGNORE_SUFFIX:
+        pattern_set_insert(&list->suffix_set, copy + 1, index, match_only_dir);
+        break;
+    case IGNORE_PATH:
+        pattern_set_insert(&list->path_set, copy, index, match_only_dir);
+        break;
+    case IGNORE_GLOB:
+        list->glob_indices[list->num_globs++] = index;
+        break;
+    }
+    return true;
 }
 
-/**
- * Load patterns from a .gitignore file
- */
-void load_gitignore_file(const char* filepath)
+/** Index of the last pattern in list matching path/basename, or -1 */
+static int ignore_list_match(const IgnoreList* list, const char* path, const char* basename,
+                             bool is_dir)
 {
-    assert(filepath != NULL);
+    if (list->count == 0)
+    {
+        return -1;
+    }
 
-    FILE* file = fopen(filepath, "r");
-    if (!file)
+    /* Literal patterns without '/' can only match the basename, and literal
+     * paths only the whole path; "*.ext" matches any basename ending in .ext. */
+    int best = pattern_set_best(&list->basename_set, basename, is_dir, -1);
+    best = pattern_set_best(&list->path_set, path, is_dir, best);
+    if (list->suffix_set.count > 0)
     {
-        return;
+        for (const char* dot = strchr(basename, '.'); dot; dot = strchr(dot + 1, '.'))
+        {
+            best = pattern_set_best(&list->suffix_set, dot, is_dir, best);
+        }
     }
 
+    /* Only globs added after the best hash match can still override it */
+    for (int g = list->num_globs - 1; g >= 0 && list->glob_indices[g] > best; g--)
+    {
+        const IgnorePattern* p = &list->patterns[list->glob_indices[g]];
+        if (p->match_only_dir && !is_dir)
+        {
+            continue;
+        }
+
+        /* WHY: a glob without '/' cannot match across '/' under FNM_PATHNAME, so
+         * its path match implies a basename match; a glob with '/' can never
+         * match a basename. One fnmatch() per glob suffices. */
+        bool matched = p->match_path ? fnmatch(p->pattern, path, FNM_PATHNAME) == 0
+                                     : fnmatch(p->pattern, basename, 0) == 0;
+        if (matched)
+        {
+            best = list->glob_indices[g];
+            break;
+        }
+    }
+
+    return best;
+}
+
+static const char* path_basename(const char* path)
+{
+    const char* basename = strrchr(path, '/');
+    return basename ? basename + 1 : path;
+}
+
+void reset_gitignore_patterns(void)
+{
+    ignore_list_clear(&g_root_list);
+    free(g_root_files);
+    g_root_files = NULL;
+    g_num_root_files = 0;
+    ignore_patterns = NULL;
+    num_ignore_patterns = 0;
+    respect_gitignore = true;
+    assert(num_ignore_patterns == 0);
+    assert(respect_gitignore == true);
+}
+
+int should_ignore_path(const char* path)
+{
+    assert(path != NULL);
+
+    if (!respect_gitignore || num_ignore_patterns == 0)
+    {
+        return 0;
+    }
+
+    struct stat path_stat;
+    bool is_dir = false;
+    timing_count(COUNTER_LSTAT, 1);
+    if (lstat(path, &path_stat) == 0)
+    {
+        is_dir = S_ISDIR(path_stat.st_mode);
+    }
+
+    return should_ignore_entry(path, is_dir);
+}
+
+int should_ignore_entry(const char* path, bool is_dir)
+{
+    assert(path != NULL);
+
+    if (!respect_gitignore || num_ignore_patterns == 0)
+    {
+        return 0;
+    }
+
+    int best = ignore_list_match(&g_root_list, path, path_basename(path), is_dir);
+    return best >= 0 && !g_root_list.patterns[best].is_negation;
+}
+
+int should_ignore_scoped(const IgnoreScope* scope, const char* path, bool is_dir)
+{
+    assert(path != NULL);
+
+    if (!respect_gitignore)
+    {
+        return 0;
+    }
+
+    /* The innermost .gitignore with a matching pattern decides, as in git */
+    const char* basename = path_basename(path);
+    for (; scope; scope = scope->parent)
+    {
+        if (strncmp(path, scope->dir, scope->dir_len) != 0 || path[scope->dir_len] != '/')
+        {
+            continue;
+        }
+        const char* rel = path + scope->dir_len + 1;
+        int best = ignore_list_match(&scope->list, rel, basename, is_dir);
+        if (best >= 0)
+        {
+            return !scope->list.patterns[best].is_negation;
+        }
+    }
+
+    return should_ignore_entry(path, is_dir);
+}
+
+// Add pattern to ignore list with whitespace trimming and negation support
+void add_ignore_pattern(char* pattern)
+{
+    assert(pattern != NULL);
+
+    ignore_list_add(&g_root_list, pattern, false);
+    ignore_patterns = g_root_list.patterns;
+    num_ignore_patterns = g_root_list.count;
+}
+
+static void load_patterns_from_stream(IgnoreList* list, FILE* file, bool anchored)
+{
     char line[MAX_PATH];
     while (fgets(line, sizeof(line), file))
     {
@@ -152,9 +443,164 @@ void load_gitignore_file(const char* filepath)
             line[len - 1] = '\0';
         }
 
-        add_ignore_pattern(line);
+        ignore_list_add(list, line, anchored);
+    }
+}
+
+const IgnoreScope* ignore_scope_enter(const IgnoreScope* parent, const char* dir, int dir_fd)
+{
+    if (!respect_gitignore)
+    {
+        return parent;
+    }
+
+    int fd = openat(dir_fd, ".gitignore", O_RDONLY);
+    timing_count(COUNTER_OPEN, 1);
+    if (fd < 0)
+    {
+        return parent;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return parent;
+    }
+    timing_count(COUNTER_BYTES_READ, (uint64_t)st.st_size);
+    for (int i = 0; i < g_num_root_files; i++)
+    {
+        if (g_root_files[i].dev == st.st_dev && g_root_files[i].ino == st.st_ino)
+        {
+            close(fd);
+            return parent;
+        }
+    }
+
+    FILE* file = fdopen(fd, "r");
+    if (!file)
+    {
+        close(fd);
+        return parent;
     }
 
+    IgnoreList list;
+    memset(&list, 0, sizeof(list));
+    load_patterns_from_stream(&list, file, true);
+    fclose(file);
+
+    if (list.count == 0)
+    {
+        return parent;
+    }
+
+    ScopeNode* node = malloc(sizeof(ScopeNode));
+    char* dir_copy = strdup(dir);
+    if (!node || !dir_copy)
+    {
+        fprintf(stderr, "Error: Out of memory loading ignore patterns\n");
+        exit(1);
+    }
+    node->scope.parent = parent;
+    node->scope.dir = dir_copy;
+    node->scope.dir_len = strlen(dir_copy);
+    node->scope.list = list;
+
+    pthread_mutex_lock(&g_scopes_lock);
+    node->next = g_scopes;
+    g_scopes = node;
+    pthread_mutex_unlock(&g_scopes_lock);
+
+    return &node->scope;
+}
+
+const IgnoreScope* ignore_scope_ancestors(const char* path)
+{
+    const IgnoreScope* scope = NULL;
+    if (!respect_gitignore || path[0] == '/')
+    {
+        return NULL;
+    }
+
+    /* Enter each directory from the CWD down to path's parent, spelled as the
+     * walker would spell them below the CWD ("a", "a/b" or "./a", "./a/b") */
+    char dir[MAX_PATH];
+    size_t len = strlen(path);
+    if (len >= sizeof(dir))
+    {
+        return NULL;
+    }
+    memcpy(dir, path, len + 1);
+    for (char* slash = strchr(dir, '/'); slash && slash[1]; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        const char* name = strrchr(dir, '/');
+        name = name ? name + 1 : dir;
+        if (strcmp(name, "..") == 0)
+        {
+            /* Above the CWD: only the ancestors' files in the global list apply */
+            *slash = '/';
+            return NULL;
+        }
+        if (name[0] != '\0' && strcmp(name, ".") != 0)
+        {
+            int fd = open(dir, O_RDONLY | O_DIRECTORY);
+            if (fd >= 0)
+            {
+                scope = ignore_scope_enter(scope, dir, fd);
+                close(fd);
+            }
+        }
+        *slash = '/';
+    }
+    return scope;
+}
+
+void ignore_scopes_release(void)
+{
+    pthread_mutex_lock(&g_scopes_lock);
+    ScopeNode* node = g_scopes;
+    g_scopes = NULL;
+    pthread_mutex_unlock(&g_scopes_lock);
+
+    while (node)
+    {
+        ScopeNode* next = node->next;
+        ignore_list_clear(&node->scope.list);
+        free(node->scope.dir);
+        free(node);
+        node = next;
+    }
+}
+
+/**
+ * Load patterns from a .gitignore file
+ */
+void load_gitignore_file(const char* filepath)
+{
+    assert(filepath != NULL);
+
+    FILE* file = fopen(filepath, "r");
+    timing_count(COUNTER_OPEN, 1);
+    if (!file)
+    {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0)
+    {
+        timing_count(COUNTER_BYTES_READ, (uint64_t)st.st_size);
+        g_root_files = xrealloc(g_root_files, (size_t)(g_num_root_files + 1) * sizeof(FileId));
+        g_root_files[g_num_root_files].dev = st.st_dev;
+        g_root_files[g_num_root_files].ino = st.st_ino;
+        g_num_root_files++;
+    }
+
+    load_patterns_from_stream(&g_root_list, file, false);
+    ignore_patterns = g_root_list.patterns;
+    num_ignore_patterns = g_root_list.count;
+
     fclose(file);
 }
 
@@ -166,8 +612,6 @@ void load_all_gitignore_files(void)
     char current_dir[MAX_PATH];
     char gitignore_path[MAX_PATH * 2];
 
-    assert(num_ignore_patterns < MAX_IGNORE_PATTERNS);
-
     /* Get the current working directory */
     if (getcwd(current_dir, sizeof(current_dir)) == NULL)
     {
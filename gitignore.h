@@ -18,23 +18,90 @@
 STATIC_ASSERT(sizeof(size_t) >= 4, size_t_at_least_32_bits);
 
 #define MAX_PATH 4096
-#define MAX_IGNORE_PATTERNS 1024
+
+/** How a pattern is matched; assigned once by add_ignore_pattern() */
+typedef enum
+{
+    IGNORE_LITERAL, /* Plain name, e.g. "build": basename hash lookup */
+    IGNORE_SUFFIX,  /* "*.ext": hash lookup of each ".ext" suffix of the basename */
+    IGNORE_PATH,    /* Fixed path containing '/', e.g. "docs/_site": path hash lookup */
+    IGNORE_GLOB     /* Anything else: fnmatch() */
+} IgnorePatternKind;
 
 typedef struct
 {
-    char pattern[MAX_PATH];
+    char* pattern;
     bool is_negation;
     bool match_only_dir;
+    bool match_path; /* Matched against the whole (relative) path, never the basename */
+    IgnorePatternKind kind;
 } IgnorePattern;
 
-extern IgnorePattern ignore_patterns[MAX_IGNORE_PATTERNS];
+/** Hash index over the literal/suffix/path patterns of one IgnoreList */
+typedef struct
+{
+    struct PatternSlot* slots;
+    size_t cap;
+    size_t count;
+} PatternSet;
+
+/** A growable, compiled list of patterns; later patterns take precedence */
+typedef struct
+{
+    IgnorePattern* patterns;
+    int count;
+    int cap;
+    PatternSet basename_set;
+    PatternSet suffix_set;
+    PatternSet path_set;
+    int* glob_indices;
+    int num_globs;
+} IgnoreList;
+
+/**
+ * Patterns of one directory's .gitignore, chained to the enclosing directory.
+ * A scope only applies below its directory; deeper scopes take precedence.
+ */
+typedef struct IgnoreScope
+{
+    const struct IgnoreScope* parent;
+    char* dir; /* Directory as spelled by the walker, e.g. "./src" */
+    size_t dir_len;
+    IgnoreList list;
+} IgnoreScope;
+
+/* Patterns from the CWD and its ancestors; views into the root IgnoreList */
+extern IgnorePattern* ignore_patterns;
 extern int num_ignore_patterns;
 extern bool respect_gitignore;
 
 int should_ignore_path(const char* path);
+/* Same as should_ignore_path() for callers that already know the entry type */
+int should_ignore_entry(const char* path, bool is_dir);
 void add_ignore_pattern(char* pattern);
 void load_gitignore_file(const char* filepath);
 void load_all_gitignore_files(void);
 void reset_gitignore_patterns(void);
 
+/**
+ * Enter a directory during a walk. If dir (open as dir_fd) has a .gitignore
+ * that is not already part of the global list, return a new scope holding its
+ * patterns; otherwise return parent. Safe to call from walker threads.
+ */
+const IgnoreScope* ignore_scope_enter(const IgnoreScope* parent, const char* dir, int dir_fd);
+
+/**
+ * Scopes for the directories between the CWD and path's parent, innermost
+ * last; NULL for absolute paths or paths leaving the CWD. Pass it as the walk's
+ * root_ctx, or to should_ignore_scoped() for path itself. Freed by
+ * ignore_scopes_release().
+ */
+const IgnoreScope* ignore_scope_ancestors(const char* path);
+
+/** Like should_ignore_entry(), consulting scope and its ancestors first */
+int should_ignore_scoped(const IgnoreScope* scope, const char* path, bool is_dir);
+
+/** Free every scope created by ignore_scope_enter(); call once the walk is over */
+void ignore_scopes_release(void);
+
 #endif /* GITIGNORE_H */
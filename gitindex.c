@@ -0,0 +1,664 @@
+#include "gitindex.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "timings.h"
+
+#define INDEX_SIGNATURE "DIRC"
+#define SHA1_SIZE 20
+#define SHA256_SIZE 32
+
+#define ENTRY_FLAG_EXTENDED 0x4000
+#define ENTRY_FLAG_STAGE_SHIFT 12
+#define ENTRY_FLAG_NAME_MASK 0x0fff
+#define ENTRY_EXT_SKIP_WORKTREE 0x4000
+
+#define GIT_MODE_DIR 0040000u /* Sparse-index directory entry */
+
+/* One entry as stored; names are offsets so the blob can grow */
+typedef struct
+{
+    size_t name;
+    size_t name_len;
+    uint32_t mode;
+    uint8_t stage;
+    bool skip_worktree;
+    bool removed; /* Deleted from a shared index by its split index */
+} RawEntry;
+
+typedef struct
+{
+    RawEntry* entries;
+    size_t count;
+    size_t cap;
+    char* names;
+    size_t names_len;
+    size_t names_cap;
+    /* "link" extension: this index is the split part of a shared index */
+    bool has_link;
+    char shared_hex[2 * SHA256_SIZE + 1];
+    size_t* deleted;
+    size_t deleted_count;
+    size_t* replaced;
+    size_t replaced_count;
+} RawIndex;
+
+static uint32_t be32(const unsigned char* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t be16(const unsigned char* p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint64_t be64(const unsigned char* p)
+{
+    return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+static void raw_free(RawIndex* raw)
+{
+    free(raw->entries);
+    free(raw->names);
+    free(raw->deleted);
+    free(raw->replaced);
+    memset(raw, 0, sizeof(*raw));
+}
+
+static bool grow(void** buf, size_t* cap, size_t need, size_t elem_size)
+{
+    if (need <= *cap)
+    {
+        return true;
+    }
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need)
+    {
+        new_cap *= 2;
+    }
+    void* grown = realloc(*buf, new_cap * elem_size);
+    if (!grown)
+    {
+        return false;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return true;
+}
+
+/**
+ * Append a name (plus a NUL) to the blob: the prefix_len bytes at offset
+ * prefix of the blob itself (the v4 prefix of the previous name), then
+ * suffix. Returns its offset, or SIZE_MAX
+ */
+static size_t raw_add_name(RawIndex* raw, size_t prefix, size_t prefix_len, const char* suffix,
+                           size_t suffix_len)
+{
+    size_t at = raw->names_len;
+    if (!grow((void**)&raw->names, &raw->names_cap, at + prefix_len + suffix_len + 1, 1))
+    {
+        return SIZE_MAX;
+    }
+    /* WHY: grow() may have moved the blob, so the prefix is found by offset only now */
+    if (prefix_len > 0)
+    {
+        memcpy(raw->names + at, raw->names + prefix, prefix_len);
+    }
+    if (suffix_len > 0)
+    {
+        memcpy(raw->names + at + prefix_len, suffix, suffix_len);
+    }
+    raw->names[at + prefix_len + suffix_len] = '\0';
+    raw->names_len += prefix_len + suffix_len + 1;
+    return at;
+}
+
+static RawEntry* raw_add_entry(RawIndex* raw)
+{
+    if (!grow((void**)&raw->entries, &raw->cap, raw->count + 1, sizeof(RawEntry)))
+    {
+        return NULL;
+    }
+    RawEntry* e = &raw->entries[raw->count++];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+/**
+ * Decode an EWAH bitmap (as written by git's ewah_serialize) into the
+ * positions of its set bits, in increasing order
+ */
+static bool ewah_positions(const unsigned char* p, size_t len, size_t* used, size_t** out,
+                           size_t* count)
+{
+    if (len < 8)
+    {
+        return false;
+    }
+    uint32_t bit_size = be32(p);
+    uint32_t words = be32(p + 4);
+    if ((len - 8) / 8 < words || len - 8 - (size_t)words * 8 < 4)
+    {
+        return false;
+    }
+    *used = 8 + (size_t)words * 8 + 4;
+
+    size_t cap = 0;
+    *out = NULL;
+    *count = 0;
+    uint64_t pos = 0;
+    const unsigned char* w = p + 8;
+    size_t i = 0;
+    while (i < words)
+    {
+        /* Marker word: running bit, running length (words), literal words that follow */
+        uint64_t marker = be64(w + 8 * i++);
+        bool run_bit = marker & 1;
+        uint64_t run_len = (marker >> 1) & 0xffffffffu;
+        uint64_t literals = marker >> 33;
+        if (run_bit)
+        {
+            for (uint64_t b = 0; b < run_len * 64 && pos + b < bit_size; b++)
+            {
+                if (!grow((void**)out, &cap, *count + 1, sizeof(size_t)))
+                {
+                    return false;
+                }
+                (*out)[(*count)++] = (size_t)(pos + b);
+            }
+        }
+        pos += run_len * 64;
+        for (uint64_t l = 0; l < literals; l++)
+        {
+            if (i >= words)
+            {
+                return false;
+            }
+            uint64_t word = be64(w + 8 * i++);
+            while (word)
+            {
+                uint64_t bit = pos + (uint64_t)__builtin_ctzll(word);
+                word &= word - 1;
+                if (bit >= bit_size)
+                {
+                    break;
+                }
+                if (!grow((void**)out, &cap, *count + 1, sizeof(size_t)))
+                {
+                    return false;
+                }
+                (*out)[(*count)++] = (size_t)bit;
+            }
+            pos += 64;
+        }
+    }
+    return true;
+}
+
+static bool parse_link(RawIndex* raw, const unsigned char* p, size_t len, size_t hash_size)
+{
+    if (len < hash_size)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < hash_size; i++)
+    {
+        snprintf(raw->shared_hex + 2 * i, 3, "%02x", p[i]);
+    }
+    raw->has_link = true;
+    p += hash_size;
+    len -= hash_size;
+    if (len == 0)
+    {
+        return true; /* Nothing deleted or replaced */
+    }
+    size_t used;
+    if (!ewah_positions(p, len, &used, &raw->deleted, &raw->deleted_count))
+    {
+        return false;
+    }
+    return ewah_positions(p + used, len - used, &used, &raw->replaced, &raw->replaced_count);
+}
+
+/** Parse a whole index file; false if it is not valid for this hash size */
+static bool parse_index(const unsigned char* data, size_t len, size_t hash_size, RawIndex* raw)
+{
+    if (len < 12 + hash_size || memcmp(data, INDEX_SIGNATURE, 4) != 0)
+    {
+        return false;
+    }
+    uint32_t version = be32(data + 4);
+    uint32_t count = be32(data + 8);
+    if (version < 2 || version > 4)
+    {
+        return false;
+    }
+
+    const size_t end = len - hash_size; /* Trailing checksum */
+    const size_t fixed = 40 + hash_size + 2; /* Stat data, mode, oid, flags */
+    size_t pos = 12;
+    size_t prev = 0;                 /* v4: offset of the previous name in the blob */
+    size_t prev_len = 0;
+    for (uint32_t n = 0; n < count; n++)
+    {
+        if (end - pos < fixed)
+        {
+            return false;
+        }
+        const unsigned char* e = data + pos;
+        uint32_t mode = be32(e + 24);
+        uint16_t flags = be16(e + 40 + hash_size);
+        size_t off = fixed;
+        uint16_t ext = 0;
+        if (flags & ENTRY_FLAG_EXTENDED)
+        {
+            if (version < 3 || end - pos < off + 2)
+            {
+                return false;
+            }
+            ext = be16(e + off);
+            off += 2;
+        }
+
+        RawEntry* entry = raw_add_entry(raw);
+        if (!entry)
+        {
+            return false;
+        }
+        entry->mode = mode;
+        entry->stage = (uint8_t)((flags >> ENTRY_FLAG_STAGE_SHIFT) & 3);
+        entry->skip_worktree = (ext & ENTRY_EXT_SKIP_WORKTREE) != 0;
+
+        const char* name = (const char*)e + off;
+        size_t avail = end - pos - off;
+        if (version == 4)
+        {
+            /* Bytes to strip from the previous name, then the new suffix */
+            size_t i = 0;
+            if (avail == 0)
+            {
+                return false;
+            }
+            unsigned char c = (unsigned char)name[i++];
+            uint64_t strip = c & 127;
+            while (c & 128)
+            {
+                if (i >= avail || strip > SIZE_MAX >> 8)
+                {
+                    return false;
+                }
+                c = (unsigned char)name[i++];
+                strip = ((strip + 1) << 7) | (c & 127);
+            }
+            const char* nul = memchr(name + i, '\0', avail - i);
+            if (!nul || strip > prev_len)
+            {
+                return false;
+            }
+            size_t suffix_len = (size_t)(nul - (name + i));
+            size_t keep = prev_len - (size_t)strip;
+            size_t at = raw_add_name(raw, prev, keep, name + i, suffix_len);
+            if (at == SIZE_MAX)
+            {
+                return false;
+            }
+            entry = &raw->entries[raw->count - 1];
+            entry->name = at;
+            entry->name_len = keep + suffix_len;
+            prev = at;
+            prev_len = entry->name_len;
+            pos += off + (size_t)(nul - name) + 1;
+        }
+        else
+        {
+            const char* nul = memchr(name, '\0', avail);
+            if (!nul)
+            {
+                return false;
+            }
+            size_t name_len = (size_t)(nul - name);
+            size_t size = (off + name_len + 8) & ~(size_t)7; /* NUL-padded to 8 bytes */
+            if (size > end - pos)
+            {
+                return false;
+            }
+            size_t at = raw_add_name(raw, 0, 0, name, name_len);
+            if (at == SIZE_MAX)
+            {
+                return false;
+            }
+            entry = &raw->entries[raw->count - 1];
+            entry->name = at;
+            entry->name_len = name_len;
+            pos += size;
+        }
+    }
+
+    /* Extensions: uppercase signatures are optional and may be skipped */
+    while (end - pos >= 8)
+    {
+        const unsigned char* sig = data + pos;
+        uint32_t size = be32(sig + 4);
+        if (size > end - pos - 8)
+        {
+            return false;
+        }
+        if (memcmp(sig, "link", 4) == 0)
+        {
+            if (!parse_link(raw, sig + 8, size, hash_size))
+            {
+                return false;
+            }
+        }
+        else if ((sig[0] < 'A' || sig[0] > 'Z') && memcmp(sig, "sdir", 4) != 0)
+        {
+            return false; /* A required extension this reader does not know */
+        }
+        pos += 8 + (size_t)size;
+    }
+    return pos == end;
+}
+
+/** Map and parse path, trying SHA-1 and then SHA-256 layouts */
+static bool load_index_file(const char* path, RawIndex* raw, size_t* hash_size)
+{
+    int fd = open(path, O_RDONLY);
+    timing_count(COUNTER_OPEN, 1);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    void* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    timing_count(COUNTER_BYTES_READ, len);
+
+    static const size_t sizes[] = {SHA1_SIZE, SHA256_SIZE};
+    bool ok = false;
+    for (size_t i = 0; i < 2 && !ok; i++)
+    {
+        if (*hash_size && *hash_size != sizes[i])
+        {
+            continue;
+        }
+        raw_free(raw);
+        ok = parse_index(data, len, sizes[i], raw);
+        if (ok)
+        {
+            *hash_size = sizes[i];
+        }
+    }
+    munmap(data, len);
+    if (!ok)
+    {
+        raw_free(raw);
+    }
+    return ok;
+}
+
+/** Apply a split index to its shared base; the result is left in base */
+static bool merge_split_index(RawIndex* base, const RawIndex* split)
+{
+    for (size_t i = 0; i < split->deleted_count; i++)
+    {
+        if (split->deleted[i] >= base->count)
+        {
+            return false;
+        }
+        base->entries[split->deleted[i]].removed = true;
+    }
+    /* The first entries of the split index replace base entries in order,
+     * keeping the base entry's name */
+    if (split->replaced_count > split->count)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < split->replaced_count; i++)
+    {
+        if (split->replaced[i] >= base->count)
+        {
+            return false;
+        }
+        RawEntry* dst = &base->entries[split->replaced[i]];
+        const RawEntry* src = &split->entries[i];
+        dst->mode = src->mode;
+        dst->stage = src->stage;
+        dst->skip_worktree = src->skip_worktree;
+    }
+    for (size_t i = split->replaced_count; i < split->count; i++)
+    {
+        const RawEntry* src = &split->entries[i];
+        size_t at = raw_add_name(base, 0, 0, split->names + src->name, src->name_len);
+        RawEntry* dst = at == SIZE_MAX ? NULL : raw_add_entry(base);
+        if (!dst)
+        {
+            return false;
+        }
+        *dst = *src;
+        dst->name = at;
+    }
+    return true;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    return strcmp(((const GitIndexEntry*)a)->path, ((const GitIndexEntry*)b)->path);
+}
+
+/** Find the worktree root above dir and its git directory */
+static bool find_worktree(const char* dir, char* root, char* git_dir, size_t size)
+{
+    if (!realpath(dir, root))
+    {
+        return false;
+    }
+    for (;;)
+    {
+        char dot_git[PATH_MAX + 8];
+        snprintf(dot_git, sizeof(dot_git), "%s/.git", strcmp(root, "/") == 0 ? "" : root);
+        struct stat st;
+        timing_count(COUNTER_LSTAT, 1);
+        if (stat(dot_git, &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                snprintf(git_dir, size, "%s", dot_git);
+                return true;
+            }
+            /* Linked worktree or submodule: ".git" holds "gitdir: <path>" */
+            FILE* fp = fopen(dot_git, "r");
+            char line[PATH_MAX + 16] = "";
+            bool ok = fp && fgets(line, sizeof(line), fp) && strncmp(line, "gitdir: ", 8) == 0;
+            if (fp)
+            {
+                fclose(fp);
+            }
+            if (!ok)
+            {
+                return false;
+            }
+            line[strcspn(line, "\r\n")] = '\0';
+            const char* target = line + 8;
+            if (target[0] == '/')
+            {
+                snprintf(git_dir, size, "%s", target);
+            }
+            else
+            {
+                snprintf(git_dir, size, "%s/%s", root, target);
+            }
+            return true;
+        }
+        char* slash = strrchr(root, '/');
+        if (!slash || slash == root)
+        {
+            if (strcmp(root, "/") == 0)
+            {
+                return false;
+            }
+            strcpy(root, "/");
+            continue;
+        }
+        *slash = '\0';
+    }
+}
+
+/** Open sharedindex.<hex> from the git dir, or from the common dir of a worktree */
+static bool load_shared_index(const char* git_dir, const char* hex, RawIndex* base,
+                              size_t* hash_size)
+{
+    char path[PATH_MAX * 2];
+    snprintf(path, sizeof(path), "%s/sharedindex.%s", git_dir, hex);
+    if (load_index_file(path, base, hash_size))
+    {
+        return true;
+    }
+
+    char common[PATH_MAX] = "";
+    snprintf(path, sizeof(path), "%s/commondir", git_dir);
+    FILE* fp = fopen(path, "r");
+    bool ok = fp && fgets(common, sizeof(common), fp);
+    if (fp)
+    {
+        fclose(fp);
+    }
+    if (!ok)
+    {
+        return false;
+    }
+    common[strcspn(common, "\r\n")] = '\0';
+    if (common[0] == '/')
+    {
+        snprintf(path, sizeof(path), "%s/sharedindex.%s", common, hex);
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "%s/%s/sharedindex.%s", git_dir, common, hex);
+    }
+    return load_index_file(path, base, hash_size);
+}
+
+bool git_index_load(const char* dir, GitIndex* index, const char** error)
+{
+    memset(index, 0, sizeof(*index));
+    char git_dir[PATH_MAX * 2];
+    if (!find_worktree(dir, index->root, git_dir, sizeof(git_dir)))
+    {
+        *error = "not inside a git worktree";
+        return false;
+    }
+
+    char path[PATH_MAX * 2 + 8];
+    snprintf(path, sizeof(path), "%s/index", git_dir);
+    RawIndex raw;
+    memset(&raw, 0, sizeof(raw));
+    size_t hash_size = 0;
+    if (!load_index_file(path, &raw, &hash_size))
+    {
+        *error = "no readable index (unsupported format or not checked out)";
+        return false;
+    }
+
+    RawIndex* final_raw = &raw;
+    RawIndex base;
+    memset(&base, 0, sizeof(base));
+    if (raw.has_link)
+    {
+        if (!load_shared_index(git_dir, raw.shared_hex, &base, &hash_size) ||
+            !merge_split_index(&base, &raw))
+        {
+            raw_free(&raw);
+            raw_free(&base);
+            *error = "cannot read the shared index of a split index";
+            return false;
+        }
+        final_raw = &base;
+    }
+
+    index->names = final_raw->names;
+    final_raw->names = NULL;
+    index->entries = malloc((final_raw->count ? final_raw->count : 1) * sizeof(GitIndexEntry));
+    if (!index->entries)
+    {
+        raw_free(&raw);
+        raw_free(&base);
+        git_index_free(index);
+        *error = "out of memory";
+        return false;
+    }
+    for (size_t i = 0; i < final_raw->count; i++)
+    {
+        const RawEntry* e = &final_raw->entries[i];
+        uint32_t type = e->mode & GIT_MODE_TYPE_MASK;
+        if (e->removed || e->skip_worktree || type == GIT_MODE_DIR || e->name_len == 0)
+        {
+            continue;
+        }
+        index->entries[index->count].path = index->names + e->name;
+        index->entries[index->count].mode = e->mode;
+        index->count++;
+    }
+    bool split = raw.has_link;
+    raw_free(&raw);
+    raw_free(&base);
+
+    /* Entries are stored sorted, but a split index appends its additions */
+    if (split)
+    {
+        qsort(index->entries, index->count, sizeof(GitIndexEntry), compare_entries);
+    }
+    /* Conflicted paths have one entry per stage */
+    size_t kept = 0;
+    for (size_t i = 0; i < index->count; i++)
+    {
+        if (kept == 0 || strcmp(index->entries[kept - 1].path, index->entries[i].path) != 0)
+        {
+            index->entries[kept++] = index->entries[i];
+        }
+    }
+    index->count = kept;
+    return true;
+}
+
+void git_index_free(GitIndex* index)
+{
+    free(index->entries);
+    free(index->names);
+    index->entries = NULL;
+    index->names = NULL;
+    index->count = 0;
+}
+
+size_t git_index_lower_bound(const GitIndex* index, const char* prefix)
+{
+    size_t lo = 0, hi = index->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(index->entries[mid].path, prefix) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
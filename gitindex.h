@@ -0,0 +1,53 @@
+#ifndef GITINDEX_H
+#define GITINDEX_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Git index reader
+ *
+ * Lists the tracked files of a worktree straight from its index file, so a
+ * checkout can be enumerated without reading a single directory or
+ * evaluating a single .gitignore rule. Index versions 2 to 4 are supported,
+ * including v4 path compression and split indexes (the "link" extension
+ * and its shared index), for SHA-1 and SHA-256 repositories. Conflicted
+ * paths are listed once; skip-worktree (sparse checkout) entries, which are
+ * not on disk, are left out.
+ */
+
+#define GIT_MODE_FILE 0100000u    /* Regular file (0100644 or 0100755) */
+#define GIT_MODE_SYMLINK 0120000u
+#define GIT_MODE_GITLINK 0160000u /* Submodule commit */
+#define GIT_MODE_TYPE_MASK 0170000u
+
+typedef struct
+{
+    const char* path; /* Relative to the worktree root, '/'-separated */
+    uint32_t mode;
+} GitIndexEntry;
+
+typedef struct
+{
+    char root[PATH_MAX];    /* Worktree root, as realpath() reports it */
+    GitIndexEntry* entries; /* Sorted by path, one per path */
+    size_t count;
+    char* names; /* Storage behind every entry's path */
+} GitIndex;
+
+/**
+ * Load the index of the worktree containing dir
+ *
+ * Returns false with *error describing why when dir is not inside a
+ * worktree or its index cannot be read or parsed; index is then empty.
+ */
+bool git_index_load(const char* dir, GitIndex* index, const char** error);
+
+void git_index_free(GitIndex* index);
+
+/** Index of the first entry whose path is >= prefix */
+size_t git_index_lower_bound(const GitIndex* index, const char* prefix);
+
+#endif /* GITINDEX_H */
@@ -0,0 +1,189 @@
+#include "globset.h"
+#include <fnmatch.h>
+#include <string.h>
+
+#define GLOB_FNMATCH_FLAGS (FNM_PATHNAME | FNM_PERIOD)
+
+static bool has_glob_meta(const char* s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void glob_set_init(GlobSet* set, Arena* arena)
+{
+    memset(set, 0, sizeof(*set));
+    set->arena = arena;
+}
+
+static void compile_pattern(GlobPattern* p)
+{
+    const char* pat = p->pattern;
+    size_t len = strlen(pat);
+    p->kind = GLOB_GENERIC;
+
+    const char* double_star = strstr(pat, "**");
+    if (p->mode == GLOB_MATCH_EXCLUDE && double_star)
+    {
+        p->kind = GLOB_DOUBLE_STAR;
+        p->prefix_len = (size_t)(double_star - pat);
+        p->matches_prefix = double_star[2] == '\0' ||
+                            (double_star[2] == '/' && double_star[3] == '\0') ||
+                            (p->prefix_len > 0 && pat[p->prefix_len - 1] == '/');
+        const char* suffix = double_star + 2;
+        if (*suffix == '/')
+        {
+            suffix++;
+        }
+        p->literal = suffix;
+        p->literal_len = strlen(suffix);
+        return;
+    }
+
+    if (!has_glob_meta(pat, len))
+    {
+        p->kind = GLOB_LITERAL;
+        p->literal = pat;
+        p->literal_len = len;
+    }
+    else if (pat[0] == '*' && !has_glob_meta(pat + 1, len - 1) && !strchr(pat + 1, '/'))
+    {
+        p->kind = GLOB_SUFFIX;
+        p->literal = pat + 1;
+        p->literal_len = len - 1;
+    }
+}
+
+int glob_set_add(GlobSet* set, const char* pattern, GlobMode mode)
+{
+    if (set->count == set->cap)
+    {
+        int cap = set->cap ? set->cap * 2 : 8;
+        GlobPattern* grown = arena_push_array_safe(set->arena, GlobPattern, (size_t)cap);
+        if (set->count)
+        {
+            memcpy(grown, set->patterns, (size_t)set->count * sizeof(GlobPattern));
+        }
+        set->patterns = grown;
+        set->cap = cap;
+    }
+
+    GlobPattern* p = &set->patterns[set->count];
+    memset(p, 0, sizeof(*p));
+    p->pattern = arena_strdup_safe(set->arena, pattern);
+    p->mode = mode;
+    compile_pattern(p);
+
+    if ((p->kind == GLOB_LITERAL || p->kind == GLOB_SUFFIX) && p->literal_len > 0)
+    {
+        set->last[(unsigned char)p->literal[p->literal_len - 1]] = 1;
+    }
+    else
+    {
+        set->has_unfiltered = true;
+    }
+    return set->count++;
+}
+
+bool glob_pattern_matches(const GlobPattern* p, const char* str, size_t len)
+{
+    /* WHY: a pattern without a literal part has a NULL literal, which memcmp must not see */
+    bool tail = p->literal_len == 0 ||
+                (p->literal_len <= len &&
+                 memcmp(str + len - p->literal_len, p->literal, p->literal_len) == 0);
+    const char* base = NULL;
+
+    switch (p->kind)
+    {
+    case GLOB_LITERAL:
+        if (p->mode == GLOB_MATCH_NAME)
+        {
+            return len == p->literal_len && tail;
+        }
+        /* The whole path, or its basename */
+        if (!tail || len == p->literal_len)
+        {
+            return tail;
+        }
+        base = strrchr(str, '/');
+        return base && strcmp(base + 1, p->literal) == 0;
+    case GLOB_SUFFIX:
+        if (p->mode == GLOB_MATCH_NAME)
+        {
+            /* FNM_PERIOD: '*' may not consume a leading '.'; FNM_PATHNAME: nor a '/' */
+            return tail && str[0] != '.' && !memchr(str, '/', len - p->literal_len);
+        }
+        /* WHY: the literal holds no '/', so a matching tail lies inside the
+         * basename, which the flagless basename fnmatch() accepts */
+        return tail;
+    case GLOB_DOUBLE_STAR:
+        if (p->prefix_len > 0 && strncmp(str, p->pattern, p->prefix_len) != 0)
+        {
+            return false;
+        }
+        if (p->matches_prefix)
+        {
+            return true;
+        }
+        return p->literal_len > 0 && strstr(str + p->prefix_len, p->literal) != NULL;
+    case GLOB_GENERIC:
+    default:
+        if (p->mode == GLOB_MATCH_NAME)
+        {
+            return fnmatch(p->pattern, str, GLOB_FNMATCH_FLAGS) == 0;
+        }
+        if (fnmatch(p->pattern, str, GLOB_FNMATCH_FLAGS) == 0)
+        {
+            return true;
+        }
+        base = strrchr(str, '/');
+        return fnmatch(p->pattern, base ? base + 1 : str, 0) == 0;
+    }
+}
+
+/** Whether the last-byte table alone rules str out */
+static inline bool filtered_out(const GlobSet* set, const char* str, size_t len)
+{
+    return !set->has_unfiltered && (len == 0 || !set->last[(unsigned char)str[len - 1]]);
+}
+
+int glob_set_match(const GlobSet* set, const char* str, int* hits)
+{
+    size_t len = strlen(str);
+    if (filtered_out(set, str, len))
+    {
+        return 0;
+    }
+    int found = 0;
+    for (int i = 0; i < set->count; i++)
+    {
+        if (glob_pattern_matches(&set->patterns[i], str, len))
+        {
+            hits[found++] = i;
+        }
+    }
+    return found;
+}
+
+bool glob_set_any(const GlobSet* set, const char* str)
+{
+    size_t len = strlen(str);
+    if (filtered_out(set, str, len))
+    {
+        return false;
+    }
+    for (int i = 0; i < set->count; i++)
+    {
+        if (glob_pattern_matches(&set->patterns[i], str, len))
+        {
+            return true;
+        }
+    }
+    return false;
+}
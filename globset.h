@@ -0,0 +1,78 @@
+#ifndef GLOBSET_H
+#define GLOBSET_H
+
+#include <stdbool.h>
+#include "arena.h"
+
+/**
+ * Compiled set of shell globs matched together
+ *
+ * Each pattern is classified once when added: a literal, a "*<literal>"
+ * suffix such as "*.c", a "**" exclude rule, or a general glob left to
+ * fnmatch(). Literals and suffixes cost a length check and one memcmp, and
+ * a table of their last bytes rejects most strings before any pattern is
+ * tried. The set is read-only once built, so it may be matched from the
+ * walker's threads.
+ */
+
+typedef enum
+{
+    /* Include pattern matched against a basename, as fnmatch() with
+     * FNM_PATHNAME | FNM_PERIOD: '*' does not match a leading '.' */
+    GLOB_MATCH_NAME,
+    /* -x/--exclude rule matched against a whole path: "**" rules match by
+     * prefix (and substring after the "**"), any other glob matches if it
+     * matches the path (FNM_PATHNAME | FNM_PERIOD) or its basename */
+    GLOB_MATCH_EXCLUDE
+} GlobMode;
+
+typedef enum
+{
+    GLOB_LITERAL,     /* No metacharacters */
+    GLOB_SUFFIX,      /* '*' followed by a literal without '/' */
+    GLOB_DOUBLE_STAR, /* Exclude rule containing "**" */
+    GLOB_GENERIC      /* Anything else: fnmatch() */
+} GlobKind;
+
+typedef struct
+{
+    const char* pattern; /* Owned by the set's arena */
+    GlobMode mode;
+    GlobKind kind;
+    const char* literal; /* LITERAL/SUFFIX: the fixed text; DOUBLE_STAR: text after "**" */
+    size_t literal_len;
+    size_t prefix_len;   /* DOUBLE_STAR: length of the text before "**" */
+    bool matches_prefix; /* DOUBLE_STAR: everything below the prefix matches */
+} GlobPattern;
+
+typedef struct
+{
+    GlobPattern* patterns;
+    int count;
+    int cap;
+    Arena* arena;
+    bool has_unfiltered;     /* Some pattern can match whatever its last byte */
+    unsigned char last[256]; /* Nonzero for last bytes of literal/suffix patterns */
+} GlobSet;
+
+/** Start an empty set; pattern storage comes from arena */
+void glob_set_init(GlobSet* set, Arena* arena);
+
+/** Compile pattern into the set; returns its index */
+int glob_set_add(GlobSet* set, const char* pattern, GlobMode mode);
+
+/**
+ * Store the index of every pattern matching str in hits (in the order the
+ * patterns were added) and return how many matched. hits must hold
+ * set->count entries. NAME patterns see str as a basename, EXCLUDE rules
+ * as a path.
+ */
+int glob_set_match(const GlobSet* set, const char* str, int* hits);
+
+/** Whether any pattern matches str; stops at the first hit */
+bool glob_set_any(const GlobSet* set, const char* str);
+
+/** Whether pattern i alone matches str */
+bool glob_pattern_matches(const GlobPattern* p, const char* str, size_t len);
+
+#endif /* GLOBSET_H */
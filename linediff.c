@@ -0,0 +1,391 @@
+#include "linediff.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    OP_KEEP,
+    OP_DELETE,
+    OP_INSERT
+};
+
+typedef struct
+{
+    const char* text; /* Newline included, except on a last line without one */
+    size_t len;
+    uint64_t hash;
+} DiffLine;
+
+typedef struct
+{
+    char* data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} DiffBuf;
+
+/** Split text into lines; *count gets how many */
+static DiffLine* split_lines(const char* text, size_t len, size_t* count)
+{
+    size_t n = 0;
+    for (const char* p = text; (p = memchr(p, '\n', (size_t)(text + len - p))) != NULL; p++)
+    {
+        n++;
+    }
+    if (len > 0 && text[len - 1] != '\n')
+    {
+        n++;
+    }
+    DiffLine* lines = malloc((n > 0 ? n : 1) * sizeof(*lines));
+    if (!lines)
+    {
+        return NULL;
+    }
+    size_t start = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+        const char* nl = memchr(text + start, '\n', len - start);
+        size_t end = nl ? (size_t)(nl - text) + 1 : len;
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = start; i < end; i++)
+        {
+            h = (h ^ (unsigned char)text[i]) * 0x100000001b3ull;
+        }
+        lines[k].text = text + start;
+        lines[k].len = end - start;
+        lines[k].hash = h;
+        start = end;
+    }
+    *count = n;
+    return lines;
+}
+
+static bool same_line(const DiffLine* a, const DiffLine* b)
+{
+    return a->hash == b->hash && a->len == b->len && memcmp(a->text, b->text, a->len) == 0;
+}
+
+/**
+ * Shortest edit script from a[0, n) to b[0, m), one op per line, into ops
+ *
+ * Returns the number of ops, or SIZE_MAX if it takes more than max_edits
+ * edits or memory runs out.
+ */
+/* WHY: Myers' greedy algorithm; only the furthest x of every diagonal k is
+ * kept for each edit count d, (d + 1) values per step, so the trace needed
+ * to walk the script back grows with the square of the edits, not with the
+ * size of the files. */
+static size_t shortest_edit(const DiffLine* a, int n, const DiffLine* b, int m, size_t max_edits,
+                            unsigned char* ops)
+{
+    int max_d = (size_t)n + (size_t)m < max_edits ? n + m : (int)max_edits;
+    int* v = calloc(2 * (size_t)max_d + 2, sizeof(int));
+    int* trace = NULL;
+    size_t trace_cap = 0;
+    int found = -1;
+    int off = max_d;
+    if (!v)
+    {
+        return SIZE_MAX;
+    }
+    v[off + 1] = 0;
+    for (int d = 0; d <= max_d && found < 0; d++)
+    {
+        size_t row = (size_t)d * (d + 1) / 2;
+        if (row + d + 1 > trace_cap)
+        {
+            size_t cap = trace_cap ? trace_cap * 2 : 1024;
+            while (cap < row + d + 1)
+            {
+                cap *= 2;
+            }
+            int* grown = realloc(trace, cap * sizeof(int));
+            if (!grown)
+            {
+                break;
+            }
+            trace = grown;
+            trace_cap = cap;
+        }
+        for (int k = -d; k <= d; k += 2)
+        {
+            int x;
+            if (k == -d || (k != d && v[off + k - 1] < v[off + k + 1]))
+            {
+                x = v[off + k + 1];
+            }
+            else
+            {
+                x = v[off + k - 1] + 1;
+            }
+            int y = x - k;
+            while (x < n && y < m && same_line(&a[x], &b[y]))
+            {
+                x++;
+                y++;
+            }
+            v[off + k] = x;
+            trace[row + (size_t)(k + d) / 2] = x;
+            if (x >= n && y >= m)
+            {
+                found = d;
+                break;
+            }
+        }
+    }
+    free(v);
+    if (found < 0)
+    {
+        free(trace);
+        return SIZE_MAX;
+    }
+
+    /* Walk back from (n, m), writing ops in reverse */
+    size_t count = 0;
+    int x = n, y = m;
+    for (int d = found; d > 0; d--)
+    {
+        const int* prev = trace + (size_t)(d - 1) * d / 2;
+        int k = x - y;
+        bool down = k == -d || (k != d && prev[(k - 1 + d - 1) / 2] < prev[(k + 1 + d - 1) / 2]);
+        int pk = down ? k + 1 : k - 1;
+        int px = prev[(pk + d - 1) / 2];
+        int py = px - pk;
+        while (x > px && y > py)
+        {
+            ops[count++] = OP_KEEP;
+            x--;
+            y--;
+        }
+        ops[count++] = down ? OP_INSERT : OP_DELETE;
+        x = px;
+        y = py;
+    }
+    while (x > 0 && y > 0)
+    {
+        ops[count++] = OP_KEEP;
+        x--;
+        y--;
+    }
+    free(trace);
+    for (size_t i = 0; i < count / 2; i++)
+    {
+        unsigned char t = ops[i];
+        ops[i] = ops[count - 1 - i];
+        ops[count - 1 - i] = t;
+    }
+    return count;
+}
+
+static void buf_put(DiffBuf* buf, const char* data, size_t len)
+{
+    if (buf->failed)
+    {
+        return;
+    }
+    if (buf->len + len + 1 > buf->cap)
+    {
+        size_t cap = buf->cap ? buf->cap * 2 : 4096;
+        while (cap < buf->len + len + 1)
+        {
+            cap *= 2;
+        }
+        char* grown = realloc(buf->data, cap);
+        if (!grown)
+        {
+            buf->failed = true;
+            return;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buf_puts(DiffBuf* buf, const char* text)
+{
+    buf_put(buf, text, strlen(text));
+}
+
+/** One side of a hunk header: "-12,3", "-12" for one line, "-11,0" for none */
+static void put_range(DiffBuf* buf, char sign, size_t from, size_t count)
+{
+    char range[64];
+    if (count == 1)
+    {
+        snprintf(range, sizeof(range), "%c%zu", sign, from + 1);
+    }
+    else
+    {
+        snprintf(range, sizeof(range), "%c%zu,%zu", sign, count > 0 ? from + 1 : from, count);
+    }
+    buf_puts(buf, range);
+}
+
+static void put_line(DiffBuf* buf, char prefix, const DiffLine* line)
+{
+    buf_put(buf, &prefix, 1);
+    buf_put(buf, line->text, line->len);
+    if (line->len == 0 || line->text[line->len - 1] != '\n')
+    {
+        buf_puts(buf, "\n\\ No newline at end of file\n");
+    }
+}
+
+/** Hunks covering every change in ops, with context */
+static void put_hunks(DiffBuf* buf, const unsigned char* ops, size_t count, const DiffLine* a,
+                      const DiffLine* b)
+{
+    size_t i = 0, a_at = 0, b_at = 0, done = 0;
+    for (;;)
+    {
+        while (i < count && ops[i] == OP_KEEP)
+        {
+            i++;
+            a_at++;
+            b_at++;
+        }
+        if (i == count)
+        {
+            return;
+        }
+        size_t back = i - done < LINE_DIFF_CONTEXT ? i - done : LINE_DIFF_CONTEXT;
+        size_t from = i - back, a_from = a_at - back, b_from = b_at - back;
+
+        /* Take in later changes while the unchanged lines between them would overlap */
+        size_t j = i, change_end = i;
+        while (j < count)
+        {
+            if (ops[j] != OP_KEEP)
+            {
+                change_end = ++j;
+                continue;
+            }
+            size_t run = 0;
+            while (j + run < count && ops[j + run] == OP_KEEP)
+            {
+                run++;
+            }
+            if (j + run == count || run > 2 * LINE_DIFF_CONTEXT)
+            {
+                break;
+            }
+            j += run;
+        }
+        size_t to = change_end;
+        while (to < count && to - change_end < LINE_DIFF_CONTEXT)
+        {
+            to++;
+        }
+
+        size_t a_count = 0, b_count = 0;
+        for (size_t o = from; o < to; o++)
+        {
+            a_count += ops[o] != OP_INSERT;
+            b_count += ops[o] != OP_DELETE;
+        }
+        buf_puts(buf, "@@ ");
+        put_range(buf, '-', a_from, a_count);
+        buf_puts(buf, " ");
+        put_range(buf, '+', b_from, b_count);
+        buf_puts(buf, " @@\n");
+
+        size_t ai = a_from, bi = b_from;
+        for (size_t o = from; o < to; o++)
+        {
+            if (ops[o] == OP_KEEP)
+            {
+                put_line(buf, ' ', &b[bi]);
+                ai++;
+                bi++;
+            }
+            else if (ops[o] == OP_DELETE)
+            {
+                put_line(buf, '-', &a[ai++]);
+            }
+            else
+            {
+                put_line(buf, '+', &b[bi++]);
+            }
+        }
+        i = to;
+        a_at = ai;
+        b_at = bi;
+        done = to;
+    }
+}
+
+char* line_diff_unified(const char* old_text, size_t old_len, const char* new_text,
+                        size_t new_len, const char* label, size_t max_edits, size_t* len)
+{
+    size_t na = 0, nb = 0;
+    DiffLine* a = split_lines(old_text, old_len, &na);
+    DiffLine* b = split_lines(new_text, new_len, &nb);
+    unsigned char* ops = a && b && na < INT_MAX / 2 && nb < INT_MAX / 2 ? malloc(na + nb + 1)
+                                                                        : NULL;
+    DiffBuf buf = {0};
+    if (!ops)
+    {
+        buf.failed = true;
+    }
+
+    size_t count = 0;
+    if (!buf.failed)
+    {
+        size_t head = 0, tail = 0;
+        while (head < na && head < nb && same_line(&a[head], &b[head]))
+        {
+            head++;
+        }
+        while (tail < na - head && tail < nb - head &&
+               same_line(&a[na - 1 - tail], &b[nb - 1 - tail]))
+        {
+            tail++;
+        }
+        if (head == na && head == nb)
+        {
+            buf.failed = true; /* Same lines; nothing to show */
+        }
+        else
+        {
+            memset(ops, OP_KEEP, head);
+            size_t middle = shortest_edit(a + head, (int)(na - head - tail), b + head,
+                                          (int)(nb - head - tail), max_edits, ops + head);
+            if (middle == SIZE_MAX)
+            {
+                buf.failed = true;
+            }
+            else
+            {
+                memset(ops + head + middle, OP_KEEP, tail);
+                count = head + middle + tail;
+            }
+        }
+    }
+
+    if (!buf.failed)
+    {
+        buf_puts(&buf, "--- a/");
+        buf_puts(&buf, label);
+        buf_puts(&buf, "\n+++ b/");
+        buf_puts(&buf, label);
+        buf_puts(&buf, "\n");
+        put_hunks(&buf, ops, count, a, b);
+    }
+    free(ops);
+    free(a);
+    free(b);
+    if (buf.failed)
+    {
+        free(buf.data);
+        return NULL;
+    }
+    *len = buf.len;
+    return buf.data;
+}
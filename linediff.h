@@ -0,0 +1,31 @@
+#ifndef LINEDIFF_H
+#define LINEDIFF_H
+
+#include <stddef.h>
+
+/**
+ * Line-based unified diffs
+ *
+ * Lines are compared whole, newline included, after the common leading
+ * and trailing lines are set aside; Myers' greedy algorithm finds a
+ * shortest edit script for the lines in between. Output follows diff -u:
+ * "--- a/<label>" and "+++ b/<label>" lines, then hunks with
+ * LINE_DIFF_CONTEXT lines of context, and "\ No newline at end of file"
+ * after a last line that has none.
+ */
+
+/* Unchanged lines shown around each change */
+#define LINE_DIFF_CONTEXT 3
+
+/**
+ * Unified diff from old_text to new_text as a malloc()ed NUL-terminated string
+ *
+ * *len gets its length. Returns NULL if the texts have the same lines, if
+ * more than max_edits lines would be deleted or inserted (the edit script
+ * costs time and memory quadratic in that count, and such a rewrite is
+ * better sent whole), or if memory runs out.
+ */
+char* line_diff_unified(const char* old_text, size_t old_len, const char* new_text,
+                        size_t new_len, const char* label, size_t max_edits, size_t* len);
+
+#endif /* LINEDIFF_H */
@@ -6,10 +6,13 @@
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <glob.h>
 #include <libgen.h>
 #include <errno.h>
+#include <signal.h>
 #include <fnmatch.h>
 #include <ctype.h>
 #include <stdbool.h>
@@ -27,21 +30,79 @@
 #include "debug.h"
 #include "tokenizer.h"
 #include "config.h"
+#include "walker.h"
+#include "output.h"
+#include "matcher.h"
+#include "filecache.h"
+#include "filemeta.h"
+#include "fileload.h"
+#include "filetree.h"
+#include "gitindex.h"
+#include "globset.h"
+#include "linediff.h"
+#include "chunker.h"
+#include "pathset.h"
+#include "packer.h"
+#include "promptstore.h"
+#include "stdinpipe.h"
+#include "timings.h"
+#include "tokenest.h"
 
 static Arena g_arena;
 
 static size_t g_token_budget = 1024 * 64;
 static const char* g_token_model = "gpt-4o";
+static LLMTokenizer* g_tokenizer = NULL; /* Opened on first count, closed in cleanup() */
+static TokenRatio g_token_ratio;         /* Bytes per token of g_token_model, calibrated per run */
+static TokenEstimator g_token_estimator; /* Byte-class estimates for --estimate */
+static int g_jobs = 0;                   /* Walker/tokenizer threads; 0 = core count */
+static bool g_no_cache = false;          /* --no-cache */
+static bool g_stream = false;            /* --stream */
+static bool g_estimate = false;          /* --estimate */
+static double g_estimate_margin = 0.10;  /* --estimate=PCT as a fraction of the budget */
+static int g_queue_depth = FILE_LOAD_DEFAULT_DEPTH; /* --queue-depth: files loaded at once */
+static size_t g_token_top = TOKEN_DIAG_DEFAULT_TOP;  /* --token-top: diagnostics rows listed */
+static size_t g_tail_tokens = 0;                    /* --tail-tokens: keep only the end of stdin */
+static const char* g_since = NULL;                  /* --since: earlier prompt's UUID, or "last" */
+static FileLoader* g_file_loader = NULL;            /* Content loads in flight, if any */
 static char* g_token_diagnostics_file = NULL;
+static bool g_timings = false;                 /* --timings */
+static const char* g_timings_json_file = NULL; /* --timings=FILE or LLM_CTX_TIMINGS_JSON */
+
+typedef enum
+{
+    GIT_INDEX_OFF = 0,
+    GIT_INDEX_TRACKED,  /* --git-index: tracked files only */
+    GIT_INDEX_UNTRACKED /* --git-index=untracked: plus the walk's untracked, unignored files */
+} GitIndexMode;
+static GitIndexMode g_git_index_mode = GIT_INDEX_OFF;
+static GitIndex g_git_index;            /* Loaded on first use, for one worktree at a time */
+static bool g_git_index_loaded = false;
+static bool g_git_index_warned = false; /* The fallback-to-walk warning is shown once */
 static bool g_token_diagnostics_requested = true;
 
 typedef struct
 {
-    char* path;
-    int start_line; /* 1-based; 0 means beginning */
-    int end_line;   /* 1-based inclusive; 0 means end of file */
+    const char* path; /* Interned in g_processed_set */
+    int start_line;   /* 1-based; 0 means beginning */
+    int end_line;    /* 1-based inclusive; 0 means end of file */
+    long out_offset; /* Byte offset of this file's fragment in the assembled context */
+    size_t out_len;  /* Fragment length; 0 if nothing was emitted */
+    size_t tokens;   /* Fragment token count, computed once after assembly */
+    FileMeta* meta;  /* Loaded on first touch; shared by every range of the path and by
+                      * FileRank, assembly and the cache */
+    const PromptFile* since; /* --since: the entry of this file in the earlier prompt, if any */
+    const char* diff;        /* --since: the fragment carries this diff against it instead */
+    size_t diff_len;
 } ProcessedFile;
 
+/* --since: the earlier prompt, its file table, and the files left out as unchanged */
+static char* g_since_uuid = NULL;
+static PromptFileTable g_since_table;
+static ProcessedFile* g_unchanged_files = NULL;
+static int g_num_unchanged_files = 0;
+static int g_unchanged_files_cap = 0;
+
 void cleanup(void);
 
 static bool g_effective_copy_to_clipboard = true;
@@ -104,28 +165,61 @@ static char* generate_prompt_uuid(Arena* arena)
 }
 
 
-static char* ensure_prompts_dir(Arena* arena)
+/** Resolve the llm_ctx config directory ($XDG_CONFIG_HOME/llm_ctx or ~/.config/llm_ctx) */
+static bool get_config_base(char* config_base, size_t size)
 {
-    char config_base[MAX_PATH];
     const char* home = getenv("HOME");
     const char* xdg_config = getenv("XDG_CONFIG_HOME");
-    
+
     if (xdg_config)
     {
-        snprintf(config_base, sizeof(config_base), "%s/llm_ctx", xdg_config);
+        snprintf(config_base, size, "%s/llm_ctx", xdg_config);
     }
     else if (home)
     {
-        snprintf(config_base, sizeof(config_base), "%s/.config/llm_ctx", home);
+        snprintf(config_base, size, "%s/.config/llm_ctx", home);
     }
     else
     {
         struct passwd* pw = getpwuid(getuid());
         if (!pw || !pw->pw_dir)
         {
-            return NULL;
+            return false;
         }
-        snprintf(config_base, sizeof(config_base), "%s/.config/llm_ctx", pw->pw_dir);
+        snprintf(config_base, size, "%s/.config/llm_ctx", pw->pw_dir);
+    }
+    return true;
+}
+
+/** Open <config>/cache.bin unless --no-cache or LLM_CTX_NO_CACHE is set */
+static void open_file_cache(void)
+{
+    const char* no_cache = getenv("LLM_CTX_NO_CACHE");
+    if (g_no_cache || (no_cache && strcmp(no_cache, "0") != 0))
+    {
+        return;
+    }
+    char config_base[MAX_PATH];
+    if (!get_config_base(config_base, sizeof(config_base)))
+    {
+        return;
+    }
+    mkdir(config_base, 0755); /* May already exist; filecache_open() reports the real failure */
+    char cache_path[MAX_PATH];
+    if (snprintf(cache_path, sizeof(cache_path), "%s/cache.bin", config_base) >=
+        (int)sizeof(cache_path))
+    {
+        return;
+    }
+    filecache_open(cache_path);
+}
+
+static char* ensure_prompts_dir(Arena* arena)
+{
+    char config_base[MAX_PATH];
+    if (!get_config_base(config_base, sizeof(config_base)))
+    {
+        return NULL;
     }
     
     char prompts_dir[MAX_PATH];
@@ -163,9 +257,67 @@ static char* ensure_prompts_dir(Arena* arena)
 static char* slurp_stream(FILE* fp);
 
 
-static char* save_prompt(const char* content, int argc, char* argv[],
+/** The bytes of a loaded file that its fragment shows, whole or its line range */
+static void fragment_content(ProcessedFile* pf, const char** data, size_t* len)
+{
+    size_t from = 0, to = pf->meta->size;
+    if (pf->start_line > 0 || pf->end_line > 0)
+    {
+        file_meta_line_range(pf->meta, pf->start_line, pf->end_line, &from, &to);
+    }
+    *data = pf->meta->data + from;
+    *len = to - from;
+}
+
+/**
+ * File table of a saved prompt: the files of its context, then those it
+ * listed as unchanged since an earlier one
+ *
+ * Binary and unreadable files are left out; their fragments say nothing a
+ * later diff could build on.
+ */
+static PromptFile* prompt_file_table(ProcessedFile* context_files, int num_context_files,
+                                     size_t* count, Arena* arena)
+{
+    PromptFile* files = arena_push_array_safe(
+        arena, PromptFile, (size_t)num_context_files + (size_t)g_num_unchanged_files + 1);
+    size_t n = 0;
+    for (int i = 0; i < num_context_files; i++)
+    {
+        ProcessedFile* pf = &context_files[i];
+        const FileMeta* meta = pf->meta;
+        if (pf->out_len == 0 || !meta || !meta->readable || meta->binary)
+        {
+            continue;
+        }
+        PromptFile* f = &files[n++];
+        memset(f, 0, sizeof(*f));
+        f->path = pf->path;
+        f->start_line = pf->start_line;
+        f->end_line = pf->end_line;
+        f->sig = meta->sig;
+        fragment_content(pf, &f->content, &f->len);
+    }
+    for (int i = 0; i < g_num_unchanged_files; i++)
+    {
+        const ProcessedFile* pf = &g_unchanged_files[i];
+        PromptFile* f = &files[n++];
+        *f = *pf->since;
+        f->path = pf->path;
+        /* Content read and found the same: the new signature spares the next run that read */
+        if (pf->meta->loaded && pf->meta->readable)
+        {
+            f->sig = pf->meta->sig;
+        }
+    }
+    *count = n;
+    return files;
+}
+
+/** Save the prompt to the prompt store; returns its UUID, or NULL if it was not saved */
+static char* save_prompt(const OutputVec* content, int argc, char* argv[],
                         ProcessedFile* processed_files, int num_processed_files,
-                        Arena* arena)
+                        int num_context_files, size_t tokens, Arena* arena)
 {
     if (!content || !arena)
     {
@@ -184,77 +336,55 @@ static char* save_prompt(const char* content, int argc, char* argv[],
         return NULL;
     }
 
-    char prompt_path[MAX_PATH];
-    snprintf(prompt_path, sizeof(prompt_path), "%s/%s", prompts_dir, uuid);
-    
-    FILE* fp = fopen(prompt_path, "w");
-    if (!fp)
+    size_t cli_len = 0;
+    for (int i = 0; i < argc; i++)
     {
-        fprintf(stderr, "Warning: Could not save prompt to %s: %s\n", 
-                prompt_path, strerror(errno));
-        return NULL;
+        cli_len += strlen(argv[i]) + 1;
     }
-
-    time_t now = time(NULL);
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S UTC", gmtime(&now));
-
-    fprintf(fp, "# llm_ctx saved prompt\n");
-    fprintf(fp, "# UUID: %s\n", uuid);
-    fprintf(fp, "# Saved: %s\n", timestamp);
-    
-    fprintf(fp, "# CLI:");
+    char* cli = arena_push_array_safe(arena, char, cli_len + 1);
+    char* end = cli;
     for (int i = 0; i < argc; i++)
     {
-        fprintf(fp, " %s", argv[i]);
+        end += sprintf(end, i > 0 ? " %s" : "%s", argv[i]);
     }
-    fprintf(fp, "\n");
-    
-    fprintf(fp, "# Files: %d files processed\n", num_processed_files);
-    fprintf(fp, "#\n");
-    
+    *end = '\0';
+
+    /* The file list heads the prompt as `get` prints it; the content is referenced, not copied */
+    OutputVec stored;
+    outvec_init(&stored, arena);
     if (num_processed_files > 0 && processed_files)
     {
-        fprintf(fp, "<file_list>\n");
+        outvec_printf(&stored, "<file_list>\n");
         for (int i = 0; i < num_processed_files; i++)
         {
             if (processed_files[i].start_line > 0 || processed_files[i].end_line > 0)
             {
                 if (processed_files[i].end_line > 0)
                 {
-                    fprintf(fp, "%s:%d-%d\n", processed_files[i].path, processed_files[i].start_line,
-                            processed_files[i].end_line);
+                    outvec_printf(&stored, "%s:%d-%d\n", processed_files[i].path,
+                                  processed_files[i].start_line, processed_files[i].end_line);
                 }
                 else
                 {
-                    fprintf(fp, "%s:%d-\n", processed_files[i].path, processed_files[i].start_line);
+                    outvec_printf(&stored, "%s:%d-\n", processed_files[i].path,
+                                  processed_files[i].start_line);
                 }
             }
             else
             {
-                fprintf(fp, "%s\n", processed_files[i].path);
+                outvec_printf(&stored, "%s\n", processed_files[i].path);
             }
         }
-        fprintf(fp, "</file_list>\n");
-        fprintf(fp, "\n");
-    }
-    
-    if (fprintf(fp, "%s", content) < 0)
-    {
-        fprintf(stderr, "Warning: Failed to write prompt content to %s: %s\n", 
-                prompt_path, strerror(errno));
-        fclose(fp);
-        return NULL;
-    }
-    
-    if (fclose(fp) != 0)
-    {
-        fprintf(stderr, "Warning: Error closing prompt file %s: %s\n", 
-                prompt_path, strerror(errno));
-        return NULL;
+        outvec_printf(&stored, "</file_list>\n\n");
     }
+    outvec_append_range(&stored, content, 0, outvec_size(content));
 
-    return uuid;
+    size_t file_count;
+    PromptFile* files = prompt_file_table(processed_files, num_context_files, &file_count, arena);
+    PromptMeta meta = {uuid, cli, time(NULL), tokens, num_processed_files, files, file_count};
+    bool saved = prompt_store_save(prompts_dir, &meta, &stored);
+    outvec_free(&stored);
+    return saved ? uuid : NULL;
 }
 
 
@@ -286,6 +416,13 @@ static char* load_prompt(const char* uuid, Arena* arena)
         return NULL;
     }
 
+    char* stored = prompt_store_load(prompts_dir, uuid, NULL);
+    if (stored)
+    {
+        return stored;
+    }
+
+    /* Prompts saved before the store existed are plain files named by UUID */
     char prompt_path[MAX_PATH];
     snprintf(prompt_path, sizeof(prompt_path), "%s/%s", prompts_dir, uuid);
 
@@ -385,77 +522,113 @@ char* get_executable_dir(void)
 
 
 #define MAX_PATH 4096
-#define BINARY_CHECK_SIZE 1024
-#define TEMP_FILE_TEMPLATE "/tmp/llm_ctx_XXXXXX"
 #define MAX_PATTERNS 64
-#define MAX_FILES 4096
 #define STDIN_BUFFER_SIZE (80 * 1024 * 1024)
 #define CLIPBOARD_SOFT_MAX (8 * 1024 * 1024)
 
-typedef struct
-{
-    char path[MAX_PATH];
-    char* relative_path;
-    bool is_dir;
-} FileInfo;
-
 typedef struct
 {
     const char* path;
     double score;
     size_t bytes;
     size_t tokens;
+    int start_line; /* Line range of the ProcessedFile; 0 means unbounded */
+    int end_line;
+    int file_index; /* Index into processed_files */
+    FileMeta* meta; /* That file's metadata; NULL for pseudo-files such as stdin_content */
 } FileRank;
 
 
 void show_help(void);
 bool collect_file(const char* filepath, int start_line, int end_line);
-bool output_file_content(const ProcessedFile* file, FILE* output);
+static bool collect_regular_file(const char* filepath, int start_line, int end_line);
+bool output_file_content(ProcessedFile* file, OutputVec* out);
 void add_user_instructions(const char* instructions);
 void find_recursive(const char* base_dir, const char* pattern);
 bool copy_to_clipboard(const char* buffer);
+static bool copy_output_to_clipboard(const OutputVec* out);
+static void write_output_to_stdout(const OutputVec* out);
 bool process_pattern(const char* pattern);
 void generate_file_tree(void);
 void add_to_file_tree(const char* filepath);
-int compare_file_paths(const void* a, const void* b);
-char* find_common_prefix(void);
-void print_tree_node(const char* path, int level, bool is_last, const char* prefix);
-void build_tree_recursive(char** paths, int count, int level, const char* prefix);
+void add_file_tree_entry(const char* filepath, bool is_dir);
 void rank_files(const char* query, FileRank* ranks, int num_files);
 
 
-static char* slurp_stream(FILE* fp)
+/* First read size for streams without a size hint (pipes, terminals) */
+#define SLURP_CHUNK_SIZE (64 * 1024)
+
+/**
+ * Read up to max_len bytes of fp into a NUL-terminated arena buffer
+ *
+ * Regular files are sized up front from fstat(); other streams start at
+ * SLURP_CHUNK_SIZE and double. *truncated reports whether data remained
+ * past max_len. Returns NULL (arena restored, errno set) on read error.
+ */
+/* WHY: the buffer is always the newest arena allocation while it is being
+ * filled, so it grows in place with arena_resize_last() instead of leaving
+ * each outgrown copy behind; large fread() calls go straight to read(). */
+static char* slurp_stream_bounded(FILE* fp, size_t max_len, size_t* out_len, bool* truncated)
 {
     size_t mark = arena_get_mark(&g_arena);
-    size_t cap = 4096, len = 0;
-    char* buf = arena_push_array_safe(&g_arena, char, cap);
-    bool warning_issued = false;
+    size_t cap = SLURP_CHUNK_SIZE;
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        long pos = ftell(fp);
+        if (pos >= 0 && st.st_size >= pos)
+        {
+            /* Room for the remaining bytes, the NUL, and one byte to see EOF */
+            cap = (size_t)(st.st_size - pos) + 2;
+        }
+    }
+    if (max_len < SIZE_MAX - 2 && cap > max_len + 2)
+    {
+        cap = max_len + 2;
+    }
+
+    char* buf = arena_push_size_safe(&g_arena, cap, 1);
+    size_t len = 0;
+    *truncated = false;
 
-    int c;
-    while ((c = fgetc(fp)) != EOF)
+    for (;;)
     {
-        if (len + 1 >= cap)
+        if (len >= max_len)
+        {
+            /* Probe for data beyond the limit without keeping it */
+            *truncated = fgetc(fp) != EOF;
+            break;
+        }
+        if (cap - len < 2)
         {
             if (cap > SIZE_MAX / 2)
             {
+                arena_set_mark(&g_arena, mark);
                 errno = ENOMEM;
                 return NULL;
             }
             size_t new_cap = cap * 2;
-            char* tmp = arena_push_array_safe(&g_arena, char, new_cap);
-            memcpy(tmp, buf, len);
-            buf = tmp;
+            if (!arena_resize_last(&g_arena, buf, cap, new_cap))
+            {
+                char* tmp = arena_push_size_safe(&g_arena, new_cap, 1);
+                memcpy(tmp, buf, len);
+                buf = tmp;
+            }
             cap = new_cap;
         }
-        buf[len++] = (char)c;
 
-        if (!warning_issued && len > STDIN_BUFFER_SIZE)
+        size_t want = cap - len - 1;
+        if (want > max_len - len)
         {
-            fprintf(stderr,
-                    "Warning: Input stream exceeds %d MB. Large inputs may cause clipboard "
-                    "operations to fail.\n",
-                    STDIN_BUFFER_SIZE / (1024 * 1024));
-            warning_issued = true;
+            want = max_len - len;
+        }
+        size_t n = fread(buf + len, 1, want, fp);
+        len += n;
+        timing_count(COUNTER_BYTES_READ, n);
+        if (n < want)
+        {
+            break; /* EOF or error */
         }
     }
     buf[len] = '\0';
@@ -467,6 +640,28 @@ static char* slurp_stream(FILE* fp)
         errno = saved_errno;
         return NULL;
     }
+
+    /* Hand back the unused tail of the buffer */
+    arena_resize_last(&g_arena, buf, cap, len + 1);
+    if (out_len)
+    {
+        *out_len = len;
+    }
+    return buf;
+}
+
+static char* slurp_stream(FILE* fp)
+{
+    size_t len;
+    bool truncated;
+    char* buf = slurp_stream_bounded(fp, SIZE_MAX, &len, &truncated);
+    if (buf && len > STDIN_BUFFER_SIZE)
+    {
+        fprintf(stderr,
+                "Warning: Input stream exceeds %d MB. Large inputs may cause clipboard "
+                "operations to fail.\n",
+                STDIN_BUFFER_SIZE / (1024 * 1024));
+    }
     return buf;
 }
 
@@ -541,29 +736,38 @@ static char* expand_tilde_path(const char* path)
     return expanded_path;
 }
 
-bool process_stdin_content(void);
-void output_file_callback(const char* name, const char* type, const char* content);
-bool is_binary(FILE* file);
-bool file_already_in_tree(const char* filepath);
-void add_directory_tree(const char* base_dir);
-void add_directory_tree_with_depth(const char* base_dir, int current_depth);
-
 typedef struct
 {
     char filename[MAX_PATH];
     char type[32];
-    char* content;
+    const char* content;
+    size_t len;
+    /* Tokens of content[count_from, count_to), taken while stdin was read */
+    bool counted;
+    size_t count_from;
+    size_t count_to;
+    size_t tokens;
+    size_t header_len; /* Bytes of the fragment before the content */
 } SpecialFile;
 
-char temp_file_path[MAX_PATH];
-FILE* temp_file = NULL;
+static LLMTokenizer* context_tokenizer(void);
+bool process_stdin_content(void);
+SpecialFile* output_file_callback(const char* name, const char* type, const char* content,
+                                  size_t len);
+bool is_binary(FILE* file);
+bool file_already_in_tree(const char* filepath);
+void add_directory_tree(const char* base_dir);
+void add_directory_tree_with_depth(const char* base_dir, int current_depth);
+
+static OutputVec g_out; /* The assembled context, written once at the end */
 int files_found = 0;
-ProcessedFile processed_files[MAX_FILES];
+/* WHY: The table grows without a cap; the set indexes it by interned path so
+ * collection and dedupe stay O(1) per file on large trees. */
+ProcessedFile* processed_files = NULL;
 int num_processed_files = 0;
-FileInfo file_tree[MAX_FILES];
-int file_tree_count = 0;
-FILE* tree_file = NULL;
-char tree_file_path[MAX_PATH];
+static int processed_files_cap = 0;
+static PathSet g_processed_set; /* (path, start_line, end_line) of processed_files */
+static FileTree g_file_tree; /* Every path shown by -t/-T, inserted as discovered */
 SpecialFile special_files[10];
 int num_special_files = 0;
 static int file_mode = 0;
@@ -587,6 +791,7 @@ static double g_filerank_weight_content = 0.8; /* Weight for content hits */
 static double g_filerank_weight_size = 0.08;   /* Weight for size penalty */
 static double g_filerank_weight_tfidf = 16.0;  /* Weight for TF-IDF score */
 static char* g_filerank_cutoff_spec = NULL;    /* Cutoff specification string */
+static int g_chunk_lines = 0; /* --chunks: rank chunks of at most this many lines; 0 ranks files */
 
 /* Keywords boost configuration */
 #define MAX_KEYWORDS 32
@@ -605,8 +810,7 @@ static bool g_keywords_flag_used = false; /* Track if --keywords was used */
 
 /* CLI exclude pattern configuration */
 #define MAX_CLI_EXCLUDE_PATTERNS 128
-static char* g_cli_exclude_patterns[MAX_CLI_EXCLUDE_PATTERNS];
-static int g_cli_exclude_count = 0;
+static GlobSet g_cli_excludes; /* Compiled as they are added; read by walker threads */
 
 static bool parse_keywords(const char* spec)
 {
@@ -787,70 +991,64 @@ static bool parse_filerank_weights(const char* weight_str)
 /** Add CLI exclude pattern to global list */
 static void add_cli_exclude_pattern(const char* raw)
 {
-    if (g_cli_exclude_count >= MAX_CLI_EXCLUDE_PATTERNS)
+    if (g_cli_excludes.count >= MAX_CLI_EXCLUDE_PATTERNS)
     {
         fprintf(stderr, "Warning: Maximum %d exclude patterns allowed, ignoring '%s'\n",
                 MAX_CLI_EXCLUDE_PATTERNS, raw);
         return;
     }
-    g_cli_exclude_patterns[g_cli_exclude_count++] = arena_strdup_safe(&g_arena, raw);
+    if (!g_cli_excludes.arena)
+    {
+        glob_set_init(&g_cli_excludes, &g_arena);
+    }
+    glob_set_add(&g_cli_excludes, raw, GLOB_MATCH_EXCLUDE);
 }
 
 /** Check if path matches CLI exclude pattern */
-/* WHY: Supports git-style globs with ** for recursive matching,
- * combining fnmatch efficiency with custom ** handling */
+/* WHY: Supports git-style globs with ** for recursive matching; each rule
+ * is classified once in globset.c so the per-entry check skips fnmatch
+ * for literal and "*.ext" rules */
 static bool matches_cli_exclude(const char* path)
 {
-    const char* base = strrchr(path, '/');
-    base = base ? base + 1 : path;
-
-    for (int i = 0; i < g_cli_exclude_count; ++i)
-    {
-        const char* pat = g_cli_exclude_patterns[i];
+    return g_cli_excludes.count > 0 && glob_set_any(&g_cli_excludes, path);
+}
 
-        /* Handle ** patterns for recursive directory matching */
-        const char* double_star = strstr(pat, "**");
-        if (double_star)
-        {
-            /* Pattern contains **, needs special handling */
-            size_t prefix_len = double_star - pat;
+/* Tagged sections of the assembled context, recorded as they are written so
+ * diagnostics can attribute tokens to them without re-parsing the output. */
+#define MAX_OUTPUT_SECTIONS 8
 
-            /* Check if path starts with the prefix before ** */
-            if (prefix_len > 0 && strncmp(path, pat, prefix_len) != 0)
-            {
-                continue;
-            }
+typedef struct
+{
+    const char* name;
+    long offset;
+    size_t len;
+    size_t tokens;
+} OutputSection;
 
-            /* If pattern ends with double-star or slash-double-star, match any path with that
-             * prefix */
-            if (double_star[2] == '\0' || (double_star[2] == '/' && double_star[3] == '\0'))
-            {
-                return true;
-            }
+static OutputSection g_output_sections[MAX_OUTPUT_SECTIONS];
+static int g_num_output_sections = 0;
+static long g_section_start = -1;
 
-            /* If pattern is like dir/double-star, match anything under dir/ */
-            if (prefix_len > 0 && pat[prefix_len - 1] == '/')
-            {
-                return true;
-            }
+static void begin_output_section(void)
+{
+    g_section_start = (long)outvec_size(&g_out);
+}
 
-            /* For patterns like dir/double-star/file, use simple substring match for now */
-            const char* suffix = double_star + 2;
-            if (*suffix == '/')
-                suffix++;
-            if (*suffix && strstr(path + prefix_len, suffix))
-            {
-                return true;
-            }
-        }
-        else
-        {
-            /* Standard fnmatch for patterns without ** */
-            if (fnmatch(pat, path, FNM_PATHNAME | FNM_PERIOD) == 0 || fnmatch(pat, base, 0) == 0)
-                return true;
-        }
+static void end_output_section(const char* name)
+{
+    long end = (long)outvec_size(&g_out);
+    if (g_section_start < 0 || end < g_section_start ||
+        g_num_output_sections >= MAX_OUTPUT_SECTIONS)
+    {
+        g_section_start = -1;
+        return;
     }
-    return false;
+    OutputSection* sec = &g_output_sections[g_num_output_sections++];
+    sec->name = name;
+    sec->offset = g_section_start;
+    sec->len = (size_t)(end - g_section_start);
+    sec->tokens = 0;
+    g_section_start = -1;
 }
 
 /** Add system instructions to output if provided */
@@ -858,7 +1056,9 @@ static void add_system_instructions(const char* msg)
 {
     if (!msg || !*msg)
         return;
-    fprintf(temp_file, "<system_instructions>\n%s\n</system_instructions>\n\n", msg);
+    begin_output_section();
+    outvec_printf(&g_out, "<system_instructions>\n%s\n</system_instructions>\n\n", msg);
+    end_output_section("system_instructions");
 }
 
 /* Global flag to track if any file content has been written */
@@ -869,7 +1069,7 @@ static void open_file_context_if_needed(void)
 {
     if (!wrote_file_context)
     {
-        fprintf(temp_file, "<file_context>\n\n");
+        outvec_printf(&g_out, "<file_context>\n\n");
         wrote_file_context = true;
     }
 }
@@ -880,35 +1080,37 @@ static void add_response_guide(const char* problem)
     // Only add the guide if -e flag was explicitly used
     if (want_editor_comments)
     {
-        fprintf(temp_file, "<response_guide>\n");
+        begin_output_section();
+        outvec_printf(&g_out, "<response_guide>\n");
 
         // If custom response guide provided, use it directly
         if (custom_response_guide && *custom_response_guide)
         {
-            fprintf(temp_file, "%s\n", custom_response_guide);
+            outvec_printf(&g_out, "%s\n", custom_response_guide);
         }
         else
         {
             // Use default behavior
-            fprintf(temp_file, "LLM: Please respond using the markdown format below.\n");
+            outvec_printf(&g_out, "LLM: Please respond using the markdown format below.\n");
 
             // Only include Problem Statement section if user instructions were provided
             if (problem && *problem)
             {
-                fprintf(temp_file, "## Problem Statement\n");
-                fprintf(temp_file, "Summarize the user's request or problem based on the overall "
+                outvec_printf(&g_out, "## Problem Statement\n");
+                outvec_printf(&g_out, "Summarize the user's request or problem based on the overall "
                                    "context provided.\n");
             }
 
-            fprintf(temp_file, "## Response\n");
-            fprintf(temp_file, "    1. Provide a clear, step-by-step solution or explanation.\n");
-            fprintf(
-                temp_file,
+            outvec_printf(&g_out, "## Response\n");
+            outvec_printf(&g_out, "    1. Provide a clear, step-by-step solution or explanation.\n");
+            outvec_printf(
+                &g_out,
                 "    2. Return **PR-style code review comments**: use GitHub inline-diff syntax, "
                 "group notes per file, justify each change, and suggest concrete refactors.\n");
         }
 
-        fprintf(temp_file, "</response_guide>\n\n");
+        outvec_printf(&g_out, "</response_guide>\n\n");
+        end_output_section("response_guide");
     }
 }
 /** Check if file already processed to avoid duplicates */
@@ -918,49 +1120,121 @@ bool file_already_processed(const char* filepath, int start_line, int end_line)
     assert(filepath != NULL);
     assert(strlen(filepath) > 0);
 
-    /* Invariant: num_processed_files is always valid */
-    assert(num_processed_files >= 0);
-    assert(num_processed_files <= MAX_FILES);
+    return path_set_contains(&g_processed_set, filepath, start_line, end_line);
+}
+
+/** Grow an arena-backed table to hold at least one more element */
+static void* grow_table(void* table, int count, int* cap, size_t elem_size)
+{
+    if (count < *cap)
+    {
+        return table;
+    }
+    int new_cap = *cap ? *cap * 2 : 256;
+    /* WHY: Collection runs before any arena mark is taken, so the copy is
+     * never released early; the abandoned block costs at most the final size. */
+    void* grown = arena_push_size(&g_arena, (size_t)new_cap * elem_size, 16);
+    if (!grown)
+    {
+        fatal("Out of memory growing file table to %d entries", new_cap);
+    }
+    if (count > 0)
+    {
+        memcpy(grown, table, (size_t)count * elem_size);
+    }
+    *cap = new_cap;
+    return grown;
+}
+
+/* Paths listed with a line range, and the FileMeta their entries share */
+typedef struct
+{
+    const char* path;
+    FileMeta* meta;
+} RangedMeta;
+
+static RangedMeta* ranged_metas = NULL;
+static int num_ranged_metas = 0;
+static int ranged_metas_cap = 0;
 
+static FileMeta* meta_of_ranged_path(const char* path)
+{
+    for (int i = 0; i < num_ranged_metas; i++)
+    {
+        if (strcmp(ranged_metas[i].path, path) == 0)
+        {
+            return ranged_metas[i].meta;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * The FileMeta an earlier entry for the same path already has, if any
+ *
+ * WHY: several ranges of one file (typically a large log) then share a
+ * single mapping and line index. Ranges come from explicit arguments, so
+ * the table is short; only a ranged lookup may scan all entries, to find
+ * a whole-file entry for the same path.
+ */
+static FileMeta* shared_file_meta(const char* path, int start_line, int end_line)
+{
+    FileMeta* meta = meta_of_ranged_path(path);
+    if (meta || (start_line == 0 && end_line == 0) ||
+        !path_set_contains(&g_processed_set, path, 0, 0))
+    {
+        return meta;
+    }
     for (int i = 0; i < num_processed_files; i++)
     {
-        /* Invariant: each processed_files entry is valid */
-        if (strcmp(processed_files[i].path, filepath) == 0 &&
-            processed_files[i].start_line == start_line && processed_files[i].end_line == end_line)
+        const ProcessedFile* pf = &processed_files[i];
+        if (pf->start_line == 0 && pf->end_line == 0 && strcmp(pf->path, path) == 0)
         {
-            /* Post-condition: found matching file */
-            return true;
+            return pf->meta;
         }
     }
-    /* Post-condition: file not found */
-    return false;
+    return NULL;
 }
 
-/** Add file to processed files list */
-void add_to_processed_files(const char* filepath, int start_line, int end_line)
+/**
+ * Add file to processed files list
+ *
+ * Returns the new entry, or NULL if this path and line range is already
+ * listed.
+ */
+static ProcessedFile* add_to_processed_files(const char* filepath, int start_line, int end_line)
 {
     /* Pre-condition: valid filepath */
     assert(filepath != NULL);
     assert(strlen(filepath) > 0);
 
-    /* Pre-condition: we have space for more files */
-    assert(num_processed_files < MAX_FILES);
-
-    if (num_processed_files < MAX_FILES)
+    const char* path;
+    if (!path_set_insert(&g_processed_set, filepath, start_line, end_line, &path))
     {
-        processed_files[num_processed_files].path = arena_strdup_safe(&g_arena, filepath);
-        processed_files[num_processed_files].start_line = start_line;
-        processed_files[num_processed_files].end_line = end_line;
-        if (!processed_files[num_processed_files].path)
-        {
-            fatal("Out of memory duplicating file path: %s", filepath);
-        }
-        num_processed_files++;
+        return NULL;
+    }
 
-        /* Post-condition: file was added successfully */
-        assert(num_processed_files > 0);
-        assert(strcmp(processed_files[num_processed_files - 1].path, filepath) == 0);
+    processed_files = grow_table(processed_files, num_processed_files, &processed_files_cap,
+                                 sizeof(ProcessedFile));
+    FileMeta* meta = shared_file_meta(path, start_line, end_line);
+    ProcessedFile* pf = &processed_files[num_processed_files++];
+    memset(pf, 0, sizeof(*pf));
+    pf->path = path;
+    pf->start_line = start_line;
+    pf->end_line = end_line;
+    pf->meta = meta ? meta : arena_push_safe(&g_arena, FileMeta);
+    if ((start_line > 0 || end_line > 0) && !meta_of_ranged_path(path))
+    {
+        ranged_metas = grow_table(ranged_metas, num_ranged_metas, &ranged_metas_cap,
+                                  sizeof(RangedMeta));
+        ranged_metas[num_ranged_metas].path = path;
+        ranged_metas[num_ranged_metas].meta = pf->meta;
+        num_ranged_metas++;
     }
+
+    /* Post-condition: file was added successfully */
+    assert(strcmp(processed_files[num_processed_files - 1].path, filepath) == 0);
+    return pf;
 }
 
 /** Add file to file tree structure */
@@ -970,24 +1244,6 @@ void add_to_file_tree(const char* filepath)
     assert(filepath != NULL);
     assert(strlen(filepath) > 0);
 
-    /* We don't need to assert file_tree_count < MAX_FILES anymore since we check and handle it */
-
-    /* Check if we've hit the file limit */
-    if (file_tree_count >= MAX_FILES)
-    {
-        /* Log warning only once when we first hit the limit */
-        static bool limit_warning_shown = false;
-        if (!limit_warning_shown)
-        {
-            fprintf(stderr,
-                    "Warning: Maximum number of files (%d) exceeded. Some files will not be "
-                    "included in the context.\n",
-                    MAX_FILES);
-            limit_warning_shown = true;
-        }
-        return;
-    }
-
     bool is_special = (strcmp(filepath, "stdin_content") == 0);
     struct stat statbuf;
     bool is_dir = false; /* Default to not a directory */
@@ -995,6 +1251,7 @@ void add_to_file_tree(const char* filepath)
     /* Only call lstat for actual file paths, not special names */
     if (!is_special)
     {
+        timing_count(COUNTER_LSTAT, 1);
         if (lstat(filepath, &statbuf) == 0)
         {
             is_dir = S_ISDIR(statbuf.st_mode);
@@ -1003,40 +1260,21 @@ void add_to_file_tree(const char* filepath)
     }
     /* For special files like "stdin_content", is_dir remains false */
 
-    FileInfo new_file = {
-        .path = "", .relative_path = NULL, .is_dir = is_dir /* Use determined or default value */
-    };
-
-    /* Store file path using snprintf for guaranteed null termination. */
-    /* This avoids potential truncation issues with strncpy if filepath */
-    /* has length >= MAX_PATH - 1. */
-    int written = snprintf(new_file.path, sizeof(new_file.path), "%s", filepath);
-
-    /* Check for truncation or encoding errors from snprintf. */
-    if (written < 0 || (size_t)written >= sizeof(new_file.path))
-    {
-        fprintf(stderr, "Warning: File path truncated or encoding error for '%s'\n", filepath);
-        /* Decide how to handle: skip this file or fatal? Skipping for now. */
-        return; /* Skip adding this file to the tree */
-    }
+    add_file_tree_entry(filepath, is_dir);
+}
 
-    /* Add to file tree array */
-    file_tree[file_tree_count++] = new_file;
+/** Add an entry whose type is already known (e.g. from the walker) to the file tree */
+void add_file_tree_entry(const char* filepath, bool is_dir)
+{
+    assert(filepath != NULL);
 
-    assert(file_tree_count > 0);
+    file_tree_add(&g_file_tree, filepath, is_dir);
 }
 
 /** Check if path already exists in file tree */
 bool file_already_in_tree(const char* filepath)
 {
-    for (int i = 0; i < file_tree_count; i++)
-    {
-        if (strcmp(file_tree[i].path, filepath) == 0)
-        {
-            return true;
-        }
-    }
-    return false;
+    return file_tree_contains(&g_file_tree, filepath);
 }
 
 /** Recursively add directory tree to file_tree */
@@ -1070,6 +1308,7 @@ void add_directory_tree_with_depth(const char* base_dir, int current_depth)
         if (entry->d_name[0] == '.')
             continue;
         snprintf(path, sizeof(path), "%s/%s", base_dir, entry->d_name);
+        timing_count(COUNTER_LSTAT, 1);
         if (lstat(path, &statbuf) == -1)
             continue;
         if (respect_gitignore && should_ignore_path(path))
@@ -1084,366 +1323,52 @@ void add_directory_tree_with_depth(const char* base_dir, int current_depth)
 
     closedir(dir);
 }
-/** Compare function for sorting file paths */
-int compare_file_paths(const void* a, const void* b)
-{
-    const FileInfo* file_a = (const FileInfo*)a;
-    const FileInfo* file_b = (const FileInfo*)b;
-    return strcmp(file_a->path, file_b->path);
-}
-
-/** Find common prefix of all files in tree */
-char* find_common_prefix(void)
+/** Generate and add file tree to output */
+void generate_file_tree(void)
 {
-    if (file_tree_count == 0)
+    if (g_file_tree.count == 0)
     {
-        return arena_strdup_safe(&g_arena, ".");
+        return;
     }
 
-    /* Start with the first file's directory */
-    char* prefix = arena_strdup_safe(&g_arena, file_tree[0].path);
-    char* last_slash = NULL;
+    begin_output_section();
+    outvec_printf(&g_out, "<file_tree>\n");
+    file_tree_render(&g_file_tree, &g_out, tree_max_depth);
+    outvec_printf(&g_out, "</file_tree>\n\n");
+    end_output_section("file_tree");
+}
+/**
+ * Check if file stream contains binary data
+ *
+ * Detects null bytes and non-printable characters, rewinds stream.
+ */
+bool is_binary(FILE* file)
+{
+    /* Pre-condition: file must be non-NULL and opened in binary read mode */
+    assert(file != NULL);
 
-    /* Find directory part */
-    last_slash = strrchr(prefix, '/');
-    if (last_slash != NULL)
+    char buffer[BINARY_CHECK_SIZE];
+    size_t bytes_read;
+    long original_pos = ftell(file);
+    /* Check if ftell failed (e.g., on a pipe/socket) */
+    if (original_pos == -1)
     {
-        *last_slash = '\0';
+        /* Cannot reliably check or rewind; assume not binary or handle error. */
+        /* For now, let's assume it's not binary if we can't check. */
+        /* Alternatively, could return an error or a specific status. */
+        return false;
     }
-    else
+    /* Read a chunk from the beginning */
+    /* No need to rewind here, ftell already gives position. Seek back later. */
+    bytes_read = fread(buffer, 1, BINARY_CHECK_SIZE, file);
+    /* Check for read error */
+    if (ferror(file))
     {
-        /* If no slash, use current directory */
-        return arena_strdup_safe(&g_arena, ".");
+        fseek(file, original_pos, SEEK_SET); /* Attempt to restore position */
+        return false;                        /* Treat read error as non-binary for safety */
     }
 
-    /* Check each file to find common prefix */
-    for (int i = 1; i < file_tree_count; i++)
-    {
-        char* path = file_tree[i].path;
-        int j;
-
-        /* Find common prefix */
-        for (j = 0; prefix[j] && path[j]; j++)
-        {
-            if (prefix[j] != path[j])
-            {
-                break;
-            }
-        }
-
-        /* Truncate to common portion */
-        prefix[j] = '\0';
-
-        /* Find last directory separator */
-        last_slash = strrchr(prefix, '/');
-        if (last_slash != NULL)
-        {
-            *last_slash = '\0';
-        }
-        else
-        {
-            /* If no common directory, use current directory */
-            return arena_strdup_safe(&g_arena, ".");
-        }
-    }
-
-    /* If prefix ends up empty, use current directory */
-    if (prefix[0] == '\0')
-    {
-        return arena_strdup_safe(&g_arena, ".");
-    }
-
-    return prefix;
-}
-
-/** Print tree node with indentation */
-void print_tree_node(const char* path, int level, bool is_last, const char* prefix)
-{
-    /* Print indentation */
-    fprintf(tree_file, "%s", prefix);
-
-    /* Print node connector */
-    if (level > 0)
-    {
-        fprintf(tree_file, is_last ? "└── " : "├── ");
-    }
-
-    /* Print the filename part (after the last slash) */
-    const char* filename = strrchr(path, '/');
-    if (filename)
-    {
-        fprintf(tree_file, "%s\n", filename + 1);
-    }
-    else
-    {
-        fprintf(tree_file, "%s\n", path);
-    }
-}
-
-/** Build directory structure recursively */
-void build_tree_recursive(char** paths, int count, int level, const char* prefix)
-{
-    if (count <= 0 || level >= tree_max_depth)
-    {
-        return;
-    }
-
-    typedef struct TreeEntry
-    {
-        int start;
-        int end;
-        bool is_dir;
-    } TreeEntry;
-
-    TreeEntry entries[MAX_FILES];
-    int entry_count = 0;
-
-    for (int i = 0; i < count && entry_count < MAX_FILES;)
-    {
-        TreeEntry* entry = &entries[entry_count];
-        entry->start = i;
-
-        char* path = paths[i];
-        char* slash = strchr(path, '/');
-
-        if (slash)
-        {
-            entry->is_dir = true;
-            int dir_len = (int)(slash - path);
-            int j = i + 1;
-
-            while (j < count)
-            {
-                char* other = paths[j];
-                if (strncmp(other, path, dir_len) == 0 && other[dir_len] == '/')
-                {
-                    j++;
-                }
-                else
-                {
-                    break;
-                }
-            }
-
-            entry->end = j;
-        }
-        else
-        {
-            entry->is_dir = false;
-            entry->end = i + 1;
-        }
-
-        entry_count++;
-        i = entry->end;
-    }
-
-    for (int idx = 0; idx < entry_count; idx++)
-    {
-        TreeEntry* entry = &entries[idx];
-        bool is_last = (idx == entry_count - 1);
-
-        fprintf(tree_file, "%s%s", prefix, is_last ? "└── " : "├── ");
-
-        if (entry->is_dir)
-        {
-            char* name_source = paths[entry->start];
-            char* slash = strchr(name_source, '/');
-            int dir_len = slash ? (int)(slash - name_source) : (int)strlen(name_source);
-
-            fprintf(tree_file, "%.*s\n", dir_len, name_source);
-
-            if (level + 1 >= tree_max_depth)
-            {
-                continue;
-            }
-
-            char child_prefix[MAX_PATH];
-            snprintf(child_prefix, sizeof(child_prefix), "%s%s", prefix, is_last ? "    " : "│   ");
-
-            char* child_paths[MAX_FILES];
-            int child_count = 0;
-            for (int j = entry->start; j < entry->end && child_count < MAX_FILES; j++)
-            {
-                char* child = strchr(paths[j], '/');
-                if (child && child[1] != '\0')
-                {
-                    child_paths[child_count++] = child + 1;
-                }
-            }
-
-            build_tree_recursive(child_paths, child_count, level + 1, child_prefix);
-        }
-        else
-        {
-            fprintf(tree_file, "%s\n", paths[entry->start]);
-        }
-    }
-}
-
-/** Generate and add file tree to output */
-void generate_file_tree(void)
-{
-    if (file_tree_count == 0)
-    {
-        return;
-    }
-
-    /* Create a temporary file for the tree */
-    strcpy(tree_file_path, "/tmp/llm_ctx_tree_XXXXXX");
-    int fd = mkstemp(tree_file_path);
-    if (fd == -1)
-    {
-        return;
-    }
-
-    tree_file = fdopen(fd, "w");
-    if (!tree_file)
-    {
-        close(fd);
-        return;
-    }
-
-    /* Sort files for easier tree generation */
-    qsort(file_tree, file_tree_count, sizeof(FileInfo), compare_file_paths);
-
-    /* Find common prefix */
-    char* common_prefix = find_common_prefix();
-    int prefix_len = strlen(common_prefix);
-
-    /* Set relative paths and collect non-directory paths */
-    char* paths[MAX_FILES];
-    int path_count = 0;
-
-    for (int i = 0; i < file_tree_count; i++)
-    {
-        const char* path = file_tree[i].path;
-
-        /* Skip directories, we only want files */
-        if (file_tree[i].is_dir)
-        {
-            continue;
-        }
-
-        /* If path starts with common prefix, skip it for relative path */
-        if (strncmp(path, common_prefix, prefix_len) == 0)
-        {
-            if (path[prefix_len] == '/')
-            {
-                file_tree[i].relative_path = arena_strdup_safe(&g_arena, path + prefix_len + 1);
-            }
-            else
-            {
-                file_tree[i].relative_path = arena_strdup_safe(&g_arena, path + prefix_len);
-            }
-        }
-        else
-        {
-            file_tree[i].relative_path = arena_strdup_safe(&g_arena, path);
-        }
-
-        /* Add to paths array for tree building */
-        if (file_tree[i].relative_path && path_count < MAX_FILES)
-        {
-            paths[path_count++] = file_tree[i].relative_path;
-        }
-    }
-
-    /* Print the root directory */
-    fprintf(tree_file, "%s\n", common_prefix);
-
-    /* Build the tree recursively */
-    build_tree_recursive(paths, path_count, 0, "");
-
-    /* common_prefix was allocated from the arena; no explicit free needed */
-
-    /* Close tree file */
-    fclose(tree_file);
-
-    /* Add file tree to the main output */
-    fprintf(temp_file, "<file_tree>\n");
-
-    /* Copy tree file content */
-    FILE* f = fopen(tree_file_path, "r");
-    if (f)
-    {
-        char buffer[4096];
-        size_t bytes_read;
-
-        while ((bytes_read = fread(buffer, 1, sizeof(buffer), f)) > 0)
-        {
-            fwrite(buffer, 1, bytes_read, temp_file);
-        }
-
-        fclose(f);
-    }
-
-    fprintf(temp_file, "</file_tree>\n\n");
-
-    /* Don't remove tree file yet - FileRank might need it later */
-    /* Tree file will be cleaned up in cleanup() function */
-
-    /* Clear relative path pointers */
-    for (int i = 0; i < file_tree_count; i++)
-    {
-        file_tree[i].relative_path = NULL;
-    }
-}
-/**
- * Check if file stream contains binary data
- *
- * Detects null bytes and non-printable characters, rewinds stream.
- */
-bool is_binary(FILE* file)
-{
-    /* Pre-condition: file must be non-NULL and opened in binary read mode */
-    assert(file != NULL);
-
-    char buffer[BINARY_CHECK_SIZE];
-    size_t bytes_read;
-    long original_pos = ftell(file);
-    /* Check if ftell failed (e.g., on a pipe/socket) */
-    if (original_pos == -1)
-    {
-        /* Cannot reliably check or rewind; assume not binary or handle error. */
-        /* For now, let's assume it's not binary if we can't check. */
-        /* Alternatively, could return an error or a specific status. */
-        return false;
-    }
-    bool likely_binary = false;
-
-    /* Read a chunk from the beginning */
-    /* No need to rewind here, ftell already gives position. Seek back later. */
-    bytes_read = fread(buffer, 1, BINARY_CHECK_SIZE, file);
-    /* Check for read error */
-    if (ferror(file))
-    {
-        fseek(file, original_pos, SEEK_SET); /* Attempt to restore position */
-        return false;                        /* Treat read error as non-binary for safety */
-    }
-
-    if (bytes_read > 0)
-    {
-        /* Check for Null Bytes (strongest indicator) and specific non-whitespace */
-        /* C0 control codes (0x01-0x08, 0x0B, 0x0C, 0x0E-0x1F). */
-        /* This combined check avoids locale issues with isprint() and handles */
-        /* common binary file characteristics efficiently. */
-        for (size_t i = 0; i < bytes_read; i++)
-        {
-            unsigned char c = (unsigned char)buffer[i];
-            if (c == '\0')
-            {
-                likely_binary = true;
-                break; /* Found null byte, definitely binary */
-            }
-            /* Check for control characters excluding common whitespace (TAB, LF, CR) */
-            if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
-            {
-                likely_binary = true;
-                break; /* Found suspicious control code */
-            }
-        }
-        /* No need for goto, loop completion handles the non-binary case. */
-    }
+    bool likely_binary = is_binary_buffer(buffer, bytes_read);
 
     /* Restore original file position. Check for fseek error. */
     if (fseek(file, original_pos, SEEK_SET) != 0)
@@ -1500,11 +1425,34 @@ void show_help(void)
     printf("                 Shows warning if exceeded (use -r to auto-select files)\n");
     printf("  --token-budget=N      Set token budget limit (default: 96000)\n");
     printf("  --token-model=MODEL   Set model for token counting (default: gpt-4o)\n");
+    printf("  --token-top=N         List the N largest rows of the token breakdown and fold the\n");
+    printf("                        rest into one (default: %d; 0 lists every row)\n",
+           TOKEN_DIAG_DEFAULT_TOP);
+    printf("  --tail-tokens=N       Keep only the last N tokens of stdin, in bounded memory\n");
+    printf("  --since=UUID|last     Send only files changed since a saved prompt, as diffs when\n");
+    printf("                        smaller, and list the unchanged ones\n");
+    printf("  -j, --jobs=N          Walk directories and tokenize on N threads (default: CPU cores)\n");
+    printf("  --no-cache            Do not read or update the token/FileRank cache\n");
+    printf("  --stream              Write each file as soon as it is counted (stdout or -o FILE,\n");
+    printf("                        never the clipboard); with -r, stop at the token budget\n");
+    printf("  --estimate[=PCT]      Estimate tokens from byte classes instead of tokenizing, unless\n");
+    printf("                        the estimate is within PCT%% of the budget (default: 10)\n");
+    printf("  --queue-depth=N       Read up to N files at once ahead of ranking and assembly, via\n");
+    printf("                        io_uring on Linux (default: %d; 0 reads each on first use)\n",
+           FILE_LOAD_DEFAULT_DEPTH);
+    printf("  --timings[=FILE]      Report phase times and I/O counters on stderr, or as JSON\n");
+    printf("                        to FILE (- for stderr)\n");
+    printf("  --git-index[=untracked] List directories from the git index instead of walking\n");
+    printf("                        them (tracked files only, .gitignore not consulted);\n");
+    printf("                        =untracked also walks for untracked, unignored files\n");
     printf("  --filerank-debug      Show FileRank scoring details (requires -r flag)\n");
     printf("  --filerank-weight=W   Set FileRank weights (requires -r flag)\n");
     printf("                        Format: path:2,content:1,size:0.05,tfidf:10\n");
     printf("  --filerank-cutoff=SPEC Set FileRank score threshold (requires -r flag)\n");
     printf("                        Format: ratio:0.125, topk:10, percentile:75, auto\n");
+    printf("  --chunks[=LINES]      With -r, rank and include functions and sections of at most\n");
+    printf("                        LINES lines (default: %d) instead of whole files\n",
+           CHUNK_DEFAULT_LINES);
     printf("  -k, --keywords=SPEC   Boost specific keywords in FileRank scoring (requires -r)\n");
     printf("                        Format: token1:factor1,token2:factor2 or token1,token2\n");
     printf("                        Factors are multiplied by 64 (e.g., factor 2 = 128x boost)\n");
@@ -1566,193 +1514,124 @@ void show_help(void)
     exit(0);
 }
 
+/* First block of stdin: reject binary input and pick the fence language */
+static bool classify_stdin_block(const char* data, size_t len, void* user)
+{
+    char* content_type = user;
+    if (is_binary_buffer(data, len < BINARY_CHECK_SIZE ? len : BINARY_CHECK_SIZE))
+    {
+        return false;
+    }
+
+    /* Content type from the first line (as fgets would read it) */
+    char first_line[1024];
+    size_t first_len = 0;
+    while (first_len < sizeof(first_line) - 1 && first_len < len)
+    {
+        char c = data[first_len];
+        first_line[first_len++] = c;
+        if (c == '\n')
+        {
+            break;
+        }
+    }
+    first_line[first_len] = '\0';
+
+    /* Content type detection logic */
+    if (strstr(first_line, "diff --git") == first_line ||
+        strstr(first_line, "commit ") == first_line || strstr(first_line, "index ") == first_line ||
+        strstr(first_line, "--- a/") == first_line)
+    {
+        strcpy(content_type, "diff");
+    }
+    else if (first_line[0] == '{' || first_line[0] == '[')
+    {
+        strcpy(content_type, "json");
+    }
+    else if (strstr(first_line, "<?xml") == first_line || strstr(first_line, "<") != NULL)
+    {
+        strcpy(content_type, "xml");
+    }
+    else if (first_line[0] == '#' || strstr(first_line, "```") != NULL)
+    {
+        strcpy(content_type, "markdown");
+    }
+    return true;
+}
+
 /** Process raw content from stdin as single file */
 /* WHY: Handles piped input from commands like git/cat with proper
- * binary detection and content type recognition for LLM formatting */
+ * binary detection and content type recognition for LLM formatting.
+ * The input is classified on its first block and counted chunk by chunk
+ * while the rest arrives (see stdinpipe.h), so a large pipe is mostly
+ * counted by the time it ends and assembly reuses that count. */
 bool process_stdin_content(void)
 {
-    char buffer[4096];
-    size_t bytes_read;
-    FILE* content_file_write = NULL;
-    FILE* content_file_read = NULL;
-    bool found_content = false;
-    char* stdin_content_buffer = NULL;      /* Buffer to hold content if not binary */
-    const char* content_to_register = NULL; /* Points to buffer or placeholder */
-    char content_type[32] = "";             /* Detected content type */
-    bool buffer_filled_completely = false;  /* Flag to detect truncation */
-    bool truncation_warning_issued = false; /* Ensure warning is printed only once */
-
-    /* Create a temporary file to store the content */
-    char content_path[MAX_PATH];
-    strcpy(content_path, "/tmp/llm_ctx_content_XXXXXX");
-    int fd = mkstemp(content_path);
-    if (fd == -1)
-    {
-        perror("Failed to create temporary file for stdin");
+    char content_type[32] = ""; /* Detected content type */
+
+    /* --estimate may never need the tokenizer; --tail-tokens always does */
+    StdinPipeOptions opts = {
+        .tok = NULL,
+        .jobs = g_jobs,
+        .max_bytes = STDIN_BUFFER_SIZE - 1,
+        .tail_tokens = g_tail_tokens,
+        .first_block = classify_stdin_block,
+        .user = content_type,
+    };
+    if (g_tail_tokens > 0 || !g_estimate)
+    {
+        opts.tok = context_tokenizer();
+    }
+    if (g_tail_tokens > 0 && !opts.tok)
+    {
+        fprintf(stderr, "Error: --tail-tokens needs the tokenizer, which could not be loaded\n");
         return false;
     }
 
-    content_file_write = fdopen(fd, "wb"); /* Open in binary write mode */
-    if (!content_file_write)
+    StdinPipeResult in;
+    if (!stdin_pipe_read(STDIN_FILENO, &opts, &g_arena, &in))
     {
-        perror("Failed to open temporary file for writing");
-        close(fd);
-        unlink(content_path);
+        perror("Error reading from stdin");
         return false;
     }
 
-    /* Read all data from stdin and save to temp file */
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+    if (in.truncated && g_tail_tokens > 0)
     {
-        fwrite(buffer, 1, bytes_read, content_file_write);
-        found_content = true;
+        fprintf(stderr,
+                "Warning: The last %zu tokens of standard input exceed the buffer size (%d MB); "
+                "only its end was kept.\n",
+                g_tail_tokens, STDIN_BUFFER_SIZE / (1024 * 1024));
+    }
+    else if (in.truncated)
+    {
+        fprintf(stderr, "Warning: Standard input exceeded buffer size (%d MB) and was truncated.\n",
+                STDIN_BUFFER_SIZE / (1024 * 1024));
+    }
+    if (in.dropped > 0)
+    {
+        debug_printf("--tail-tokens: dropped the first %zu bytes of stdin", in.dropped);
     }
-    fclose(content_file_write); /* Close write handle */
 
-    /* Check if we actually got any content. If not, treat as empty input. */
-    if (!found_content)
+    /* Common path for registration */
+    SpecialFile* sf;
+    if (in.discarded)
     {
-        /* Register stdin_content with empty content */
-        content_to_register = "";
-        strcpy(content_type, ""); /* No type for empty */
-        /* Register stdin_content with empty content */
-        content_to_register = "";
-        strcpy(content_type, ""); /* No type for empty */
-        /* content_file_read remains NULL */
+        /* The content itself is not kept */
+        content_type[0] = '\0';
+        sf = output_file_callback("stdin_content", content_type, "[Binary file content skipped]",
+                                  strlen("[Binary file content skipped]"));
     }
     else
     {
-        /* Content was found, reopen the temp file for reading */
-        content_file_read = fopen(content_path, "rb");
-        if (!content_file_read)
-        {
-            perror("Failed to reopen temporary file for reading");
-            unlink(content_path);
-            return false;
-        }
-
-        /* Check if the content is binary */
-        if (is_binary(content_file_read))
-        {
-            content_to_register = "[Binary file content skipped]";
-            strcpy(content_type, ""); /* No type for binary */
-        }
-        else
-        {
-            /* Not binary, determine content type and read content */
-            rewind(content_file_read); /* Rewind after binary check */
-            char first_line[1024] = "";
-            if (fgets(first_line, sizeof(first_line), content_file_read) != NULL)
-            {
-                /* Content type detection logic */
-                if (strstr(first_line, "diff --git") == first_line ||
-                    strstr(first_line, "commit ") == first_line ||
-                    strstr(first_line, "index ") == first_line ||
-                    strstr(first_line, "--- a/") == first_line)
-                {
-                    strcpy(content_type, "diff");
-                }
-                else if (first_line[0] == '{' || first_line[0] == '[')
-                {
-                    strcpy(content_type, "json");
-                }
-                else if (strstr(first_line, "<?xml") == first_line ||
-                         strstr(first_line, "<") != NULL)
-                {
-                    strcpy(content_type, "xml");
-                }
-                else if (first_line[0] == '#' || strstr(first_line, "```") != NULL)
-                {
-                    strcpy(content_type, "markdown");
-                }
-            }
-
-            /* Allocate buffer and read the full content */
-            rewind(content_file_read); /* Rewind again before full read */
-            stdin_content_buffer = arena_push_array_safe(&g_arena, char, STDIN_BUFFER_SIZE);
-            if (!stdin_content_buffer)
-            {
-                /* Post-condition: Allocation failed */
-                assert(stdin_content_buffer == NULL);
-                perror("Failed to allocate memory for stdin content");
-                fclose(content_file_read);
-                unlink(content_path);
-                return false;
-            }
-
-            size_t total_read = 0;
-            while (total_read < STDIN_BUFFER_SIZE - 1)
-            {
-                size_t space_left = STDIN_BUFFER_SIZE - 1 - total_read;
-                /* Read either a full buffer or just enough to fill stdin_content_buffer */
-                size_t bytes_to_read = (space_left < sizeof(buffer)) ? space_left : sizeof(buffer);
-
-                bytes_read = fread(buffer, 1, bytes_to_read, content_file_read);
-
-                if (bytes_read > 0)
-                {
-                    memcpy(stdin_content_buffer + total_read, buffer, bytes_read);
-                    total_read += bytes_read;
-
-                    /* Check if we've filled the buffer exactly */
-                    if (total_read == STDIN_BUFFER_SIZE - 1)
-                    {
-                        buffer_filled_completely = true;
-                        break; /* Exit loop to check if there's more data */
-                    }
-                }
-                else
-                {
-                    /* Check for read error */
-                    if (ferror(content_file_read))
-                    {
-                        perror("Error reading from temporary stdin file");
-                        /* Consider this a failure, cleanup will happen below */
-                        /* Allocation from arena will be cleaned up globally */
-                        fclose(content_file_read);
-                        unlink(content_path);
-                        return false;
-                    }
-                    /* EOF reached before buffer was full */
-                    break;
-                }
-            }
-            stdin_content_buffer[total_read] = '\0'; /* Null-terminate */
-
-            /* Check for truncation if the buffer was filled */
-            if (buffer_filled_completely)
-            {
-                /* Try reading one more byte to see if input was longer */
-                int next_char = fgetc(content_file_read);
-                if (next_char != EOF)
-                {
-                    /* More data exists - input was truncated */
-                    fprintf(
-                        stderr,
-                        "Warning: Standard input exceeded buffer size (%d MB) and was truncated.\n",
-                        STDIN_BUFFER_SIZE / (1024 * 1024));
-                    truncation_warning_issued = true;
-                    /* Put the character back (optional, but good practice) */
-                    ungetc(next_char, content_file_read);
-                }
-                /* Post-condition: Checked for data beyond buffer limit */
-                assert(truncation_warning_issued == (next_char != EOF));
-            }
-
-            content_to_register = stdin_content_buffer;
-        }
+        sf = output_file_callback("stdin_content", content_type, in.data, in.len);
     }
-
-    /* Common path for registration and cleanup */
-    output_file_callback("stdin_content", content_type, content_to_register);
-
-    /* Clean up resources */
-    if (content_file_read)
-    { /* Only close if it was opened */
-        fclose(content_file_read);
+    if (sf && in.counted && !in.discarded)
+    {
+        sf->counted = true;
+        sf->count_from = in.count_from;
+        sf->count_to = in.count_to;
+        sf->tokens = in.tokens;
     }
-    unlink(content_path); /* Always remove temp file */
-    /* Buffer allocated from arena persists until cleanup */
 
     /* Increment files found so we don't error out */
     files_found++;
@@ -1761,7 +1640,9 @@ bool process_stdin_content(void)
 }
 
 /* Function to register a callback for a special file */
-void output_file_callback(const char* name, const char* type, const char* content)
+/* content is referenced, not copied: it must live until the output is written */
+SpecialFile* output_file_callback(const char* name, const char* type, const char* content,
+                                  size_t len)
 {
     /* Pre-condition: validate inputs */
     assert(name != NULL);
@@ -1772,16 +1653,16 @@ void output_file_callback(const char* name, const char* type, const char* conten
     assert(num_special_files < 10);
     if (num_special_files >= 10)
     {
-        return;
+        return NULL;
     }
 
     /* Store the special file information */
-    strcpy(special_files[num_special_files].filename, name);
-    strcpy(special_files[num_special_files].type, type);
-    special_files[num_special_files].content = arena_strdup_safe(&g_arena, content);
-
-    /* Invariant: memory was allocated successfully */
-    assert(special_files[num_special_files].content != NULL);
+    SpecialFile* sf = &special_files[num_special_files];
+    memset(sf, 0, sizeof(*sf));
+    strcpy(sf->filename, name);
+    strcpy(sf->type, type);
+    sf->content = content;
+    sf->len = len;
 
     num_special_files++;
 
@@ -1789,23 +1670,12 @@ void output_file_callback(const char* name, const char* type, const char* conten
     assert(num_special_files > 0);
 
     /* Add to processed files list for content output and tree display */
-    if (num_processed_files < MAX_FILES)
+    if (add_to_processed_files(name, 0, 0))
     {
-        processed_files[num_processed_files].path = arena_strdup_safe(&g_arena, name);
-        processed_files[num_processed_files].start_line = 0;
-        processed_files[num_processed_files].end_line = 0;
-        /* Check allocation immediately */
-        if (!processed_files[num_processed_files].path)
-        {
-            fatal("Out of memory duplicating special file name: %s", name);
-        }
-        num_processed_files++;
-
         /* Also add to the file tree structure */
-        // REVIEW: Replaced assert with fatal() call on allocation failure for consistency
-        // and robustness, normalizing the OOM failure path.
         add_to_file_tree(name); /* Handles special "stdin_content" case */
     }
+    return sf;
 }
 
 /** Collect file for processing without outputting content */
@@ -1820,38 +1690,34 @@ bool collect_file(const char* filepath, int start_line, int end_line)
     struct stat statbuf;
     // Check if it's a regular file and readable
     // lstat check is slightly redundant as caller likely did it, but safe.
-    if (lstat(filepath, &statbuf) == 0 && S_ISREG(statbuf.st_mode) && access(filepath, R_OK) == 0)
+    timing_count(COUNTER_LSTAT, 1);
+    if (lstat(filepath, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
     {
-        if (num_processed_files < MAX_FILES)
-        {
-            processed_files[num_processed_files].path = arena_strdup_safe(&g_arena, filepath);
-            processed_files[num_processed_files].start_line = start_line;
-            processed_files[num_processed_files].end_line = end_line;
-            /* Check allocation immediately */
-            if (!processed_files[num_processed_files].path)
-            {
-                /* Use fatal for consistency on OOM */
-                fatal("Out of memory duplicating file path in collect_file: %s", filepath);
-            }
-            num_processed_files++;
-            files_found++; // Increment count only for files we will output content for
-            return true;
-        }
-        else
-        {
-            // Too many files - log warning?
-            fprintf(stderr, "Warning: Maximum number of files (%d) exceeded. Skipping %s\n",
-                    MAX_FILES, filepath);
-            return false; // Indicate that we couldn't process it
-        }
+        return collect_regular_file(filepath, start_line, end_line);
+    }
+    // Not a regular file, don't add to processed_files for content output.
+    return true;
+}
+
+/** Collect a path the caller already knows is a regular file */
+static bool collect_regular_file(const char* filepath, int start_line, int end_line)
+{
+    if (file_already_processed(filepath, start_line, end_line))
+    {
+        return true;
+    }
+
+    /* WHY: no access() probe; readability is settled by the one open() that
+     * loads the file's FileMeta, and unreadable files emit nothing */
+    if (add_to_processed_files(filepath, start_line, end_line))
+    {
+        files_found++; // Increment count only for files we will output content for
     }
-    // Not a regular readable file, don't add to processed_files for content output.
-    // Return true because it's not an error, just skipping content for this path.
     return true;
 }
 
 /** Output file content with fenced code blocks for LLM */
-bool output_file_content(const ProcessedFile* file_info, FILE* output)
+bool output_file_content(ProcessedFile* file_info, OutputVec* out)
 {
     /* Ensure the file context block is opened before writing file content */
     open_file_context_if_needed();
@@ -1868,209 +1734,645 @@ bool output_file_content(const ProcessedFile* file_info, FILE* output)
     {
         if (strcmp(filepath, special_files[i].filename) == 0)
         {
-            fprintf(output, "File: %s", filepath);
+            size_t fragment_start = outvec_size(out);
+            outvec_printf(out, "File: %s", filepath);
             if (file_info->start_line > 0 || file_info->end_line > 0)
             {
                 if (file_info->end_line > 0)
                 {
-                    fprintf(output, " (lines %d-%d)", file_info->start_line, file_info->end_line);
+                    outvec_printf(out, " (lines %d-%d)", file_info->start_line,
+                                  file_info->end_line);
                 }
                 else
                 {
-                    fprintf(output, " (lines %d-)", file_info->start_line);
+                    outvec_printf(out, " (lines %d-)", file_info->start_line);
                 }
             }
-            fprintf(output, "\n");
+            outvec_printf(out, "\n");
             /* Check if the content is the binary placeholder */
             if (strcmp(special_files[i].content, "[Binary file content skipped]") == 0)
             {
-                fprintf(output, "%s\n", special_files[i].content);
+                outvec_printf(out, "%s\n", special_files[i].content);
             }
             else
             {
                 /* Format with code fences for non-binary special files */
-                fprintf(output, "```%s\n", special_files[i].type);
-                fprintf(output, "%s", special_files[i].content);
-                fprintf(output, "```\n");
+                outvec_printf(out, "```%s\n", special_files[i].type);
+                special_files[i].header_len = outvec_size(out) - fragment_start;
+                outvec_ref(out, special_files[i].content, special_files[i].len);
+                outvec_printf(out, "```\n");
             }
-            fprintf(output, "----------------------------------------\n");
+            outvec_printf(out, "----------------------------------------\n");
             return true;
         }
     }
 
     /* Not a special file, process normally */
 
-    /* Check if path is a directory - skip it if so */
-    struct stat statbuf;
-    if (lstat(filepath, &statbuf) == 0 && S_ISDIR(statbuf.st_mode))
+    /* WHY: the body is referenced straight from a read-only mapping; it is
+     * never copied until the final writev() or the tokenizer's gather.
+     * FileRank has usually loaded it already. Directories and unreadable
+     * files fail to load and are skipped silently. */
+    FileMeta* meta = file_info->meta;
+    if (!file_meta_load(meta, filepath, out))
     {
-        return true; /* Skip directories silently */
+        return true;
     }
+    const char* data = meta->data;
+    size_t len = meta->size;
 
-    /* Check if file exists and is readable before attempting to open */
-    if (access(filepath, R_OK) != 0)
+    if (meta->binary)
     {
-        /* Don't print error for non-readable files, just skip */
+        outvec_printf(out, "File: %s\n", filepath);
+        outvec_printf(out, "[Binary file content skipped]\n");
+        outvec_printf(out, "----------------------------------------\n");
         return true;
     }
 
-    /* Open in binary read mode for binary detection */
-    FILE* file = fopen(filepath, "rb");
-    if (!file)
+    /* File is not binary, output its content with fences */
+    /* WHY: one formatted header and a referenced footer per file; with
+     * --chunks there are thousands of fragments and each printf costs two
+     * vsnprintf() passes and an iovec entry */
+    static const char footer[] = "```\n----------------------------------------\n";
+    if (file_info->diff)
     {
-        /* Should not happen due to access check, but handle anyway */
-        return true;
+        /* --since: what changed since the earlier prompt */
+        if (file_info->start_line == 0 && file_info->end_line == 0)
+        {
+            outvec_printf(out, "File: %s (diff since %s)\n```diff\n", filepath, g_since_uuid);
+        }
+        else if (file_info->end_line > 0)
+        {
+            outvec_printf(out, "File: %s (lines %d-%d, diff since %s)\n```diff\n", filepath,
+                          file_info->start_line, file_info->end_line, g_since_uuid);
+        }
+        else
+        {
+            outvec_printf(out, "File: %s (lines %d-, diff since %s)\n```diff\n", filepath,
+                          file_info->start_line, g_since_uuid);
+        }
+        outvec_ref(out, file_info->diff, file_info->diff_len);
     }
-
-    /* Check if the file is binary */
-    if (is_binary(file))
+    else if (file_info->start_line == 0 && file_info->end_line == 0)
     {
-        fprintf(output, "File: %s\n", filepath);
-        fprintf(output, "[Binary file content skipped]\n");
-        fprintf(output, "----------------------------------------\n");
+        outvec_printf(out, "File: %s\n```\n", filepath);
+        outvec_ref(out, data, len);
     }
     else
     {
-        /* File is not binary, output its content with fences */
-        fprintf(output, "File: %s", filepath);
-        if (file_info->start_line > 0 || file_info->end_line > 0)
+        if (file_info->end_line > 0)
         {
-            if (file_info->end_line > 0)
-            {
-                fprintf(output, " (lines %d-%d)", file_info->start_line, file_info->end_line);
-            }
-            else
-            {
-                fprintf(output, " (lines %d-)", file_info->start_line);
-            }
+            outvec_printf(out, "File: %s (lines %d-%d)\n```\n", filepath, file_info->start_line,
+                          file_info->end_line);
+        }
+        else
+        {
+            outvec_printf(out, "File: %s (lines %d-)\n```\n", filepath, file_info->start_line);
         }
-        fprintf(output, "\n");
-        fprintf(output, "```\n");
+        size_t from, to;
+        file_meta_line_range(meta, file_info->start_line, file_info->end_line, &from, &to);
+        outvec_ref(out, data + from, to - from);
+    }
 
-        /* Read and write the file contents */
-        char buffer[4096];
-        size_t bytes_read;
-        /* Ensure we read from the beginning after the binary check */
-        rewind(file);
+    /* Close the code fence and add a separator */
+    outvec_ref(out, footer, sizeof(footer) - 1);
+    return true;
+}
 
-        if (file_info->start_line == 0 && file_info->end_line == 0)
+/** Add user instructions to output if provided */
+void add_user_instructions(const char* instructions)
+{
+    if (!instructions || !instructions[0])
+    {
+        return;
+    }
+
+    begin_output_section();
+    outvec_printf(&g_out, "<user_instructions>\n");
+    outvec_printf(&g_out, "%s\n", instructions);
+    outvec_printf(&g_out, "</user_instructions>\n\n");
+    end_output_section("user_instructions");
+}
+
+/**
+ * Walker filter: gitignore (global list plus the directory's scope chain) and
+ * CLI exclude rules.
+ * WHY: runs on walker threads; both checks only read pattern tables that are
+ * loaded before the walk or owned by an immutable scope.
+ */
+static bool walk_keep_entry(const char* path, WalkKind kind, void* dir_ctx, void* user)
+{
+    (void)user;
+    if (respect_gitignore && should_ignore_scoped(dir_ctx, path, kind == WALK_DIR))
+    {
+        return false;
+    }
+    return !matches_cli_exclude(path);
+}
+
+/** Walker hook: pick up a nested .gitignore when entering its directory */
+static void* walk_enter_dir(const char* path, int dir_fd, void* parent_ctx, void* user)
+{
+    (void)user;
+    return (void*)ignore_scope_enter(parent_ctx, path, dir_fd);
+}
+
+/** Add walked entries (sorted by path) to the tree and collect files whose name matches pattern */
+static void collect_walk_entries(const WalkEntry* entries, size_t count, const char* pattern)
+{
+    /* GLOB_MATCH_NAME is fnmatch(FNM_PATHNAME | FNM_PERIOD) on the basename: '*' does not
+     * match '/' or a leading '.', in line with shell globbing and .gitignore behavior */
+    GlobSet names;
+    glob_set_init(&names, &g_arena);
+    glob_set_add(&names, pattern, GLOB_MATCH_NAME);
+    const GlobPattern* name_pattern = &names.patterns[0];
+
+    /* Entries arrive sorted by path, so collection order is deterministic */
+    for (size_t i = 0; i < count; i++)
+    {
+        const WalkEntry* entry = &entries[i];
+
+        // Add any non-ignored entry to the file tree structure
+        add_file_tree_entry(entry->path, entry->kind == WALK_DIR);
+
+        if (entry->kind == WALK_FILE &&
+            glob_pattern_matches(name_pattern, entry->name, strlen(entry->name)))
+        {
+            collect_regular_file(entry->path, 0, 0);
+        }
+    }
+}
+
+/** Index of dir's worktree, loading it on first use; NULL (warned once) if there is none */
+static const GitIndex* git_index_for(const char* dir, const char* real_dir)
+{
+    if (g_git_index_loaded)
+    {
+        size_t root_len = strlen(g_git_index.root);
+        bool inside = strncmp(real_dir, g_git_index.root, root_len) == 0 &&
+                      (real_dir[root_len] == '\0' || real_dir[root_len] == '/' || root_len == 1);
+        /* A nested repository (submodule) has an index of its own */
+        char nested[PATH_MAX + 8];
+        snprintf(nested, sizeof(nested), "%s/.git", real_dir);
+        if (inside && (strcmp(real_dir, g_git_index.root) == 0 || access(nested, F_OK) != 0))
+        {
+            return &g_git_index;
+        }
+        git_index_free(&g_git_index);
+        g_git_index_loaded = false;
+    }
+
+    const char* error = NULL;
+    if (!git_index_load(dir, &g_git_index, &error))
+    {
+        if (!g_git_index_warned)
+        {
+            fprintf(stderr, "Warning: --git-index: %s: %s; walking the directory instead\n", dir,
+                    error);
+            g_git_index_warned = true;
+        }
+        return NULL;
+    }
+    g_git_index_loaded = true;
+    debug_printf("Loaded git index of %s (%zu entries)", g_git_index.root, g_git_index.count);
+    return &g_git_index;
+}
+
+typedef struct
+{
+    WalkEntry* entries;
+    size_t count;
+    size_t cap;
+} WalkEntryList;
+
+/** Append "<base>/<rel[0..rel_len)>" to list, allocated in g_arena */
+static void walk_entry_list_push(WalkEntryList* list, const char* base, const char* rel,
+                                 size_t rel_len, WalkKind kind)
+{
+    if (list->count == list->cap)
+    {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        WalkEntry* grown = arena_push_array_safe(&g_arena, WalkEntry, cap);
+        if (list->count)
+        {
+            memcpy(grown, list->entries, list->count * sizeof(WalkEntry));
+        }
+        list->entries = grown;
+        list->cap = cap;
+    }
+    size_t base_len = strlen(base);
+    char* path = arena_push_array_safe(&g_arena, char, base_len + 1 + rel_len + 1);
+    memcpy(path, base, base_len);
+    path[base_len] = '/';
+    memcpy(path + base_len + 1, rel, rel_len);
+    path[base_len + 1 + rel_len] = '\0';
+    list->entries[list->count++] =
+        (WalkEntry){.path = path, .name = strrchr(path, '/') + 1, .kind = kind};
+}
+
+static int compare_walk_entry_paths(const void* a, const void* b)
+{
+    return strcmp(((const WalkEntry*)a)->path, ((const WalkEntry*)b)->path);
+}
+
+/**
+ * List what the git index tracks below base_dir as walk entries, sorted the
+ * way walk_tree() sorts them, so the directory walk and every .gitignore
+ * check are skipped. Paths are spelled "<base_dir>/<rel>" as the walker
+ * spells them. Directories are implied by their files, and a CLI-excluded
+ * directory prunes everything below it as it does in the walk. Submodules
+ * appear as directories that are not entered, symlinks as tree-only
+ * entries. Returns false if base_dir is not in a readable worktree.
+ */
+static bool git_index_walk_entries(const char* base_dir, WalkEntryList* list)
+{
+    char real_dir[PATH_MAX];
+    if (!realpath(base_dir, real_dir))
+    {
+        return false;
+    }
+    const GitIndex* index = git_index_for(base_dir, real_dir);
+    if (!index)
+    {
+        return false;
+    }
+
+    /* Everything below base_dir shares the prefix "<base_dir relative to the root>/" */
+    size_t root_len = strlen(index->root);
+    const char* rel_dir = real_dir + (root_len == 1 ? 0 : root_len);
+    if (*rel_dir == '/')
+    {
+        rel_dir++;
+    }
+    char prefix[PATH_MAX + 1];
+    snprintf(prefix, sizeof(prefix), "%s%s", rel_dir, *rel_dir ? "/" : "");
+    size_t prefix_len = strlen(prefix);
+
+    const char* prev = "";   /* rel path of the previous entry */
+    size_t prev_dir_len = 0; /* Length of its directories that were emitted, with the '/' */
+    size_t skip_len = 0;     /* rel prefix of an excluded directory, with the '/' */
+    for (size_t i = git_index_lower_bound(index, prefix); i < index->count; i++)
+    {
+        const char* path = index->entries[i].path;
+        if (strncmp(path, prefix, prefix_len) != 0)
         {
-            while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            break; /* Sorted: nothing further lies below base_dir */
+        }
+        const char* rel = path + prefix_len;
+        if (skip_len && strncmp(rel, prev, skip_len) == 0)
+        {
+            continue;
+        }
+        skip_len = 0;
+
+        /* WHY: the index is sorted, so the files of a directory are contiguous
+         * and only directories not shared with the previous entry are new */
+        size_t common = 0;
+        for (size_t j = 0; j < prev_dir_len && rel[j] == prev[j]; j++)
+        {
+            if (rel[j] == '/')
             {
-                fwrite(buffer, 1, bytes_read, output);
+                common = j + 1;
             }
         }
-        else
+        prev = rel;
+        prev_dir_len = common;
+
+        bool excluded = false;
+        for (const char* slash = strchr(rel + common, '/'); slash; slash = strchr(slash + 1, '/'))
         {
-            int current_line = 1;
-            while (fgets(buffer, sizeof(buffer), file))
+            size_t len = (size_t)(slash - rel);
+            walk_entry_list_push(list, base_dir, rel, len, WALK_DIR);
+            if (matches_cli_exclude(list->entries[list->count - 1].path))
             {
-                if (current_line >= file_info->start_line &&
-                    (file_info->end_line == 0 || current_line <= file_info->end_line))
-                {
-                    fputs(buffer, output);
-                }
-
-                if (strchr(buffer, '\n'))
-                {
-                    current_line++;
-                }
+                list->count--;
+                skip_len = len + 1;
+                excluded = true;
+                break;
             }
+            prev_dir_len = len + 1;
+        }
+        if (excluded)
+        {
+            continue;
         }
 
-        /* Close the code fence and add a separator */
-        fprintf(output, "```\n");
-        fprintf(output, "----------------------------------------\n");
+        uint32_t type = index->entries[i].mode & GIT_MODE_TYPE_MASK;
+        WalkKind kind = WALK_OTHER;
+        if (type == GIT_MODE_FILE)
+        {
+            kind = WALK_FILE;
+        }
+        else if (type == GIT_MODE_GITLINK)
+        {
+            kind = WALK_DIR;
+        }
+        walk_entry_list_push(list, base_dir, rel, strlen(rel), kind);
+        if (matches_cli_exclude(list->entries[list->count - 1].path))
+        {
+            list->count--;
+        }
     }
-
-    fclose(file);
     return true;
 }
 
-/** Add user instructions to output if provided */
-void add_user_instructions(const char* instructions)
+/** Everything one enumeration of a directory produced, sorted by path */
+typedef struct
 {
-    if (!instructions || !instructions[0])
+    const WalkEntry* entries;
+    size_t count;
+    WalkResult walk; /* Storage behind entries when they came straight from walk_tree() */
+    bool has_walk;
+} DirListing;
+
+/** Enumerate base_dir and everything below it, from the git index and/or a walk */
+static void list_directory(const char* base_dir, DirListing* listing)
+{
+    memset(listing, 0, sizeof(*listing));
+    WalkEntryList tracked = {0};
+    bool from_index =
+        g_git_index_mode != GIT_INDEX_OFF && git_index_walk_entries(base_dir, &tracked);
+    if (from_index && g_git_index_mode == GIT_INDEX_TRACKED)
+    {
+        qsort(tracked.entries, tracked.count, sizeof(WalkEntry), compare_walk_entry_paths);
+        listing->entries = tracked.entries;
+        listing->count = tracked.count;
+        return;
+    }
+
+    /* .gitignore files between the CWD and base_dir apply below it too */
+    WalkOptions opts = {.filter = walk_keep_entry,
+                        .enter_dir = walk_enter_dir,
+                        .root_ctx = (void*)ignore_scope_ancestors(base_dir)};
+    if (walk_tree(base_dir, g_jobs, &opts, &listing->walk) != 0)
     {
+        fatal("Out of memory walking directory: %s", base_dir);
+    }
+    /* Scopes are only consulted during the walk itself */
+    ignore_scopes_release();
+
+    if (!from_index)
+    {
+        listing->entries = listing->walk.entries;
+        listing->count = listing->walk.count;
+        listing->has_walk = true;
         return;
     }
 
-    fprintf(temp_file, "<user_instructions>\n");
-    fprintf(temp_file, "%s\n", instructions);
-    fprintf(temp_file, "</user_instructions>\n\n");
+    /* --git-index=untracked: the walk adds untracked, unignored files; tracked
+     * files under ignored directories come from the index alone */
+    size_t base_len = strlen(base_dir);
+    for (size_t i = 0; i < listing->walk.count; i++)
+    {
+        const WalkEntry* entry = &listing->walk.entries[i];
+        walk_entry_list_push(&tracked, base_dir, entry->path + base_len + 1,
+                             strlen(entry->path) - base_len - 1, entry->kind);
+    }
+    walk_result_free(&listing->walk);
+    qsort(tracked.entries, tracked.count, sizeof(WalkEntry), compare_walk_entry_paths);
+    size_t kept = 0;
+    for (size_t i = 0; i < tracked.count; i++)
+    {
+        if (kept == 0 || strcmp(tracked.entries[kept - 1].path, tracked.entries[i].path) != 0)
+        {
+            tracked.entries[kept++] = tracked.entries[i];
+        }
+    }
+    listing->entries = tracked.entries;
+    listing->count = kept;
 }
 
-/** Recursively search directories for pattern matches */
-void find_recursive(const char* base_dir, const char* pattern)
+static void dir_listing_free(DirListing* listing)
 {
-    DIR* dir;
-    struct dirent* entry;
-    struct stat statbuf;
-    char path[MAX_PATH];
-    /* FNM_PATHNAME: Makes wildcard '*' not match '/'. */
-    /* FNM_PERIOD: Makes wildcard '*' not match a leading '.' in the filename part. */
-    /* Include FNM_PERIOD to align with typical shell globbing and .gitignore behavior */
-    /* where '*' usually doesn't match hidden files unless explicitly started with '.'. */
-    int fnmatch_flags = FNM_PATHNAME | FNM_PERIOD;
+    if (listing->has_walk)
+    {
+        walk_result_free(&listing->walk);
+    }
+    memset(listing, 0, sizeof(*listing));
+}
 
-    /* Try to open directory - silently return if can't access */
-    if (!(dir = opendir(base_dir)))
-        return;
-    /* Process each entry in the directory */
-    while ((entry = readdir(dir)) != NULL)
+/* Recursive arguments sharing a base directory, served by one enumeration */
+#define WALK_GROUP_MAX_PATTERNS 64 /* One bit per pattern in each entry's mask */
+
+typedef struct
+{
+    const char* base_dir;
+    GlobSet names;      /* One GLOB_MATCH_NAME pattern per argument, in argument order */
+    bool* consumed;     /* Pattern i has been collected */
+    int remaining;      /* Patterns not collected yet; the listing is freed at 0 */
+    bool listed;
+    DirListing listing;
+    uint64_t* masks;    /* Per entry: bit i set if pattern i matches its name */
+} WalkGroup;
+
+static WalkGroup* g_walk_groups = NULL;
+static int g_walk_group_count = 0;
+static int g_walk_groups_cap = 0;
+
+/**
+ * Split a recursive pattern into the directory before its "**" and the name
+ * pattern after it, defaulting to "." and "*"
+ */
+static void split_recursive_pattern(const char* pattern, char* base_dir, char* file_pattern)
+{
+    strcpy(base_dir, ".");
+    file_pattern[0] = '\0';
+
+    /* Extract base directory and file pattern */
+    const char* recursive_marker = strstr(pattern, "**");
+    if (recursive_marker)
     {
-        /* Skip the special directory entries */
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-            continue;
+        /* Copy base directory (everything before **) */
+        size_t base_len = recursive_marker - pattern;
+        if (base_len > 0)
+        {
+            /* Bounds check for base_dir */
+            if (base_len >= MAX_PATH)
+            {
+                fprintf(stderr, "Warning: Pattern base directory too long, truncating\n");
+                base_len = MAX_PATH - 1;
+            }
+            strncpy(base_dir, pattern, base_len);
+            base_dir[base_len] = '\0';
+
+            /* Remove trailing slash if present */
+            if (base_len > 0 && base_dir[base_len - 1] == '/')
+            {
+                base_dir[base_len - 1] = '\0';
+            }
+        }
 
-        /* Always skip the .git directory to mirror Git's behavior */
-        /* This prevents descending into the Git internal directory structure. */
-        if (strcmp(entry->d_name, ".git") == 0)
+        const char* pattern_start = recursive_marker + 2;
+        if (*pattern_start == '/')
+        {
+            pattern_start++;
+        }
+        /* Bounds-checked copy for file_pattern */
+        size_t pattern_len = strlen(pattern_start);
+        if (pattern_len >= MAX_PATH)
         {
-            continue; // Skip .git entirely
+            fprintf(stderr, "Warning: File pattern too long, truncating\n");
+            pattern_len = MAX_PATH - 1;
         }
+        strncpy(file_pattern, pattern_start, pattern_len);
+        file_pattern[pattern_len] = '\0';
+    }
 
-        /* Construct the full path of the current entry */
-        snprintf(path, sizeof(path), "%s/%s", base_dir, entry->d_name);
+    /* Set defaults for empty values */
+    if (strlen(base_dir) == 0)
+    {
+        strcpy(base_dir, ".");
+    }
 
-        /* Get entry information - skip if can't stat */
-        if (lstat(path, &statbuf) == -1)
-            continue;
+    if (strlen(file_pattern) == 0)
+    {
+        strcpy(file_pattern, "*");
+    }
+}
 
-        /* Check if the path should be ignored *before* processing */
-        if (respect_gitignore && should_ignore_path(path))
+/**
+ * Find every argument process_pattern() will hand to find_recursive()
+ * (directories and "**" patterns) and group those sharing a base directory,
+ * so patterns for the .c and the .h files below src/ read src/ once and each
+ * file is routed to every pattern its name matches.
+ * WHY: directories with different spellings are not merged, and a base
+ * nested in another still gets its own walk: walking from the outer base
+ * would apply .gitignore files between the two that a walk from the inner
+ * base never reads.
+ */
+static void plan_recursive_walks(char* const* patterns, int count)
+{
+    char base_dir[MAX_PATH];
+    char file_pattern[MAX_PATH];
+    for (int i = 0; i < count; i++)
+    {
+        const char* pattern = patterns[i];
+        struct stat statbuf;
+        timing_count(COUNTER_LSTAT, 1);
+        if (lstat(pattern, &statbuf) == 0 && S_ISDIR(statbuf.st_mode))
+        {
+            snprintf(base_dir, sizeof(base_dir), "%s", pattern);
+            strcpy(file_pattern, "*");
+        }
+        else if (strstr(pattern, "**") && !strchr(pattern, ':'))
+        {
+            /* ':' may start a line range, which process_pattern() tries first */
+            split_recursive_pattern(pattern, base_dir, file_pattern);
+        }
+        else
         {
-            continue; /* Skip ignored files/directories */
+            continue; /* Plain file, line range or glob() pattern */
         }
 
-        /* Check CLI exclude patterns */
-        if (matches_cli_exclude(path))
+        WalkGroup* group = NULL;
+        for (int g = 0; g < g_walk_group_count; g++)
+        {
+            if (strcmp(g_walk_groups[g].base_dir, base_dir) == 0 &&
+                g_walk_groups[g].names.count < WALK_GROUP_MAX_PATTERNS)
+            {
+                group = &g_walk_groups[g];
+                break;
+            }
+        }
+        if (!group)
         {
-            continue; /* Skip CLI-excluded files/directories */
+            g_walk_groups = grow_table(g_walk_groups, g_walk_group_count, &g_walk_groups_cap,
+                                       sizeof(WalkGroup));
+            group = &g_walk_groups[g_walk_group_count++];
+            memset(group, 0, sizeof(*group));
+            group->base_dir = arena_strdup_safe(&g_arena, base_dir);
+            glob_set_init(&group->names, &g_arena);
         }
+        glob_set_add(&group->names, file_pattern, GLOB_MATCH_NAME);
+        group->remaining++;
+    }
 
-        // Add any non-ignored entry to the file tree structure
-        add_to_file_tree(path);
+    for (int g = 0; g < g_walk_group_count; g++)
+    {
+        WalkGroup* group = &g_walk_groups[g];
+        group->consumed = arena_push_array_safe(&g_arena, bool, (size_t)group->names.count);
+        memset(group->consumed, 0, (size_t)group->names.count * sizeof(bool));
+    }
+}
 
-        /* If entry is a directory, recurse into it */
-        if (S_ISDIR(statbuf.st_mode))
+/** The planned group that still owes pattern for base_dir, with the pattern's slot */
+static WalkGroup* walk_group_for(const char* base_dir, const char* pattern, int* slot)
+{
+    for (int g = 0; g < g_walk_group_count; g++)
+    {
+        WalkGroup* group = &g_walk_groups[g];
+        if (group->names.count < 2 || strcmp(group->base_dir, base_dir) != 0)
         {
-            find_recursive(path, pattern);
+            continue; /* A lone pattern gains nothing from routing */
         }
-        /* If entry is a regular file, check if it matches the pattern */
-        else if (S_ISREG(statbuf.st_mode))
+        for (int i = 0; i < group->names.count; i++)
         {
-            /* Match filename against the pattern using appropriate flags */
-            if (fnmatch(pattern, entry->d_name, fnmatch_flags) == 0)
+            if (!group->consumed[i] && strcmp(group->names.patterns[i].pattern, pattern) == 0)
             {
-                // Collect the file for content output ONLY if it matches and is readable
-                // collect_file now handles adding to processed_files and files_found
-                collect_file(path, 0, 0);
+                *slot = i;
+                return group;
             }
         }
     }
+    return NULL;
+}
 
-    closedir(dir);
+/** Search base_dir and everything below it for files whose name matches pattern */
+void find_recursive(const char* base_dir, const char* pattern)
+{
+    int slot = 0;
+    WalkGroup* group = walk_group_for(base_dir, pattern, &slot);
+    if (!group)
+    {
+        DirListing listing;
+        list_directory(base_dir, &listing);
+        collect_walk_entries(listing.entries, listing.count, pattern);
+        dir_listing_free(&listing);
+        return;
+    }
+
+    if (!group->listed)
+    {
+        /* One enumeration for the whole group: the tree gets every entry now,
+         * and each file is routed to all patterns its name matches */
+        list_directory(base_dir, &group->listing);
+        group->listed = true;
+        const DirListing* listing = &group->listing;
+        group->masks = arena_push_array_safe(&g_arena, uint64_t, listing->count + 1);
+        int hits[WALK_GROUP_MAX_PATTERNS];
+        for (size_t i = 0; i < listing->count; i++)
+        {
+            const WalkEntry* entry = &listing->entries[i];
+            add_file_tree_entry(entry->path, entry->kind == WALK_DIR);
+            group->masks[i] = 0;
+            if (entry->kind != WALK_FILE)
+            {
+                continue;
+            }
+            int found = glob_set_match(&group->names, entry->name, hits);
+            for (int h = 0; h < found; h++)
+            {
+                group->masks[i] |= (uint64_t)1 << hits[h];
+            }
+        }
+    }
+
+    /* Collect in the order a walk of its own would have: this pattern's files, sorted */
+    const DirListing* listing = &group->listing;
+    uint64_t bit = (uint64_t)1 << slot;
+    for (size_t i = 0; i < listing->count; i++)
+    {
+        if (group->masks[i] & bit)
+        {
+            collect_regular_file(listing->entries[i].path, 0, 0);
+        }
+    }
+
+    group->consumed[slot] = true;
+    if (--group->remaining == 0)
+    {
+        dir_listing_free(&group->listing);
+    }
 }
 
 /** Process glob pattern to find matching files */
@@ -2151,6 +2453,7 @@ bool process_pattern(const char* pattern)
 
     /* First check if the pattern is a directory */
     struct stat statbuf;
+    timing_count(COUNTER_LSTAT, 1);
     if (lstat(pattern, &statbuf) == 0 && S_ISDIR(statbuf.st_mode))
     {
         /* It's a directory - add it to tree and recursively find all files */
@@ -2167,6 +2470,7 @@ bool process_pattern(const char* pattern)
 
     if (has_range)
     {
+        timing_count(COUNTER_LSTAT, 1);
         if (lstat(base_path, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
         {
             if (respect_gitignore && should_ignore_path(base_path))
@@ -2183,68 +2487,18 @@ bool process_pattern(const char* pattern)
     /* Check if this is a recursive pattern */
     if (strstr(pattern, "**/") != NULL || strstr(pattern, "**") != NULL)
     {
-        char base_dir[MAX_PATH] = ".";
-        char file_pattern[MAX_PATH] = "";
+        char base_dir[MAX_PATH];
+        char file_pattern[MAX_PATH];
+        split_recursive_pattern(pattern, base_dir, file_pattern);
 
-        /* Extract base directory and file pattern */
-        const char* recursive_marker = strstr(pattern, "**");
-        if (recursive_marker)
-        {
-            /* Copy base directory (everything before **) */
-            size_t base_len = recursive_marker - pattern;
-            if (base_len > 0)
-            {
-                /* Bounds check for base_dir */
-                if (base_len >= MAX_PATH)
-                {
-                    fprintf(stderr, "Warning: Pattern base directory too long, truncating\n");
-                    base_len = MAX_PATH - 1;
-                }
-                strncpy(base_dir, pattern, base_len);
-                base_dir[base_len] = '\0';
-
-                /* Remove trailing slash if present */
-                if (base_len > 0 && base_dir[base_len - 1] == '/')
-                {
-                    base_dir[base_len - 1] = '\0';
-                }
-            }
-
-            const char* pattern_start = recursive_marker + 2;
-            if (*pattern_start == '/')
-            {
-                pattern_start++;
-            }
-            /* Bounds-checked copy for file_pattern */
-            size_t pattern_len = strlen(pattern_start);
-            if (pattern_len >= MAX_PATH)
-            {
-                fprintf(stderr, "Warning: File pattern too long, truncating\n");
-                pattern_len = MAX_PATH - 1;
-            }
-            strncpy(file_pattern, pattern_start, pattern_len);
-            file_pattern[pattern_len] = '\0';
-        }
-
-        /* Set defaults for empty values */
-        if (strlen(base_dir) == 0)
-        {
-            strcpy(base_dir, ".");
-        }
-
-        if (strlen(file_pattern) == 0)
-        {
-            strcpy(file_pattern, "*");
-        }
-
-        /* Use custom recursive directory traversal */
-        find_recursive(base_dir, file_pattern);
-    }
-    else
-    {
-        /* For standard patterns, use the system glob() function */
-        glob_t glob_result;
-        int glob_flags = GLOB_TILDE; /* Support ~ expansion for home directory */
+        /* Use custom recursive directory traversal */
+        find_recursive(base_dir, file_pattern);
+    }
+    else
+    {
+        /* For standard patterns, use the system glob() function */
+        glob_t glob_result;
+        int glob_flags = GLOB_TILDE; /* Support ~ expansion for home directory */
 
 /* Add brace expansion support if available on this platform */
 #ifdef GLOB_BRACE
@@ -2258,15 +2512,44 @@ bool process_pattern(const char* pattern)
             return false;
         }
 
+        /* Scopes of the directory holding the previous match; glob() sorts its
+         * results, so siblings share one chain. A path named outright only
+         * answers to the CWD's .gitignore files, as before. */
+        bool scoped = strpbrk(pattern, "*?[{") != NULL;
+        const IgnoreScope* scope = NULL;
+        const char* scope_path = NULL;
+        size_t scope_len = 0;
+
         /* Process each matched file */
         for (size_t i = 0; i < glob_result.gl_pathc; i++)
         {
             const char* path = glob_result.gl_pathv[i];
+            struct stat statbuf;
+            timing_count(COUNTER_LSTAT, 1);
+            bool exists = lstat(path, &statbuf) == 0;
 
-            // Check ignore rules before adding
-            if (respect_gitignore && should_ignore_path(path))
+            // Check ignore rules, including .gitignore files between the CWD and path
+            if (respect_gitignore && !scoped)
             {
-                continue;
+                if (should_ignore_entry(path, exists && S_ISDIR(statbuf.st_mode)))
+                {
+                    continue;
+                }
+            }
+            else if (respect_gitignore)
+            {
+                const char* slash = strrchr(path, '/');
+                size_t dir_len = slash ? (size_t)(slash - path) : 0;
+                if (!scope_path || dir_len != scope_len || strncmp(path, scope_path, dir_len) != 0)
+                {
+                    scope = ignore_scope_ancestors(path);
+                    scope_path = path;
+                    scope_len = dir_len;
+                }
+                if (should_ignore_scoped(scope, path, exists && S_ISDIR(statbuf.st_mode)))
+                {
+                    continue;
+                }
             }
 
             // Check CLI exclude patterns
@@ -2279,22 +2562,23 @@ bool process_pattern(const char* pattern)
             add_to_file_tree(path);
 
             // Collect file content if it's a regular file
-            struct stat statbuf;
-            if (lstat(path, &statbuf) == 0 && S_ISREG(statbuf.st_mode))
+            if (exists && S_ISREG(statbuf.st_mode))
             {
                 // collect_file now handles adding to processed_files and files_found,
                 // and checks for readability.
                 collect_file(path, 0, 0);
             }
             // If it's a directory matched by glob, descend into it
-            else if (S_ISDIR(statbuf.st_mode))
+            else if (exists && S_ISDIR(statbuf.st_mode))
             {
                 // Recursively find all files within this directory, respecting gitignore
                 // Use "*" as the pattern to match all files within.
                 find_recursive(path, "*");
+                scope_path = NULL; /* The walk released every scope */
             }
         }
 
+        ignore_scopes_release();
         globfree(&glob_result);
     }
 
@@ -2304,6 +2588,27 @@ bool process_pattern(const char* pattern)
 
 /** Copy buffer content to system clipboard */
 bool copy_to_clipboard(const char* buffer)
+{
+    OutputVec out;
+    outvec_init(&out, &g_arena);
+    outvec_ref(&out, buffer, strlen(buffer));
+    bool ok = copy_output_to_clipboard(&out);
+    outvec_free(&out);
+    return ok;
+}
+
+/** Write the assembled segments to stdout, after anything already buffered */
+static void write_output_to_stdout(const OutputVec* out)
+{
+    fflush(stdout);
+    if (outvec_write_fd(out, STDOUT_FILENO) != 0)
+    {
+        perror("Failed to write output");
+    }
+}
+
+/** Copy the assembled segments to the system clipboard */
+static bool copy_output_to_clipboard(const OutputVec* out)
 {
     const char* cmd = NULL;
 #ifdef __APPLE__
@@ -2333,17 +2638,28 @@ bool copy_to_clipboard(const char* buffer)
         return false;
     }
 
+    timing_begin(TIMING_CLIPBOARD);
     FILE* pipe = popen(cmd, "w");
     if (!pipe)
     {
+        timing_end(TIMING_CLIPBOARD);
         perror("popen failed for clipboard command");
         return false;
     }
 
-    fwrite(buffer, 1, strlen(buffer), pipe);
+    /* WHY: A clipboard command that is missing or exits early must not kill
+     * the run with SIGPIPE halfway through the write; the write just fails. */
+    struct sigaction ignore_pipe, saved_pipe;
+    memset(&ignore_pipe, 0, sizeof(ignore_pipe));
+    ignore_pipe.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore_pipe, &saved_pipe);
+    outvec_write_file(out, pipe);
 
     /* Close the pipe and check status */
-    if (pclose(pipe) == -1)
+    int status = pclose(pipe);
+    sigaction(SIGPIPE, &saved_pipe, NULL);
+    timing_end(TIMING_CLIPBOARD);
+    if (status == -1)
     {
         perror("pclose failed for clipboard command");
         return false;
@@ -2363,9 +2679,29 @@ void cleanup(void)
         user_instructions = NULL;
     }
 
+    /* Loads still in flight map into g_out, so they finish before it is freed */
+    file_loader_finish(g_file_loader);
+    g_file_loader = NULL;
+
     for (int i = 0; i < num_processed_files; i++)
     {
         processed_files[i].path = NULL;
+        if (processed_files[i].meta)
+        {
+            file_meta_free(processed_files[i].meta);
+        }
+    }
+
+    for (int i = 0; i < g_num_unchanged_files; i++)
+    {
+        file_meta_free(g_unchanged_files[i].meta);
+    }
+    prompt_store_files_free(&g_since_table);
+
+    if (g_git_index_loaded)
+    {
+        git_index_free(&g_git_index);
+        g_git_index_loaded = false;
     }
 
     /* Free special file content */
@@ -2374,18 +2710,18 @@ void cleanup(void)
         special_files[i].content = NULL;
     }
 
-    /* Remove temporary file */
-    if (strlen(temp_file_path) > 0)
-    {
-        unlink(temp_file_path);
-    }
+    /* Drop the output segments and unmap file bodies */
+    outvec_free(&g_out);
 
-    /* Remove tree file if it exists */
-    if (strlen(tree_file_path) > 0)
+    if (g_tokenizer)
     {
-        unlink(tree_file_path);
+        llm_tokenizer_close(g_tokenizer);
+        g_tokenizer = NULL;
     }
 
+    /* Persist what this run learned about each file */
+    filecache_close();
+
     arena_destroy(&g_arena);
 }
 /* Define command-line options for getopt_long */
@@ -2416,6 +2752,17 @@ static const struct option long_options[] = {
     {"filerank-cutoff", required_argument, 0, 406},   /* FileRank cutoff specification */
     {"exclude", required_argument, 0, 'x'},           /* Exclude pattern */
     {"read", no_argument, 0, 407},                    /* Output to stdout instead of clipboard (get subcommand) */
+    {"jobs", required_argument, 0, 'j'},              /* Worker threads for walking/tokenizing */
+    {"no-cache", no_argument, 0, 408},                /* Skip the persistent file cache */
+    {"stream", no_argument, 0, 409},                  /* Write output as it is assembled */
+    {"timings", optional_argument, 0, 410},           /* Phase timings and I/O counters */
+    {"git-index", optional_argument, 0, 411},         /* Enumerate directories from .git/index */
+    {"chunks", optional_argument, 0, 412},            /* Rank and include chunks of files */
+    {"estimate", optional_argument, 0, 413},          /* Estimate tokens away from the budget */
+    {"queue-depth", required_argument, 0, 414},       /* Files loaded concurrently */
+    {"token-top", required_argument, 0, 415},         /* Rows of the token breakdown */
+    {"tail-tokens", required_argument, 0, 416},       /* Keep only the end of stdin */
+    {"since", required_argument, 0, 417},             /* Delta against a saved prompt */
     {0, 0, 0, 0}                                      /* Terminator */
 };
 static bool s_flag_used = false;                 /* Track if -s was used */
@@ -2659,35 +3006,6 @@ static void handle_output_arg(const char* arg)
         fatal("Out of memory duplicating output filename");
 }
 
-/** Check if character is word boundary */
-static bool is_word_boundary(char c)
-{
-    return !isalnum(c) && c != '_';
-}
-
-/** Case-insensitive word boundary search */
-static int count_word_hits(const char* haystack, const char* needle)
-{
-    int count = 0;
-    size_t needle_len = strlen(needle);
-    const char* pos = haystack;
-
-    while ((pos = strcasestr(pos, needle)) != NULL)
-    {
-        /* Check word boundaries */
-        bool start_ok = (pos == haystack || is_word_boundary(*(pos - 1)));
-        bool end_ok = is_word_boundary(*(pos + needle_len));
-
-        if (start_ok && end_ok)
-        {
-            count++;
-        }
-        pos++;
-    }
-
-    return count;
-}
-
 /** Tokenize query into lowercase words */
 static char** tokenize_query(const char* query, int* num_tokens)
 {
@@ -2845,9 +3163,145 @@ static int compare_filerank(const void* a, const void* b)
     return 0;
 }
 
+/* A distinct query term and its postings: (file, content hits) for every file
+ * whose content contains it */
+typedef struct
+{
+    const char* term; /* Lowercase, from tokenize_query() */
+    int doc_freq;     /* Files whose path or content contains the term */
+    int* docs;
+    int* hits;
+    int count;
+    int cap;
+} RankTerm;
+
+static void rank_term_add_posting(RankTerm* term, int doc, int hits)
+{
+    if (term->count == term->cap)
+    {
+        int cap = term->cap ? term->cap * 2 : 16;
+        int* docs = realloc(term->docs, (size_t)cap * sizeof(int));
+        int* new_hits = docs ? realloc(term->hits, (size_t)cap * sizeof(int)) : NULL;
+        if (!docs || !new_hits)
+        {
+            fatal("Out of memory building FileRank index");
+        }
+        term->docs = docs;
+        term->hits = new_hits;
+        term->cap = cap;
+    }
+    term->docs[term->count] = doc;
+    term->hits[term->count] = hits;
+    term->count++;
+}
+
+/**
+ * Count the term hits and words of one file's (line-ranged) content
+ *
+ * Loads the file's FileMeta if nothing has yet. Sets rank->bytes to the file
+ * size and *binary if the content is skipped as binary. Binary and unreadable
+ * files have no content hits. Returns the word count.
+ */
+static int rank_scan_file(const WordMatcher* matcher, FileRank* rank, int* hits, bool* binary)
+{
+    rank->bytes = 0;
+    *binary = false;
+    if (!rank->meta || !file_meta_load(rank->meta, rank->path, &g_out))
+    {
+        return 0;
+    }
+    FileMeta* meta = rank->meta;
+    rank->bytes = meta->size;
+    *binary = meta->binary;
+    if (meta->binary || meta->size == 0)
+    {
+        return 0;
+    }
+
+    size_t from, to;
+    file_meta_line_range(rank->meta, rank->start_line, rank->end_line, &from, &to);
+    return (int)word_matcher_scan(matcher, meta->data + from, to - from, hits);
+}
+
+/** True for registered pseudo-files such as stdin_content */
+static bool is_special_file(const char* path)
+{
+    for (int i = 0; i < num_special_files; i++)
+    {
+        if (strcmp(path, special_files[i].filename) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * rank_scan_file(), answered from the file cache when the file is unchanged
+ * and every term has been counted in it before
+ */
+static int rank_file_stats(const WordMatcher* matcher, const RankTerm* terms, int num_terms,
+                           FileRank* rank, int* hits)
+{
+    /* WHY: the file is loaded even on a cache hit; assembly needs its
+     * content next, and the load's fstat() doubles as the cache check */
+    bool cacheable = filecache_enabled() && rank->meta &&
+                     file_meta_load(rank->meta, rank->path, &g_out);
+    const FileSig* sig = cacheable ? &rank->meta->sig : NULL;
+    if (cacheable)
+    {
+        size_t words;
+        bool binary;
+        if (filecache_get_words(rank->path, rank->start_line, rank->end_line, sig, &words,
+                                &binary))
+        {
+            int t = 0;
+            while (!binary && t < num_terms &&
+                   filecache_get_term(rank->path, rank->start_line, rank->end_line, sig,
+                                      terms[t].term, &hits[t]))
+            {
+                t++;
+            }
+            if (binary || t == num_terms)
+            {
+                rank->bytes = rank->meta->size;
+                return (int)words;
+            }
+            memset(hits, 0, (size_t)num_terms * sizeof(int));
+        }
+    }
+
+    bool binary;
+    int words = rank_scan_file(matcher, rank, hits, &binary);
+    if (cacheable)
+    {
+        filecache_put_words(rank->path, rank->start_line, rank->end_line, sig, (size_t)words,
+                            binary);
+        for (int t = 0; t < num_terms && !binary; t++)
+        {
+            filecache_put_term(rank->path, rank->start_line, rank->end_line, sig, terms[t].term,
+                               hits[t]);
+        }
+    }
+    return words;
+}
+
+/* BM25 term saturation and length normalization, used when ranking chunks */
+#define RANK_BM25_K1 1.2
+#define RANK_BM25_B 0.75
+
+/** BM25's term frequency component, scaled into [0, 1) like a plain tf */
+static double bm25_tf(int hits, int words, double avg_words)
+{
+    double norm = RANK_BM25_K1 * (1.0 - RANK_BM25_B + RANK_BM25_B * words / avg_words);
+    return hits / (hits + norm);
+}
+
 /** Rank files using TF-IDF scoring with path/content hits */
 /* WHY: Prioritizes files with unique terms (TF-IDF) while considering
- * path relevance and penalizing large files for better context selection */
+ * path relevance and penalizing large files for better context selection.
+ * Each file is read once: one matcher sweep fills a term -> (file, hits)
+ * posting table plus per-file word counts, and all scores come from that. */
 void rank_files(const char* query, FileRank* ranks, int num_files)
 {
     /* Parse query into tokens */
@@ -2864,285 +3318,1081 @@ void rank_files(const char* query, FileRank* ranks, int num_files)
         return;
     }
 
-    /* Slice 3: First pass - calculate document frequency for each term */
-    int* doc_freq = calloc(num_tokens, sizeof(int));
-    if (!doc_freq)
+    size_t mark = arena_get_mark(&g_arena);
+
+    /* Distinct terms; term_of[j] is token j's term */
+    int* term_of = arena_push_array_safe(&g_arena, int, num_tokens);
+    const char** term_words = arena_push_array_safe(&g_arena, const char*, num_tokens);
+    RankTerm* terms = arena_push_array_safe(&g_arena, RankTerm, num_tokens);
+    int num_terms = 0;
+    for (int j = 0; j < num_tokens; j++)
+    {
+        int t = 0;
+        while (t < num_terms && strcmp(term_words[t], tokens[j]) != 0)
+        {
+            t++;
+        }
+        if (t == num_terms)
+        {
+            term_words[num_terms] = tokens[j];
+            terms[num_terms].term = tokens[j];
+            num_terms++;
+        }
+        term_of[j] = t;
+    }
+
+    WordMatcher matcher;
+    word_matcher_init(&matcher, &g_arena, term_words, num_terms);
+
+    double* token_weight = arena_push_array_safe(&g_arena, double, num_tokens);
+    for (int j = 0; j < num_tokens; j++)
     {
-        /* Fallback to basic scoring if allocation fails */
-        goto basic_scoring;
+        token_weight[j] = kw_weight_for(tokens[j]);
     }
 
+    int* hits = arena_push_array_safe(&g_arena, int, num_terms);
+    int* path_hits = arena_push_array_safe(&g_arena, int, num_terms);
+    int* total_words = arena_push_array_safe(&g_arena, int, num_files);
+    double* path_score = arena_push_array_safe(&g_arena, double, num_files);
+
+    /* Single pass: one read per file builds the posting table */
     for (int i = 0; i < num_files; i++)
     {
-        /* Track which terms appear in this document */
-        int* term_found = calloc(num_tokens, sizeof(int));
-        if (!term_found)
+        memset(hits, 0, (size_t)num_terms * sizeof(int));
+        memset(path_hits, 0, (size_t)num_terms * sizeof(int));
+        word_matcher_scan(&matcher, ranks[i].path, strlen(ranks[i].path), path_hits);
+        total_words[i] = rank_file_stats(&matcher, terms, num_terms, &ranks[i], hits);
+
+        for (int t = 0; t < num_terms; t++)
         {
-            free(doc_freq);
-            goto basic_scoring;
+            if (hits[t] > 0 || path_hits[t] > 0)
+            {
+                terms[t].doc_freq++;
+            }
+            if (hits[t] > 0)
+            {
+                rank_term_add_posting(&terms[t], i, hits[t]);
+            }
         }
 
-        /* Check path for terms */
+        path_score[i] = 0;
         for (int j = 0; j < num_tokens; j++)
         {
-            if (count_word_hits(ranks[i].path, tokens[j]) > 0)
-            {
-                term_found[j] = 1;
-            }
+            path_score[i] += token_weight[j] * path_hits[term_of[j]];
+        }
+    }
+
+    /* WHY: chunks of one file share its terms, so a plain hits/words tf lets
+     * a three-line chunk with one hit outrank the function that uses the
+     * term throughout. With --chunks, tf and idf follow BM25 instead: hits
+     * saturate and are normalized by the chunk's length against the mean. */
+    bool bm25 = g_chunk_lines > 0;
+    double avg_words = 0.0;
+    if (bm25)
+    {
+        long sum = 0;
+        int docs = 0;
+        for (int i = 0; i < num_files; i++)
+        {
+            sum += total_words[i];
+            docs += total_words[i] > 0;
         }
+        avg_words = docs > 0 ? (double)sum / docs : 1.0;
+    }
 
-        /* Check content for terms */
-        FILE* f = fopen(ranks[i].path, "r");
-        if (f && !is_binary(f))
+    /* Score from the postings */
+    double* content_hits = arena_push_array_safe(&g_arena, double, num_files);
+    double* tfidf_score = arena_push_array_safe(&g_arena, double, num_files);
+    for (int j = 0; j < num_tokens; j++)
+    {
+        const RankTerm* term = &terms[term_of[j]];
+        double w = token_weight[j];
+        double df = term->doc_freq;
+        double idf = df > 0 ? log((double)num_files / df) : 0.0;
+        if (bm25)
+        {
+            idf = log(1.0 + (num_files - df + 0.5) / (df + 0.5));
+        }
+        for (int p = 0; p < term->count; p++)
         {
-            char buffer[4096];
-            rewind(f);
-            int current_line = 1;
-            const ProcessedFile* pf = NULL;
-            for (int k = 0; k < num_processed_files; k++)
+            int d = term->docs[p];
+            content_hits[d] += w * term->hits[p];
+            if (total_words[d] > 0)
             {
-                if (strcmp(processed_files[k].path, ranks[i].path) == 0)
-                {
-                    pf = &processed_files[k];
-                    break;
-                }
+                double tf = bm25 ? bm25_tf(term->hits[p], total_words[d], avg_words)
+                                 : (double)term->hits[p] / total_words[d];
+                tfidf_score[d] += w * tf * idf;
             }
-            int start_line = pf ? pf->start_line : 0;
-            int end_line = pf ? pf->end_line : 0;
+        }
+    }
 
-            while (fgets(buffer, sizeof(buffer), f))
-            {
-                if (start_line > 0 && current_line < start_line)
-                {
-                    if (strchr(buffer, '\n'))
-                        current_line++;
-                    continue;
-                }
-                if (end_line > 0 && current_line > end_line)
-                {
-                    break;
-                }
+    for (int i = 0; i < num_files; i++)
+    {
+        /* Calculate score: TF-IDF weight + content_hits + path_weight*path_hits -
+         * size_weight*(bytes/1MiB) */
+        size_t bytes = ranks[i].bytes;
+        if (bm25 && bytes > 0 && (ranks[i].start_line > 0 || ranks[i].end_line > 0))
+        {
+            /* A chunk is penalized for its own size, not its file's */
+            size_t from, to;
+            file_meta_line_range(ranks[i].meta, ranks[i].start_line, ranks[i].end_line, &from,
+                                 &to);
+            bytes = to - from;
+        }
+        double size_penalty = g_filerank_weight_size * (bytes / (1024.0 * 1024.0));
+        ranks[i].score = tfidf_score[i] * g_filerank_weight_tfidf +
+                         content_hits[i] * g_filerank_weight_content +
+                         g_filerank_weight_path * path_score[i] - size_penalty;
+    }
 
-                for (int j = 0; j < num_tokens; j++)
-                {
-                    if (!term_found[j] && count_word_hits(buffer, tokens[j]) > 0)
-                    {
-                        term_found[j] = 1;
-                    }
-                }
+    for (int t = 0; t < num_terms; t++)
+    {
+        free(terms[t].docs);
+        free(terms[t].hits);
+    }
+    arena_set_mark(&g_arena, mark);
+}
 
-                if (strchr(buffer, '\n'))
-                    current_line++;
-            }
-            fclose(f);
+/**
+ * Queue the content of every processed file on a batch loader (see fileload.h)
+ *
+ * Ranking, chunking and assembly then find each file loaded, or wait for
+ * that one file, through file_meta_load() as before.
+ */
+static void start_content_loads(void)
+{
+    if (g_queue_depth <= 0 || num_processed_files == 0)
+    {
+        return;
+    }
+    size_t mark = arena_get_mark(&g_arena);
+    FileMeta** metas = arena_push_array_safe(&g_arena, FileMeta*, num_processed_files);
+    const char** paths = arena_push_array_safe(&g_arena, const char*, num_processed_files);
+    for (int i = 0; i < num_processed_files; i++)
+    {
+        /* Pseudo-files such as stdin_content have no file behind them */
+        bool special = is_special_file(processed_files[i].path);
+        metas[i] = special ? NULL : processed_files[i].meta;
+        paths[i] = processed_files[i].path;
+    }
+    g_file_loader = file_loader_start(metas, paths, num_processed_files, &g_out, g_queue_depth);
+    arena_set_mark(&g_arena, mark);
+}
+
+/**
+ * Replace each whole text file longer than g_chunk_lines lines with one
+ * ranged entry per chunk (see chunker.h), ahead of FileRank
+ *
+ * The chunks share the file's FileMeta, so the file is still read and mapped
+ * once; ranking, assembly, packing and the token cache then handle them as
+ * any other ranged file. Returns the number of files that were split.
+ */
+static int split_processed_files_into_chunks(void)
+{
+    ProcessedFile* split = NULL;
+    int count = 0;
+    int cap = 0;
+    int files_split = 0;
+    for (int i = 0; i < num_processed_files; i++)
+    {
+        const ProcessedFile* pf = &processed_files[i];
+        FileMeta* meta = pf->meta;
+        ChunkRange* chunks = NULL;
+        int n = 0;
+        if (pf->start_line == 0 && pf->end_line == 0 && !pf->diff && !is_special_file(pf->path) &&
+            file_meta_load(meta, pf->path, &g_out) && !meta->binary)
+        {
+            n = chunk_lines(meta->data, meta->size, g_chunk_lines, &g_arena, &chunks);
+        }
+        if (n <= 1)
+        {
+            split = grow_table(split, count, &cap, sizeof(ProcessedFile));
+            split[count++] = *pf;
+            continue;
         }
-        else if (f)
+        files_split++;
+        for (int c = 0; c < n; c++)
         {
-            fclose(f);
+            split = grow_table(split, count, &cap, sizeof(ProcessedFile));
+            split[count] = *pf;
+            split[count].start_line = chunks[c].start_line;
+            split[count].end_line = chunks[c].end_line;
+            count++;
         }
+    }
+    processed_files = split;
+    num_processed_files = count;
+    processed_files_cap = cap;
+    return files_split;
+}
 
-        /* Update document frequency counts */
-        for (int j = 0; j < num_tokens; j++)
+/* A ranked entry and where --chunks output puts it */
+typedef struct
+{
+    int group; /* Rank of the best entry of the same file */
+    int line;
+    FileRank rank;
+} ChunkOrder;
+
+static int compare_chunk_order(const void* a, const void* b)
+{
+    const ChunkOrder* ca = (const ChunkOrder*)a;
+    const ChunkOrder* cb = (const ChunkOrder*)b;
+    if (ca->group != cb->group)
+    {
+        return ca->group < cb->group ? -1 : 1;
+    }
+    return ca->line < cb->line ? -1 : ca->line > cb->line;
+}
+
+/**
+ * Reorder ranked entries so each file's chunks sit together in line order,
+ * at the position of its best-ranked chunk
+ */
+/* WHY: pack_budget() selects by score per token whatever the order, so this
+ * only changes how the selection reads. The chunks of a file are adjacent in
+ * processed_files and share its FileMeta, which identifies the file. */
+static void group_ranked_chunks(FileRank* ranks, int n)
+{
+    size_t mark = arena_get_mark(&g_arena);
+    int* head = arena_push_array_safe(&g_arena, int, num_processed_files);
+    int* best = arena_push_array_safe(&g_arena, int, num_processed_files);
+    for (int j = 0; j < num_processed_files; j++)
+    {
+        const FileMeta* meta = processed_files[j].meta;
+        head[j] = j > 0 && meta && meta == processed_files[j - 1].meta ? head[j - 1] : j;
+        best[j] = -1;
+    }
+
+    ChunkOrder* order = arena_push_array_safe(&g_arena, ChunkOrder, n);
+    for (int i = 0; i < n; i++)
+    {
+        int h = head[ranks[i].file_index];
+        if (best[h] < 0)
         {
-            if (term_found[j])
+            best[h] = i;
+        }
+        order[i].group = best[h];
+        order[i].line = ranks[i].start_line;
+        order[i].rank = ranks[i];
+    }
+    qsort(order, n, sizeof(ChunkOrder), compare_chunk_order);
+    for (int i = 0; i < n; i++)
+    {
+        ranks[i] = order[i].rank;
+    }
+    arena_set_mark(&g_arena, mark);
+}
+
+/** " (lines A-B)" for a ranged entry, "" for a whole file; for debug output */
+static const char* line_range_suffix(int start_line, int end_line, char* buf, size_t size)
+{
+    if (start_line == 0 && end_line == 0)
+    {
+        return "";
+    }
+    snprintf(buf, size, end_line > 0 ? " (lines %d-%d)" : " (lines %d-)", start_line, end_line);
+    return buf;
+}
+
+/* Most lines a --since diff may delete or insert before the file is sent whole */
+/* WHY: The edit script takes memory quadratic in this (8 MB at 2000), and a
+ * file with more changed lines than that is rarely cheaper as a diff. */
+#define SINCE_MAX_DIFF_EDITS 2000
+
+static int compare_prompt_files(const void* a, const void* b)
+{
+    const PromptFile* x = a;
+    const PromptFile* y = b;
+    int c = strcmp(x->path, y->path);
+    if (c != 0)
+    {
+        return c;
+    }
+    if (x->start_line != y->start_line)
+    {
+        return x->start_line < y->start_line ? -1 : 1;
+    }
+    return x->end_line < y->end_line ? -1 : x->end_line > y->end_line;
+}
+
+/** Entry of pf in the --since file table, if the earlier prompt had it */
+static const PromptFile* since_entry(const ProcessedFile* pf)
+{
+    if (g_since_table.count == 0 || is_special_file(pf->path))
+    {
+        return NULL;
+    }
+    PromptFile key = {0};
+    key.path = pf->path;
+    key.start_line = pf->start_line;
+    key.end_line = pf->end_line;
+    return bsearch(&key, g_since_table.files, g_since_table.count, sizeof(PromptFile),
+                   compare_prompt_files);
+}
+
+/** Resolve --since to a saved prompt and read its file table; false if it has none */
+static bool since_open(void)
+{
+    char* dir = ensure_prompts_dir(&g_arena);
+    if (!dir)
+    {
+        fatal("Error: --since needs the prompts directory");
+    }
+    char uuid[128];
+    if (strcmp(g_since, "last") == 0)
+    {
+        if (!prompt_store_last(dir, uuid, sizeof(uuid)))
+        {
+            fatal("Error: --since last: no prompt has been saved yet");
+        }
+    }
+    else
+    {
+        snprintf(uuid, sizeof(uuid), "%s", g_since);
+    }
+    if (!prompt_store_files(dir, uuid, &g_since_table))
+    {
+        /* A prompt saved before the store existed, a plain file named by UUID, has no table */
+        char legacy_path[MAX_PATH];
+        struct stat st;
+        snprintf(legacy_path, sizeof(legacy_path), "%s/%s", dir, uuid);
+        if (stat(legacy_path, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            fatal("Error: --since: no saved prompt %s", uuid);
+        }
+        memset(&g_since_table, 0, sizeof(g_since_table));
+    }
+    g_since_uuid = arena_strdup_safe(&g_arena, uuid);
+    if (!g_since_table.recorded)
+    {
+        fprintf(stderr,
+                "Warning: Prompt %s was saved without file signatures; every file is sent "
+                "in full\n",
+                uuid);
+        return false;
+    }
+    qsort(g_since_table.files, g_since_table.count, sizeof(PromptFile), compare_prompt_files);
+    return true;
+}
+
+static void add_unchanged_file(const ProcessedFile* pf)
+{
+    g_unchanged_files = grow_table(g_unchanged_files, g_num_unchanged_files,
+                                   &g_unchanged_files_cap, sizeof(ProcessedFile));
+    g_unchanged_files[g_num_unchanged_files++] = *pf;
+}
+
+/**
+ * --since, before any content is read: set aside the files whose stat()
+ * signature is the one the earlier prompt recorded
+ *
+ * Every other file the prompt had gets its entry in ProcessedFile.since,
+ * for since_compare_content() to check once the content is loaded.
+ */
+static void since_skip_unchanged(void)
+{
+    if (!since_open())
+    {
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < num_processed_files; i++)
+    {
+        ProcessedFile* pf = &processed_files[i];
+        pf->since = since_entry(pf);
+        FileSig sig;
+        if (pf->since && file_sig_for(pf->path, &sig) &&
+            memcmp(&sig, &pf->since->sig, sizeof(sig)) == 0)
+        {
+            add_unchanged_file(pf);
+            continue;
+        }
+        processed_files[kept++] = *pf;
+    }
+    num_processed_files = kept;
+}
+
+/**
+ * --since, once contents are loading: set aside the files whose content is
+ * what the earlier prompt left, and give each changed one a diff against
+ * the saved copy when the diff has fewer tokens than the content
+ */
+/* WHY: The diff and the content of every changed file are counted in one
+ * batch. Under --estimate nothing else may need the tokenizer, so byte
+ * counts stand in for the token counts there. */
+static void since_compare_content(void)
+{
+    if (!g_since_table.recorded)
+    {
+        return;
+    }
+    char* dir = ensure_prompts_dir(&g_arena);
+    size_t n = (size_t)num_processed_files;
+    TokenSpan* spans = arena_push_array_safe(&g_arena, TokenSpan, 2 * n + 1);
+    char** diffs = arena_push_array_safe(&g_arena, char*, n + 1);
+    int* diff_of = arena_push_array_safe(&g_arena, int, n + 1);
+    size_t num_diffs = 0;
+    int changed = 0, added = 0, kept = 0;
+    for (int i = 0; i < num_processed_files; i++)
+    {
+        ProcessedFile* pf = &processed_files[i];
+        if (!pf->since)
+        {
+            added += !is_special_file(pf->path);
+            processed_files[kept++] = *pf;
+            continue;
+        }
+        const char* data = NULL;
+        size_t len = 0;
+        bool text = file_meta_load(pf->meta, pf->path, &g_out) && !pf->meta->binary;
+        if (text)
+        {
+            fragment_content(pf, &data, &len);
+            StoreHash hash = prompt_store_hash(data, len);
+            if (len == pf->since->len && hash.hi == pf->since->hash.hi &&
+                hash.lo == pf->since->hash.lo)
             {
-                doc_freq[j]++;
+                add_unchanged_file(pf);
+                continue;
             }
         }
+        changed++;
+        processed_files[kept++] = *pf;
+        char* base = text && dir ? prompt_store_file_content(dir, pf->since) : NULL;
+        size_t diff_len = 0;
+        char* diff = base ? line_diff_unified(base, pf->since->len, data, len, pf->path,
+                                              SINCE_MAX_DIFF_EDITS, &diff_len)
+                          : NULL;
+        free(base);
+        if (diff)
+        {
+            spans[2 * num_diffs] = (TokenSpan){diff, diff_len, true, 0};
+            spans[2 * num_diffs + 1] = (TokenSpan){data, len, false, 0};
+            diffs[num_diffs] = diff;
+            diff_of[num_diffs++] = kept - 1;
+        }
+    }
+    num_processed_files = kept;
 
-        free(term_found);
+    LLMTokenizer* tok = g_estimate || num_diffs == 0 ? NULL : context_tokenizer();
+    bool counted = tok && llm_tokenizer_count_batch(tok, spans, 2 * num_diffs, g_jobs) == 0;
+    int sent_as_diffs = 0;
+    for (size_t d = 0; d < num_diffs; d++)
+    {
+        const TokenSpan* diff = &spans[2 * d];
+        const TokenSpan* whole = &spans[2 * d + 1];
+        if (counted ? diff->tokens < whole->tokens : diff->len < whole->len)
+        {
+            ProcessedFile* pf = &processed_files[diff_of[d]];
+            pf->diff_len = diff->len;
+            outvec_adopt(&g_out, diffs[d], diff->len, &pf->diff);
+            sent_as_diffs++;
+        }
+        else
+        {
+            free(diffs[d]);
+        }
     }
+    fprintf(stderr, "Since prompt %s: %d unchanged, %d changed (%d sent as diffs), %d new\n",
+            g_since_uuid, g_num_unchanged_files, changed, sent_as_diffs, added);
+}
 
-    /* Second pass - calculate TF-IDF scores */
-    for (int i = 0; i < num_files; i++)
+/** --since: list the files left out as unchanged, ahead of the file context */
+static void add_unchanged_manifest(void)
+{
+    if (g_num_unchanged_files == 0)
     {
-        double path_hits = 0;
-        double content_hits = 0;
-        double tfidf_score = 0;
+        return;
+    }
+    begin_output_section();
+    outvec_printf(&g_out, "<unchanged_files since=\"%s\">\n", g_since_uuid);
+    outvec_printf(&g_out, "Unchanged since that prompt, so not repeated here:\n");
+    for (int i = 0; i < g_num_unchanged_files; i++)
+    {
+        const ProcessedFile* pf = &g_unchanged_files[i];
+        char range[64];
+        outvec_printf(&g_out, "%s%s\n", pf->path,
+                      line_range_suffix(pf->start_line, pf->end_line, range, sizeof(range)));
+    }
+    outvec_printf(&g_out, "</unchanged_files>\n\n");
+    end_output_section("unchanged_files");
+}
 
-        /* Count hits in path */
-        for (int j = 0; j < num_tokens; j++)
+/** True if tiktoken's pre-tokenizer is guaranteed to split content at pos */
+/* WHY: Fragments must be counted independently (and in parallel) yet add up to
+ * the one-shot count. A cut right after '\n' and right before a byte that is
+ * neither whitespace nor '/' is always a pre-token boundary for the cl100k,
+ * o200k and gpt2 split patterns: no pattern continues a newline run into a
+ * non-space byte, and only the punctuation rule's [\r\n/]* tail can swallow a
+ * following '/'. Assembly only ever cuts at "<tag>" and "File: " lines. */
+static bool is_token_safe_cut(const OutputVec* content, size_t pos)
+{
+    if (pos == 0 || pos >= outvec_size(content))
+    {
+        return true;
+    }
+    unsigned char next = (unsigned char)outvec_byte_at(content, pos);
+    return outvec_byte_at(content, pos - 1) == '\n' && !isspace(next) && next != '/';
+}
+
+/* Consecutive fragments of the assembled context awaiting a batch count */
+typedef struct
+{
+    const OutputVec* content;
+    TokenSpan* spans;
+    size_t* starts;  /* Offset of each span in content */
+    size_t** owners; /* Where each span's count is stored; NULL for framing */
+    ProcessedFile** files; /* File whose whole fragment the span is, if any */
+    int count;
+} FragmentList;
+
+static void fragment_list_push(FragmentList* list, size_t from, size_t to, size_t* owner,
+                               ProcessedFile* file);
+
+/** Append content[from, to) to the list, merging it into the previous fragment
+ * when its start is not a safe cut */
+static void fragment_list_add(FragmentList* list, size_t from, size_t to, size_t* owner,
+                              ProcessedFile* file)
+{
+    if (to <= from)
+    {
+        return;
+    }
+    if (list->count > 0 && !is_token_safe_cut(list->content, from))
+    {
+        list->spans[list->count - 1].len += to - from;
+        list->files[list->count - 1] = NULL; /* No longer one file's fragment alone */
+        return;
+    }
+    fragment_list_push(list, from, to, owner, file);
+}
+
+/** Append content[from, to) to the list as a fragment of its own */
+static void fragment_list_push(FragmentList* list, size_t from, size_t to, size_t* owner,
+                               ProcessedFile* file)
+{
+    list->files[list->count] = file;
+    list->starts[list->count] = from;
+    list->spans[list->count].text = NULL;
+    list->spans[list->count].len = to - from;
+    list->spans[list->count].tokens = 0;
+    list->owners[list->count] = owner;
+    list->count++;
+}
+
+/** Cached token count of a file's whole fragment, if the file is unchanged */
+static bool cached_fragment_tokens(const ProcessedFile* pf, size_t len, size_t* tokens)
+{
+    return filecache_enabled() && pf->meta->readable && !pf->diff &&
+           filecache_get_tokens(pf->path, pf->start_line, pf->end_line, &pf->meta->sig,
+                                g_token_model, len, tokens);
+}
+
+/** The tokenizer of g_token_model, opened on first use */
+/* WHY: Loading libtiktoken_c and building the model's BPE table costs more
+ * than counting a small context. Runs whose fragments are all cached, or
+ * whose --estimate is far from the budget, never load it at all. */
+static LLMTokenizer* context_tokenizer(void)
+{
+    if (!g_tokenizer)
+    {
+        g_tokenizer = llm_tokenizer_open(g_token_model);
+    }
+    return g_tokenizer;
+}
+
+/** The special file whose whole fragment a span of span_len bytes is, if it
+ * was counted while it was read */
+static const SpecialFile* precounted_special_file(const ProcessedFile* pf, size_t span_len)
+{
+    if (pf->start_line != 0 || pf->end_line != 0)
+    {
+        return NULL;
+    }
+    for (int i = 0; i < num_special_files; i++)
+    {
+        const SpecialFile* sf = &special_files[i];
+        if (sf->counted && sf->header_len > 0 && sf->header_len + sf->len <= span_len &&
+            strcmp(pf->path, sf->filename) == 0)
         {
-            double w = kw_weight_for(tokens[j]);
-            path_hits += w * count_word_hits(ranks[i].path, tokens[j]);
+            return sf;
         }
+    }
+    return NULL;
+}
 
-        /* Get file size for penalty calculation */
-        struct stat st;
-        if (stat(ranks[i].path, &st) == 0)
+/** Count every fragment of the list, store each count with its owner, and return the sum */
+static size_t count_fragment_list(FragmentList* list)
+{
+    /* Whole file fragments of unchanged files keep their cached counts. A
+     * fragment of stdin counted while it was read only needs the text around
+     * that count; the two pieces start and end at safe cuts. The batch and
+     * its text copies only live for this call, in the thread's scratch arena. */
+    ARENA_SCRATCH_SCOPE(scratch, &g_arena);
+    TokenSpan* batch = arena_push_array_safe(scratch.arena, TokenSpan, 2 * list->count + 1);
+    int* batch_of = arena_push_array_safe(scratch.arena, int, 2 * list->count + 1);
+    size_t* batch_from = arena_push_array_safe(scratch.arena, size_t, 2 * list->count + 1);
+    int batch_count = 0;
+    for (int i = 0; i < list->count; i++)
+    {
+        ProcessedFile* pf = list->files[i];
+        const SpecialFile* sf = pf ? precounted_special_file(pf, list->spans[i].len) : NULL;
+        if (sf)
+        {
+            size_t start = list->starts[i];
+            size_t counted_to = sf->header_len + sf->count_to;
+            list->files[i] = NULL;
+            list->spans[i].tokens = sf->tokens;
+            batch[batch_count].len = sf->header_len + sf->count_from;
+            batch_from[batch_count] = start;
+            batch_of[batch_count++] = i;
+            batch[batch_count].len = list->spans[i].len - counted_to;
+            batch_from[batch_count] = start + counted_to;
+            batch_of[batch_count++] = i;
+            continue;
+        }
+        if (pf && (!filecache_enabled() || !pf->meta->readable || pf->diff))
         {
-            ranks[i].bytes = st.st_size;
+            list->files[i] = pf = NULL;
         }
-        else
+        if (pf && cached_fragment_tokens(pf, list->spans[i].len, &list->spans[i].tokens))
         {
-            ranks[i].bytes = 0;
+            continue;
         }
+        list->spans[i].tokens = 0;
+        batch[batch_count].len = list->spans[i].len;
+        batch_from[batch_count] = list->starts[i];
+        batch_of[batch_count++] = i;
+    }
+
+    timing_begin(TIMING_TOKENIZE);
+    for (int b = 0; b < batch_count; b++)
+    {
+        size_t len = batch[b].len;
+        char* text = arena_push_size_safe(scratch.arena, len + 1, 1);
+        outvec_gather(list->content, batch_from[b], len, text);
+        text[len] = '\0';
+        batch[b].text = text;
+        batch[b].terminated = true;
+        batch[b].tokens = 0;
+    }
+
+    if (batch_count > 0 &&
+        llm_tokenizer_count_batch(context_tokenizer(), batch, (size_t)batch_count, g_jobs) != 0)
+    {
+        fatal("Tokenizer failed to count tokens for assembled context");
+    }
+    timing_end(TIMING_TOKENIZE);
 
-        /* Read file content to count hits and calculate TF-IDF */
-        FILE* f = fopen(ranks[i].path, "r");
-        if (f)
+    for (int b = 0; b < batch_count; b++)
+    {
+        int i = batch_of[b];
+        list->spans[i].tokens += batch[b].tokens;
+        ProcessedFile* pf = list->files[i];
+        if (pf)
         {
-            /* Check if binary */
-            if (!is_binary(f))
-            {
-                /* Count total words for TF calculation */
-                int total_words = 0;
-                int* term_freq = calloc(num_tokens, sizeof(int));
+            filecache_put_tokens(pf->path, pf->start_line, pf->end_line, &pf->meta->sig,
+                                 g_token_model, list->spans[i].len, batch[b].tokens);
+        }
+    }
 
-                if (term_freq)
-                {
-                    /* Read content and count term frequencies */
-                    char buffer[4096];
-                    char buffer_copy[4096];
-                    rewind(f);
-                    while (fgets(buffer, sizeof(buffer), f))
-                    {
-                        /* Make a copy for word counting since strtok modifies the buffer */
-                        strcpy(buffer_copy, buffer);
+    size_t total = 0;
+    for (int i = 0; i < list->count; i++)
+    {
+        if (list->owners[i])
+        {
+            *list->owners[i] = list->spans[i].tokens;
+        }
+        total += list->spans[i].tokens;
+    }
+    return total;
+}
 
-                        /* Simple word count - count space-separated tokens */
-                        char* word = strtok(buffer_copy, " \t\n\r");
-                        while (word)
-                        {
-                            total_words++;
-                            word = strtok(NULL, " \t\n\r");
-                        }
+/** Split content[from, to) into the fragments account_range_tokens() counts */
+static void build_range_fragments(const OutputVec* content, size_t from, size_t to, int file_lo,
+                                  int file_hi, FragmentList* list)
+{
+    /* Sections, files, and the framing gaps around each of them */
+    int max_spans = 2 * (g_num_output_sections + (file_hi - file_lo)) + 1;
+    *list = (FragmentList){
+        .content = content,
+        .spans = arena_push_array_safe(&g_arena, TokenSpan, max_spans),
+        .starts = arena_push_array_safe(&g_arena, size_t, max_spans),
+        .owners = arena_push_array_safe(&g_arena, size_t*, max_spans),
+        .files = arena_push_array_safe(&g_arena, ProcessedFile*, max_spans),
+        .count = 0,
+    };
+    size_t cursor = from;
 
-                        /* Count term hits on original buffer */
-                        for (int j = 0; j < num_tokens; j++)
-                        {
-                            int hits = count_word_hits(buffer, tokens[j]);
-                            term_freq[j] += hits;
-                            double w = kw_weight_for(tokens[j]);
-                            content_hits += w * hits;
-                        }
-                    }
+    for (int i = 0; i < g_num_output_sections; i++)
+    {
+        OutputSection* sec = &g_output_sections[i];
+        size_t start = (size_t)sec->offset;
+        size_t end = start + sec->len;
+        if (start < cursor || end > to)
+        {
+            continue;
+        }
+        sec->tokens = 0;
+        fragment_list_add(list, cursor, start, NULL, NULL);
+        fragment_list_add(list, start, end, &sec->tokens, NULL);
+        cursor = end;
+    }
 
-                    /* Calculate TF-IDF score */
-                    if (total_words > 0)
-                    {
-                        for (int j = 0; j < num_tokens; j++)
-                        {
-                            if (term_freq[j] > 0 && doc_freq[j] > 0)
-                            {
-                                double tf = (double)term_freq[j] / total_words;
-                                double idf = log((double)num_files / doc_freq[j]);
-                                double w = kw_weight_for(tokens[j]);
-                                tfidf_score += w * tf * idf;
-                            }
-                        }
-                    }
+    for (int i = file_lo; i < file_hi; i++)
+    {
+        ProcessedFile* pf = &processed_files[i];
+        size_t start = (size_t)pf->out_offset;
+        size_t end = start + pf->out_len;
+        pf->tokens = 0;
+        if (pf->out_len == 0 || start < cursor || end > to)
+        {
+            continue;
+        }
+        fragment_list_add(list, cursor, start, NULL, NULL);
+        fragment_list_add(list, start, end, &pf->tokens, pf);
+        cursor = end;
+    }
 
-                    free(term_freq);
-                }
-                else
-                {
-                    /* Fallback to simple counting */
-                    char buffer[4096];
-                    rewind(f);
-                    int current_line = 1;
-                    const ProcessedFile* pf = NULL;
-                    for (int k = 0; k < num_processed_files; k++)
-                    {
-                        if (strcmp(processed_files[k].path, ranks[i].path) == 0)
-                        {
-                            pf = &processed_files[k];
-                            break;
-                        }
-                    }
-                    int start_line = pf ? pf->start_line : 0;
-                    int end_line = pf ? pf->end_line : 0;
+    fragment_list_add(list, cursor, to, NULL, NULL);
+}
 
-                    while (fgets(buffer, sizeof(buffer), f))
-                    {
-                        if (start_line > 0 && current_line < start_line)
-                        {
-                            if (strchr(buffer, '\n'))
-                                current_line++;
-                            continue;
-                        }
-                        if (end_line > 0 && current_line > end_line)
-                        {
-                            break;
-                        }
+/**
+ * Count every byte of content[from, to) exactly once
+ *
+ * Sections inside the range and the fragments of processed_files[file_lo,
+ * file_hi) get their own counts. The range ends must be safe cuts.
+ */
+/* WHY: The context is counted as consecutive fragments (tagged sections, the
+ * framing between them, one fragment per file) so that FileRank selection and
+ * diagnostics can reuse the per-fragment counts instead of re-tokenizing, and
+ * so fragments can be encoded on g_jobs threads. Boundary rule: a fragment
+ * whose start is not a safe cut (see is_token_safe_cut) is merged into the
+ * fragment before it and counted together, its tokens attributed to the
+ * earlier fragment. This keeps the total identical to one-shot tokenization.
+ * Each fragment is gathered once out of the output segments into a
+ * NUL-terminated scratch copy, which the tokenizer then reads in place. */
+static size_t account_range_tokens(const OutputVec* content, size_t from, size_t to, int file_lo,
+                                   int file_hi)
+{
+    FragmentList list;
+    build_range_fragments(content, from, to, file_lo, file_hi, &list);
+    return count_fragment_list(&list);
+}
 
-                        for (int j = 0; j < num_tokens; j++)
-                        {
-                            double w = kw_weight_for(tokens[j]);
-                            content_hits += w * count_word_hits(buffer, tokens[j]);
-                        }
+/** Count the whole assembled context */
+static size_t account_context_tokens(const OutputVec* content)
+{
+    return account_range_tokens(content, 0, outvec_size(content), 0,
+                                tree_only_output ? 0 : num_processed_files);
+}
 
-                        if (strchr(buffer, '\n'))
-                            current_line++;
-                    }
-                }
+/** outvec_visit() callback adding a piece's byte classes to a ByteClassCounts */
+static void add_byte_classes(const char* data, size_t len, void* user)
+{
+    byte_class_count(data, len, (ByteClassCounts*)user);
+}
+
+/**
+ * Estimate the whole assembled context for --estimate without tokenizing
+ *
+ * Fragments are those of account_context_tokens() and their counts go to the
+ * same owners. Whole file fragments with a cached exact count keep it and
+ * calibrate g_token_estimator; the rest are estimated from their byte
+ * classes. *error gets the bound on the estimated part of the total.
+ */
+static size_t estimate_context_tokens(const OutputVec* content, size_t* error)
+{
+    timing_begin(TIMING_TOKENIZE);
+    FragmentList list;
+    build_range_fragments(content, 0, outvec_size(content), 0,
+                          tree_only_output ? 0 : num_processed_files, &list);
+    ARENA_SCRATCH_SCOPE(scratch, &g_arena);
+    ByteClassCounts* classes =
+        arena_push_array_safe(scratch.arena, ByteClassCounts, list.count + 1);
+    bool* exact = arena_push_array_safe(scratch.arena, bool, list.count + 1);
+
+    /* Exact counts first, so every estimate gets the calibration of all of them */
+    for (int i = 0; i < list.count; i++)
+    {
+        memset(&classes[i], 0, sizeof(classes[i]));
+        outvec_visit(content, list.starts[i], list.spans[i].len, add_byte_classes, &classes[i]);
+        ProcessedFile* pf = list.files[i];
+        exact[i] = pf && cached_fragment_tokens(pf, list.spans[i].len, &list.spans[i].tokens);
+        if (exact[i])
+        {
+            token_estimator_observe(&g_token_estimator, &classes[i], list.spans[i].tokens);
+        }
+    }
+
+    size_t total = 0;
+    size_t estimated = 0;
+    for (int i = 0; i < list.count; i++)
+    {
+        if (!exact[i])
+        {
+            list.spans[i].tokens = token_estimator_estimate(&g_token_estimator, &classes[i]);
+            estimated += list.spans[i].tokens;
+        }
+        if (list.owners[i])
+        {
+            *list.owners[i] = list.spans[i].tokens;
+        }
+        total += list.spans[i].tokens;
+    }
+    *error = (size_t)((double)estimated * token_estimator_error(&g_token_estimator) + 0.5);
+    timing_end(TIMING_TOKENIZE);
+    return total;
+}
+
+/** PackCountFn over processed_files: item i is the fragment of processed_files[i] */
+static bool count_pack_items(PackItem* items, const int* idx, int n, void* user)
+{
+    (void)user;
+    FragmentList list = {
+        .content = &g_out,
+        .spans = arena_push_array_safe(&g_arena, TokenSpan, n),
+        .starts = arena_push_array_safe(&g_arena, size_t, n),
+        .owners = arena_push_array_safe(&g_arena, size_t*, n),
+        .files = arena_push_array_safe(&g_arena, ProcessedFile*, n),
+        .count = 0,
+    };
+    for (int k = 0; k < n; k++)
+    {
+        ProcessedFile* pf = &processed_files[idx[k]];
+        size_t start = (size_t)pf->out_offset;
+        fragment_list_push(&list, start, start + pf->out_len, &pf->tokens, pf);
+    }
+    count_fragment_list(&list);
+    for (int k = 0; k < n; k++)
+    {
+        items[idx[k]].tokens = processed_files[idx[k]].tokens;
+        items[idx[k]].counted = true;
+    }
+    return true;
+}
+
+/**
+ * Choose the ranked files that fit g_token_budget from the first pass's fragments
+ *
+ * The text around the file fragments is counted exactly and the files are
+ * handed to pack_budget(), so only files that might fit are tokenized.
+ * items[i] describes processed_files[i]. Returns the tokens around the files.
+ */
+/* WHY: Every file fragment starts after '\n' with "File: " and the closing
+ * tag is "</file_context>", so each fragment is a safe cut and counting
+ * fragments on their own adds up to the count of any selection of them. */
+static size_t pack_ranked_files(const FileRank* ranks, PackItem* items, PackResult* result)
+{
+    const ProcessedFile* last = &processed_files[num_processed_files - 1];
+    size_t files_start = (size_t)processed_files[0].out_offset;
+    size_t files_end = (size_t)last->out_offset + last->out_len;
+    size_t framing = account_range_tokens(&g_out, 0, files_start, 0, 0) +
+                     account_range_tokens(&g_out, files_end, outvec_size(&g_out), 0, 0);
+
+    for (int i = 0; i < num_processed_files; i++)
+    {
+        ProcessedFile* pf = &processed_files[i];
+        pf->tokens = 0;
+        items[i].score = ranks[i].score;
+        items[i].bytes = pf->out_len;
+        items[i].tokens = 0;
+        items[i].counted = pf->out_len == 0 || cached_fragment_tokens(pf, pf->out_len, &pf->tokens);
+        items[i].tokens = pf->tokens;
+    }
+
+    size_t room = g_token_budget > framing ? g_token_budget - framing : 0;
+    pack_budget(items, num_processed_files, room, &g_token_ratio, &g_arena, count_pack_items, NULL,
+                result);
+    return framing;
+}
+
+/* Where --stream writes, and what it has written so far */
+typedef struct
+{
+    int fd;
+    size_t flushed;   /* Bytes of g_out already written or skipped */
+    OutputVec emitted; /* The written ranges by reference, for the prompt store */
+    bool failed;
+} OutputStream;
+
+/** Write g_out[flushed, to) to the stream */
+static void stream_emit(OutputStream* s, size_t to)
+{
+    if (to <= s->flushed)
+    {
+        return;
+    }
+    outvec_append_range(&s->emitted, &g_out, s->flushed, to - s->flushed);
+    if (!s->failed && outvec_write_range_fd(&g_out, s->flushed, to - s->flushed, s->fd) != 0)
+    {
+        perror("Failed to write output");
+        s->failed = true;
+    }
+    s->flushed = to;
+}
+
+/**
+ * Assemble the file context and write it out piece by piece
+ *
+ * Everything already assembled (instructions, tree) goes out first, then each
+ * file as soon as its fragment is counted. With stop_at_budget (FileRank
+ * order), files that would take the total past g_token_budget are left out
+ * and smaller files after them still fill the rest; a file whose size alone
+ * rules it out is never tokenized. Returns the total tokens written;
+ * *files_written gets the number of files written.
+ */
+/* WHY: Each step ends on a fragment boundary, which is a safe cut, so the
+ * running total equals what account_context_tokens() would report for the
+ * same text; nothing is counted twice and there is no second pass. Streaming
+ * keeps rank order rather than pack_budget()'s score-per-token order, since a
+ * file is written before the ones after it are even rendered. */
+static size_t stream_context(OutputStream* s, bool stop_at_budget, int* files_written)
+{
+    size_t head = outvec_size(&g_out);
+    size_t total = account_range_tokens(&g_out, 0, head, 0, 0);
+    stream_emit(s, head);
+
+    int written = 0;
+    if (!tree_only_output && num_processed_files > 0)
+    {
+        static const char close_tag[] = "</file_context>\n";
+        size_t close_tokens = llm_tokenizer_count(context_tokenizer(), close_tag);
+
+        int skipped = 0;
+        int skipped_unread = 0;
+        for (int i = 0; i < num_processed_files; i++)
+        {
+            ProcessedFile* pf = &processed_files[i];
+            size_t step_start = outvec_size(&g_out);
+            timing_begin(TIMING_ASSEMBLE);
+            open_file_context_if_needed();
+            pf->out_offset = (long)outvec_size(&g_out);
+            output_file_content(pf, &g_out);
+            size_t end = outvec_size(&g_out);
+            pf->out_len = end - (size_t)pf->out_offset;
+            timing_end(TIMING_ASSEMBLE);
+
+            size_t step;
+            bool fits;
+            size_t floor = token_ratio_floor(&g_token_ratio, pf->out_len);
+            if (stop_at_budget && total + floor + close_tokens > g_token_budget)
+            {
+                /* Only the framing before the file is counted */
+                step = account_range_tokens(&g_out, step_start, (size_t)pf->out_offset, 0, 0);
+                pf->tokens = 0;
+                skipped_unread++;
+                fits = false;
             }
-            fclose(f);
+            else
+            {
+                step = account_range_tokens(&g_out, step_start, end, i, i + 1);
+                token_ratio_observe(&g_token_ratio, pf->out_len, pf->tokens);
+                fits = !stop_at_budget || total + step + close_tokens <= g_token_budget;
+            }
+
+            if (!fits)
+            {
+                /* Keep the framing before the file (the opening tag), drop the file */
+                total += step - pf->tokens;
+                stream_emit(s, (size_t)pf->out_offset);
+                s->flushed = end;
+                pf->tokens = 0;
+                pf->out_len = 0; /* Not in the output, so not in the saved prompt's file table */
+                skipped++;
+                continue;
+            }
+            total += step;
+            stream_emit(s, end);
+            written++;
+        }
+        if (skipped > 0)
+        {
+            fprintf(stderr, "Skipped %d files that would exceed budget (%d never tokenized)\n",
+                    skipped, skipped_unread);
         }
 
-        /* Calculate score: TF-IDF weight + content_hits + path_weight*path_hits -
-         * size_weight*(bytes/1MiB) */
-        double size_penalty = g_filerank_weight_size * (ranks[i].bytes / (1024.0 * 1024.0));
-        ranks[i].score = tfidf_score * g_filerank_weight_tfidf +
-                         content_hits * g_filerank_weight_content +
-                         g_filerank_weight_path * path_hits - size_penalty;
+        size_t tail = outvec_size(&g_out);
+        outvec_printf(&g_out, "%s", close_tag);
+        total += account_range_tokens(&g_out, tail, outvec_size(&g_out), 0, 0);
+        stream_emit(s, outvec_size(&g_out));
+    }
+
+    *files_written = written;
+    return total;
+}
+
+/** Print the token breakdown from the counts gathered by account_context_tokens() */
+static void report_context_diagnostics(int num_context_files, size_t total_tokens, FILE* out)
+{
+    TokenCount sections[MAX_OUTPUT_SECTIONS];
+    for (int i = 0; i < g_num_output_sections; i++)
+    {
+        sections[i].name = g_output_sections[i].name;
+        sections[i].tokens = g_output_sections[i].tokens;
     }
 
-    free(doc_freq);
-    return;
-
-basic_scoring:
-    /* Fallback: basic scoring without TF-IDF */
-    for (int i = 0; i < num_files; i++)
+    TokenCount* files = arena_push_array_safe(&g_arena, TokenCount,
+                                              num_context_files > 0 ? num_context_files : 1);
+    size_t file_count = 0;
+    for (int i = 0; i < num_context_files; i++)
     {
-        double path_hits = 0;
-        double content_hits = 0;
-
-        /* Count hits in path */
-        for (int j = 0; j < num_tokens; j++)
-        {
-            double w = kw_weight_for(tokens[j]);
-            path_hits += w * count_word_hits(ranks[i].path, tokens[j]);
-        }
-
-        /* Get file size for penalty calculation */
-        struct stat st;
-        if (stat(ranks[i].path, &st) == 0)
+        const ProcessedFile* pf = &processed_files[i];
+        if (pf->out_len == 0)
         {
-            ranks[i].bytes = st.st_size;
-        }
-        else
-        {
-            ranks[i].bytes = 0;
+            continue;
         }
 
-        /* Read file content to count hits */
-        FILE* f = fopen(ranks[i].path, "r");
-        if (f)
+        /* Same label as the "File:" header line of the fragment; whole files need no copy */
+        const char* name = pf->path;
+        if (pf->start_line > 0 || pf->end_line > 0)
         {
-            /* Check if binary */
-            if (!is_binary(f))
+            char label[MAX_PATH + 64];
+            if (pf->end_line > 0)
             {
-                /* Read content and count hits */
-                char buffer[4096];
-                rewind(f);
-                while (fgets(buffer, sizeof(buffer), f))
-                {
-                    for (int j = 0; j < num_tokens; j++)
-                    {
-                        double w = kw_weight_for(tokens[j]);
-                        content_hits += w * count_word_hits(buffer, tokens[j]);
-                    }
-                }
+                snprintf(label, sizeof(label), "%s (lines %d-%d)", pf->path, pf->start_line,
+                         pf->end_line);
             }
-            fclose(f);
+            else
+            {
+                snprintf(label, sizeof(label), "%s (lines %d-)", pf->path, pf->start_line);
+            }
+            name = arena_strdup_safe(&g_arena, label);
         }
 
-        /* Calculate score: content_hits + path_weight*path_hits - size_weight*(bytes/1MiB) */
-        double size_penalty = g_filerank_weight_size * (ranks[i].bytes / (1024.0 * 1024.0));
-        ranks[i].score = content_hits * g_filerank_weight_content +
-                         g_filerank_weight_path * path_hits - size_penalty;
+        files[file_count].name = name;
+        files[file_count].tokens = pf->tokens;
+        file_count++;
+    }
+
+    report_token_diagnostics(sections, (size_t)g_num_output_sections, files, file_count,
+                             total_tokens, g_token_top, out);
+}
+
+/** Report --timings on exit: JSON to the requested file ("-" for stderr), else text on stderr */
+static void report_timings(void)
+{
+    ArenaStats stats = arena_stats(&g_arena);
+    size_t scratch = arena_scratch_high_water();
+    if (!g_timings_json_file)
+    {
+        timings_write_text(stderr, &stats, scratch);
+        return;
+    }
+    if (strcmp(g_timings_json_file, "-") == 0)
+    {
+        timings_write_json(stderr, &stats, scratch);
+        return;
+    }
+    FILE* fp = fopen(g_timings_json_file, "w");
+    if (!fp)
+    {
+        perror("Failed to open timings file");
+        return;
     }
+    timings_write_json(fp, &stats, scratch);
+    fclose(fp);
 }
 
 /** Main function - program entry point */
@@ -3156,9 +4406,22 @@ int main(int argc, char* argv[])
     /* Register cleanup handler */
     atexit(cleanup); /* Register cleanup handler early */
 
-    g_arena = arena_create(MiB(256));
+    /* WHY: Kept as an alias of --timings=FILE so `make bench` can time any
+     * build without depending on its option parser. */
+    const char* timings_env = getenv("LLM_CTX_TIMINGS_JSON");
+    if (timings_env && *timings_env)
+    {
+        g_timings = true;
+        g_timings_json_file = timings_env;
+        timings_enable();
+    }
+
+    /* WHY: growable, so a run past the first reserve chains chunks instead of aborting */
+    g_arena = arena_create_ex(MiB(256), ARENA_FLAG_GROW);
     if (!g_arena.base)
         fatal("Failed to allocate arena");
+    path_set_init(&g_processed_set, &g_arena);
+    file_tree_init(&g_file_tree, &g_arena);
 
     /* Check for 'get' subcommand before other processing */
     if (argc > 1 && strcmp(argv[1], "get") == 0)
@@ -3220,19 +4483,8 @@ int main(int argc, char* argv[])
         llm_set_executable_dir(exe_dir);
     }
 
-    /* Create temporary file for output assembly */
-    strcpy(temp_file_path, TEMP_FILE_TEMPLATE);
-    int fd = mkstemp(temp_file_path);
-    if (fd == -1)
-    {
-        fatal("Failed to create temporary file: %s", strerror(errno));
-    }
-    temp_file = fdopen(fd, "w");
-    if (!temp_file)
-    {
-        /* fd is still open here, cleanup() will handle unlinking */
-        fatal("Failed to open temporary file stream: %s", strerror(errno));
-    }
+    /* Output is assembled as a segment list and written in one go at the end */
+    outvec_init(&g_out, &g_arena);
 
     /* Silence getopt_long(); we'll print the expected diagnostic ourselves. */
     opterr = 0;
@@ -3241,11 +4493,11 @@ int main(int argc, char* argv[])
     /* This replaces the manual strcmp/strncmp chain, reducing complexity */
     /* and adhering to the "minimize execution paths" principle. */
     int opt;
-    char** explicit_files = arena_push_array_safe(&g_arena, char*, MAX_FILES);
+    char** explicit_files = arena_push_array_safe(&g_arena, char*, argc);
     int explicit_file_count = 0;
     /* Add 'C' to the short options string. It takes no argument. */
     /* Add 'b:' for short form of --token-budget and 'D::' for token diagnostics */
-    while ((opt = getopt_long(argc, argv, "hc:s::fRe::CtdTOL:o::b:D::k:x:r", long_options, NULL)) !=
+    while ((opt = getopt_long(argc, argv, "hc:s::fRe::CtdTOL:o::b:D::k:x:rj:", long_options, NULL)) !=
            -1)
     {
         switch (opt)
@@ -3279,13 +4531,7 @@ int main(int argc, char* argv[])
             file_mode = 1;
             while (optind < argc && argv[optind] && argv[optind][0] != '-')
             {
-                if (explicit_file_count >= MAX_FILES)
-                {
-                    fprintf(stderr,
-                            "Error: Too many files specified via -f (maximum %d)\n",
-                            MAX_FILES);
-                    return 1;
-                }
+                /* Each operand is a distinct argv slot, so argc entries always suffice */
                 explicit_files[explicit_file_count++] = argv[optind++];
             }
             break;
@@ -3452,6 +4698,136 @@ int main(int argc, char* argv[])
             }
             g_filerank_cutoff_spec = arena_strdup_safe(&g_arena, optarg);
             break;
+        case 408: /* --no-cache */
+            g_no_cache = true;
+            break;
+        case 409: /* --stream */
+            g_stream = true;
+            break;
+        case 410: /* --timings[=FILE] */
+            g_timings = true;
+            if (optarg && *optarg)
+            {
+                g_timings_json_file = arena_strdup_safe(&g_arena, optarg);
+            }
+            timings_enable();
+            break;
+        case 411: /* --git-index[=untracked] */
+            if (!optarg || !*optarg)
+            {
+                g_git_index_mode = GIT_INDEX_TRACKED;
+            }
+            else if (strcmp(optarg, "untracked") == 0)
+            {
+                g_git_index_mode = GIT_INDEX_UNTRACKED;
+            }
+            else
+            {
+                fprintf(stderr, "Error: Invalid --git-index value: %s (expected 'untracked')\n",
+                        optarg);
+                return 1;
+            }
+            break;
+        case 412: /* --chunks[=LINES] */
+            g_chunk_lines = CHUNK_DEFAULT_LINES;
+            if (optarg && *optarg)
+            {
+                char* end;
+                long lines = strtol(optarg, &end, 10);
+                if (*end != '\0' || lines < 1 || lines > INT_MAX)
+                {
+                    fprintf(stderr, "Error: Invalid --chunks value: %s (expected lines > 0)\n",
+                            optarg);
+                    return 1;
+                }
+                g_chunk_lines = (int)lines;
+            }
+            break;
+        case 413: /* --estimate[=PCT] */
+            g_estimate = true;
+            if (optarg && *optarg)
+            {
+                char* end;
+                double pct = strtod(optarg, &end);
+                if (*end != '\0' || !(pct >= 0.0 && pct <= 100.0))
+                {
+                    fprintf(stderr, "Error: Invalid --estimate value: %s (expected 0-100)\n",
+                            optarg);
+                    return 1;
+                }
+                g_estimate_margin = pct / 100.0;
+            }
+            break;
+        case 414: /* --queue-depth=N */
+        {
+            char* end;
+            long depth = strtol(optarg, &end, 10);
+            if (*end != '\0' || end == optarg || depth < 0 || depth > 4096)
+            {
+                fprintf(stderr, "Error: Invalid --queue-depth value: %s (expected 0-4096)\n",
+                        optarg);
+                return 1;
+            }
+            g_queue_depth = (int)depth;
+            break;
+        }
+        case 415: /* --token-top=N */
+        {
+            char* end;
+            long top = strtol(optarg, &end, 10);
+            if (*end != '\0' || end == optarg || top < 0)
+            {
+                fprintf(stderr, "Error: Invalid --token-top value: %s (expected 0 or more)\n",
+                        optarg);
+                return 1;
+            }
+            g_token_top = (size_t)top;
+            break;
+        }
+        case 416: /* --tail-tokens=N */
+        {
+            char* end;
+            long long tail = strtoll(optarg, &end, 10);
+            if (*end != '\0' || end == optarg || tail <= 0)
+            {
+                fprintf(stderr, "Error: Invalid --tail-tokens value: %s (expected 1 or more)\n",
+                        optarg);
+                return 1;
+            }
+            g_tail_tokens = (size_t)tail;
+            break;
+        }
+        case 417: /* --since=UUID|last */
+        {
+            size_t len = strlen(optarg);
+            bool valid = strcmp(optarg, "last") == 0 || (len >= 16 && len <= 64);
+            for (size_t i = 0; valid && i < len; i++)
+            {
+                valid = isalnum((unsigned char)optarg[i]) || optarg[i] == '-';
+            }
+            if (!valid)
+            {
+                fprintf(stderr,
+                        "Error: Invalid --since value: %s (expected a prompt UUID or last)\n",
+                        optarg);
+                return 1;
+            }
+            g_since = optarg;
+            break;
+        }
+        case 'j': /* -j or --jobs */
+            if (!optarg)
+            {
+                fprintf(stderr, "Error: -j/--jobs requires a numeric argument\n");
+                return 1;
+            }
+            g_jobs = (int)strtol(optarg, NULL, 10);
+            if (g_jobs <= 0)
+            {
+                fprintf(stderr, "Error: Invalid job count: %s\n", optarg);
+                return 1;
+            }
+            break;
         case 'x': /* -x or --exclude */
             if (!optarg)
             {
@@ -3503,7 +4879,14 @@ int main(int argc, char* argv[])
     /* These are the file paths/patterns if file_mode is set. */
     int file_args_start = optind;
 
+    /* Registered after cleanup so it runs first, while the arena is still alive */
+    if (g_timings)
+    {
+        atexit(report_timings);
+    }
+
     /* --- Configuration File Loading --- */
+    timing_begin(TIMING_CONFIG);
     ConfigSettings loaded_settings = {0};
     bool config_loaded = false;
 
@@ -3641,6 +5024,7 @@ int main(int argc, char* argv[])
     {
         g_effective_copy_to_clipboard = (loaded_settings.copy_to_clipboard == 1);
     }
+    timing_end(TIMING_CONFIG);
 
     /* --- Finalize editor_comments setting (apply toggle logic) --- */
     /* Determine initial state (default false) */
@@ -3674,7 +5058,13 @@ int main(int argc, char* argv[])
     else if (user_instructions && *user_instructions)
     {
         /* In raw mode, just print user instructions without tags */
-        fprintf(temp_file, "%s\n\n", user_instructions);
+        outvec_printf(&g_out, "%s\n\n", user_instructions);
+    }
+
+    if (g_jobs <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        g_jobs = cores > 0 ? (int)cores : 1;
     }
 
     /* Load gitignore files if enabled */
@@ -3682,14 +5072,19 @@ int main(int argc, char* argv[])
     {
         /* Pre-condition: gitignore is enabled */
         assert(respect_gitignore == 1);
+        timing_begin(TIMING_GITIGNORE);
         load_all_gitignore_files();
+        timing_end(TIMING_GITIGNORE);
         /* Post-condition: gitignore patterns may have been loaded */
         assert(respect_gitignore == 1);
     }
 
+    timing_begin(TIMING_WALK);
+
     /* Process input based on mode */
     if (file_mode)
     {
+        plan_recursive_walks(explicit_files, explicit_file_count);
         for (int i = 0; i < explicit_file_count; i++)
         {
             process_pattern(explicit_files[i]);
@@ -3736,6 +5131,7 @@ int main(int argc, char* argv[])
         else
         {
             /* Process each remaining argument as a file/pattern */
+            plan_recursive_walks(argv + file_args_start, argc - file_args_start);
             for (int i = file_args_start; i < argc; i++)
             {
                 process_pattern(argv[i]);
@@ -3765,12 +5161,12 @@ int main(int argc, char* argv[])
         }
     }
 
+    timing_end(TIMING_WALK);
+
     /* Check if any files were found or if prompt-only output is allowed */
     if (files_found == 0 && !allow_empty_context)
     {
         fprintf(stderr, "No files to process\n");
-        fclose(temp_file);
-        unlink(temp_file_path);
         return 1;
     }
 
@@ -3781,28 +5177,26 @@ int main(int argc, char* argv[])
     }
 
     /* Expand file tree to show full directory contents */
-    if (file_tree_count > 0 && global_tree_only)
+    if (g_file_tree.count > 0 && global_tree_only)
     {
-        char* tree_root = find_common_prefix();
+        char* tree_root = file_tree_root(&g_file_tree, &g_arena);
 
-        /* For full tree, add the entire directory tree from the common root */
-        if (strcmp(tree_root, ".") == 0)
+        /* For full tree, add the entire directory tree from the common root. A single
+         * file keeps its own directory; several files widen to the first one's
+         * top-level directory, as the old prefix scan did. */
+        if (strcmp(tree_root, ".") == 0 || g_file_tree.count > 1)
         {
-            /* If root is current dir, use the first file's top-level directory */
-            if (file_tree_count > 0)
+            char first_dir[MAX_PATH];
+            snprintf(first_dir, sizeof(first_dir), "%s", g_file_tree.first_path);
+            char* first_slash = strchr(first_dir, '/');
+            if (first_slash)
             {
-                char first_dir[MAX_PATH];
-                strcpy(first_dir, file_tree[0].path);
-                char* first_slash = strchr(first_dir, '/');
-                if (first_slash)
-                {
-                    *first_slash = '\0';
-                    add_directory_tree(first_dir);
-                }
-                else
-                {
-                    add_directory_tree(".");
-                }
+                *first_slash = '\0';
+                add_directory_tree(first_dir);
+            }
+            else
+            {
+                add_directory_tree(".");
             }
         }
         else
@@ -3818,16 +5212,37 @@ int main(int argc, char* argv[])
         generate_file_tree();
     }
 
+    /* Token counts and FileRank statistics of unchanged files come from here */
+    open_file_cache();
+
     /* FileRank array - declared at broader scope for budget handling */
     FileRank* ranks = NULL;
 
     /* Process codemap and file content unless tree_only_output is set */
     if (!tree_only_output)
     {
+        if (g_since)
+        {
+            since_skip_unchanged();
+        }
+        start_content_loads();
+        since_compare_content();
 
         /* Apply FileRank if we have files and a query and FileRank is enabled */
         if (num_processed_files > 0 && user_instructions && enable_filerank)
         {
+            if (g_chunk_lines > 0)
+            {
+                timing_begin(TIMING_RANK);
+                int files_split = split_processed_files_into_chunks();
+                timing_end(TIMING_RANK);
+                if (g_filerank_debug)
+                {
+                    fprintf(stderr, "FileRank chunks: split %d files, ranking %d entries\n",
+                            files_split, num_processed_files);
+                }
+            }
+
             /* Allocate FileRank array */
             ranks = arena_push_array_safe(&g_arena, FileRank, num_processed_files);
             if (!ranks)
@@ -3842,13 +5257,20 @@ int main(int argc, char* argv[])
                 ranks[i].score = 0.0;
                 ranks[i].bytes = 0;
                 ranks[i].tokens = 0;
+                ranks[i].start_line = processed_files[i].start_line;
+                ranks[i].end_line = processed_files[i].end_line;
+                ranks[i].file_index = i;
+                ranks[i].meta =
+                    is_special_file(ranks[i].path) ? NULL : processed_files[i].meta;
             }
 
             /* Call ranking function */
+            timing_begin(TIMING_RANK);
             rank_files(user_instructions, ranks, num_processed_files);
 
             /* Sort files by score (for budget-based selection) */
             qsort(ranks, num_processed_files, sizeof(FileRank), compare_filerank);
+            timing_end(TIMING_RANK);
 
             /* Apply filerank cutoff if specified */
             if (g_filerank_cutoff_spec)
@@ -3897,198 +5319,237 @@ int main(int argc, char* argv[])
 
                 for (int i = 0; i < num_processed_files; i++)
                 {
-                    fprintf(stderr, "  %.2f  %s\n", ranks[i].score, ranks[i].path);
+                    char range[64];
+                    fprintf(stderr, "  %.2f  %s%s\n", ranks[i].score, ranks[i].path,
+                            line_range_suffix(ranks[i].start_line, ranks[i].end_line, range,
+                                              sizeof(range)));
                 }
             }
 
+            if (g_chunk_lines > 0 && !g_stream)
+            {
+                group_ranked_chunks(ranks, num_processed_files);
+            }
+
             /* Update processed_files array to match sorted order */
+            ProcessedFile* sorted =
+                arena_push_array_safe(&g_arena, ProcessedFile, processed_files_cap);
             for (int i = 0; i < num_processed_files; i++)
             {
-                /* Preserve ranges alongside path when reordering */
-                for (int j = i; j < num_processed_files; j++)
-                {
-                    if (strcmp(processed_files[j].path, ranks[i].path) == 0)
-                    {
-                        ProcessedFile tmp = processed_files[i];
-                        processed_files[i] = processed_files[j];
-                        processed_files[j] = tmp;
-                        break;
-                    }
-                }
+                sorted[i] = processed_files[ranks[i].file_index];
+                ranks[i].file_index = i;
             }
+            processed_files = sorted;
         }
 
-        /* First pass: try outputting all files */
-        for (int i = 0; i < num_processed_files; i++)
+        add_unchanged_manifest();
+
+        /* First pass: try outputting all files, recording each file's fragment */
+        timing_begin(TIMING_ASSEMBLE);
+        for (int i = 0; i < num_processed_files && !g_stream; i++)
         {
-            output_file_content(&processed_files[i], temp_file);
+            open_file_context_if_needed();
+            processed_files[i].out_offset = (long)outvec_size(&g_out);
+            output_file_content(&processed_files[i], &g_out);
+            long end = (long)outvec_size(&g_out);
+            processed_files[i].out_len =
+                end > processed_files[i].out_offset ? (size_t)(end - processed_files[i].out_offset)
+                                                    : 0;
         }
+        timing_end(TIMING_ASSEMBLE);
 
         /* Add closing file_context tag */
         if (wrote_file_context)
-            fprintf(temp_file, "</file_context>\n");
+            outvec_printf(&g_out, "</file_context>\n");
     }
 
-    /* Flush and close the temp file */
-    fclose(temp_file);
-
     /* --- Token Counting and Budget Check --- */
-    /* Read the content first to count tokens if needed */
-    char* final_content = slurp_file(temp_file_path);
-    if (!final_content)
-    {
-        perror("Failed to read temporary file");
-        return 1;
+    /* The context that will be emitted; FileRank may replace it with a subset */
+    const OutputVec* final_out = &g_out;
+
+    token_ratio_init(&g_token_ratio, g_token_model);
+    token_estimator_init(&g_token_estimator, g_token_model);
+    size_t total_tokens;
+    bool total_estimated = false; /* Some fragments in total_tokens are estimates */
+
+    /* FileRank's budget selection, when the files were ranked */
+    PackItem* pack_items = NULL;
+    PackResult pack = {0};
+    size_t selected_tokens = 0;
+
+    /* Files whose fragments are part of final_out, in output order */
+    int num_context_files;
+
+    /* --estimate: the estimate stands unless an exact count could change the outcome */
+    bool use_estimate = false;
+    size_t estimate_error = 0; /* Bound on total_tokens when it was estimated */
+    if (g_estimate && !g_stream)
+    {
+        size_t estimate = estimate_context_tokens(&g_out, &estimate_error);
+        size_t margin = (size_t)(g_estimate_margin * (double)g_token_budget);
+        if (margin < estimate_error)
+        {
+            margin = estimate_error;
+        }
+        size_t distance =
+            estimate > g_token_budget ? estimate - g_token_budget : g_token_budget - estimate;
+        /* WHY: Over the budget, FileRank has to choose files on exact counts;
+         * under it, every file is kept either way. */
+        use_estimate = distance > margin && (!ranks || estimate < g_token_budget);
+        if (use_estimate)
+        {
+            total_tokens = estimate;
+            total_estimated = estimate_error > 0;
+            num_context_files = tree_only_output ? 0 : num_processed_files;
+        }
+        else
+        {
+            estimate_error = 0;
+        }
     }
 
-    /* Always try to count tokens if tokenizer is available */
-    size_t total_tokens = llm_count_tokens(final_content, g_token_model);
-    if (total_tokens == SIZE_MAX)
+    static OutputStream stream;
+    if (use_estimate)
     {
-        fatal("Tokenizer failed to count tokens for assembled context");
+        /* Counted above */
+    }
+    else if (g_stream)
+    {
+        /* The clipboard takes the text in one piece, so streaming never goes there */
+        stream.fd = STDOUT_FILENO;
+        if (g_output_file)
+        {
+            stream.fd = open(g_output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (stream.fd < 0)
+            {
+                perror("Failed to open output file");
+                return 1;
+            }
+        }
+        outvec_init(&stream.emitted, &g_arena);
+        fflush(stdout);
+        total_tokens = stream_context(&stream, ranks != NULL, &num_context_files);
+        final_out = &stream.emitted;
+    }
+    else if (ranks && num_processed_files > 0)
+    {
+        pack_items = arena_push_array_safe(&g_arena, PackItem, num_processed_files);
+        size_t framing = pack_ranked_files(ranks, pack_items, &pack);
+        num_context_files = num_processed_files;
+        selected_tokens = framing + pack.tokens;
+        total_tokens = selected_tokens;
+        if (pack.selected < num_processed_files)
+        {
+            /* Report the whole context; it is an estimate if some file left out was not counted */
+            total_tokens = framing;
+            for (int i = 0; i < num_processed_files; i++)
+            {
+                total_tokens += pack_items[i].estimate;
+                total_estimated = total_estimated || !pack_items[i].counted;
+            }
+        }
+    }
+    else
+    {
+        total_tokens = account_context_tokens(&g_out);
+        num_context_files = tree_only_output ? 0 : num_processed_files;
+    }
+    if (ranks)
+    {
+        for (int i = 0; i < num_processed_files; i++)
+        {
+            ranks[i].tokens = processed_files[i].tokens;
+        }
     }
 
     /* Token counting succeeded - always display usage */
     /* Use floating point division to avoid integer overflow on very large token counts */
     double budget_pct = 100.0 * (double)total_tokens / (double)g_token_budget;
-    fprintf(stderr, "Token usage: %zu / %zu (%.0f%% of budget)\n", total_tokens, g_token_budget,
-            budget_pct);
+    char error_bound[32] = "";
+    if (estimate_error > 0)
+    {
+        snprintf(error_bound, sizeof(error_bound), " +/- %zu", estimate_error);
+    }
+    fprintf(stderr, "Token usage: %s%zu%s / %zu (%.0f%% of budget%s)\n", total_estimated ? "~" : "",
+            total_tokens, error_bound, g_token_budget, budget_pct,
+            total_estimated ? ", estimated" : "");
 
     /* Check budget */
     if (total_tokens > g_token_budget)
     {
-        if (ranks && user_instructions)
+        if (pack_items && pack.selected < num_processed_files)
         {
             fprintf(
                 stderr,
-                "\nBudget exceeded (%zu > %zu) - using FileRank to select most relevant files\n",
+                "\nBudget exceeded (~%zu > %zu) - using FileRank to select most relevant files\n",
                 total_tokens, g_token_budget);
             fprintf(stderr, "Query: \"%s\"\n", user_instructions);
-
-            fclose(fopen(temp_file_path, "w"));
-            temp_file = fopen(temp_file_path, "w");
-            if (!temp_file)
-            {
-                fatal("Failed to reopen temp file for FileRank selection");
-            }
-
-            if (user_instructions)
-            {
-                fprintf(temp_file, "<user_instructions>\n%s\n</user_instructions>\n\n",
-                        user_instructions);
-            }
-            if (system_instructions)
-            {
-                add_system_instructions(system_instructions);
-            }
-            if (custom_response_guide)
-            {
-                fprintf(temp_file, "<response_guide>\n%s\n</response_guide>\n\n",
-                        custom_response_guide);
-            }
-
-            if ((tree_only || global_tree_only) && strlen(tree_file_path) > 0)
-            {
-                FILE* tree_f = fopen(tree_file_path, "r");
-                if (tree_f)
-                {
-                    fprintf(temp_file, "<file_tree>\n");
-                    char buffer[4096];
-                    size_t bytes_read;
-                    while ((bytes_read = fread(buffer, 1, sizeof(buffer), tree_f)) > 0)
-                    {
-                        fwrite(buffer, 1, bytes_read, temp_file);
-                    }
-                    fprintf(temp_file, "</file_tree>\n\n");
-                    fclose(tree_f);
-                }
-            }
-
-            size_t running_tokens = 0;
-            size_t base_tokens = 0;
+            fprintf(stderr, "Skipped %d files that would exceed budget (%d never tokenized)\n",
+                    num_processed_files - pack.selected, pack.skipped_unread);
+
+            /* Rebuild the context from the fragments of the first pass: everything
+             * before the first file, the selected files in rank order, then the
+             * closing tag. The new list only references the existing segments.
+             * Selected files move to the front of processed_files, the rest after
+             * them, so the first num_context_files entries are what was emitted. */
+            size_t content_len = outvec_size(&g_out);
+            const ProcessedFile* last = &processed_files[num_processed_files - 1];
+            size_t files_start = (size_t)processed_files[0].out_offset;
+            size_t files_end = (size_t)last->out_offset + last->out_len;
+
+            static OutputVec selected;
+            outvec_init(&selected, &g_arena);
+            outvec_append_range(&selected, &g_out, 0, files_start);
+
+            ProcessedFile* packed =
+                arena_push_array_safe(&g_arena, ProcessedFile, processed_files_cap);
             int files_included = 0;
-
-            fflush(temp_file);
-            char* base_content = slurp_file(temp_file_path);
-            if (base_content)
-            {
-                base_tokens = llm_count_tokens(base_content, g_token_model);
-                if (base_tokens == SIZE_MAX)
-                {
-                    fatal("Tokenizer failed while counting base context tokens");
-                }
-                running_tokens = base_tokens;
-            }
-
-            fprintf(temp_file, "<file_context>\n\n");
-
+            int next_skipped = pack.selected;
             for (int i = 0; i < num_processed_files; i++)
             {
-                size_t mark = arena_get_mark(&g_arena);
-                char* file_content = arena_push_array_safe(&g_arena, char, 1024 * 1024);
-                if (!file_content)
-                {
-                    arena_set_mark(&g_arena, mark);
-                    continue;
-                }
-
-                FILE* mem_file = fmemopen(file_content, 1024 * 1024, "w");
-                if (mem_file)
+                ProcessedFile* pf = &processed_files[i];
+                if (!pack_items[i].selected)
                 {
-                    output_file_content(&processed_files[i], mem_file);
-                    fclose(mem_file);
-
-                    size_t file_tokens = llm_count_tokens(file_content, g_token_model);
-                    if (file_tokens == SIZE_MAX)
-                    {
-                        fatal("Tokenizer failed while counting '%s'", processed_files[i].path);
-                    }
-
-                    if (running_tokens + file_tokens + 50 <= g_token_budget)
-                    {
-                        fprintf(temp_file, "%s", file_content);
-                        running_tokens += file_tokens;
-                        files_included++;
-                        ranks[i].tokens = file_tokens;
-                    }
-                    else
+                    if (g_filerank_debug)
                     {
-                        fprintf(stderr,
-                                "Skipping remaining %d files - adding '%s' would exceed budget\n",
-                                num_processed_files - i, processed_files[i].path);
-                        arena_set_mark(&g_arena, mark);
-                        break;
+                        char range[64];
+                        fprintf(stderr, "  skipped  %s%s (%s%zu tokens)\n", pf->path,
+                                line_range_suffix(pf->start_line, pf->end_line, range,
+                                                  sizeof(range)),
+                                pack_items[i].counted ? "" : "~", pack_items[i].estimate);
                     }
+                    packed[next_skipped++] = *pf;
+                    continue;
                 }
-
-                arena_set_mark(&g_arena, mark);
+                outvec_append_range(&selected, &g_out, (size_t)pf->out_offset, pf->out_len);
+                packed[files_included++] = *pf;
             }
+            processed_files = packed;
 
-            fprintf(temp_file, "</file_context>\n");
-            fclose(temp_file);
+            outvec_append_range(&selected, &g_out, files_end, content_len - files_end);
 
-            final_content = slurp_file(temp_file_path);
-            if (final_content)
-            {
-                total_tokens = llm_count_tokens(final_content, g_token_model);
-                if (total_tokens == SIZE_MAX)
-                {
-                    fatal("Tokenizer failed after FileRank selection");
-                }
-                fprintf(stderr, "\nFileRank selection complete:\n");
-                fprintf(stderr, "  - Selected %d most relevant files out of %d total\n",
-                        files_included, num_processed_files);
-                /* Use floating point division to avoid integer overflow */
-                double pct = 100.0 * (double)total_tokens / (double)g_token_budget;
-                fprintf(stderr, "  - Token usage: %zu / %zu (%.0f%% of budget)\n", total_tokens,
-                        g_token_budget, pct);
-            }
+            final_out = &selected;
+            total_tokens = selected_tokens;
+            num_context_files = files_included;
+
+            fprintf(stderr, "\nFileRank selection complete:\n");
+            fprintf(stderr, "  - Selected %d most relevant files out of %d total\n",
+                    files_included, num_processed_files);
+            /* Use floating point division to avoid integer overflow */
+            double pct = 100.0 * (double)total_tokens / (double)g_token_budget;
+            fprintf(stderr, "  - Token usage: %zu / %zu (%.0f%% of budget)\n", total_tokens,
+                    g_token_budget, pct);
+            fprintf(stderr, "  - Tokenized %d of %d files\n", pack.counted, num_processed_files);
         }
         else
         {
             fprintf(stderr, "WARNING: context uses %zu tokens > budget %zu\n", total_tokens,
                     g_token_budget);
-            if (user_instructions)
+            if (ranks)
+            {
+                /* FileRank already left files out; the other sections alone exceed the budget */
+            }
+            else if (user_instructions)
             {
                 fprintf(stderr, "\nHint: Use -r flag to enable FileRank, which will select the "
                                 "most relevant files\n");
@@ -4116,7 +5577,14 @@ int main(int argc, char* argv[])
             }
         }
 
-        generate_token_diagnostics(final_content, g_token_model, diag_out, &g_arena);
+        timing_begin(TIMING_DIAGNOSTICS);
+        report_context_diagnostics(num_context_files, total_tokens, diag_out);
+        if (estimate_error > 0)
+        {
+            fprintf(diag_out, "  (estimated from byte classes, total within +/- %zu tokens)\n",
+                    estimate_error);
+        }
+        timing_end(TIMING_DIAGNOSTICS);
 
         if (diag_out != stderr)
         {
@@ -4125,82 +5593,91 @@ int main(int argc, char* argv[])
     }
 
     /* --- Save prompt to disk --- */
-    char* saved_uuid = save_prompt(final_content, argc, argv, processed_files, num_processed_files, &g_arena);
+    timing_begin(TIMING_SAVE_PROMPT);
+    /* Files --stream dropped are interleaved with the written ones; their fragments are empty */
+    char* saved_uuid =
+        save_prompt(final_out, argc, argv, processed_files, num_processed_files,
+                    g_stream ? num_processed_files : num_context_files, total_tokens, &g_arena);
+    timing_end(TIMING_SAVE_PROMPT);
     if (saved_uuid)
     {
         fprintf(stderr, "Retrieve this prompt via llm_ctx get %s\n", saved_uuid);
     }
 
     /* --- Output Handling --- */
-    if (g_effective_copy_to_clipboard)
+    if (g_stream)
     {
-        /* final_content already read above */
-        if (final_content)
+        /* Already written while it was assembled */
+        if (g_output_file)
         {
-            size_t final_len = strlen(final_content);
-            /* Check if content exceeds clipboard limit */
-            if (final_len > CLIPBOARD_SOFT_MAX)
-            {
-                fprintf(stderr,
-                        "Warning: output (%zu bytes) exceeds clipboard limit (%d MB); "
-                        "writing to stdout instead.\n",
-                        final_len, CLIPBOARD_SOFT_MAX / (1024 * 1024));
-                printf("%s", final_content);
-            }
-            else if (!copy_to_clipboard(final_content))
+            close(stream.fd);
+            if (!stream.failed)
             {
-                /* Clipboard copy failed, fall back to stdout */
-                fprintf(stderr, "Clipboard copy failed; falling back to stdout.\n");
-                printf("%s", final_content);
+                fprintf(stderr, "Content written to %s\n", g_output_file);
             }
-            else
+        }
+        if (stream.failed)
+        {
+            return 1;
+        }
+    }
+    else if (g_effective_copy_to_clipboard)
+    {
+        size_t final_len = outvec_size(final_out);
+        /* Check if content exceeds clipboard limit */
+        if (final_len > CLIPBOARD_SOFT_MAX)
+        {
+            fprintf(stderr,
+                    "Warning: output (%zu bytes) exceeds clipboard limit (%d MB); "
+                    "writing to stdout instead.\n",
+                    final_len, CLIPBOARD_SOFT_MAX / (1024 * 1024));
+            write_output_to_stdout(final_out);
+        }
+        else if (!copy_output_to_clipboard(final_out))
+        {
+            /* Clipboard copy failed, fall back to stdout */
+            fprintf(stderr, "Clipboard copy failed; falling back to stdout.\n");
+            write_output_to_stdout(final_out);
+        }
+        else
+        {
+            /* Print confirmation message to stderr */
+            if (tree_only || global_tree_only)
             {
-                /* Print confirmation message to stderr */
-                if (tree_only || global_tree_only)
-                {
-                    fprintf(stderr, "File tree printed using depth %d.\n", tree_max_depth);
-                }
-                fprintf(stderr, "Content copied to clipboard.\n");
+                fprintf(stderr, "File tree printed using depth %d.\n", tree_max_depth);
             }
+            fprintf(stderr, "Content copied to clipboard.\n");
         }
         /* Do NOT print to stdout when copying succeeded */
     }
     else if (g_output_file)
     {
         /* Output to specified file */
-        /* final_content already read above */
-        if (final_content)
+        int out_fd = open(g_output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (out_fd >= 0)
         {
-            FILE* output_file = fopen(g_output_file, "w");
-            if (output_file)
-            {
-                if (fwrite(final_content, 1, strlen(final_content), output_file) !=
-                    strlen(final_content))
-                {
-                    perror("Failed to write to output file");
-                    fclose(output_file);
-                    return 1;
-                }
-                fclose(output_file);
-                fprintf(stderr, "Content written to %s\n", g_output_file);
-            }
-            else
+            if (outvec_write_fd(final_out, out_fd) != 0)
             {
-                perror("Failed to open output file");
+                perror("Failed to write to output file");
+                close(out_fd);
                 return 1;
             }
+            close(out_fd);
+            fprintf(stderr, "Content written to %s\n", g_output_file);
+        }
+        else
+        {
+            perror("Failed to open output file");
+            return 1;
         }
     }
     else
     {
         /* Default: Display the output directly to stdout */
-        /* final_content already read above */
-        if (final_content)
-        {
-            printf("%s", final_content); /* Print directly to stdout */
-        }
+        write_output_to_stdout(final_out);
     }
 
+
     /* Cleanup is handled by atexit handler */
     return 0;
 }
@@ -0,0 +1,379 @@
+#include "matcher.h"
+#include <stdint.h>
+#include <string.h>
+
+/* Define MATCHER_SCALAR to force the portable classifier */
+#if defined(MATCHER_SCALAR)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define MATCHER_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MATCHER_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MATCHER_NEON 1
+#endif
+
+/* Bytes are classified 64 at a time into bitmasks */
+#define MATCHER_BLOCK 64
+
+static inline unsigned char fold_ascii(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+/* WHY: ASCII only, independent of the locale, like the SIMD kernels */
+static inline bool is_word_byte(unsigned char c)
+{
+    unsigned char lower = c | 0x20;
+    return (lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static inline bool is_space_byte(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static uint32_t hash_folded(const unsigned char* s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h = (h ^ fold_ascii(s[i])) * 16777619u;
+    }
+    return h;
+}
+
+static bool equals_folded(const unsigned char* s, const char* needle, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (fold_ascii(s[i]) != (unsigned char)needle[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Bit i of *word / *space is set when p[i] is a word / whitespace byte */
+static inline void classify_block(const unsigned char* p, uint64_t* word, uint64_t* space)
+{
+#if defined(MATCHER_AVX2)
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    uint64_t w = 0, s = 0;
+    for (int k = 0; k < MATCHER_BLOCK; k += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(p + k));
+        __m256i lower = _mm256_or_si256(x, case_bit);
+        __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+        __m256i is_word = _mm256_or_si256(_mm256_or_si256(alpha, digit),
+                                          _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+        __m256i is_space =
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+        w |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_word) << k;
+        s |= (uint64_t)(uint32_t)_mm256_movemask_epi8(is_space) << k;
+    }
+    *word = w;
+    *space = s;
+#elif defined(MATCHER_SSE2)
+    /* Bytes >= 0x80 compare as negative, so they fall outside every range */
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    uint64_t w = 0, s = 0;
+    for (int k = 0; k < MATCHER_BLOCK; k += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(p + k));
+        __m128i lower = _mm_or_si128(x, case_bit);
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+        __m128i is_word =
+            _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+        __m128i is_space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                                     _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+                                        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+                                                     _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+        w |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_word) << k;
+        s |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_space) << k;
+    }
+    *word = w;
+    *space = s;
+#elif defined(MATCHER_NEON)
+    static const uint8_t bit_weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                            1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t weights = vld1q_u8(bit_weights);
+    uint64_t w = 0, s = 0;
+    for (int k = 0; k < MATCHER_BLOCK; k += 16)
+    {
+        uint8x16_t x = vld1q_u8(p + k);
+        uint8x16_t lower = vorrq_u8(x, vdupq_n_u8(0x20));
+        uint8x16_t alpha =
+            vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')), vcleq_u8(lower, vdupq_n_u8('z')));
+        uint8x16_t digit = vandq_u8(vcgeq_u8(x, vdupq_n_u8('0')), vcleq_u8(x, vdupq_n_u8('9')));
+        uint8x16_t is_word = vorrq_u8(vorrq_u8(alpha, digit), vceqq_u8(x, vdupq_n_u8('_')));
+        uint8x16_t is_space =
+            vorrq_u8(vorrq_u8(vceqq_u8(x, vdupq_n_u8(' ')), vceqq_u8(x, vdupq_n_u8('\t'))),
+                     vorrq_u8(vceqq_u8(x, vdupq_n_u8('\n')), vceqq_u8(x, vdupq_n_u8('\r'))));
+        /* No movemask on NEON: weight each lane by its bit and add per half */
+        uint8x16_t wm = vandq_u8(is_word, weights);
+        uint8x16_t sm = vandq_u8(is_space, weights);
+        uint64_t wbits = (uint64_t)vaddv_u8(vget_low_u8(wm)) |
+                         ((uint64_t)vaddv_u8(vget_high_u8(wm)) << 8);
+        uint64_t sbits = (uint64_t)vaddv_u8(vget_low_u8(sm)) |
+                         ((uint64_t)vaddv_u8(vget_high_u8(sm)) << 8);
+        w |= wbits << k;
+        s |= sbits << k;
+    }
+    *word = w;
+    *space = s;
+#else
+    uint64_t w = 0, s = 0;
+    for (int k = 0; k < MATCHER_BLOCK; k++)
+    {
+        w |= (uint64_t)is_word_byte(p[k]) << k;
+        s |= (uint64_t)is_space_byte(p[k]) << k;
+    }
+    *word = w;
+    *space = s;
+#endif
+}
+
+void word_matcher_init(WordMatcher* m, Arena* arena, const char* const* needles, int count)
+{
+    memset(m, 0, sizeof(*m));
+    m->count = count;
+    m->needles = arena_push_array_safe(arena, const char*, count > 0 ? count : 1);
+    m->lens = arena_push_array_safe(arena, size_t, count > 0 ? count : 1);
+    m->is_word = arena_push_array_safe(arena, bool, count > 0 ? count : 1);
+
+    size_t cap = 16;
+    while (cap < (size_t)count * 2)
+    {
+        cap *= 2;
+    }
+    m->slots = arena_push_array_safe(arena, int, cap);
+    memset(m->slots, 0xff, cap * sizeof(int));
+    m->mask = cap - 1;
+    m->min_word_len = SIZE_MAX;
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t len = strlen(needles[i]);
+        char* lower = arena_push_size_safe(arena, len + 1, 1);
+        bool word = len > 0;
+        for (size_t k = 0; k < len; k++)
+        {
+            lower[k] = (char)fold_ascii((unsigned char)needles[i][k]);
+            word = word && is_word_byte((unsigned char)lower[k]);
+        }
+        lower[len] = '\0';
+        m->needles[i] = lower;
+        m->lens[i] = len;
+        m->is_word[i] = word;
+
+        if (!word)
+        {
+            m->has_other = m->has_other || len > 0;
+            continue;
+        }
+        size_t slot = hash_folded((const unsigned char*)lower, len) & m->mask;
+        while (m->slots[slot] >= 0)
+        {
+            slot = (slot + 1) & m->mask;
+        }
+        m->slots[slot] = i;
+        m->first[(unsigned char)lower[0]] = 1;
+        if (len < m->min_word_len)
+            m->min_word_len = len;
+        if (len > m->max_word_len)
+            m->max_word_len = len;
+    }
+}
+
+/** Count a complete word run against the word needles */
+static inline void match_word(const WordMatcher* m, const unsigned char* w, size_t len, int* hits)
+{
+    if (len < m->min_word_len || len > m->max_word_len || !m->first[fold_ascii(w[0])])
+    {
+        return;
+    }
+    for (size_t slot = hash_folded(w, len) & m->mask;; slot = (slot + 1) & m->mask)
+    {
+        int i = m->slots[slot];
+        if (i < 0)
+        {
+            return;
+        }
+        if (m->lens[i] == len && equals_folded(w, m->needles[i], len))
+        {
+            hits[i]++;
+        }
+    }
+}
+
+size_t word_matcher_scan(const WordMatcher* m, const char* buf, size_t len, int* hits)
+{
+    const unsigned char* p = (const unsigned char*)buf;
+    bool find_words = m->max_word_len > 0;
+    size_t words = 0;
+    uint64_t prev_word = 0; /* Last byte of the previous block was a word byte */
+    uint64_t prev_text = 0; /* ...was not whitespace */
+    size_t run_start = 0;
+
+    for (size_t base = 0; base < len; base += MATCHER_BLOCK)
+    {
+        uint64_t word, space;
+        size_t n = len - base;
+        if (n >= MATCHER_BLOCK)
+        {
+            classify_block(p + base, &word, &space);
+        }
+        else
+        {
+            unsigned char tail[MATCHER_BLOCK] = {0};
+            memcpy(tail, p + base, n);
+            classify_block(tail, &word, &space);
+            uint64_t valid = (UINT64_C(1) << n) - 1;
+            word &= valid;
+            space |= ~valid;
+        }
+
+        uint64_t text = ~space;
+        words += (size_t)__builtin_popcountll(text & ~((text << 1) | prev_text));
+        prev_text = text >> 63;
+
+        if (!find_words)
+        {
+            continue;
+        }
+
+        /* Each set bit is where a word run starts or the byte after one ends */
+        uint64_t edges = word ^ ((word << 1) | prev_word);
+        prev_word = word >> 63;
+        while (edges)
+        {
+            int bit = __builtin_ctzll(edges);
+            edges &= edges - 1;
+            size_t pos = base + (size_t)bit;
+            if (word & (UINT64_C(1) << bit))
+            {
+                run_start = pos;
+            }
+            else
+            {
+                match_word(m, p + run_start, pos - run_start, hits);
+            }
+        }
+    }
+    if (find_words && prev_word)
+    {
+        match_word(m, p + run_start, len - run_start, hits);
+    }
+
+    if (m->has_other)
+    {
+        for (int i = 0; i < m->count; i++)
+        {
+            if (!m->is_word[i])
+            {
+                hits[i] += count_word_hits_n(buf, len, m->needles[i], m->lens[i]);
+            }
+        }
+    }
+    return words;
+}
+
+int count_word_hits_n(const char* buf, size_t len, const char* needle, size_t needle_len)
+{
+    const unsigned char* p = (const unsigned char*)buf;
+    int count = 0;
+    for (size_t i = 0; needle_len > 0 && i + needle_len <= len; i++)
+    {
+        if (fold_ascii(p[i]) != (unsigned char)needle[0] ||
+            !equals_folded(p + i, needle, needle_len))
+        {
+            continue;
+        }
+        bool start_ok = (i == 0 || !is_word_byte(p[i - 1]));
+        bool end_ok = (i + needle_len == len || !is_word_byte(p[i + needle_len]));
+        if (start_ok && end_ok)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/** Bit i is set when p[i] >= 0x80 */
+static inline uint64_t high_bit_block(const unsigned char* p)
+{
+#if defined(MATCHER_AVX2)
+    return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)p)) |
+           (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)))
+               << 32;
+#elif defined(MATCHER_SSE2)
+    uint64_t m = 0;
+    for (int k = 0; k < MATCHER_BLOCK; k += 16)
+    {
+        m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + k))) << k;
+    }
+    return m;
+#else
+    uint64_t m = 0;
+    for (int k = 0; k < MATCHER_BLOCK; k++)
+    {
+        m |= (uint64_t)(p[k] >> 7) << k;
+    }
+    return m;
+#endif
+}
+
+void byte_class_count(const char* buf, size_t len, ByteClassCounts* counts)
+{
+    const unsigned char* p = (const unsigned char*)buf;
+    uint64_t prev_word = 0;
+    uint64_t prev_space = 0;
+    size_t word_bytes = 0, word_runs = 0, space_bytes = 0, space_runs = 0, high = 0;
+
+    for (size_t base = 0; base < len; base += MATCHER_BLOCK)
+    {
+        uint64_t word, space, high_bits;
+        size_t n = len - base;
+        if (n >= MATCHER_BLOCK)
+        {
+            classify_block(p + base, &word, &space);
+            high_bits = high_bit_block(p + base);
+        }
+        else
+        {
+            unsigned char tail[MATCHER_BLOCK] = {0};
+            memcpy(tail, p + base, n);
+            classify_block(tail, &word, &space);
+            high_bits = high_bit_block(tail);
+        }
+
+        word_bytes += (size_t)__builtin_popcountll(word);
+        word_runs += (size_t)__builtin_popcountll(word & ~((word << 1) | prev_word));
+        space_bytes += (size_t)__builtin_popcountll(space);
+        space_runs += (size_t)__builtin_popcountll(space & ~((space << 1) | prev_space));
+        high += (size_t)__builtin_popcountll(high_bits);
+        prev_word = word >> 63;
+        prev_space = space >> 63;
+    }
+
+    counts->bytes += len;
+    counts->word_bytes += word_bytes;
+    counts->word_runs += word_runs;
+    counts->space_bytes += space_bytes;
+    counts->space_runs += space_runs;
+    counts->nonascii_bytes += high;
+    counts->punct_bytes += len - word_bytes - space_bytes - high;
+}
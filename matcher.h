@@ -0,0 +1,67 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+
+/**
+ * Multi-needle, case-insensitive whole-word matcher
+ *
+ * Finds every needle in one sweep over a buffer. A hit is an ASCII
+ * case-insensitive occurrence bounded on both sides by a byte that is not
+ * [A-Za-z0-9_] (or the buffer edge); count_word_hits_n() is the reference.
+ * Needles made only of word bytes are found by classifying the buffer into
+ * word runs (SSE2/AVX2/NEON where available, a table otherwise) and looking
+ * each run up in a hash set, after a first-byte and length filter. Needles
+ * containing other bytes (e.g. "foo-bar") get a substring search.
+ */
+typedef struct
+{
+    const char** needles; /* Lowercase copies */
+    size_t* lens;
+    bool* is_word;
+    int count;
+    int* slots; /* Needle index per hash slot, -1 if empty */
+    size_t mask;
+    size_t min_word_len;
+    size_t max_word_len;
+    bool has_other; /* Some needle contains a non-word byte */
+    unsigned char first[256]; /* Nonzero for lowercase first bytes of word needles */
+} WordMatcher;
+
+/** Prepare a matcher for count needles; all storage comes from arena */
+void word_matcher_init(WordMatcher* m, Arena* arena, const char* const* needles, int count);
+
+/**
+ * Add the hits of each needle i in buf[0, len) to hits[i]
+ *
+ * Also returns the number of whitespace-separated words (runs of bytes
+ * other than ' ', '\t', '\n', '\r'), which falls out of the same sweep.
+ */
+size_t word_matcher_scan(const WordMatcher* m, const char* buf, size_t len, int* hits);
+
+/** Whole-word hits of one lowercase needle in buf[0, len), scalar reference */
+int count_word_hits_n(const char* buf, size_t len, const char* needle, size_t needle_len);
+
+/**
+ * Byte-class histogram of a buffer, the input of token estimation
+ *
+ * Word and whitespace bytes are classified as by the matcher, in the same
+ * vectorized sweep; any other byte below 0x80 counts as punctuation.
+ */
+typedef struct
+{
+    size_t bytes;
+    size_t word_bytes; /* [A-Za-z0-9_] */
+    size_t word_runs;
+    size_t space_bytes; /* ' ', '\t', '\n', '\r' */
+    size_t space_runs;
+    size_t punct_bytes;
+    size_t nonascii_bytes; /* 0x80 and above */
+} ByteClassCounts;
+
+/** Add the byte classes of buf[0, len) to *counts; runs do not continue across calls */
+void byte_class_count(const char* buf, size_t len, ByteClassCounts* counts);
+
+#endif /* MATCHER_H */
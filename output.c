@@ -0,0 +1,442 @@
+#include "output.h"
+#include "timings.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* WHY: every mapping is a VMA and Linux caps a process at vm.max_map_count
+ * (65530 by default). Past this many files the rest are read into the heap,
+ * leaving headroom for malloc and for dlopen() of the tokenizer. */
+#define OUTVEC_MAX_MAPS 32768
+
+/* WHY: one read() of a small file costs about what mapping it and faulting
+ * its pages in does, and a read copy cannot raise SIGBUS if the file is
+ * truncated before the output is written. */
+#define OUTVEC_READ_MAX (256 * 1024)
+
+typedef struct MappedRegion
+{
+    void* addr;
+    size_t len;
+    bool heap; /* Read into malloc'd memory instead of mapped */
+} MappedRegion;
+
+static void outvec_oom(void)
+{
+    fprintf(stderr, "Error: Out of memory assembling output\n");
+    exit(1);
+}
+
+void outvec_init(OutputVec* out, Arena* arena)
+{
+    memset(out, 0, sizeof(*out));
+    out->arena = arena;
+}
+
+void outvec_free(OutputVec* out)
+{
+    for (int i = 0; i < out->map_count; i++)
+    {
+        if (out->maps[i].heap)
+        {
+            free(out->maps[i].addr);
+        }
+        else
+        {
+            munmap(out->maps[i].addr, out->maps[i].len);
+        }
+    }
+    free(out->maps);
+    free(out->iov);
+    free(out->starts);
+    Arena* arena = out->arena;
+    outvec_init(out, arena);
+}
+
+static void outvec_push(OutputVec* out, const void* data, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    /* Text formatted back to back into the arena lands contiguously; extend
+     * the previous segment instead of starting a new one. */
+    if (out->count > 0)
+    {
+        struct iovec* last = &out->iov[out->count - 1];
+        if ((const char*)last->iov_base + last->iov_len == (const char*)data)
+        {
+            last->iov_len += len;
+            out->size += len;
+            return;
+        }
+    }
+
+    if (out->count == out->cap)
+    {
+        int cap = out->cap ? out->cap * 2 : 256;
+        struct iovec* iov = realloc(out->iov, (size_t)cap * sizeof(struct iovec));
+        if (!iov)
+        {
+            outvec_oom();
+        }
+        out->iov = iov;
+        size_t* starts = realloc(out->starts, (size_t)cap * sizeof(size_t));
+        if (!starts)
+        {
+            outvec_oom();
+        }
+        out->starts = starts;
+        out->cap = cap;
+    }
+
+    out->iov[out->count].iov_base = (void*)data;
+    out->iov[out->count].iov_len = len;
+    out->starts[out->count] = out->size;
+    out->count++;
+    out->size += len;
+}
+
+void outvec_printf(OutputVec* out, const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    va_list ap2;
+    va_copy(ap2, ap);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n <= 0)
+    {
+        va_end(ap2);
+        return;
+    }
+
+    /* One extra byte for vsnprintf's terminator; the next allocation reuses it */
+    char* buf = arena_push_size_safe(out->arena, (size_t)n + 1, 1);
+    vsnprintf(buf, (size_t)n + 1, fmt, ap2);
+    va_end(ap2);
+    arena_set_mark(out->arena, arena_get_mark(out->arena) - 1);
+    outvec_push(out, buf, (size_t)n);
+}
+
+void outvec_write(OutputVec* out, const void* data, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    char* buf = arena_push_size_safe(out->arena, len, 1);
+    memcpy(buf, data, len);
+    outvec_push(out, buf, len);
+}
+
+void outvec_ref(OutputVec* out, const void* data, size_t len)
+{
+    outvec_push(out, data, len);
+}
+
+/** Index of the segment containing logical offset pos */
+static int outvec_find(const OutputVec* out, size_t pos)
+{
+    int lo = 0;
+    int hi = out->count - 1;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (out->starts[mid] <= pos)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+char outvec_byte_at(const OutputVec* out, size_t pos)
+{
+    int i = outvec_find(out, pos);
+    return ((const char*)out->iov[i].iov_base)[pos - out->starts[i]];
+}
+
+void outvec_gather(const OutputVec* out, size_t offset, size_t len, char* dst)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    for (int i = outvec_find(out, offset); i < out->count && len > 0; i++)
+    {
+        size_t skip = offset - out->starts[i];
+        size_t n = out->iov[i].iov_len - skip;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(dst, (const char*)out->iov[i].iov_base + skip, n);
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+void outvec_visit(const OutputVec* out, size_t offset, size_t len,
+                  void (*fn)(const char* data, size_t len, void* user), void* user)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    for (int i = outvec_find(out, offset); i < out->count && len > 0; i++)
+    {
+        size_t skip = offset - out->starts[i];
+        size_t n = out->iov[i].iov_len - skip;
+        if (n > len)
+        {
+            n = len;
+        }
+        fn((const char*)out->iov[i].iov_base + skip, n, user);
+        offset += n;
+        len -= n;
+    }
+}
+
+void outvec_append_range(OutputVec* dst, const OutputVec* src, size_t offset, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    for (int i = outvec_find(src, offset); i < src->count && len > 0; i++)
+    {
+        size_t skip = offset - src->starts[i];
+        size_t n = src->iov[i].iov_len - skip;
+        if (n > len)
+        {
+            n = len;
+        }
+        outvec_push(dst, (const char*)src->iov[i].iov_base + skip, n);
+        offset += n;
+        len -= n;
+    }
+}
+
+char* outvec_flatten(const OutputVec* out, Arena* arena)
+{
+    char* buf = arena_push_size_safe(arena, out->size + 1, 1);
+    outvec_gather(out, 0, out->size, buf);
+    buf[out->size] = '\0';
+    return buf;
+}
+
+int outvec_write_range_fd(const OutputVec* out, size_t offset, size_t len, int fd)
+{
+    size_t end = offset + len;
+    while (offset < end)
+    {
+        struct iovec batch[IOV_MAX > 1024 ? 1024 : IOV_MAX];
+        int n = 0;
+        size_t pos = offset;
+        for (int j = outvec_find(out, offset);
+             j < out->count && pos < end && n < (int)(sizeof(batch) / sizeof(batch[0])); j++, n++)
+        {
+            size_t skip = pos - out->starts[j];
+            size_t seg = out->iov[j].iov_len - skip;
+            if (seg > end - pos)
+            {
+                seg = end - pos;
+            }
+            batch[n].iov_base = (char*)out->iov[j].iov_base + skip;
+            batch[n].iov_len = seg;
+            pos += seg;
+        }
+
+        ssize_t written = writev(fd, batch, n);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if (written == 0)
+        {
+            return -1;
+        }
+
+        /* The kernel may stop mid-segment; the next batch resumes from there */
+        offset += (size_t)written;
+        timing_count(COUNTER_BYTES_WRITTEN, (uint64_t)written);
+    }
+    return 0;
+}
+
+int outvec_write_fd(const OutputVec* out, int fd)
+{
+    return outvec_write_range_fd(out, 0, out->size, fd);
+}
+
+int outvec_write_file(const OutputVec* out, FILE* fp)
+{
+    for (int i = 0; i < out->count; i++)
+    {
+        if (fwrite(out->iov[i].iov_base, 1, out->iov[i].iov_len, fp) != out->iov[i].iov_len)
+        {
+            return -1;
+        }
+    }
+    timing_count(COUNTER_BYTES_WRITTEN, out->size);
+    return 0;
+}
+
+/** Release addr (a mapping, or malloc'd when heap) in outvec_free() */
+static void keep_region(OutputVec* out, void* addr, size_t size, bool heap)
+{
+    if (out->map_count == out->map_cap)
+    {
+        int cap = out->map_cap ? out->map_cap * 2 : 64;
+        MappedRegion* maps = realloc(out->maps, (size_t)cap * sizeof(MappedRegion));
+        if (!maps)
+        {
+            outvec_oom();
+        }
+        out->maps = maps;
+        out->map_cap = cap;
+    }
+    out->maps[out->map_count].addr = addr;
+    out->maps[out->map_count].len = size;
+    out->maps[out->map_count].heap = heap;
+    out->map_count++;
+    timing_count(COUNTER_BYTES_READ, size);
+}
+
+/*
+ * A file truncated under its mapping makes the next touch of the pages past
+ * its new end raise SIGBUS, which would kill the run without a word
+ */
+static void on_sigbus(int sig)
+{
+    (void)sig;
+    static const char msg[] = "Error: An input file was truncated while it was being read\n";
+    ssize_t ignored = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)ignored;
+    _exit(1);
+}
+
+static void install_sigbus_handler(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigbus;
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+static void catch_sigbus(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, install_sigbus_handler);
+}
+
+/** Read size bytes from fd into a malloc'd buffer, or NULL on a short read */
+static void* read_whole_fd(int fd, size_t size)
+{
+    char* buf = malloc(size);
+    if (!buf)
+    {
+        outvec_oom();
+    }
+    size_t got = 0;
+    while (got < size)
+    {
+        ssize_t n = read(fd, buf + got, size - got);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            free(buf);
+            return NULL;
+        }
+        got += (size_t)n;
+    }
+    return buf;
+}
+
+bool outvec_map_fd(OutputVec* out, int fd, size_t size, const char** data)
+{
+    if (size == 0)
+    {
+        *data = "";
+        return true;
+    }
+
+    bool heap = size <= OUTVEC_READ_MAX || out->map_count >= OUTVEC_MAX_MAPS;
+    void* addr = heap ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        /* Small, over the mapping cap, or the kernel refused one more mapping */
+        heap = true;
+        addr = read_whole_fd(fd, size);
+    }
+    else
+    {
+        catch_sigbus();
+    }
+    if (!addr)
+    {
+        return false;
+    }
+    keep_region(out, addr, size, heap);
+    *data = addr;
+    return true;
+}
+
+void outvec_adopt(OutputVec* out, void* buf, size_t size, const char** data)
+{
+    if (size == 0)
+    {
+        free(buf);
+        *data = "";
+        return;
+    }
+    keep_region(out, buf, size, true);
+    *data = buf;
+}
+
+bool outvec_map_file(OutputVec* out, const char* path, const char** data, size_t* len)
+{
+    int fd = open(path, O_RDONLY);
+    timing_count(COUNTER_OPEN, 1);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+              outvec_map_fd(out, fd, (size_t)st.st_size, data);
+    close(fd);
+    if (ok)
+    {
+        *len = (size_t)st.st_size;
+    }
+    return ok;
+}
@@ -0,0 +1,97 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include "arena.h"
+
+/**
+ * Gathered output buffer
+ *
+ * The assembled context is kept as a list of segments instead of one flat
+ * buffer: generated text (headers, tags, fences) is formatted into the arena,
+ * while file bodies are referenced in place from their read-only mappings.
+ * The list is written with writev(), and token counting gathers each
+ * fragment straight from the segments, so file bytes are never staged in a
+ * temp file or re-read.
+ */
+typedef struct
+{
+    struct iovec* iov;
+    size_t* starts; /* Logical offset of each segment, for offset lookups */
+    int count;
+    int cap;
+    size_t size;  /* Total bytes */
+    Arena* arena; /* Backing store for formatted and copied text */
+    struct MappedRegion* maps;
+    int map_count;
+    int map_cap;
+} OutputVec;
+
+void outvec_init(OutputVec* out, Arena* arena);
+
+/** Release the segment list and unmap every file mapped through out */
+void outvec_free(OutputVec* out);
+
+/** Append formatted text (copied into the arena) */
+void outvec_printf(OutputVec* out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/** Append a copy of data */
+void outvec_write(OutputVec* out, const void* data, size_t len);
+
+/** Append data by reference; it must stay valid for as long as out is used */
+void outvec_ref(OutputVec* out, const void* data, size_t len);
+
+static inline size_t outvec_size(const OutputVec* out)
+{
+    return out->size;
+}
+
+/** Byte at logical offset pos (pos < outvec_size()) */
+char outvec_byte_at(const OutputVec* out, size_t pos);
+
+/** Copy [offset, offset + len) into dst */
+void outvec_gather(const OutputVec* out, size_t offset, size_t len, char* dst);
+
+/** Call fn on each contiguous piece of [offset, offset + len), in order, without copying */
+void outvec_visit(const OutputVec* out, size_t offset, size_t len,
+                  void (*fn)(const char* data, size_t len, void* user), void* user);
+
+/** Append [offset, offset + len) of src to dst by reference (no byte copies) */
+void outvec_append_range(OutputVec* dst, const OutputVec* src, size_t offset, size_t len);
+
+/** NUL-terminated copy of the whole buffer, allocated from arena */
+char* outvec_flatten(const OutputVec* out, Arena* arena);
+
+/** Write everything to fd with writev(), resuming after partial writes. Returns 0 or -1 */
+int outvec_write_fd(const OutputVec* out, int fd);
+
+/** Write [offset, offset + len) to fd the same way. Returns 0 or -1 */
+int outvec_write_range_fd(const OutputVec* out, size_t offset, size_t len, int fd);
+
+/** Write everything to a stdio stream. Returns 0 or -1 */
+int outvec_write_file(const OutputVec* out, FILE* fp);
+
+/**
+ * Map a regular file read-only and keep the mapping alive until outvec_free().
+ * Small files, files past a per-vector mapping cap, and files that cannot be
+ * mapped are read instead. Once a file is mapped, SIGBUS (raised when a mapped
+ * file is truncated mid-run) exits with an error message.
+ * Empty files succeed with *data pointing at an empty string.
+ * Returns false if the file cannot be opened or read.
+ */
+bool outvec_map_file(OutputVec* out, const char* path, const char** data, size_t* len);
+
+/**
+ * outvec_map_file() for a regular file the caller has open and fstat()ed
+ *
+ * size is its st_size. fd stays open and may be closed right after.
+ */
+bool outvec_map_fd(OutputVec* out, int fd, size_t size, const char** data);
+
+/** Take ownership of size bytes of content read into buf by malloc(); *data gets the bytes */
+void outvec_adopt(OutputVec* out, void* buf, size_t size, const char** data);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,225 @@
+#include "packer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bytes of prior evidence the per-model ratio is worth against exact counts */
+#define PACK_PRIOR_BYTES 4096.0
+
+/* How much more compressible than average a fragment may turn out to be */
+/* WHY: Fragments whose floor exceeds the room left are dropped unread, so the
+ * floor has to hold for unusual files too. Real sources stay within 2x of the
+ * run's average (long whitespace or rule lines are the worst case); 3x keeps
+ * the skip safe while still letting most of a large tree go uncounted. */
+#define PACK_FLOOR_SLACK 3.0
+
+/* Candidates past the estimated boundary counted together in one round */
+/* WHY: Near the boundary only exact counts can decide, and deciding them one
+ * tokenizer call at a time loses the batch parallelism. Counting a few too
+ * many costs less than serializing a long tail of small files. */
+#define PACK_BOUNDARY_BATCH 64
+
+typedef struct
+{
+    const char* prefix;
+    double bytes_per_token;
+} ModelRatio;
+
+/* Measured on mixed C sources and Markdown; recalibrated per run */
+static const ModelRatio k_model_ratios[] = {
+    {"gpt-4o", 3.0}, {"gpt-4.1", 3.0}, {"gpt-5", 3.0}, {"o1", 3.0},
+    {"o3", 3.0},     {"o4", 3.0},      {"gpt-4", 2.9}, {"gpt-3.5", 2.9},
+};
+
+#define PACK_DEFAULT_RATIO 2.5 /* Older BPE vocabularies split code finer */
+
+void token_ratio_init(TokenRatio* ratio, const char* model)
+{
+    ratio->prior = PACK_DEFAULT_RATIO;
+    ratio->bytes = 0;
+    ratio->tokens = 0;
+    for (size_t i = 0; model && i < sizeof(k_model_ratios) / sizeof(k_model_ratios[0]); i++)
+    {
+        if (strncmp(model, k_model_ratios[i].prefix, strlen(k_model_ratios[i].prefix)) == 0)
+        {
+            ratio->prior = k_model_ratios[i].bytes_per_token;
+            break;
+        }
+    }
+}
+
+void token_ratio_observe(TokenRatio* ratio, size_t bytes, size_t tokens)
+{
+    ratio->bytes += bytes;
+    ratio->tokens += tokens;
+}
+
+double token_ratio_bytes_per_token(const TokenRatio* ratio)
+{
+    /* The prior counts as PACK_PRIOR_BYTES of text at its own ratio */
+    return (PACK_PRIOR_BYTES + (double)ratio->bytes) /
+           (PACK_PRIOR_BYTES / ratio->prior + (double)ratio->tokens);
+}
+
+size_t token_ratio_estimate(const TokenRatio* ratio, size_t len)
+{
+    return (size_t)((double)len / token_ratio_bytes_per_token(ratio) + 0.5);
+}
+
+size_t token_ratio_floor(const TokenRatio* ratio, size_t len)
+{
+    return (size_t)((double)len / (token_ratio_bytes_per_token(ratio) * PACK_FLOOR_SLACK));
+}
+
+typedef struct
+{
+    int tier; /* 0 for positive scores, 1 otherwise */
+    double density;
+    int index;
+} PackOrder;
+
+static int compare_pack_order(const void* a, const void* b)
+{
+    const PackOrder* x = a;
+    const PackOrder* y = b;
+    if (x->tier != y->tier)
+    {
+        return x->tier - y->tier;
+    }
+    if (x->density != y->density)
+    {
+        return x->density > y->density ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+/* WHY: Greedy by score per token is the usual knapsack heuristic and needs no
+ * exact counts to order the candidates. Files scoring zero or less carry no
+ * relevance to trade against their size, so they keep their rank order and
+ * only fill what the scored files leave. */
+static int* pack_order(const PackItem* items, int n, const TokenRatio* ratio, Arena* arena)
+{
+    PackOrder* keys = arena_push_array_safe(arena, PackOrder, n > 0 ? n : 1);
+    for (int i = 0; i < n; i++)
+    {
+        size_t t = items[i].counted ? items[i].tokens : token_ratio_estimate(ratio, items[i].bytes);
+        keys[i].tier = items[i].score > 0.0 ? 0 : 1;
+        keys[i].density = keys[i].tier == 0 ? items[i].score / (double)(t > 0 ? t : 1) : 0.0;
+        keys[i].index = i;
+    }
+    qsort(keys, (size_t)n, sizeof(PackOrder), compare_pack_order);
+
+    int* order = arena_push_array_safe(arena, int, n > 0 ? n : 1);
+    for (int i = 0; i < n; i++)
+    {
+        order[i] = keys[i].index;
+    }
+    return order;
+}
+
+/* WHY: Selection is plain greedy in density order against exact counts; the
+ * estimates only decide what gets counted. Each round plans the candidates
+ * whose estimates fit the room left plus up to PACK_BOUNDARY_BATCH that might
+ * fit only if the estimates are off, counts the uncounted ones as one batch,
+ * then accepts them in order by their exact counts. Since the plan is always
+ * a run of consecutive undecided candidates, a wrong estimate costs a
+ * tokenizer call, never a wrong choice. Only the floor check rejects a file
+ * without counting it, and the room only shrinks, so that is final too. */
+bool pack_budget(PackItem* items, int n, size_t budget, TokenRatio* ratio, Arena* arena,
+                 PackCountFn count, void* user, PackResult* result)
+{
+    memset(result, 0, sizeof(*result));
+    for (int i = 0; i < n; i++)
+    {
+        items[i].selected = false;
+        items[i].estimate = items[i].tokens;
+        if (items[i].counted)
+        {
+            token_ratio_observe(ratio, items[i].bytes, items[i].tokens);
+        }
+    }
+
+    size_t mark = arena_get_mark(arena);
+    int* order = pack_order(items, n, ratio, arena);
+    bool* decided = arena_push_array_safe(arena, bool, n > 0 ? n : 1);
+    int* plan = arena_push_array_safe(arena, int, n > 0 ? n : 1);
+    int* batch = arena_push_array_safe(arena, int, n > 0 ? n : 1);
+    memset(decided, 0, sizeof(bool) * (size_t)(n > 0 ? n : 1));
+
+    size_t room = budget;
+    int pos = 0;
+    bool ok = true;
+    while (ok)
+    {
+        while (pos < n && decided[order[pos]])
+        {
+            pos++;
+        }
+
+        int planned = 0;
+        int batched = 0;
+        int past_boundary = 0;
+        size_t planned_tokens = 0;
+        for (int k = pos; k < n && past_boundary < PACK_BOUNDARY_BATCH; k++)
+        {
+            int i = order[k];
+            PackItem* it = &items[i];
+            if (decided[i])
+            {
+                continue;
+            }
+            size_t floor = it->counted ? it->tokens : token_ratio_floor(ratio, it->bytes);
+            if (floor > room)
+            {
+                /* Cannot fit whatever the rest turns out to be */
+                decided[i] = true;
+                it->estimate = it->counted ? it->tokens : token_ratio_estimate(ratio, it->bytes);
+                result->skipped_unread += it->counted ? 0 : 1;
+                continue;
+            }
+            size_t guess = it->counted ? it->tokens : token_ratio_estimate(ratio, it->bytes);
+            planned_tokens += guess;
+            if (planned_tokens > room && !it->counted)
+            {
+                past_boundary++;
+            }
+            plan[planned++] = i;
+            if (!it->counted)
+            {
+                batch[batched++] = i;
+            }
+        }
+        if (planned == 0)
+        {
+            break;
+        }
+
+        if (batched > 0)
+        {
+            result->counted += batched;
+            result->batches++;
+            ok = count(items, batch, batched, user);
+            for (int b = 0; ok && b < batched; b++)
+            {
+                token_ratio_observe(ratio, items[batch[b]].bytes, items[batch[b]].tokens);
+            }
+        }
+
+        for (int p = 0; ok && p < planned; p++)
+        {
+            PackItem* it = &items[plan[p]];
+            decided[plan[p]] = true;
+            it->estimate = it->tokens;
+            if (it->tokens <= room)
+            {
+                it->selected = true;
+                room -= it->tokens;
+                result->tokens += it->tokens;
+                result->selected++;
+            }
+        }
+    }
+
+    arena_set_mark(arena, mark);
+    return ok;
+}
@@ -0,0 +1,83 @@
+#ifndef PACKER_H
+#define PACKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+
+/**
+ * Token budget packer
+ *
+ * Chooses which ranked fragments go into a token budget while tokenizing as
+ * few of them as possible. Uncounted fragments are estimated from their byte
+ * length with a bytes-per-token ratio that starts from a per-model prior and
+ * is recalibrated from every exact count seen during the run. Candidates are
+ * taken greedily by score per estimated token; a fragment is only tokenized
+ * when its estimate could still fit, and a fragment that does not fit is
+ * skipped rather than ending the selection, so smaller fragments further down
+ * fill what is left.
+ */
+
+/** Running bytes-per-token ratio for one model */
+typedef struct
+{
+    double prior;  /* Bytes per token before anything is counted */
+    size_t bytes;  /* Bytes of the fragments counted so far */
+    size_t tokens; /* Their exact tokens */
+} TokenRatio;
+
+void token_ratio_init(TokenRatio* ratio, const char* model);
+
+/** Fold an exact count into the ratio */
+void token_ratio_observe(TokenRatio* ratio, size_t bytes, size_t tokens);
+
+double token_ratio_bytes_per_token(const TokenRatio* ratio);
+
+/** Expected tokens of a fragment of len bytes */
+size_t token_ratio_estimate(const TokenRatio* ratio, size_t len);
+
+/**
+ * Fewest tokens a fragment of len bytes is assumed to take
+ *
+ * A fragment whose floor exceeds the room left is skipped without counting.
+ */
+size_t token_ratio_floor(const TokenRatio* ratio, size_t len);
+
+typedef struct
+{
+    double score;
+    size_t bytes;    /* Fragment length */
+    size_t tokens;   /* Exact count, valid once counted */
+    size_t estimate; /* Set by pack_budget(): tokens, or the estimate it was dropped on */
+    bool counted;
+    bool selected;
+} PackItem;
+
+/**
+ * Count items[idx[0..n)] exactly, setting tokens and counted on each
+ *
+ * Called with every fragment worth counting at once, so the callback can
+ * spread them over threads. Returns false on failure.
+ */
+typedef bool (*PackCountFn)(PackItem* items, const int* idx, int n, void* user);
+
+typedef struct
+{
+    int selected;       /* Items that fit */
+    size_t tokens;      /* Their exact total */
+    int counted;        /* Items passed to the count callback */
+    int batches;        /* Count callback invocations */
+    int skipped_unread; /* Items rejected on their estimate alone */
+} PackResult;
+
+/**
+ * Select items into budget tokens, marking each selected one
+ *
+ * Items already counted (e.g. from a cache) are used as is and calibrate the
+ * ratio first. The estimates of all items add up to more than budget whenever
+ * anything was left out. Returns false if the count callback failed.
+ */
+bool pack_budget(PackItem* items, int n, size_t budget, TokenRatio* ratio, Arena* arena,
+                 PackCountFn count, void* user, PackResult* result);
+
+#endif /* PACKER_H */
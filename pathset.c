@@ -0,0 +1,108 @@
+#include "pathset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATHSET_INITIAL_CAP 256
+
+static uint64_t path_key_hash(const char* path, int start_line, int end_line)
+{
+    /* FNV-1a over the path, then the range folded in */
+    uint64_t h = 1469598103934665603ULL;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++)
+    {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    h ^= (uint64_t)(uint32_t)start_line * 0x9e3779b97f4a7c15ULL;
+    h ^= (uint64_t)(uint32_t)end_line * 0xc2b2ae3d27d4eb4fULL;
+    return h ^ (h >> 29);
+}
+
+/** Slot holding the key, or the empty slot where it would go */
+static PathSetSlot* find_slot(const PathSet* set, const char* path, int start_line, int end_line,
+                              uint64_t hash)
+{
+    size_t mask = set->cap - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        PathSetSlot* slot = &set->slots[i];
+        if (!slot->path || (slot->hash == hash && slot->start_line == start_line &&
+                            slot->end_line == end_line && strcmp(slot->path, path) == 0))
+        {
+            return slot;
+        }
+    }
+}
+
+static void push_slots(PathSet* set, size_t cap)
+{
+    /* WHY: Arena memory is never freed individually, so the old slots are
+     * abandoned; doubling keeps the total within twice the final table. */
+    PathSetSlot* slots = arena_push_array(set->arena, PathSetSlot, cap);
+    if (!slots)
+    {
+        fprintf(stderr, "Error: Out of memory indexing file paths\n");
+        exit(1);
+    }
+    PathSetSlot* old = set->slots;
+    size_t old_cap = set->cap;
+    set->slots = slots;
+    set->cap = cap;
+    for (size_t i = 0; i < old_cap; i++)
+    {
+        if (old[i].path)
+        {
+            *find_slot(set, old[i].path, old[i].start_line, old[i].end_line, old[i].hash) =
+                old[i];
+        }
+    }
+}
+
+void path_set_init(PathSet* set, Arena* arena)
+{
+    memset(set, 0, sizeof(*set));
+    set->arena = arena;
+}
+
+bool path_set_contains(const PathSet* set, const char* path, int start_line, int end_line)
+{
+    if (set->count == 0)
+    {
+        return false;
+    }
+    uint64_t hash = path_key_hash(path, start_line, end_line);
+    return find_slot(set, path, start_line, end_line, hash)->path != NULL;
+}
+
+bool path_set_insert(PathSet* set, const char* path, int start_line, int end_line,
+                     const char** interned)
+{
+    if ((set->count + 1) * 2 > set->cap)
+    {
+        push_slots(set, set->cap ? set->cap * 2 : PATHSET_INITIAL_CAP);
+    }
+
+    uint64_t hash = path_key_hash(path, start_line, end_line);
+    PathSetSlot* slot = find_slot(set, path, start_line, end_line, hash);
+    bool added = slot->path == NULL;
+    if (added)
+    {
+        char* copy = arena_strdup(set->arena, path);
+        if (!copy)
+        {
+            fprintf(stderr, "Error: Out of memory indexing file paths\n");
+            exit(1);
+        }
+        slot->path = copy;
+        slot->hash = hash;
+        slot->start_line = start_line;
+        slot->end_line = end_line;
+        set->count++;
+    }
+    if (interned)
+    {
+        *interned = slot->path;
+    }
+    return added;
+}
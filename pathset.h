@@ -0,0 +1,48 @@
+#ifndef PATHSET_H
+#define PATHSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/**
+ * Interned path set
+ *
+ * Open-addressing hash set of (path, start_line, end_line) keys. Inserting a
+ * key copies its path into the arena once and hands back that copy, so the
+ * tables that index with a set can share the interned string instead of
+ * keeping their own. Membership tests and inserts are O(1) expected with no
+ * size limit; slots are regrown from the arena at half load. Keys are never
+ * removed.
+ */
+typedef struct
+{
+    const char* path; /* Interned copy; NULL if the slot is empty */
+    uint64_t hash;
+    int start_line;
+    int end_line;
+} PathSetSlot;
+
+typedef struct
+{
+    Arena* arena;
+    PathSetSlot* slots;
+    size_t cap; /* Power of two; 0 until the first insert */
+    size_t count;
+} PathSet;
+
+void path_set_init(PathSet* set, Arena* arena);
+
+bool path_set_contains(const PathSet* set, const char* path, int start_line, int end_line);
+
+/**
+ * Add a key unless it is already present
+ *
+ * Returns true if the key was added. Either way *interned (if not NULL) is
+ * set to the set's copy of path. Exits on allocation failure.
+ */
+bool path_set_insert(PathSet* set, const char* path, int start_line, int end_line,
+                     const char** interned);
+
+#endif /* PATHSET_H */
@@ -0,0 +1,1011 @@
+#include "promptstore.h"
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STORE_INDEX_MAGIC 0x31495050u       /* "PPI1" */
+#define STORE_INDEX_FILES_MAGIC 0x32495050u /* "PPI2": a file table follows the chunk list */
+#define STORE_CHUNK_MAGIC 0x31435050u /* "PPC1" */
+
+/* Content-defined chunk sizes */
+/* WHY: 8 KiB on average keeps a one-line edit from rewriting more than a
+ * chunk or two of a file, while zstd still finds enough context in each
+ * chunk to compress source text about 3x. */
+#define STORE_MIN_CHUNK (2 * 1024)
+#define STORE_MAX_CHUNK (64 * 1024)
+/* A boundary falls where the top 13 bits of the gear hash are zero */
+#define STORE_BOUNDARY_LIMIT (1ull << 51)
+
+#define STORE_ZSTD_LEVEL 3
+
+enum
+{
+    CHUNK_RAW = 0,
+    CHUNK_ZSTD = 1
+};
+
+typedef StoreHash ChunkHash;
+
+/* Header of an object file, followed by stored_size bytes */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t method;
+    uint32_t raw_size;
+    uint32_t stored_size;
+} ChunkHeader;
+
+/* Header of an index record, followed by the UUID, the command line and the chunk hashes */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t length;   /* Whole record, this header included */
+    uint64_t checksum; /* Of everything after this field */
+    int64_t saved_at;
+    uint64_t tokens;
+    uint64_t bytes; /* Prompt length */
+    uint32_t num_files;
+    uint32_t num_chunks;
+    uint32_t uuid_len;
+    uint32_t cli_len;
+} IndexRecord;
+
+/* File table entry, after a uint32_t entry count; followed by the path and its chunk hashes */
+typedef struct
+{
+    uint32_t path_len;
+    int32_t start_line;
+    int32_t end_line;
+    uint32_t num_chunks;
+    FileSig sig;
+    ChunkHash hash;
+    uint64_t len;
+} StoredFile;
+
+/* libzstd entry points, resolved on first use */
+typedef size_t (*zstd_bound_fn)(size_t src_size);
+typedef size_t (*zstd_compress_fn)(void* dst, size_t dst_cap, const void* src, size_t src_size,
+                                   int level);
+typedef size_t (*zstd_decompress_fn)(void* dst, size_t dst_cap, const void* src, size_t src_size);
+typedef unsigned (*zstd_is_error_fn)(size_t code);
+
+static struct
+{
+    bool tried;
+    bool ok;
+    zstd_bound_fn bound;
+    zstd_compress_fn compress;
+    zstd_decompress_fn decompress;
+    zstd_is_error_fn is_error;
+} g_zstd;
+
+static bool load_zstd(void)
+{
+    if (g_zstd.tried)
+    {
+        return g_zstd.ok;
+    }
+    g_zstd.tried = true;
+    static const char* const names[] = {"libzstd.so.1", "libzstd.so", "libzstd.1.dylib",
+                                        "libzstd.dylib"};
+    void* lib = NULL;
+    for (size_t i = 0; !lib && i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        lib = dlopen(names[i], RTLD_LAZY);
+    }
+    if (!lib)
+    {
+        if (getenv("LLMCTX_DEBUG"))
+        {
+            fprintf(stderr, "debug: dlopen(libzstd) failed: %s\n", dlerror());
+        }
+        return false;
+    }
+    g_zstd.bound = (zstd_bound_fn)dlsym(lib, "ZSTD_compressBound");
+    g_zstd.compress = (zstd_compress_fn)dlsym(lib, "ZSTD_compress");
+    g_zstd.decompress = (zstd_decompress_fn)dlsym(lib, "ZSTD_decompress");
+    g_zstd.is_error = (zstd_is_error_fn)dlsym(lib, "ZSTD_isError");
+    g_zstd.ok = g_zstd.bound && g_zstd.compress && g_zstd.decompress && g_zstd.is_error;
+    return g_zstd.ok;
+}
+
+/** Whether new chunks are compressed */
+static bool compress_chunks(void)
+{
+    const char* off = getenv("LLM_CTX_NO_ZSTD");
+    return !(off && strcmp(off, "0") != 0) && load_zstd();
+}
+
+const char* prompt_store_codec(void)
+{
+    return compress_chunks() ? "zstd" : "none";
+}
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/** 128-bit hash naming a chunk; also checksums index records */
+/* WHY: Not cryptographic, but at 128 bits accidental collisions are out of
+ * reach, and every chunk is checked against its name when it is read back. */
+static ChunkHash hash_bytes(const void* data, size_t len)
+{
+    const unsigned char* p = data;
+    uint64_t a = 0x9e3779b97f4a7c15ull ^ len;
+    uint64_t b = 0xc2b2ae3d27d4eb4full + len;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        a = rotl64(a ^ mix64(w), 27) * 0x87c37b91114253d5ull;
+        b = rotl64(b + w, 31) * 0x4cf5ad432745937full ^ a;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p + i, len - i);
+    a ^= mix64(tail + 0x52dce729ull);
+    b ^= mix64(tail ^ a);
+    ChunkHash h = {mix64(a + rotl64(b, 17)), mix64(b ^ rotl64(a, 41))};
+    return h;
+}
+
+StoreHash prompt_store_hash(const void* data, size_t len)
+{
+    return hash_bytes(data, len);
+}
+
+/** "<dir>/objects/ab" and "<dir>/objects/ab/<30 hex>" for a chunk */
+static bool chunk_paths(const char* dir, ChunkHash h, char* fanout, char* path)
+{
+    char hex[33];
+    snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)h.hi,
+             (unsigned long long)h.lo);
+    int n = snprintf(fanout, PATH_MAX, "%s/objects/%.2s", dir, hex);
+    return n < PATH_MAX && snprintf(path, PATH_MAX, "%s/%s", fanout, hex + 2) < PATH_MAX;
+}
+
+static bool write_all(int fd, const void* data, size_t len)
+{
+    const char* p = data;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* data, size_t len)
+{
+    char* p = data;
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+typedef struct
+{
+    const char* dir;
+    bool compress;
+    bool failed;
+    ChunkHash* hashes;
+    size_t count;
+    size_t cap;
+    uint64_t gear;
+    size_t used;
+    char buf[STORE_MAX_CHUNK];
+} ChunkWriter;
+
+static uint64_t g_gear[256];
+
+static void init_gear(void)
+{
+    uint64_t seed = 0x243f6a8885a308d3ull;
+    for (int i = 0; i < 256; i++)
+    {
+        seed += 0x9e3779b97f4a7c15ull;
+        g_gear[i] = mix64(seed);
+    }
+}
+
+/** Record one chunk and write its object unless the store already has it */
+static void put_chunk(ChunkWriter* w, const char* data, size_t len)
+{
+    if (w->count == w->cap)
+    {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        ChunkHash* grown = realloc(w->hashes, cap * sizeof(*grown));
+        if (!grown)
+        {
+            w->failed = true;
+            return;
+        }
+        w->hashes = grown;
+        w->cap = cap;
+    }
+    ChunkHash h = hash_bytes(data, len);
+    w->hashes[w->count++] = h;
+
+    char fanout[PATH_MAX], path[PATH_MAX], tmp[PATH_MAX + 32];
+    if (!chunk_paths(w->dir, h, fanout, path))
+    {
+        w->failed = true;
+        return;
+    }
+    if (access(path, F_OK) == 0)
+    {
+        return; /* Stored by an earlier prompt */
+    }
+    mkdir(fanout, 0755);
+
+    ChunkHeader hdr = {STORE_CHUNK_MAGIC, CHUNK_RAW, (uint32_t)len, (uint32_t)len};
+    const void* payload = data;
+    void* packed = NULL;
+    if (w->compress)
+    {
+        size_t cap = g_zstd.bound(len);
+        packed = malloc(cap);
+        size_t n = packed ? g_zstd.compress(packed, cap, data, len, STORE_ZSTD_LEVEL) : 0;
+        if (packed && !g_zstd.is_error(n) && n < len)
+        {
+            hdr.method = CHUNK_ZSTD;
+            hdr.stored_size = (uint32_t)n;
+            payload = packed;
+        }
+    }
+
+    /* WHY: Written aside and renamed into place, so a reader never sees a
+     * partial object under the final name. */
+    snprintf(tmp, sizeof(tmp), "%s/.tmp-%ld", fanout, (long)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, &hdr, sizeof(hdr)) &&
+              write_all(fd, payload, hdr.stored_size);
+    if (fd >= 0 && close(fd) != 0)
+    {
+        ok = false;
+    }
+    if (!ok || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        w->failed = true;
+    }
+    free(packed);
+}
+
+static void chunk_piece(const char* data, size_t len, void* user)
+{
+    ChunkWriter* w = user;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)data[i];
+        w->buf[w->used++] = (char)c;
+        w->gear = (w->gear << 1) + g_gear[c];
+        if ((w->used >= STORE_MIN_CHUNK && w->gear < STORE_BOUNDARY_LIMIT) ||
+            w->used == STORE_MAX_CHUNK)
+        {
+            put_chunk(w, w->buf, w->used);
+            w->used = 0;
+            w->gear = 0;
+        }
+    }
+}
+
+/** Length of the record at off, 0 when what is there is not a whole record */
+static size_t record_at(const char* map, size_t size, size_t off, IndexRecord* rec)
+{
+    if (size - off < sizeof(*rec))
+    {
+        return 0;
+    }
+    memcpy(rec, map + off, sizeof(*rec));
+    uint64_t body = (uint64_t)rec->uuid_len + rec->cli_len +
+                    (uint64_t)rec->num_chunks * sizeof(ChunkHash);
+    bool files = rec->magic == STORE_INDEX_FILES_MAGIC;
+    if (files)
+    {
+        body += sizeof(uint32_t);
+    }
+    if ((rec->magic != STORE_INDEX_MAGIC && !files) || rec->length > size - off ||
+        rec->length < sizeof(*rec) || (files ? body > (uint64_t)rec->length - sizeof(*rec)
+                                             : body != (uint64_t)rec->length - sizeof(*rec)))
+    {
+        return 0;
+    }
+    return rec->length;
+}
+
+static uint64_t record_checksum(const char* record, size_t length)
+{
+    size_t skip = offsetof(IndexRecord, saved_at);
+    return hash_bytes(record + skip, length - skip).lo;
+}
+
+/** Offset just past the last whole record; a torn append after it is dropped */
+static size_t index_valid_end(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return size;
+    }
+    size_t off = 0, last = 0, len;
+    uint64_t last_checksum = 0;
+    IndexRecord rec;
+    while ((len = record_at(map, size, off, &rec)) > 0)
+    {
+        last = off;
+        last_checksum = rec.checksum;
+        off += len;
+    }
+    /* Appends are single writes, so only the last record can be damaged */
+    if (off > 0 && record_checksum(map + last, off - last) != last_checksum)
+    {
+        off = last;
+    }
+    munmap(map, size);
+    return off;
+}
+
+/** "<dir>/index" */
+static bool index_path(const char* dir, char* path)
+{
+    return snprintf(path, PATH_MAX, "%s/index", dir) < PATH_MAX;
+}
+
+/** Append a record to the index under its exclusive lock */
+static bool append_record(const char* dir, const char* record, size_t length)
+{
+    char path[PATH_MAX];
+    if (!index_path(dir, path))
+    {
+        return false;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = flock(fd, LOCK_EX) == 0;
+    if (ok)
+    {
+        off_t end = (off_t)index_valid_end(fd);
+        ok = ftruncate(fd, end) == 0 && lseek(fd, end, SEEK_SET) == end &&
+             write_all(fd, record, length);
+    }
+    close(fd);
+    return ok;
+}
+
+/** Chunks of one file's content, from first to first + count in the writer's list */
+typedef struct
+{
+    size_t first;
+    size_t count;
+} FileChunks;
+
+/** Cut data into chunks of its own, so they do not depend on what surrounds it */
+static FileChunks put_content(ChunkWriter* w, const char* data, size_t len)
+{
+    FileChunks fc = {w->count, 0};
+    w->used = 0;
+    w->gear = 0;
+    chunk_piece(data, len, w);
+    if (w->used > 0)
+    {
+        put_chunk(w, w->buf, w->used);
+        w->used = 0;
+    }
+    fc.count = w->count - fc.first;
+    return fc;
+}
+
+/** Bytes the file table of meta takes in a record */
+static uint64_t file_table_size(const PromptMeta* meta, const FileChunks* chunks)
+{
+    uint64_t size = sizeof(uint32_t);
+    for (size_t i = 0; i < meta->file_count; i++)
+    {
+        const PromptFile* f = &meta->files[i];
+        size_t n = f->content ? chunks[i].count : f->num_chunks;
+        size += sizeof(StoredFile) + strlen(f->path) + (uint64_t)n * sizeof(ChunkHash);
+    }
+    return size;
+}
+
+/** Write the file table of meta at p */
+static void put_file_table(char* p, const PromptMeta* meta, const FileChunks* chunks,
+                           const ChunkHash* hashes)
+{
+    uint32_t count = (uint32_t)meta->file_count;
+    memcpy(p, &count, sizeof(count));
+    p += sizeof(count);
+    for (size_t i = 0; i < meta->file_count; i++)
+    {
+        const PromptFile* f = &meta->files[i];
+        const ChunkHash* list = f->content ? hashes + chunks[i].first : f->chunks;
+        StoredFile sf = {(uint32_t)strlen(f->path),
+                         f->start_line,
+                         f->end_line,
+                         (uint32_t)(f->content ? chunks[i].count : f->num_chunks),
+                         f->sig,
+                         f->content ? hash_bytes(f->content, f->len) : f->hash,
+                         (uint64_t)f->len};
+        memcpy(p, &sf, sizeof(sf));
+        memcpy(p + sizeof(sf), f->path, sf.path_len);
+        memcpy(p + sizeof(sf) + sf.path_len, list, sf.num_chunks * sizeof(ChunkHash));
+        p += sizeof(sf) + sf.path_len + sf.num_chunks * sizeof(ChunkHash);
+    }
+}
+
+/** Write the chunks of content and of the files, then append the index record */
+static bool write_prompt(const char* dir, const PromptMeta* meta, const OutputVec* content)
+{
+    char objects[PATH_MAX];
+    snprintf(objects, sizeof(objects), "%s/objects", dir);
+    mkdir(objects, 0755);
+
+    ChunkWriter* w = calloc(1, sizeof(*w));
+    FileChunks* chunks = calloc(meta->file_count + 1, sizeof(*chunks));
+    if (!w || !chunks)
+    {
+        free(w);
+        free(chunks);
+        return false;
+    }
+    w->dir = dir;
+    w->compress = compress_chunks();
+    init_gear();
+    outvec_visit(content, 0, outvec_size(content), chunk_piece, w);
+    if (w->used > 0)
+    {
+        put_chunk(w, w->buf, w->used);
+    }
+    size_t prompt_chunks = w->count;
+    /* WHY: Content-defined boundaries line up again a few KiB into a file
+     * sent whole, so most of its chunks are already stored by the prompt. */
+    for (size_t i = 0; i < meta->file_count; i++)
+    {
+        if (meta->files[i].content)
+        {
+            chunks[i] = put_content(w, meta->files[i].content, meta->files[i].len);
+        }
+    }
+
+    size_t uuid_len = strlen(meta->uuid);
+    size_t cli_len = meta->cli ? strlen(meta->cli) : 0;
+    size_t head = sizeof(IndexRecord) + uuid_len + cli_len + prompt_chunks * sizeof(ChunkHash);
+    uint64_t length = head + file_table_size(meta, chunks);
+    char* record = w->failed || length > UINT32_MAX ? NULL : malloc(length);
+    bool ok = record != NULL;
+    if (ok)
+    {
+        IndexRecord rec = {STORE_INDEX_FILES_MAGIC,
+                           (uint32_t)length,
+                           0,
+                           (int64_t)meta->saved_at,
+                           (uint64_t)meta->tokens,
+                           (uint64_t)outvec_size(content),
+                           (uint32_t)(meta->num_files > 0 ? meta->num_files : 0),
+                           (uint32_t)prompt_chunks,
+                           (uint32_t)uuid_len,
+                           (uint32_t)cli_len};
+        char* p = record + sizeof(rec);
+        memcpy(p, meta->uuid, uuid_len);
+        memcpy(p + uuid_len, meta->cli, cli_len);
+        memcpy(p + uuid_len + cli_len, w->hashes, prompt_chunks * sizeof(ChunkHash));
+        put_file_table(record + head, meta, chunks, w->hashes);
+        memcpy(record, &rec, sizeof(rec));
+        rec.checksum = record_checksum(record, length);
+        memcpy(record, &rec, sizeof(rec));
+        ok = append_record(dir, record, length);
+    }
+    free(record);
+    free(chunks);
+    free(w->hashes);
+    free(w);
+    return ok;
+}
+
+/** Leave the caller's terminal and output streams to it */
+static void detach_writer(void)
+{
+    setsid();
+    signal(SIGINT, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    int null = open("/dev/null", O_RDWR);
+    if (null >= 0)
+    {
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        if (null > STDERR_FILENO)
+        {
+            close(null);
+        }
+    }
+}
+
+/** "<dir>/.<uuid>.saving", locked by the writer of uuid until its record is appended */
+static bool marker_path(const char* dir, const char* uuid, char* path)
+{
+    return snprintf(path, PATH_MAX, "%s/.%s.saving", dir, uuid) < PATH_MAX;
+}
+
+bool prompt_store_save(const char* dir, const PromptMeta* meta, const OutputVec* content)
+{
+    char marker[PATH_MAX];
+    if (!marker_path(dir, meta->uuid, marker))
+    {
+        return false;
+    }
+    int fd = open(marker, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0)
+    {
+        fprintf(stderr, "Warning: Could not save prompt to %s: %s\n", dir, strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    /* WHY: The lock belongs to the open file description, which the child
+     * shares. Taking it before fork() means a `get` issued the moment this
+     * process exits already finds something to wait on; closing our
+     * descriptor leaves the lock with the child until it has appended. The
+     * marker is new to this UUID, so unlike the index lock it never makes a
+     * run wait for the writer of an earlier one. */
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        detach_writer();
+        bool ok = write_prompt(dir, meta, content);
+        unlink(marker);
+        _exit(ok ? 0 : 1);
+    }
+    bool ok = true;
+    if (pid < 0)
+    {
+        ok = write_prompt(dir, meta, content);
+        unlink(marker);
+        if (!ok)
+        {
+            fprintf(stderr, "Warning: Could not save prompt to %s\n", dir);
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/** Read chunk h into dst, which has room for cap bytes; returns its length or -1 */
+static long read_chunk(const char* dir, ChunkHash h, char* dst, size_t cap)
+{
+    char fanout[PATH_MAX], path[PATH_MAX];
+    if (!chunk_paths(dir, h, fanout, path))
+    {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ChunkHeader hdr;
+    bool ok = read_all(fd, &hdr, sizeof(hdr)) && hdr.magic == STORE_CHUNK_MAGIC &&
+              hdr.raw_size <= cap && hdr.stored_size <= STORE_MAX_CHUNK;
+    char* stored = NULL;
+    if (ok && hdr.method == CHUNK_RAW)
+    {
+        ok = hdr.stored_size == hdr.raw_size && read_all(fd, dst, hdr.raw_size);
+    }
+    else if (ok && hdr.method == CHUNK_ZSTD)
+    {
+        stored = malloc(hdr.stored_size ? hdr.stored_size : 1);
+        ok = stored && read_all(fd, stored, hdr.stored_size) && load_zstd() &&
+             g_zstd.decompress(dst, hdr.raw_size, stored, hdr.stored_size) == hdr.raw_size;
+    }
+    else
+    {
+        ok = false;
+    }
+    free(stored);
+    close(fd);
+    if (!ok)
+    {
+        return -1;
+    }
+    ChunkHash got = hash_bytes(dst, hdr.raw_size);
+    return got.hi == h.hi && got.lo == h.lo ? (long)hdr.raw_size : -1;
+}
+
+/** Map the index under a shared lock, which is held until unmap_index() */
+/* WHY: A writer may truncate a torn record off the end of the index while
+ * it is mapped; the lock keeps it from doing so. */
+static char* map_index(const char* dir, int* fd, size_t* size)
+{
+    char path[PATH_MAX];
+    if (!index_path(dir, path))
+    {
+        return NULL;
+    }
+    *fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (*fd < 0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    char* map = MAP_FAILED;
+    if (flock(*fd, LOCK_SH) == 0 && fstat(*fd, &st) == 0 && st.st_size > 0)
+    {
+        *size = (size_t)st.st_size;
+        map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, *fd, 0);
+    }
+    if (map == MAP_FAILED)
+    {
+        close(*fd);
+        return NULL;
+    }
+    return map;
+}
+
+static void unmap_index(char* map, size_t size, int fd)
+{
+    munmap(map, size);
+    close(fd);
+}
+
+/** malloc()ed copy of the record of uuid, NULL if the index has none */
+static char* find_record(const char* dir, const char* uuid, IndexRecord* found)
+{
+    int fd;
+    size_t size;
+    char* map = map_index(dir, &fd, &size);
+    if (!map)
+    {
+        return NULL;
+    }
+    size_t uuid_len = strlen(uuid), off = 0, rec_len;
+    IndexRecord rec;
+    char* copy = NULL;
+    while (!copy && (rec_len = record_at(map, size, off, &rec)) > 0)
+    {
+        if (rec.uuid_len == uuid_len && memcmp(map + off + sizeof(rec), uuid, uuid_len) == 0 &&
+            record_checksum(map + off, rec_len) == rec.checksum)
+        {
+            copy = malloc(rec_len);
+            if (copy)
+            {
+                memcpy(copy, map + off, rec_len);
+                *found = rec;
+            }
+        }
+        off += rec_len;
+    }
+    unmap_index(map, size, fd);
+    return copy;
+}
+
+/** Block until a save of uuid still in flight has finished */
+static void wait_for_save(const char* dir, const char* uuid)
+{
+    char marker[PATH_MAX];
+    int fd = marker_path(dir, uuid, marker) ? open(marker, O_RDONLY | O_CLOEXEC) : -1;
+    if (fd >= 0)
+    {
+        flock(fd, LOCK_SH);
+        close(fd);
+    }
+}
+
+/** find_record(), after waiting for a save of uuid in flight if there is none yet */
+static char* load_record(const char* dir, const char* uuid, IndexRecord* found)
+{
+    char* record = find_record(dir, uuid, found);
+    if (!record)
+    {
+        /* WHY: Looked up again even without a marker: the writer may have
+         * appended and removed it since the first lookup. */
+        wait_for_save(dir, uuid);
+        record = find_record(dir, uuid, found);
+    }
+    return record;
+}
+
+/**
+ * Read the count chunks whose hashes start at hashes into out (cap bytes)
+ *
+ * The list may be unaligned. Returns the bytes read, or -1 with *bad set to
+ * the index of the first chunk that could not be read.
+ */
+static long read_chunks(const char* dir, const void* hashes, size_t count, char* out, size_t cap,
+                        size_t* bad)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        ChunkHash h;
+        memcpy(&h, (const char*)hashes + i * sizeof(h), sizeof(h));
+        long n = read_chunk(dir, h, out + used, cap - used);
+        if (n < 0)
+        {
+            *bad = i;
+            return -1;
+        }
+        used += (size_t)n;
+    }
+    return (long)used;
+}
+
+char* prompt_store_load(const char* dir, const char* uuid, size_t* len)
+{
+    IndexRecord rec;
+    char* record = load_record(dir, uuid, &rec);
+    if (!record)
+    {
+        return NULL;
+    }
+
+    char* out = malloc(rec.bytes + 1);
+    size_t bad = 0;
+    long used = out ? read_chunks(dir, record + sizeof(rec) + rec.uuid_len + rec.cli_len,
+                                  rec.num_chunks, out, rec.bytes, &bad)
+                    : -1;
+    free(record);
+    if (out && used < 0)
+    {
+        fprintf(stderr, "Warning: Saved prompt %s is damaged (chunk %zu of %u unreadable)\n", uuid,
+                bad + 1, rec.num_chunks);
+        free(out);
+        return NULL;
+    }
+    if (out && (uint64_t)used != rec.bytes)
+    {
+        fprintf(stderr, "Warning: Saved prompt %s is damaged (%ld of %llu bytes)\n", uuid, used,
+                (unsigned long long)rec.bytes);
+        free(out);
+        return NULL;
+    }
+    if (out)
+    {
+        out[used] = '\0';
+        if (len)
+        {
+            *len = (size_t)used;
+        }
+    }
+    return out;
+}
+
+/** Copy the file table after the chunk list of record into table; false if it is malformed */
+static bool parse_file_table(const char* record, const IndexRecord* rec, PromptFileTable* table)
+{
+    size_t off = sizeof(*rec) + rec->uuid_len + rec->cli_len +
+                 (size_t)rec->num_chunks * sizeof(ChunkHash);
+    size_t end = rec->length;
+    uint32_t count;
+    memcpy(&count, record + off, sizeof(count));
+    off += sizeof(count);
+
+    size_t pos = off, path_bytes = 0, chunk_total = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        StoredFile sf;
+        if (end - pos < sizeof(sf))
+        {
+            return false;
+        }
+        memcpy(&sf, record + pos, sizeof(sf));
+        uint64_t need =
+            sizeof(sf) + (uint64_t)sf.path_len + (uint64_t)sf.num_chunks * sizeof(ChunkHash);
+        if (need > end - pos)
+        {
+            return false;
+        }
+        path_bytes += sf.path_len + 1;
+        chunk_total += sf.num_chunks;
+        pos += need;
+    }
+
+    table->files = calloc(count > 0 ? count : 1, sizeof(*table->files));
+    table->strings = malloc(path_bytes > 0 ? path_bytes : 1);
+    table->chunks = malloc((chunk_total > 0 ? chunk_total : 1) * sizeof(ChunkHash));
+    if (!table->files || !table->strings || !table->chunks)
+    {
+        prompt_store_files_free(table);
+        return false;
+    }
+    char* str = table->strings;
+    ChunkHash* chunks = table->chunks;
+    pos = off;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        StoredFile sf;
+        memcpy(&sf, record + pos, sizeof(sf));
+        pos += sizeof(sf);
+        PromptFile* f = &table->files[i];
+        memcpy(str, record + pos, sf.path_len);
+        str[sf.path_len] = '\0';
+        f->path = str;
+        str += sf.path_len + 1;
+        pos += sf.path_len;
+        memcpy(chunks, record + pos, sf.num_chunks * sizeof(ChunkHash));
+        f->chunks = chunks;
+        f->num_chunks = sf.num_chunks;
+        chunks += sf.num_chunks;
+        pos += sf.num_chunks * sizeof(ChunkHash);
+        f->start_line = sf.start_line;
+        f->end_line = sf.end_line;
+        f->sig = sf.sig;
+        f->hash = sf.hash;
+        f->len = (size_t)sf.len;
+    }
+    table->count = count;
+    return true;
+}
+
+bool prompt_store_files(const char* dir, const char* uuid, PromptFileTable* table)
+{
+    memset(table, 0, sizeof(*table));
+    IndexRecord rec;
+    char* record = load_record(dir, uuid, &rec);
+    if (!record)
+    {
+        return false;
+    }
+    if (rec.magic == STORE_INDEX_FILES_MAGIC)
+    {
+        table->recorded = parse_file_table(record, &rec, table);
+    }
+    free(record);
+    return true;
+}
+
+void prompt_store_files_free(PromptFileTable* table)
+{
+    free(table->files);
+    free(table->strings);
+    free(table->chunks);
+    memset(table, 0, sizeof(*table));
+}
+
+char* prompt_store_file_content(const char* dir, const PromptFile* file)
+{
+    char* out = malloc(file->len + 1);
+    size_t bad = 0;
+    long used = out ? read_chunks(dir, file->chunks, file->num_chunks, out, file->len, &bad) : -1;
+    bool ok = used >= 0 && (size_t)used == file->len;
+    if (ok)
+    {
+        ChunkHash h = hash_bytes(out, file->len);
+        ok = h.hi == file->hash.hi && h.lo == file->hash.lo;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Warning: The saved copy of %s is damaged\n", file->path);
+        free(out);
+        return NULL;
+    }
+    out[used] = '\0';
+    return out;
+}
+
+/** Block until every save in flight has appended its record */
+static void wait_for_saves(const char* dir)
+{
+    DIR* d = opendir(dir);
+    if (!d)
+    {
+        return;
+    }
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL)
+    {
+        size_t n = strlen(e->d_name);
+        if (e->d_name[0] == '.' && n > 8 && strcmp(e->d_name + n - 7, ".saving") == 0)
+        {
+            char marker[PATH_MAX];
+            int fd = snprintf(marker, sizeof(marker), "%s/%s", dir, e->d_name) < PATH_MAX
+                         ? open(marker, O_RDONLY | O_CLOEXEC)
+                         : -1;
+            if (fd >= 0)
+            {
+                flock(fd, LOCK_SH);
+                close(fd);
+            }
+        }
+    }
+    closedir(d);
+}
+
+bool prompt_store_last(const char* dir, char* uuid, size_t size)
+{
+    wait_for_saves(dir);
+    int fd;
+    size_t map_size;
+    char* map = map_index(dir, &fd, &map_size);
+    if (!map)
+    {
+        return false;
+    }
+    /* Appends are single writes, so only the last record can be damaged */
+    size_t off = 0, len, last = SIZE_MAX, before = SIZE_MAX, last_len = 0, before_len = 0;
+    IndexRecord rec;
+    while ((len = record_at(map, map_size, off, &rec)) > 0)
+    {
+        before = last;
+        before_len = last_len;
+        last = off;
+        last_len = len;
+        off += len;
+    }
+    if (last != SIZE_MAX)
+    {
+        memcpy(&rec, map + last, sizeof(rec));
+        if (record_checksum(map + last, last_len) != rec.checksum)
+        {
+            last = before;
+            last_len = before_len;
+            if (last != SIZE_MAX)
+            {
+                memcpy(&rec, map + last, sizeof(rec));
+            }
+        }
+    }
+    bool ok = last != SIZE_MAX && rec.uuid_len < size;
+    if (ok)
+    {
+        memcpy(uuid, map + last + sizeof(rec), rec.uuid_len);
+        uuid[rec.uuid_len] = '\0';
+    }
+    unmap_index(map, map_size, fd);
+    return ok;
+}
@@ -0,0 +1,128 @@
+#ifndef PROMPTSTORE_H
+#define PROMPTSTORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "filecache.h"
+#include "output.h"
+
+/**
+ * Content-addressed store of saved prompts
+ *
+ * Each saved prompt is cut into content-defined chunks (a gear rolling hash
+ * picks the boundaries, so a file body repeated in another prompt yields the
+ * same chunks wherever it sits). Every distinct chunk is written once, zstd
+ * compressed, to <dir>/objects/<2 hex>/<30 hex> named by its 128-bit hash.
+ * <dir>/index is an append-only list of records: UUID, save time, token
+ * count, byte count, file count, command line and chunk list, then a file
+ * table: for each file of the prompt's context, its stat() signature, a
+ * hash of its content and that content as chunks of its own. A later run
+ * can so tell which files are unchanged without reading them, and diff the
+ * others against what the prompt left, even where the prompt carried only
+ * a diff or listed the file as unchanged.
+ *
+ * Saving runs in a forked child, so the caller can exit straight away. Until
+ * its record is appended the child holds a flock() on <dir>/.<uuid>.saving,
+ * and prompt_store_load() of that UUID waits for it.
+ * libzstd is loaded with dlopen(); without it, or with LLM_CTX_NO_ZSTD=1,
+ * chunks are stored uncompressed.
+ */
+
+/* 128-bit content hash, as chunks are named by */
+typedef struct
+{
+    uint64_t hi;
+    uint64_t lo;
+} StoreHash;
+
+/** A file as the context of a saved prompt left it */
+typedef struct
+{
+    const char* path;
+    int start_line; /* Line range as in the "File:" header; 0 and 0 for the whole file */
+    int end_line;
+    FileSig sig;    /* Of the file the content was read from */
+    StoreHash hash; /* Of the content */
+    size_t len;
+    /*
+     * Saving: the content, stored and hashed by the save (hash is then
+     * ignored), or NULL to keep hash, len and chunks as they are, for a
+     * file carried over unchanged from an earlier table.
+     */
+    const char* content;
+    const StoreHash* chunks;
+    size_t num_chunks;
+} PromptFile;
+
+typedef struct
+{
+    const char* uuid;
+    const char* cli;    /* Command line, arguments joined by spaces */
+    time_t saved_at;
+    size_t tokens;
+    int num_files;
+    const PromptFile* files; /* The file table; must stay valid as content does */
+    size_t file_count;
+} PromptMeta;
+
+/** File table of a saved prompt, from prompt_store_files() */
+typedef struct
+{
+    PromptFile* files;
+    size_t count;
+    bool recorded; /* False for prompts saved before file tables were */
+    char* strings;     /* Owned: the paths */
+    StoreHash* chunks; /* Owned: the chunk lists */
+} PromptFileTable;
+
+/**
+ * Save content under meta->uuid in the store at dir
+ *
+ * Returns once the index is locked and the writer is forked (or, if fork()
+ * fails, once everything is written). content must not change until then.
+ * Returns false, with a warning, if the index cannot be opened or locked.
+ */
+bool prompt_store_save(const char* dir, const PromptMeta* meta, const OutputVec* content);
+
+/**
+ * Content of prompt uuid as a NUL-terminated malloc()ed string
+ *
+ * Waits for saves in flight. Returns NULL if the store has no such prompt,
+ * or, with a warning, if one of its chunks is missing or damaged.
+ */
+char* prompt_store_load(const char* dir, const char* uuid, size_t* len);
+
+/**
+ * Read the file table of prompt uuid into table
+ *
+ * Waits for saves in flight. Returns false if the store has no such prompt.
+ * Free with prompt_store_files_free().
+ */
+bool prompt_store_files(const char* dir, const char* uuid, PromptFileTable* table);
+
+void prompt_store_files_free(PromptFileTable* table);
+
+/**
+ * Content of a file from a table as a NUL-terminated malloc()ed string
+ *
+ * Returns NULL, with a warning, if one of its chunks is missing or damaged.
+ */
+char* prompt_store_file_content(const char* dir, const PromptFile* file);
+
+/**
+ * UUID of the prompt saved last, into uuid (size bytes)
+ *
+ * Waits for every save in flight first, so a run started right after
+ * another finds that run's prompt. Returns false if the store is empty.
+ */
+bool prompt_store_last(const char* dir, char* uuid, size_t size);
+
+/** Hash of data as PromptFile.hash records it */
+StoreHash prompt_store_hash(const void* data, size_t len);
+
+/** "zstd" when chunks are compressed, "none" otherwise */
+const char* prompt_store_codec(void);
+
+#endif /* PROMPTSTORE_H */
@@ -0,0 +1,888 @@
+#include "stdinpipe.h"
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "timings.h"
+
+/* Most bytes asked of one read() */
+#define STDIN_PIPE_BLOCK MiB(1)
+/* First buffer for streams without a size hint (pipes, terminals) */
+#define STDIN_PIPE_START KiB(64)
+/* A chunk is queued once this much input lies past the previous cut */
+#define STDIN_PIPE_CHUNK KiB(256)
+/* With tail_tokens, the reader waits while this much input is uncounted */
+#define STDIN_PIPE_AHEAD MiB(8)
+/* Initial size of the tail ring, and the least room worth a read() */
+#define STDIN_PIPE_RING MiB(4)
+#define STDIN_PIPE_MIN_ROOM KiB(64)
+
+typedef struct
+{
+    size_t start; /* Stream offset */
+    size_t len;
+    size_t tokens;
+    bool done;
+} PipeChunk;
+
+typedef struct
+{
+    /* Stream byte i is buf[(i - origin) % cap] for tail <= i < head. The
+     * arena buffer of a whole read never wraps: origin and tail stay 0. */
+    char* buf;
+    size_t cap;
+    size_t origin;
+    size_t tail;
+    size_t head;
+    bool ring; /* malloc()ed ring for tail_tokens rather than a buffer in the arena */
+    Arena* arena;
+    size_t max_bytes;
+    size_t tail_tokens;
+
+    /* Chunk n is chunks[n - base]. Chunks [first, counted) are kept and
+     * counted; those in [counted, claimed) are being counted, and those in
+     * [claimed, count) wait for the worker. */
+    PipeChunk* chunks;
+    size_t chunk_cap;
+    size_t base;
+    size_t first;
+    size_t counted;
+    size_t claimed;
+    size_t count;
+    size_t kept_tokens; /* Tokens of chunks [first, counted) */
+
+    /* Reader only: the search for safe cuts */
+    size_t cut;       /* Where the next chunk starts; SIZE_MAX before the first safe cut */
+    size_t front;     /* First safe cut of the stream */
+    size_t last_safe; /* Latest safe cut past cut; SIZE_MAX if none */
+    size_t scan;      /* Newlines before this offset have been looked at */
+    bool scanned_start;
+
+    bool exact;  /* Every chunk ends at a safe cut */
+    bool failed; /* The tokenizer failed on a chunk */
+    bool truncated;
+
+    LLMTokenizer* tok;
+    bool threaded;
+    bool closing;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t work;     /* A chunk was queued, or the reader is closing */
+    pthread_cond_t progress; /* A chunk was counted */
+} StdinPipe;
+
+static void* pipe_alloc(void* ptr, size_t size)
+{
+    void* p = realloc(ptr, size);
+    if (!p)
+    {
+        fprintf(stderr, "FATAL: Out of memory allocating %zu bytes\n", size);
+        abort();
+    }
+    return p;
+}
+
+static size_t pipe_phys(const StdinPipe* p, size_t pos)
+{
+    return (pos - p->origin) % p->cap;
+}
+
+static unsigned char pipe_byte(const StdinPipe* p, size_t pos)
+{
+    return (unsigned char)p->buf[pipe_phys(p, pos)];
+}
+
+/* Same boundary rule as is_token_safe_cut() for the assembled context */
+static bool cut_byte_ok(unsigned char c)
+{
+    return !isspace(c) && c != '/';
+}
+
+static PipeChunk* pipe_chunk(StdinPipe* p, size_t n)
+{
+    return &p->chunks[n - p->base];
+}
+
+/** Copy stream bytes [from, from + len) to dst */
+static void pipe_gather(const StdinPipe* p, size_t from, size_t len, char* dst)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    size_t at = pipe_phys(p, from);
+    size_t run = p->cap - at < len ? p->cap - at : len;
+    memcpy(dst, p->buf + at, run);
+    memcpy(dst + run, p->buf, len - run);
+}
+
+/** Stream bytes [from, from + len) as a NUL-terminated malloc()ed string */
+static char* pipe_copy(const StdinPipe* p, size_t from, size_t len)
+{
+    char* text = pipe_alloc(NULL, len + 1);
+    pipe_gather(p, from, len, text);
+    text[len] = '\0';
+    return text;
+}
+
+/** Drop chunks that enough counted chunks after them make unnecessary; lock held */
+static void pipe_drop_counted(StdinPipe* p)
+{
+    while (p->tail_tokens > 0 && p->first + 1 < p->counted &&
+           p->kept_tokens - pipe_chunk(p, p->first)->tokens >= p->tail_tokens)
+    {
+        p->kept_tokens -= pipe_chunk(p, p->first)->tokens;
+        p->first++;
+        p->tail = pipe_chunk(p, p->first)->start;
+    }
+}
+
+/** Record the count of chunk n; lock held */
+static void pipe_chunk_counted(StdinPipe* p, size_t n, size_t tokens)
+{
+    PipeChunk* c = pipe_chunk(p, n);
+    if (tokens == SIZE_MAX)
+    {
+        p->failed = true;
+        tokens = 0;
+    }
+    c->tokens = tokens;
+    c->done = true;
+    while (p->counted < p->count && pipe_chunk(p, p->counted)->done)
+    {
+        p->kept_tokens += pipe_chunk(p, p->counted)->tokens;
+        p->counted++;
+    }
+    pipe_drop_counted(p);
+    pthread_cond_broadcast(&p->progress);
+}
+
+/* WHY: The worker copies its chunk out under the lock because the reader
+ * may move the buffer (arena growth, ring growth) between reads. The copy is
+ * small next to encoding it and gives the tokenizer the NUL it needs. */
+static void* pipe_worker(void* arg)
+{
+    StdinPipe* p = arg;
+    char* text = NULL;
+    size_t text_cap = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        while (!p->closing && p->claimed == p->count)
+        {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (p->closing)
+        {
+            break; /* The reader counts what is left */
+        }
+        size_t n = p->claimed++;
+        PipeChunk c = *pipe_chunk(p, n);
+        if (c.len + 1 > text_cap)
+        {
+            text_cap = c.len + 1;
+            text = pipe_alloc(text, text_cap);
+        }
+        pipe_gather(p, c.start, c.len, text);
+        text[c.len] = '\0';
+        pthread_mutex_unlock(&p->lock);
+
+        size_t tokens = llm_tokenizer_count(p->tok, text);
+
+        pthread_mutex_lock(&p->lock);
+        pipe_chunk_counted(p, n, tokens);
+    }
+    pthread_mutex_unlock(&p->lock);
+    free(text);
+    return NULL;
+}
+
+/** Queue stream bytes [cut, end) as a chunk and start the next one at end; lock held */
+static void pipe_queue_chunk(StdinPipe* p, size_t end)
+{
+    if (p->cut == SIZE_MAX || end <= p->cut)
+    {
+        return;
+    }
+    if (p->count - p->base == p->chunk_cap)
+    {
+        size_t dropped = p->first - p->base;
+        if (dropped >= p->chunk_cap / 2 && dropped > 0)
+        {
+            memmove(p->chunks, p->chunks + dropped, (p->count - p->first) * sizeof(PipeChunk));
+            p->base = p->first;
+        }
+        else
+        {
+            p->chunk_cap = p->chunk_cap ? p->chunk_cap * 2 : 64;
+            p->chunks = pipe_alloc(p->chunks, p->chunk_cap * sizeof(PipeChunk));
+        }
+    }
+    *pipe_chunk(p, p->count) = (PipeChunk){p->cut, end - p->cut, 0, false};
+    p->count++;
+    p->cut = end;
+    p->last_safe = SIZE_MAX;
+    pthread_cond_signal(&p->work);
+}
+
+/** Count the queued chunks on the calling thread; lock held */
+static void pipe_count_queued_here(StdinPipe* p)
+{
+    while (p->claimed < p->count)
+    {
+        size_t n = p->claimed++;
+        char* text = pipe_copy(p, pipe_chunk(p, n)->start, pipe_chunk(p, n)->len);
+        pthread_mutex_unlock(&p->lock);
+        size_t tokens = llm_tokenizer_count(p->tok, text);
+        free(text);
+        pthread_mutex_lock(&p->lock);
+        pipe_chunk_counted(p, n, tokens);
+    }
+}
+
+static void pipe_note_safe_cut(StdinPipe* p, size_t pos)
+{
+    if (p->cut == SIZE_MAX)
+    {
+        p->cut = p->front = pos;
+    }
+    else if (pos > p->cut)
+    {
+        p->last_safe = pos;
+    }
+}
+
+/** Find the safe cuts among the bytes read since the last call */
+static void pipe_scan(StdinPipe* p)
+{
+    if (p->head == 0)
+    {
+        return;
+    }
+    if (!p->scanned_start)
+    {
+        /* The text before the input ends with '\n' */
+        p->scanned_start = true;
+        if (cut_byte_ok(pipe_byte(p, 0)))
+        {
+            pipe_note_safe_cut(p, 0);
+        }
+    }
+    /* A newline at q marks a cut at q + 1 once that byte has arrived */
+    while (p->scan + 1 < p->head)
+    {
+        size_t at = pipe_phys(p, p->scan);
+        size_t run = p->head - 1 - p->scan;
+        if (run > p->cap - at)
+        {
+            run = p->cap - at;
+        }
+        const char* nl = memchr(p->buf + at, '\n', run);
+        if (!nl)
+        {
+            p->scan += run;
+            continue;
+        }
+        size_t q = p->scan + (size_t)(nl - (p->buf + at));
+        if (cut_byte_ok(pipe_byte(p, q + 1)))
+        {
+            pipe_note_safe_cut(p, q + 1);
+        }
+        p->scan = q + 1;
+    }
+}
+
+/** Queue a chunk once enough input has arrived past the previous cut */
+static void pipe_advance(StdinPipe* p)
+{
+    pipe_scan(p);
+    if (p->last_safe == SIZE_MAX || p->last_safe - p->cut < STDIN_PIPE_CHUNK)
+    {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    pipe_queue_chunk(p, p->last_safe);
+    if (!p->threaded)
+    {
+        pipe_count_queued_here(p);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/** Move the ring's kept bytes into a ring of new_cap bytes; lock held */
+static void pipe_grow_ring(StdinPipe* p, size_t new_cap)
+{
+    char* grown = pipe_alloc(NULL, new_cap);
+    pipe_gather(p, p->tail, p->head - p->tail, grown);
+    free(p->buf);
+    p->buf = grown;
+    p->cap = new_cap;
+    p->origin = p->tail;
+}
+
+/** Bytes queued or being counted */
+static size_t pipe_uncounted(StdinPipe* p)
+{
+    return p->counted < p->count ? p->cut - pipe_chunk(p, p->counted)->start : 0;
+}
+
+/**
+ * Where the next read() goes and how much it may take
+ *
+ * Returns false once a whole read holds max_bytes, or when counting failed
+ * with tail_tokens.
+ */
+static bool pipe_make_room(StdinPipe* p, char** dst, size_t* want)
+{
+    if (!p->ring)
+    {
+        if (p->head >= p->max_bytes)
+        {
+            return false;
+        }
+        if (p->cap - p->head < 2)
+        {
+            /* One byte stays free for the NUL */
+            size_t new_cap = p->cap <= p->max_bytes / 2 ? p->cap * 2 : p->max_bytes + 1;
+            pthread_mutex_lock(&p->lock);
+            if (!arena_resize_last(p->arena, p->buf, p->cap, new_cap))
+            {
+                char* moved = arena_push_size_safe(p->arena, new_cap, 1);
+                memcpy(moved, p->buf, p->head);
+                p->buf = moved;
+            }
+            p->cap = new_cap;
+            pthread_mutex_unlock(&p->lock);
+        }
+        *dst = p->buf + p->head;
+        *want = p->cap - p->head - 1;
+        if (*want > p->max_bytes - p->head)
+        {
+            *want = p->max_bytes - p->head;
+        }
+        if (*want > STDIN_PIPE_BLOCK)
+        {
+            *want = STDIN_PIPE_BLOCK;
+        }
+        return true;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        if (p->failed)
+        {
+            pthread_mutex_unlock(&p->lock);
+            return false;
+        }
+        size_t room = p->cap - (p->head - p->tail);
+        bool behind = p->threaded && pipe_uncounted(p) > STDIN_PIPE_AHEAD;
+        if (room >= STDIN_PIPE_MIN_ROOM && !behind)
+        {
+            break;
+        }
+        if (behind)
+        {
+            pthread_cond_wait(&p->progress, &p->lock);
+        }
+        else if (p->cap < p->max_bytes)
+        {
+            pipe_grow_ring(p, p->cap <= p->max_bytes / 2 ? p->cap * 2 : p->max_bytes);
+        }
+        else if (p->first < p->counted)
+        {
+            /* Even the last tail_tokens do not fit in max_bytes */
+            p->kept_tokens -= pipe_chunk(p, p->first)->tokens;
+            p->first++;
+            p->tail = p->first < p->count ? pipe_chunk(p, p->first)->start : p->cut;
+            p->truncated = true;
+        }
+        else if (p->counted < p->count)
+        {
+            pthread_cond_wait(&p->progress, &p->lock);
+        }
+        else
+        {
+            /* One line fills max_bytes: cut it where it stands, inexactly */
+            if (p->cut == SIZE_MAX)
+            {
+                p->cut = p->front = p->tail;
+                p->scanned_start = true;
+            }
+            pipe_queue_chunk(p, p->head);
+            p->scan = p->head - 1;
+            p->exact = false;
+            if (!p->threaded)
+            {
+                pipe_count_queued_here(p);
+            }
+        }
+    }
+    size_t at = pipe_phys(p, p->head);
+    size_t room = p->cap - (p->head - p->tail);
+    pthread_mutex_unlock(&p->lock);
+
+    *dst = p->buf + at;
+    *want = room < p->cap - at ? room : p->cap - at;
+    if (*want > STDIN_PIPE_BLOCK)
+    {
+        *want = STDIN_PIPE_BLOCK;
+    }
+    return true;
+}
+
+/** Queue the rest of the input, count every chunk, and stop the worker; returns count_to */
+static size_t pipe_finish_counting(StdinPipe* p, int jobs)
+{
+    pipe_scan(p);
+    size_t end = p->cut;
+    if (p->cut != SIZE_MAX)
+    {
+        /* The text after the input starts with neither whitespace nor '/' */
+        if (p->head > p->cut && pipe_byte(p, p->head - 1) == '\n')
+        {
+            end = p->head;
+        }
+        else if (p->last_safe != SIZE_MAX)
+        {
+            end = p->last_safe;
+        }
+    }
+
+    pthread_mutex_lock(&p->lock);
+    pipe_queue_chunk(p, end);
+    p->closing = true;
+    pthread_cond_broadcast(&p->work);
+
+    /* The worker keeps the chunk it has; the rest is counted here on jobs threads */
+    size_t from = p->claimed;
+    size_t n = p->count - from;
+    TokenSpan* spans = n ? pipe_alloc(NULL, n * sizeof(TokenSpan)) : NULL;
+    for (size_t i = 0; i < n; i++)
+    {
+        const PipeChunk* c = pipe_chunk(p, from + i);
+        spans[i].len = c->len;
+        spans[i].tokens = 0;
+        if (p->ring)
+        {
+            spans[i].text = pipe_copy(p, c->start, c->len);
+            spans[i].terminated = true;
+        }
+        else
+        {
+            spans[i].text = p->buf + c->start;
+            spans[i].terminated = false;
+        }
+    }
+    p->claimed = p->count;
+    pthread_mutex_unlock(&p->lock);
+
+    bool ok = n == 0 || llm_tokenizer_count_batch(p->tok, spans, n, jobs) == 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (size_t i = 0; i < n; i++)
+    {
+        pipe_chunk_counted(p, from + i, ok ? spans[i].tokens : SIZE_MAX);
+        if (p->ring)
+        {
+            free((char*)spans[i].text);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    free(spans);
+
+    if (p->threaded)
+    {
+        pthread_join(p->worker, NULL);
+        p->threaded = false;
+    }
+    return end;
+}
+
+/** Earliest line start in text[from, to) whose line and those after it, up to
+ * to, fit in room tokens; to if none does. text must stay writable. */
+static size_t pipe_fit_lines(StdinPipe* p, char* text, size_t from, size_t to, size_t room)
+{
+    size_t* starts = pipe_alloc(NULL, (to - from) * sizeof(size_t));
+    size_t n = 0;
+    for (size_t i = from + 1; i < to; i++)
+    {
+        if (text[i - 1] == '\n')
+        {
+            starts[n++] = i;
+        }
+    }
+
+    /* Fewer lines never take more tokens; find the first start that fits */
+    char saved = text[to];
+    text[to] = '\0';
+    size_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t tokens = llm_tokenizer_count(p->tok, text + starts[mid]);
+        if (tokens == SIZE_MAX)
+        {
+            p->failed = true;
+            break;
+        }
+        if (tokens <= room)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    text[to] = saved;
+    size_t fit = lo < n ? starts[lo] : to;
+    free(starts);
+    return fit;
+}
+
+/**
+ * Trim from the front of the counted tail until it fits tail_tokens
+ *
+ * end is where counting stopped; [end, head) is counted as back_tokens.
+ * Returns the stream offset of the first byte to keep, and in *counted_from
+ * the offset of the first chunk byte kept: the same, unless the kept text
+ * starts inside a run of lines without a safe cut between them.
+ */
+/* WHY: Safe cuts split the count additively, so the oldest chunk can be
+ * counted piece by piece between its safe cuts and dropped from the front
+ * until the rest fits, without recounting what is kept. Only the piece that
+ * straddles the limit is searched line by line. */
+static size_t pipe_trim_tail(StdinPipe* p, size_t end, size_t back_tokens, int jobs,
+                             size_t* counted_from)
+{
+    size_t limit = p->tail_tokens;
+    size_t keep_at = SIZE_MAX;
+    while (p->first < p->count && p->kept_tokens + back_tokens > limit)
+    {
+        PipeChunk* c = pipe_chunk(p, p->first);
+        size_t rest = p->kept_tokens - c->tokens + back_tokens;
+        if (rest >= limit)
+        {
+            p->kept_tokens -= c->tokens;
+            p->first++;
+            continue;
+        }
+
+        /* Keep the end of this chunk that fits in what is left */
+        char* text = pipe_copy(p, c->start, c->len);
+        size_t pieces = 1;
+        for (size_t i = 1; i < c->len; i++)
+        {
+            pieces += text[i - 1] == '\n' && cut_byte_ok((unsigned char)text[i]);
+        }
+        TokenSpan* spans = pipe_alloc(NULL, pieces * sizeof(TokenSpan));
+        size_t at = 0;
+        for (size_t i = 1, k = 0; i <= c->len; i++)
+        {
+            if (i == c->len || (text[i - 1] == '\n' && cut_byte_ok((unsigned char)text[i])))
+            {
+                spans[k++] = (TokenSpan){text + at, i - at, i == c->len, 0};
+                at = i;
+            }
+        }
+        if (llm_tokenizer_count_batch(p->tok, spans, pieces, jobs) != 0)
+        {
+            p->failed = true;
+        }
+
+        size_t room = limit - rest;
+        size_t kept = 0;
+        size_t chunk_from = c->len;
+        for (size_t k = pieces; k-- > 0;)
+        {
+            if (kept + spans[k].tokens > room)
+            {
+                /* Lines from the end of this piece whose count fits */
+                size_t piece_from = (size_t)(spans[k].text - text);
+                keep_at = c->start +
+                          pipe_fit_lines(p, text, piece_from, chunk_from, room - kept);
+                break;
+            }
+            kept += spans[k].tokens;
+            chunk_from = (size_t)(spans[k].text - text);
+        }
+        free(spans);
+        free(text);
+
+        p->kept_tokens -= c->tokens - kept;
+        c->start += chunk_from;
+        c->len -= chunk_from;
+        c->tokens = kept;
+        if (c->len == 0)
+        {
+            p->first++;
+        }
+        break;
+    }
+    *counted_from = p->first < p->count ? pipe_chunk(p, p->first)->start : end;
+    size_t keep = keep_at < *counted_from ? keep_at : *counted_from;
+    if (keep == p->head && p->head > p->tail)
+    {
+        /* Not even the last line fits; it is kept anyway, uncounted */
+        keep = p->head - 1;
+        while (keep > p->tail && pipe_byte(p, keep - 1) != '\n')
+        {
+            keep--;
+        }
+    }
+    return keep;
+}
+
+static void pipe_cleanup(StdinPipe* p)
+{
+    if (p->threaded)
+    {
+        pthread_mutex_lock(&p->lock);
+        p->closing = true;
+        pthread_cond_broadcast(&p->work);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->worker, NULL);
+    }
+    if (p->ring)
+    {
+        free(p->buf);
+    }
+    free(p->chunks);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->progress);
+}
+
+/** Read and throw away the rest of fd into buf[0, cap) */
+static bool pipe_drain(int fd, char* buf, size_t cap)
+{
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, cap);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return n == 0;
+        }
+        timing_count(COUNTER_BYTES_READ, (uint64_t)n);
+    }
+}
+
+/* WHY: A whole read grows its buffer as the newest arena allocation, in
+ * place, so the input lands where it stays and is never copied again; the
+ * caller must not allocate from the arena until this returns. */
+bool stdin_pipe_read(int fd, const StdinPipeOptions* opts, Arena* arena, StdinPipeResult* out)
+{
+    memset(out, 0, sizeof(*out));
+    size_t mark = arena_get_mark(arena);
+
+    StdinPipe state;
+    StdinPipe* p = &state;
+    memset(p, 0, sizeof(*p));
+    p->arena = arena;
+    p->max_bytes = opts->max_bytes ? opts->max_bytes : 1;
+    p->tok = opts->tok;
+    p->tail_tokens = opts->tok ? opts->tail_tokens : 0;
+    p->ring = p->tail_tokens > 0;
+    p->cut = p->front = p->last_safe = SIZE_MAX;
+    p->exact = true;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->progress, NULL);
+
+    if (p->ring)
+    {
+        p->cap = p->max_bytes < STDIN_PIPE_RING ? p->max_bytes : STDIN_PIPE_RING;
+        if (p->cap < STDIN_PIPE_MIN_ROOM)
+        {
+            p->cap = STDIN_PIPE_MIN_ROOM;
+        }
+        p->buf = pipe_alloc(NULL, p->cap);
+    }
+    else
+    {
+        /* Regular files are sized up front; other streams start small and double */
+        p->cap = STDIN_PIPE_START;
+        struct stat st;
+        off_t pos = lseek(fd, 0, SEEK_CUR);
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0 && st.st_size >= pos)
+        {
+            /* Room for the remaining bytes, the NUL, and one byte to see EOF */
+            p->cap = (size_t)(st.st_size - pos) + 2;
+        }
+        if (p->cap > p->max_bytes + 1)
+        {
+            p->cap = p->max_bytes + 1;
+        }
+        if (p->cap < 2)
+        {
+            p->cap = 2;
+        }
+        p->buf = arena_push_size_safe(arena, p->cap, 1);
+    }
+    if (p->tok)
+    {
+        p->threaded = pthread_create(&p->worker, NULL, pipe_worker, p) == 0;
+    }
+
+    bool classified = opts->first_block == NULL;
+    bool read_failed = false;
+    for (;;)
+    {
+        char* dst;
+        size_t want;
+        if (!pipe_make_room(p, &dst, &want))
+        {
+            /* A whole read is full: see whether anything was left out */
+            char probe;
+            ssize_t n;
+            do
+            {
+                n = p->ring ? 0 : read(fd, &probe, 1);
+            } while (n < 0 && errno == EINTR);
+            p->truncated = p->truncated || n > 0;
+            break;
+        }
+        ssize_t n = read(fd, dst, want);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            read_failed = true;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        timing_count(COUNTER_BYTES_READ, (uint64_t)n);
+        p->head += (size_t)n;
+
+        if (!classified)
+        {
+            /* The start of the stream is at buf[0] until the first chunk is queued */
+            if (p->head < STDIN_PIPE_FIRST_BLOCK)
+            {
+                continue;
+            }
+            classified = true;
+            if (!opts->first_block(p->buf, STDIN_PIPE_FIRST_BLOCK, opts->user))
+            {
+                out->discarded = true;
+                size_t scratch = p->cap < STDIN_PIPE_BLOCK ? p->cap : STDIN_PIPE_BLOCK;
+                read_failed = !pipe_drain(fd, p->buf, scratch);
+                break;
+            }
+        }
+        if (p->tok)
+        {
+            pipe_advance(p);
+        }
+    }
+    if (!classified && !read_failed && p->head > 0 &&
+        !opts->first_block(p->buf, p->head, opts->user))
+    {
+        out->discarded = true;
+    }
+
+    if (read_failed || out->discarded)
+    {
+        int saved_errno = errno;
+        pipe_cleanup(p);
+        arena_set_mark(arena, mark);
+        if (read_failed)
+        {
+            errno = saved_errno;
+            return false;
+        }
+        out->data = arena_push_size_safe(arena, 1, 1);
+        return true;
+    }
+
+    size_t end = 0;
+    if (p->tok)
+    {
+        end = pipe_finish_counting(p, opts->jobs);
+    }
+    bool counted = p->tok && p->cut != SIZE_MAX && p->exact && !p->failed;
+
+    if (!p->ring)
+    {
+        p->buf[p->head] = '\0';
+        arena_resize_last(arena, p->buf, p->cap, p->head + 1);
+        out->data = p->buf;
+        out->len = p->head;
+        out->count_from = counted ? p->front : 0;
+        out->count_to = counted ? end : 0;
+        out->tokens = counted ? p->kept_tokens : 0;
+    }
+    else
+    {
+        size_t keep_from = 0;
+        size_t counted_from = 0;
+        if (p->cut != SIZE_MAX && !p->failed)
+        {
+            char* back = pipe_copy(p, end, p->head - end);
+            size_t back_tokens = p->head > end ? llm_tokenizer_count(p->tok, back) : 0;
+            free(back);
+            if (back_tokens == SIZE_MAX)
+            {
+                p->failed = true;
+            }
+            else
+            {
+                bool fits = false;
+                if (p->tail == 0 && p->kept_tokens + back_tokens <= p->tail_tokens)
+                {
+                    /* Nothing was dropped; the input may fit whole */
+                    char* lead = pipe_copy(p, 0, p->front);
+                    size_t lead_tokens = p->front > 0 ? llm_tokenizer_count(p->tok, lead) : 0;
+                    free(lead);
+                    fits = lead_tokens != SIZE_MAX &&
+                           lead_tokens + p->kept_tokens + back_tokens <= p->tail_tokens;
+                }
+                if (fits)
+                {
+                    counted_from = p->front;
+                }
+                else
+                {
+                    keep_from = pipe_trim_tail(p, end, back_tokens, opts->jobs, &counted_from);
+                }
+            }
+        }
+        if (p->failed)
+        {
+            fprintf(stderr, "Error: Could not count the tokens of standard input\n");
+            pipe_cleanup(p);
+            arena_set_mark(arena, mark);
+            errno = EINVAL;
+            return false;
+        }
+
+        out->len = p->head - keep_from;
+        out->data = arena_push_size_safe(arena, out->len + 1, 1);
+        pipe_gather(p, keep_from, out->len, out->data);
+        out->data[out->len] = '\0';
+        out->dropped = keep_from;
+        out->count_from = counted ? counted_from - keep_from : 0;
+        out->count_to = counted ? end - keep_from : 0;
+        out->tokens = counted ? p->kept_tokens : 0;
+    }
+    out->counted = counted;
+    out->truncated = p->truncated;
+    pipe_cleanup(p);
+    return true;
+}
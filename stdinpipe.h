@@ -0,0 +1,74 @@
+#ifndef STDINPIPE_H
+#define STDINPIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
+#include "tokenizer.h"
+
+/**
+ * Pipelined reading of standard input
+ *
+ * Input is read in large blocks straight into its final buffer. The first
+ * block goes to a classifier (binary and content type detection) before the
+ * rest arrives. From then on the input is cut into chunks at safe cuts (a
+ * line start whose first byte is neither whitespace nor '/', the boundary
+ * rule of the assembled context), and a worker thread counts each chunk
+ * while the next one is read. Counting chunks apart adds up to counting the
+ * text in one go, so the caller can reuse the sum instead of tokenizing the
+ * input again. At EOF, chunks the worker has not reached are counted on the
+ * calling thread plus jobs - 1 more.
+ *
+ * With tail_tokens, only the end of the input is kept: the input goes into a
+ * ring buffer, and each chunk is dropped as soon as the chunks after it hold
+ * tail_tokens tokens. Memory then stays bounded on unbounded streams, since
+ * the reader also waits whenever the worker falls more than a few chunks
+ * behind. At EOF, whole lines are trimmed from the front until what is left
+ * fits. The last line is always kept, even if it does not fit on its own.
+ */
+
+/* Bytes handed to the first-block classifier, unless the input is shorter */
+#define STDIN_PIPE_FIRST_BLOCK (8 * 1024)
+
+/* Return false to discard the input (e.g. binary data); the rest is drained */
+typedef bool (*StdinPipeFirstBlockFn)(const char* data, size_t len, void* user);
+
+typedef struct
+{
+    LLMTokenizer* tok;     /* Counts the input as it arrives; NULL counts nothing */
+    int jobs;              /* Threads for the chunks still uncounted at EOF */
+    size_t max_bytes;      /* Most input kept; the rest is dropped with truncated set */
+    size_t tail_tokens;    /* Keep only the last this many tokens; 0 keeps all. Needs tok */
+    StdinPipeFirstBlockFn first_block;
+    void* user;
+} StdinPipeOptions;
+
+typedef struct
+{
+    char* data;        /* NUL-terminated, in the arena */
+    size_t len;
+    bool truncated;    /* More than max_bytes arrived (with tail_tokens: had to be kept) */
+    bool discarded;    /* first_block rejected the input; data is empty */
+    size_t dropped;    /* Bytes dropped from the front to keep tail_tokens */
+    /*
+     * counted: tokens is the count of data[count_from, count_to). That count
+     * is exact in any text where the data follows a '\n' and is followed by
+     * a byte that is neither whitespace nor '/'. The caller counts the
+     * data before count_from and after count_to together with the text
+     * around the data.
+     */
+    bool counted;
+    size_t count_from;
+    size_t count_to;
+    size_t tokens;
+} StdinPipeResult;
+
+/**
+ * Read fd to EOF into arena according to opts
+ *
+ * Returns false, with errno set and nothing left in the arena, on a read
+ * error, or, with a message, if counting failed with tail_tokens.
+ */
+bool stdin_pipe_read(int fd, const StdinPipeOptions* opts, Arena* arena, StdinPipeResult* out);
+
+#endif /* STDINPIPE_H */
@@ -2,6 +2,7 @@
 #include "../arena.h"
 #include "test_framework.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -106,6 +107,160 @@ TEST(test_oom) {
     arena_destroy(&a);
 }
 
+TEST(test_resize_last) {
+    Arena a = arena_create(KiB(4));
+
+    char *buf = arena_push_size(&a, 100, 1);
+    memset(buf, 'x', 100);
+    ASSERT("Top allocation grows in place", arena_resize_last(&a, buf, 100, 1000));
+    ASSERT_EQUALS(1000, (int)a.pos);
+    ASSERT("Contents survive growth", buf[99] == 'x');
+
+    ASSERT("Top allocation shrinks in place", arena_resize_last(&a, buf, 1000, 10));
+    ASSERT_EQUALS(10, (int)a.pos);
+
+    ASSERT("Growth past the reserve fails", !arena_resize_last(&a, buf, 10, KiB(8)));
+    ASSERT_EQUALS(10, (int)a.pos);
+
+    char *other = arena_push_size(&a, 8, 1);
+    ASSERT("Other allocation succeeded", other != NULL);
+    ASSERT("Buried allocation cannot grow", !arena_resize_last(&a, buf, 10, 20));
+    ASSERT("The new top can", arena_resize_last(&a, other, 8, 16));
+
+    arena_destroy(&a);
+}
+
+TEST(test_high_water) {
+    Arena a = arena_create(KiB(4));
+
+    size_t mark = arena_get_mark(&a);
+    arena_push_size(&a, 1000, 1);
+    arena_set_mark(&a, mark);
+    arena_push_size(&a, 200, 1);
+    ASSERT_EQUALS(1000, (int)arena_high_water(&a));
+
+    arena_push_size(&a, 1800, 1);
+    ASSERT_EQUALS(2000, (int)arena_high_water(&a));
+    arena_clear(&a);
+    ASSERT_EQUALS(2000, (int)arena_high_water(&a));
+
+    arena_destroy(&a);
+}
+
+TEST(test_growth_chains_chunks) {
+    Arena a = arena_create_ex(KiB(4), ARENA_FLAG_GROW);
+
+    char *first = arena_push_size(&a, 3000, 1);
+    memset(first, 'a', 3000);
+    size_t mark = arena_get_mark(&a);
+    char *second = arena_push_size(&a, 3000, 1);
+    ASSERT("Push past the reserve succeeds", second != NULL);
+    ASSERT_EQUALS(2, (int)a.chunks);
+    memset(second, 'b', 3000);
+    char *big = arena_push_size(&a, KiB(64), 64);
+    ASSERT("Push larger than a chunk gets its own chunk", big != NULL);
+    ASSERT("Big push is aligned", ((uintptr_t)big % 64) == 0);
+    ASSERT_EQUALS(3, (int)a.chunks);
+    ASSERT("Earlier chunks are intact", first[2999] == 'a' && second[0] == 'b');
+
+    ArenaStats stats = arena_stats(&a);
+    ASSERT("Held bytes cover every chunk", stats.held >= 6000 + KiB(64));
+    ASSERT("Reserve covers every chunk", stats.reserved >= KiB(8) + KiB(64));
+
+    arena_set_mark(&a, mark);
+    ASSERT_EQUALS(1, (int)a.chunks);
+    ASSERT_EQUALS(3000, (int)a.pos);
+    ASSERT("High water survives the rewind", arena_high_water(&a) >= 6000 + KiB(64));
+
+    arena_push_size(&a, 3000, 1);
+    arena_clear(&a);
+    ASSERT_EQUALS(1, (int)a.chunks);
+    ASSERT_EQUALS(0, (int)a.pos);
+    arena_destroy(&a);
+    ASSERT("Destroy releases the chain", a.base == NULL && a.chunks == 0);
+}
+
+TEST(test_resize_last_across_chunks) {
+    Arena a = arena_create_ex(KiB(4), ARENA_FLAG_GROW);
+    char *buf = arena_push_size(&a, 100, 1);
+    ASSERT("Growth beyond the chunk is refused", !arena_resize_last(&a, buf, 100, KiB(8)));
+    char *moved = arena_push_size(&a, KiB(8), 1);
+    ASSERT("The caller's fallback copy lands in a new chunk", moved != NULL && a.chunks == 2);
+    ASSERT("The new top can be resized", arena_resize_last(&a, moved, KiB(8), 10));
+    arena_destroy(&a);
+}
+
+TEST(test_temp_scope) {
+    Arena a = arena_create(KiB(4));
+    arena_push_size(&a, 16, 1);
+    size_t before = a.pos;
+    {
+        ARENA_TEMP_SCOPE(temp, &a);
+        arena_push_size(&a, 1000, 1);
+        ASSERT("Scope allocations are live inside", a.pos >= before + 1000);
+    }
+    ASSERT_EQUALS((int)before, (int)a.pos);
+
+    ArenaTemp temp = arena_temp_begin(&a);
+    arena_push_size(&a, 100, 1);
+    arena_temp_end(&temp);
+    arena_temp_end(&temp);
+    ASSERT_EQUALS((int)before, (int)a.pos);
+    arena_destroy(&a);
+}
+
+TEST(test_scratch_avoids_conflict) {
+    Arena *s1 = arena_scratch(NULL);
+    Arena *s2 = arena_scratch(s1);
+    ASSERT("Scratch arena exists", s1 != NULL && s1->base != NULL);
+    ASSERT("Conflicting arena is never returned", s2 != s1);
+    ASSERT("Same scratch on repeated calls", arena_scratch(NULL) == s1);
+    {
+        ARENA_SCRATCH_SCOPE(scratch, s1);
+        ASSERT("Scope uses the non-conflicting arena", scratch.arena == s2);
+        arena_push_size(scratch.arena, KiB(100), 1);
+    }
+    ASSERT_EQUALS(0, (int)arena_stats(s2).held);
+    ASSERT("Scratch peak is recorded", arena_scratch_high_water() >= KiB(100));
+}
+
+static pthread_barrier_t g_scratch_barrier;
+
+static void *scratch_thread(void *arg) {
+    Arena **out = arg;
+    *out = arena_scratch(NULL);
+    ARENA_SCRATCH_SCOPE(scratch, NULL);
+    memset(arena_push_size(scratch.arena, KiB(16), 1), 1, KiB(16));
+    /* Both threads hold their scratch at once, so addresses cannot be reused */
+    pthread_barrier_wait(&g_scratch_barrier);
+    return NULL;
+}
+
+TEST(test_scratch_is_per_thread) {
+    Arena *mine = arena_scratch(NULL);
+    Arena *theirs[2] = {NULL, NULL};
+    pthread_t threads[2];
+    pthread_barrier_init(&g_scratch_barrier, NULL, 2);
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, scratch_thread, &theirs[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&g_scratch_barrier);
+    ASSERT("Threads get their own scratch", theirs[0] && theirs[1] && theirs[0] != mine);
+    ASSERT("No two threads share one", theirs[0] != theirs[1]);
+}
+
+TEST(test_huge_page_hint) {
+    Arena a = arena_create_ex(MiB(4), ARENA_FLAG_HUGE_PAGES);
+    ASSERT("Hinted arena is usable", a.base != NULL);
+    char *p = arena_push_size(&a, MiB(3), 1);
+    ASSERT("Allocation succeeds", p != NULL);
+    p[MiB(3) - 1] = 1;
+    arena_destroy(&a);
+}
+
 int main(void) {
     printf("Running arena tests\n");
     printf("==================\n");
@@ -114,6 +269,14 @@ int main(void) {
     RUN_TEST(test_arena_allocations);
     RUN_TEST(test_alignment);
     RUN_TEST(test_oom);
+    RUN_TEST(test_resize_last);
+    RUN_TEST(test_high_water);
+    RUN_TEST(test_growth_chains_chunks);
+    RUN_TEST(test_resize_last_across_chunks);
+    RUN_TEST(test_temp_scope);
+    RUN_TEST(test_scratch_avoids_conflict);
+    RUN_TEST(test_scratch_is_per_thread);
+    RUN_TEST(test_huge_page_hint);
     
     printf("\n");
     PRINT_TEST_SUMMARY();
@@ -0,0 +1,200 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../chunker.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for line-range chunking and `llm_ctx -r --chunks`
+ */
+
+static char g_exe[PATH_MAX];
+
+/* Append a C function of body_lines statement lines (plus its header, closing
+ * brace and a blank line) to buf */
+static size_t append_function(char *buf, size_t used, size_t size, const char *name,
+                              int body_lines) {
+    used += (size_t)snprintf(buf + used, size - used, "int %s(void)\n{\n", name);
+    for (int i = 0; i < body_lines; i++) {
+        used += (size_t)snprintf(buf + used, size - used, "    x += %d;\n", i);
+    }
+    used += (size_t)snprintf(buf + used, size - used, "}\n\n");
+    return used;
+}
+
+/* Chunks are ordered, cover every line once and respect max_lines */
+static bool chunks_tile(const ChunkRange *chunks, int n, int total, int max_lines) {
+    int next = 1;
+    for (int i = 0; i < n; i++) {
+        if (chunks[i].start_line != next || chunks[i].end_line < chunks[i].start_line ||
+            chunks[i].end_line - chunks[i].start_line + 1 > max_lines) {
+            return false;
+        }
+        next = chunks[i].end_line + 1;
+    }
+    return next == total + 1;
+}
+
+TEST(test_chunk_short_and_empty) {
+    Arena a = arena_create(MiB(1));
+    ChunkRange *chunks;
+    ASSERT_EQUALS(0, chunk_lines("", 0, 10, &a, &chunks));
+    const char *text = "one\ntwo\n\nthree";
+    ASSERT_EQUALS(1, chunk_lines(text, strlen(text), 10, &a, &chunks));
+    ASSERT_EQUALS(1, chunks[0].start_line);
+    ASSERT_EQUALS(4, chunks[0].end_line);
+    arena_destroy(&a);
+}
+
+TEST(test_chunk_splits_after_closing_braces) {
+    static char buf[16384];
+    size_t used = 0;
+    const char *names[] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta"};
+    for (int i = 0; i < 6; i++) {
+        used = append_function(buf, used, sizeof(buf), names[i], 12);
+    }
+    /* Each function is 16 lines: header, '{', 12 statements, '}', blank */
+    Arena a = arena_create(MiB(1));
+    ChunkRange *chunks;
+    int n = chunk_lines(buf, used, 40, &a, &chunks);
+    ASSERT_EQUALS(6, n);
+    ASSERT("Chunks tile the file", chunks_tile(chunks, n, 96, 40));
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQUALS(1 + 16 * i, chunks[i].start_line);
+    }
+    arena_destroy(&a);
+}
+
+TEST(test_chunk_merges_small_pieces) {
+    static char buf[16384];
+    size_t used = 0;
+    char name[32];
+    for (int i = 0; i < 20; i++) {
+        snprintf(name, sizeof(name), "f%d", i);
+        used = append_function(buf, used, sizeof(buf), name, 1);
+    }
+    /* 20 five-line functions; with 40-line chunks none is shorter than 10 lines */
+    Arena a = arena_create(MiB(1));
+    ChunkRange *chunks;
+    int n = chunk_lines(buf, used, 40, &a, &chunks);
+    ASSERT("Tiny functions are merged", n > 1 && n <= 10);
+    ASSERT("Chunks tile the file", chunks_tile(chunks, n, 100, 40));
+    for (int i = 0; i + 1 < n; i++) {
+        ASSERT("Chunks hold at least a quarter of the limit",
+               chunks[i].end_line - chunks[i].start_line + 1 >= 10);
+    }
+    arena_destroy(&a);
+}
+
+TEST(test_chunk_long_block_cut_at_blank_line) {
+    static char buf[16384];
+    size_t used = 0;
+    for (int i = 1; i <= 100; i++) {
+        /* Indented throughout, so only the blank line at 30 is a place to cut */
+        used += (size_t)snprintf(buf + used, sizeof(buf) - used, i == 30 ? "\n" : "    s%d;\n", i);
+    }
+    Arena a = arena_create(MiB(1));
+    ChunkRange *chunks;
+    int n = chunk_lines(buf, used, 40, &a, &chunks);
+    ASSERT("Chunks tile the block", chunks_tile(chunks, n, 100, 40));
+    ASSERT_EQUALS(30, chunks[0].end_line);
+    ASSERT_EQUALS(70, chunks[1].end_line);
+    arena_destroy(&a);
+}
+
+TEST(test_chunk_markdown_headings) {
+    static char buf[16384];
+    size_t used = 0;
+    for (int s = 0; s < 4; s++) {
+        used += (size_t)snprintf(buf + used, sizeof(buf) - used, "## Section %d\n", s);
+        for (int i = 0; i < 11; i++) {
+            used += (size_t)snprintf(buf + used, sizeof(buf) - used, "  text %d\n", i);
+        }
+    }
+    Arena a = arena_create(MiB(1));
+    ChunkRange *chunks;
+    int n = chunk_lines(buf, used, 20, &a, &chunks);
+    ASSERT_EQUALS(4, n);
+    ASSERT_EQUALS(13, chunks[1].start_line);
+    ASSERT_EQUALS(37, chunks[3].start_line);
+    ASSERT_EQUALS(48, chunks[3].end_line);
+    arena_destroy(&a);
+}
+
+/* Run llm_ctx in the test directory, capturing stdout and stderr */
+static void run_llm_ctx(const char *args, char *out, size_t out_size) {
+    char cmd[PATH_MAX * 3];
+    snprintf(cmd, sizeof(cmd),
+             "cd " TEST_DIR "/chunker_tree && LLM_CTX_NO_CONFIG=1 '%s' -o "
+             "--no-cache %s 2>&1 </dev/null",
+             g_exe, args);
+    out[0] = '\0';
+    FILE *pipe = popen(cmd, "r");
+    if (!pipe) {
+        return;
+    }
+    size_t total = fread(out, 1, out_size - 1, pipe);
+    out[total] = '\0';
+    pclose(pipe);
+}
+
+TEST(test_cli_chunks_select_function) {
+    static char buf[1 << 18];
+    size_t used = 0;
+    char name[32];
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), i == 150 ? "rebalance_tree" : "helper_%d", i);
+        used = append_function(buf, used, sizeof(buf), name, 20);
+    }
+    system("mkdir -p " TEST_DIR "/chunker_tree");
+    FILE *f = fopen(TEST_DIR "/chunker_tree/big.c", "w");
+    if (f) {
+        fwrite(buf, 1, used, f);
+        fclose(f);
+    }
+
+    static char out[1 << 19];
+    run_llm_ctx("-r -b 2000 --chunks=40 -c 'fix rebalance_tree' -f big.c", out, sizeof(out));
+    ASSERT("The relevant function is included", strstr(out, "int rebalance_tree(void)") != NULL);
+    ASSERT("It comes as a line range", strstr(out, "File: big.c (lines 3601-3624)") != NULL);
+    ASSERT("Most of the file is left out", strlen(out) < used / 2);
+
+    run_llm_ctx("-r -b 2000 -c 'fix rebalance_tree' -f big.c", out, sizeof(out));
+    ASSERT("Without --chunks the file does not fit",
+           strstr(out, "int rebalance_tree(void)") == NULL);
+}
+
+TEST(test_cli_chunks_rejects_bad_size) {
+    char out[4096];
+    run_llm_ctx("-r --chunks=0 -c q -f big.c", out, sizeof(out));
+    ASSERT("Zero is rejected", strstr(out, "Invalid --chunks value") != NULL);
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return 1;
+    }
+    snprintf(g_exe, sizeof(g_exe), "%s/llm_ctx", cwd);
+
+    printf("Running chunker tests\n");
+    printf("=====================\n");
+
+    RUN_TEST(test_chunk_short_and_empty);
+    RUN_TEST(test_chunk_splits_after_closing_braces);
+    RUN_TEST(test_chunk_merges_small_pieces);
+    RUN_TEST(test_chunk_long_block_cut_at_blank_line);
+    RUN_TEST(test_chunk_markdown_headings);
+    RUN_TEST(test_cli_chunks_select_function);
+    RUN_TEST(test_cli_chunks_rejects_bad_size);
+
+    system("rm -rf " TEST_DIR "/chunker_tree");
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
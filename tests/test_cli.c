@@ -384,6 +384,67 @@ TEST(test_cli_no_gitignore) {
     ASSERT("Output contains __test_2.txt", string_contains(output, "__test_2.txt"));
 }
 
+/* Test that a .gitignore inside a subdirectory prunes its subtree */
+TEST(test_cli_nested_gitignore) {
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd),
+             "cd %s && mkdir -p __nested/gen __nested/src && printf 'gen/\\n' > __nested/.gitignore && "
+             "echo kept > __nested/src/kept.c && echo skipped > __nested/gen/skipped.c && "
+             "%s/llm_ctx -o -f '__nested/**/*.c'; rm -rf __nested",
+             TEST_DIR, getenv("PWD"));
+
+    char *output = run_command(cmd);
+
+    ASSERT("Output contains __nested/src/kept.c", string_contains(output, "__nested/src/kept.c"));
+    ASSERT("Output does not contain gen/skipped.c", !string_contains(output, "skipped.c"));
+}
+
+/* Test that a .gitignore between the CWD and the walk base still applies */
+TEST(test_cli_gitignore_above_base) {
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd),
+             "cd %s && mkdir -p __scoped/b && printf 'local.txt\\n/anch.txt\\n' > __scoped/.gitignore && "
+             "for f in local anch keep; do echo $f > __scoped/$f.txt; echo $f > __scoped/b/$f.txt; done && "
+             "%s/llm_ctx -o -f __scoped/b && echo __SPLIT__ && %s/llm_ctx -o -f '__scoped/*'; rm -rf __scoped",
+             TEST_DIR, getenv("PWD"), getenv("PWD"));
+
+    char *output = run_command(cmd);
+    char *split = strstr(output, "__SPLIT__");
+    ASSERT("Both runs completed", split != NULL);
+    if (!split) return;
+    *split = '\0';
+    const char *glob_run = split + 1;
+
+    ASSERT("Directory walk keeps __scoped/b/keep.txt", string_contains(output, "__scoped/b/keep.txt"));
+    ASSERT("Directory walk skips __scoped/b/local.txt", !string_contains(output, "__scoped/b/local.txt"));
+    ASSERT("Anchored pattern does not reach __scoped/b", string_contains(output, "__scoped/b/anch.txt"));
+    ASSERT("Glob keeps __scoped/keep.txt", string_contains(glob_run, "__scoped/keep.txt"));
+    ASSERT("Glob skips __scoped/local.txt", !string_contains(glob_run, "__scoped/local.txt"));
+    ASSERT("Glob skips anchored __scoped/anch.txt", !string_contains(glob_run, "__scoped/anch.txt"));
+    ASSERT("Glob skips __scoped/b/local.txt", !string_contains(glob_run, "__scoped/b/local.txt"));
+}
+
+/* Test --timings in its text and JSON forms */
+TEST(test_cli_timings) {
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "cd %s && (%s/llm_ctx -o --timings -f __regular.txt 2>&1 >/dev/null)",
+             TEST_DIR, getenv("PWD"));
+    char *output = run_command(cmd);
+    ASSERT("Text report has the phase table", string_contains(output, "Timings:"));
+    ASSERT("Text report has the walk phase", string_contains(output, "  walk "));
+    ASSERT("Text report has counters", string_contains(output, "  open_calls "));
+
+    snprintf(cmd, sizeof(cmd),
+             "cd %s && %s/llm_ctx -o --timings=__timings.json -f __regular.txt >/dev/null 2>&1; "
+             "cat __timings.json; rm -f __timings.json",
+             TEST_DIR, getenv("PWD"));
+    output = run_command(cmd);
+    ASSERT("JSON report has phase times", string_contains(output, "{\"config_us\": "));
+    ASSERT("JSON report has the total", string_contains(output, "\"total_us\": "));
+    ASSERT("JSON report has byte counters", string_contains(output, "\"bytes_read\": "));
+    ASSERT("JSON report has the arena mark", string_contains(output, "\"arena_high_water\": "));
+}
+
 /* Test that -f consumes inline arguments until the next flag */
 TEST(test_cli_f_flag_consumes_inline_files) {
     char cmd[1024];
@@ -1762,6 +1823,8 @@ int main(void) {
     /* Run tests */
     RUN_TEST(test_cli_gitignore_default);
     RUN_TEST(test_cli_no_gitignore);
+    RUN_TEST(test_cli_nested_gitignore);
+    RUN_TEST(test_cli_gitignore_above_base);
     RUN_TEST(test_cli_f_flag_consumes_inline_files);
     RUN_TEST(test_cli_ignore_logs);
     RUN_TEST(test_cli_ignore_dirs);
@@ -1849,6 +1912,9 @@ int main(void) {
     /* Test for get subcommand --read flag */
     RUN_TEST(test_cli_get_read_flag);
 
+    /* Test for the --timings report */
+    RUN_TEST(test_cli_timings);
+
     /* Temporarily skipped tests for UTF-16/32 handling, as the current heuristic */
     /* correctly identifies them as binary (due to null bytes), but the ideal */
     /* behavior would be to treat them as text. These tests assert the ideal */
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../filecache.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the persistent per-file cache
+ */
+
+static char cache_path[256];
+static char data_path[256];
+
+static void write_data(const char *content) {
+    FILE *f = fopen(data_path, "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+static void setup(const char *name) {
+    snprintf(cache_path, sizeof(cache_path), "%s/%s.bin", TEST_DIR, name);
+    snprintf(data_path, sizeof(data_path), "%s/%s.txt", TEST_DIR, name);
+    unlink(cache_path);
+    write_data("hello world\n");
+}
+
+static void teardown(void) {
+    filecache_close();
+    unlink(cache_path);
+    unlink(data_path);
+}
+
+TEST(test_filecache_roundtrip) {
+    setup("roundtrip");
+    FileSig sig;
+    ASSERT("Data file should stat", file_sig_for(data_path, &sig));
+    ASSERT("Cache should open", filecache_open(cache_path));
+
+    size_t tokens = 0;
+    ASSERT("Empty cache misses", !filecache_get_tokens(data_path, 0, 0, &sig, "gpt-4o", 40, &tokens));
+    filecache_put_tokens(data_path, 0, 0, &sig, "gpt-4o", 40, 11);
+    filecache_put_words(data_path, 0, 0, &sig, 2, false);
+    filecache_put_term(data_path, 0, 0, &sig, "hello", 1);
+
+    /* Buffered updates are visible before close */
+    ASSERT("Pending tokens hit", filecache_get_tokens(data_path, 0, 0, &sig, "gpt-4o", 40, &tokens));
+    ASSERT_EQUALS(11, (int)tokens);
+    filecache_close();
+
+    ASSERT("Cache should reopen", filecache_open(cache_path));
+    tokens = 0;
+    ASSERT("Stored tokens hit", filecache_get_tokens(data_path, 0, 0, &sig, "gpt-4o", 40, &tokens));
+    ASSERT_EQUALS(11, (int)tokens);
+
+    size_t words = 0;
+    bool binary = true;
+    ASSERT("Stored words hit", filecache_get_words(data_path, 0, 0, &sig, &words, &binary));
+    ASSERT_EQUALS(2, (int)words);
+    ASSERT("Binary flag round-trips", !binary);
+
+    int hits = 0;
+    ASSERT("Stored term hits", filecache_get_term(data_path, 0, 0, &sig, "hello", &hits));
+    ASSERT_EQUALS(1, hits);
+    ASSERT("Other terms miss", !filecache_get_term(data_path, 0, 0, &sig, "world", &hits));
+    teardown();
+}
+
+TEST(test_filecache_key_mismatch) {
+    setup("mismatch");
+    FileSig sig;
+    file_sig_for(data_path, &sig);
+    ASSERT("Cache should open", filecache_open(cache_path));
+    filecache_put_tokens(data_path, 0, 0, &sig, "gpt-4o", 40, 11);
+    filecache_close();
+    ASSERT("Cache should reopen", filecache_open(cache_path));
+
+    size_t tokens = 0;
+    ASSERT("Other model misses", !filecache_get_tokens(data_path, 0, 0, &sig, "o200k", 40, &tokens));
+    ASSERT("Other length misses", !filecache_get_tokens(data_path, 0, 0, &sig, "gpt-4o", 41, &tokens));
+    ASSERT("Other range misses", !filecache_get_tokens(data_path, 1, 5, &sig, "gpt-4o", 40, &tokens));
+
+    FileSig changed = sig;
+    changed.size++;
+    ASSERT("Changed size misses", !filecache_get_tokens(data_path, 0, 0, &changed, "gpt-4o", 40, &tokens));
+    changed = sig;
+    changed.mtime_ns++;
+    ASSERT("Changed mtime misses", !filecache_get_tokens(data_path, 0, 0, &changed, "gpt-4o", 40, &tokens));
+    teardown();
+}
+
+TEST(test_filecache_growth) {
+    setup("growth");
+    FileSig sig;
+    file_sig_for(data_path, &sig);
+    ASSERT("Cache should open", filecache_open(cache_path));
+    /* More distinct terms than the initial table holds */
+    char term[32];
+    for (int i = 0; i < 10000; i++) {
+        snprintf(term, sizeof(term), "term%d", i);
+        filecache_put_term(data_path, 0, 0, &sig, term, i);
+    }
+    filecache_close();
+
+    ASSERT("Cache should reopen", filecache_open(cache_path));
+    int all_hit = 1;
+    for (int i = 0; i < 10000; i++) {
+        int hits = -1;
+        snprintf(term, sizeof(term), "term%d", i);
+        all_hit = all_hit && filecache_get_term(data_path, 0, 0, &sig, term, &hits) && hits == i;
+    }
+    ASSERT("Every term survives growth", all_hit);
+    teardown();
+}
+
+TEST(test_filecache_corrupt_file) {
+    setup("corrupt");
+    FILE *f = fopen(cache_path, "w");
+    fputs("not a cache file", f);
+    fclose(f);
+
+    /* A foreign file is replaced by an empty cache */
+    ASSERT("Cache should open over garbage", filecache_open(cache_path));
+    FileSig sig;
+    file_sig_for(data_path, &sig);
+    size_t tokens;
+    ASSERT("Fresh cache misses", !filecache_get_tokens(data_path, 0, 0, &sig, "gpt-4o", 40, &tokens));
+    teardown();
+}
+
+int main(void) {
+    printf("Running file cache tests\n");
+    printf("========================\n");
+    system("mkdir -p " TEST_DIR);
+
+    RUN_TEST(test_filecache_roundtrip);
+    RUN_TEST(test_filecache_key_mismatch);
+    RUN_TEST(test_filecache_growth);
+    RUN_TEST(test_filecache_corrupt_file);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
@@ -0,0 +1,202 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../fileload.h"
+#include "../filemeta.h"
+#include "../timings.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for batched file loading
+ *
+ * Every backend must leave each FileMeta exactly as file_meta_load() alone
+ * would, whatever order the files are asked for in.
+ */
+
+#define LOAD_DIR TEST_DIR "/fileload"
+#define NUM_LOAD_FILES 12
+
+static char g_paths[NUM_LOAD_FILES][PATH_MAX];
+
+static void write_bytes(const char *path, const char *data, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (f) {
+        fwrite(data, 1, len, f);
+        fclose(f);
+    }
+}
+
+/* Text files of several sizes, one empty, one binary, one over the read cap, a
+ * directory and a missing path */
+static void write_files(void) {
+    system("mkdir -p " LOAD_DIR "/subdir");
+    static char big[FILE_LOAD_READ_MAX + 5000];
+    for (size_t i = 0; i < sizeof(big); i++) {
+        big[i] = i % 61 == 60 ? '\n' : (char)('a' + i % 26);
+    }
+    for (int i = 0; i < NUM_LOAD_FILES; i++) {
+        snprintf(g_paths[i], sizeof(g_paths[i]), LOAD_DIR "/file%d.txt", i);
+        if (i == 0) {
+            write_bytes(g_paths[i], "", 0);
+        } else if (i == 1) {
+            write_bytes(g_paths[i], "\x7f" "ELF\0\0\1", 7);
+        } else if (i == 2) {
+            write_bytes(g_paths[i], big, sizeof(big));
+        } else if (i == 3) {
+            snprintf(g_paths[i], sizeof(g_paths[i]), LOAD_DIR "/subdir");
+        } else if (i == 4) {
+            snprintf(g_paths[i], sizeof(g_paths[i]), LOAD_DIR "/missing.txt");
+        } else {
+            write_bytes(g_paths[i], big, (size_t)i * 997);
+        }
+    }
+}
+
+/* Load every file through a loader and compare with file_meta_load() */
+static int mismatches_after_load(bool in_reverse, bool finish_only) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    FileMeta expected[NUM_LOAD_FILES], batch[NUM_LOAD_FILES];
+    FileMeta *metas[NUM_LOAD_FILES];
+    const char *paths[NUM_LOAD_FILES];
+    memset(expected, 0, sizeof(expected));
+    memset(batch, 0, sizeof(batch));
+    for (int i = 0; i < NUM_LOAD_FILES; i++) {
+        file_meta_load(&expected[i], g_paths[i], &out);
+        metas[i] = &batch[i];
+        paths[i] = g_paths[i];
+    }
+
+    FileLoader *loader = file_loader_start(metas, paths, NUM_LOAD_FILES, &out, 4);
+    if (!loader) {
+        return -1;
+    }
+    for (int k = 0; k < NUM_LOAD_FILES && !finish_only; k++) {
+        int i = in_reverse ? NUM_LOAD_FILES - 1 - k : k;
+        file_meta_load(&batch[i], g_paths[i], &out);
+    }
+    file_loader_finish(loader);
+
+    int mismatches = 0;
+    for (int i = 0; i < NUM_LOAD_FILES; i++) {
+        const FileMeta *e = &expected[i], *b = &batch[i];
+        bool same = b->loaded && !b->loader && e->readable == b->readable &&
+                    e->binary == b->binary && e->size == b->size &&
+                    (!e->readable || (memcmp(&e->sig, &b->sig, sizeof(e->sig)) == 0 &&
+                                      memcmp(e->data, b->data, e->size) == 0));
+        if (!same) {
+            printf("\n  %s differs", g_paths[i]);
+            mismatches++;
+        }
+    }
+    outvec_free(&out);
+    arena_destroy(&a);
+    return mismatches;
+}
+
+TEST(test_loader_matches_file_meta_load) {
+    unsetenv("LLM_CTX_NO_IO_URING");
+    ASSERT_EQUALS(0, mismatches_after_load(false, false));
+}
+
+TEST(test_loader_out_of_order) {
+    unsetenv("LLM_CTX_NO_IO_URING");
+    ASSERT_EQUALS(0, mismatches_after_load(true, false));
+}
+
+TEST(test_loader_finish_loads_everything) {
+    unsetenv("LLM_CTX_NO_IO_URING");
+    ASSERT_EQUALS(0, mismatches_after_load(false, true));
+}
+
+TEST(test_thread_pool_matches_file_meta_load) {
+    setenv("LLM_CTX_NO_IO_URING", "1", 1);
+    ASSERT_EQUALS(0, mismatches_after_load(false, false));
+    ASSERT_EQUALS(0, mismatches_after_load(true, false));
+    ASSERT_EQUALS(0, mismatches_after_load(false, true));
+    unsetenv("LLM_CTX_NO_IO_URING");
+}
+
+TEST(test_loader_skips_loaded_and_disabled) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    FileMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    FileMeta *metas[] = {&meta};
+    const char *paths[] = {g_paths[5]};
+    ASSERT("Depth 0 disables batching", file_loader_start(metas, paths, 1, &out, 0) == NULL);
+    file_meta_load(&meta, g_paths[5], &out);
+    ASSERT("Nothing left to load", file_loader_start(metas, paths, 1, &out, 8) == NULL);
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+/* Run llm_ctx on the test files, capturing stdout or stderr */
+static void run_llm_ctx(const char *env, const char *args, bool want_stderr, char *out,
+                        size_t out_size) {
+    char cmd[PATH_MAX * 3];
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return;
+    }
+    snprintf(cmd, sizeof(cmd),
+             "cd " LOAD_DIR " && %s LLM_CTX_NO_CONFIG=1 '%s/llm_ctx' -o "
+             "--no-cache %s -f 'file*.txt' %s </dev/null",
+             env, cwd, args, want_stderr ? "2>&1 >/dev/null" : "2>/dev/null");
+    out[0] = '\0';
+    FILE *pipe = popen(cmd, "r");
+    if (!pipe) {
+        return;
+    }
+    size_t total = fread(out, 1, out_size - 1, pipe);
+    out[total] = '\0';
+    pclose(pipe);
+}
+
+TEST(test_cli_backends_give_identical_output) {
+    static char uring[1 << 20], pool[1 << 20], serial[1 << 20];
+    run_llm_ctx("", "", false, uring, sizeof(uring));
+    run_llm_ctx("LLM_CTX_NO_IO_URING=1", "", false, pool, sizeof(pool));
+    run_llm_ctx("", "--queue-depth=0", false, serial, sizeof(serial));
+    ASSERT("Files are included", strstr(uring, "File: file5.txt") != NULL);
+    ASSERT("Thread pool output matches", strcmp(uring, pool) == 0);
+    ASSERT("On-demand output matches", strcmp(uring, serial) == 0);
+}
+
+TEST(test_cli_queue_depth_in_timings) {
+    char err[8192];
+    run_llm_ctx("", "--queue-depth=7 --timings=-", true, err, sizeof(err));
+    ASSERT("Depth is reported", strstr(err, "\"io_queue_depth\": 7") != NULL);
+    run_llm_ctx("", "--queue-depth=0 --timings=-", true, err, sizeof(err));
+    ASSERT("Depth 0 is reported", strstr(err, "\"io_queue_depth\": 0") != NULL);
+    ASSERT("Nothing goes through io_uring", strstr(err, "\"io_uring_ops\": 0") != NULL);
+    run_llm_ctx("", "--queue-depth=x", true, err, sizeof(err));
+    ASSERT("Invalid depth is rejected", strstr(err, "Invalid --queue-depth value") != NULL);
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+    write_files();
+
+    printf("Running file loader tests\n");
+    printf("=========================\n");
+
+    RUN_TEST(test_loader_matches_file_meta_load);
+    RUN_TEST(test_loader_out_of_order);
+    RUN_TEST(test_loader_finish_loads_everything);
+    RUN_TEST(test_thread_pool_matches_file_meta_load);
+    RUN_TEST(test_loader_skips_loaded_and_disabled);
+    RUN_TEST(test_cli_backends_give_identical_output);
+    RUN_TEST(test_cli_queue_depth_in_timings);
+
+    system("rm -rf " LOAD_DIR);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
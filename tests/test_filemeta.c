@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../filemeta.h"
+#include "../timings.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for shared per-file metadata
+ */
+
+#define TEXT_FILE TEST_DIR "/filemeta_text.c"
+#define BINARY_FILE TEST_DIR "/filemeta_blob.bin"
+#define EMPTY_FILE TEST_DIR "/filemeta_empty.txt"
+
+static void write_bytes(const char *path, const char *data, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (f) {
+        fwrite(data, 1, len, f);
+        fclose(f);
+    }
+}
+
+TEST(test_file_meta_loads_once) {
+    write_bytes(TEXT_FILE, "int main(void) { return 0; }\n", 29);
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    timings_enable();
+
+    FileMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    uint64_t opens = timing_counter(COUNTER_OPEN);
+    ASSERT("Text file loads", file_meta_load(&meta, TEXT_FILE, &out));
+    ASSERT("Second load is free", file_meta_load(&meta, TEXT_FILE, &out));
+    ASSERT_EQUALS(1, (int)(timing_counter(COUNTER_OPEN) - opens));
+    ASSERT_EQUALS(29, (int)meta.size);
+    ASSERT("Content is mapped", memcmp(meta.data, "int main(void)", 14) == 0);
+    ASSERT("Text is not binary", !meta.binary);
+
+    FileSig sig;
+    ASSERT("stat() agrees", file_sig_for(TEXT_FILE, &sig));
+    ASSERT("Signature matches stat()", memcmp(&sig, &meta.sig, sizeof(sig)) == 0);
+
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_file_meta_binary_and_empty) {
+    write_bytes(BINARY_FILE, "\x7f" "ELF\0\0\1", 7);
+    write_bytes(EMPTY_FILE, "", 0);
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+
+    FileMeta blob;
+    memset(&blob, 0, sizeof(blob));
+    ASSERT("Binary file loads", file_meta_load(&blob, BINARY_FILE, &out));
+    ASSERT("Binary content is flagged", blob.binary);
+
+    FileMeta empty;
+    memset(&empty, 0, sizeof(empty));
+    ASSERT("Empty file loads", file_meta_load(&empty, EMPTY_FILE, &out));
+    ASSERT_EQUALS(0, (int)empty.size);
+    ASSERT("Empty file is text", !empty.binary && empty.data != NULL);
+
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_file_meta_failure_is_remembered) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    timings_enable();
+
+    FileMeta missing;
+    memset(&missing, 0, sizeof(missing));
+    ASSERT("Missing file is unreadable", !file_meta_load(&missing, TEST_DIR "/nope.c", &out));
+    uint64_t opens = timing_counter(COUNTER_OPEN);
+    ASSERT("Still unreadable", !file_meta_load(&missing, TEST_DIR "/nope.c", &out));
+    ASSERT_EQUALS(0, (int)(timing_counter(COUNTER_OPEN) - opens));
+
+    FileMeta dir;
+    memset(&dir, 0, sizeof(dir));
+    ASSERT("Directory is unreadable", !file_meta_load(&dir, TEST_DIR, &out));
+    ASSERT("Nothing is mapped", dir.data == NULL && dir.size == 0);
+
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_skip_lines_matches_memchr) {
+    /* Long enough for the 64-byte blocks, with lines of every short length */
+    char buf[4096];
+    size_t len = 0;
+    for (int i = 0; len + 40 < sizeof(buf); i++) {
+        for (int j = 0; j < i % 37; j++) {
+            buf[len++] = 'a';
+        }
+        buf[len++] = '\n';
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < len; i++) {
+        total += buf[i] == '\n';
+    }
+    for (size_t n = 0; n <= total + 2; n++) {
+        size_t expect = 0, seen = 0;
+        while (seen < n && expect < len) {
+            const char *nl = memchr(buf + expect, '\n', len - expect);
+            expect = nl ? (size_t)(nl - buf) + 1 : len;
+            seen += nl != NULL;
+        }
+        size_t skipped;
+        size_t got = skip_lines(buf, len, n, &skipped);
+        ASSERT("Offset matches a memchr walk", got == expect);
+        ASSERT("Skipped count matches", skipped == seen);
+    }
+}
+
+TEST(test_file_meta_line_range) {
+    /* Line i is "<i>\n", across several index strides */
+    FILE *f = fopen(TEXT_FILE, "w");
+    int lines = LINE_INDEX_STRIDE * 3 + 7;
+    for (int i = 1; i <= lines; i++) {
+        fprintf(f, "%d\n", i);
+    }
+    fprintf(f, "tail");
+    fclose(f);
+
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    FileMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    ASSERT("File loads", file_meta_load(&meta, TEXT_FILE, &out));
+
+    size_t from, to;
+    char line[32];
+    int probes[] = {1, 2, LINE_INDEX_STRIDE, LINE_INDEX_STRIDE + 1, 2 * LINE_INDEX_STRIDE + 5, lines};
+    for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+        file_meta_line_range(&meta, probes[p], probes[p], &from, &to);
+        snprintf(line, sizeof(line), "%d\n", probes[p]);
+        ASSERT("Single line is cut exactly", to - from == strlen(line) &&
+                                               memcmp(meta.data + from, line, to - from) == 0);
+    }
+    ASSERT("Lookups only index what they need", meta.line_offsets_count <= 4);
+
+    file_meta_line_range(&meta, lines + 1, 0, &from, &to);
+    ASSERT("Last line without newline", to - from == 4 && memcmp(meta.data + from, "tail", 4) == 0);
+    file_meta_line_range(&meta, lines + 5, lines + 9, &from, &to);
+    ASSERT("Past the end is empty", from == meta.size && to == meta.size);
+    file_meta_line_range(&meta, 0, 2, &from, &to);
+    ASSERT("Open start", from == 0 && to == 4);
+    file_meta_line_range(&meta, 9, 3, &from, &to);
+    ASSERT("Reversed range is empty", to == from);
+
+    file_meta_free(&meta);
+    ASSERT("Index is released", meta.line_offsets == NULL && meta.line_offsets_count == 0);
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_file_meta_line_cursor) {
+    /* Same file as above; ascending runs use the cursor, jumps back must not */
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    FileMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    ASSERT("File loads", file_meta_load(&meta, TEXT_FILE, &out));
+
+    int probes[] = {10, 11, 500, 1500, 1501, 12, 2 * LINE_INDEX_STRIDE + 3, 1502, 1, 3000};
+    int mismatches = 0;
+    for (size_t p = 0; p < sizeof(probes) / sizeof(probes[0]); p++) {
+        size_t from, to;
+        char line[32];
+        file_meta_line_range(&meta, probes[p], probes[p], &from, &to);
+        snprintf(line, sizeof(line), "%d\n", probes[p]);
+        if (to - from != strlen(line) || memcmp(meta.data + from, line, to - from) != 0) {
+            printf("\n  line %d cut wrong", probes[p]);
+            mismatches++;
+        }
+    }
+    ASSERT_EQUALS(0, mismatches);
+    ASSERT("Cursor sits on a looked-up line", meta.cursor_line == 3001);
+
+    file_meta_free(&meta);
+    ASSERT("Cursor is released", meta.cursor_line == 0);
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_is_binary_buffer) {
+    ASSERT("Whitespace is text", !is_binary_buffer("a\tb\r\nc", 6));
+    ASSERT("NUL is binary", is_binary_buffer("a\0b", 3));
+    ASSERT("Control codes are binary", is_binary_buffer("a\x01" "b", 3));
+    ASSERT("UTF-8 is text", !is_binary_buffer("caf\xc3\xa9", 5));
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+    printf("Running filemeta tests\n");
+    printf("======================\n");
+
+    RUN_TEST(test_file_meta_loads_once);
+    RUN_TEST(test_file_meta_binary_and_empty);
+    RUN_TEST(test_file_meta_failure_is_remembered);
+    RUN_TEST(test_skip_lines_matches_memchr);
+    RUN_TEST(test_file_meta_line_range);
+    RUN_TEST(test_file_meta_line_cursor);
+    RUN_TEST(test_is_binary_buffer);
+
+    unlink(TEXT_FILE);
+    unlink(BINARY_FILE);
+    unlink(EMPTY_FILE);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../arena.h"
+#include "../filetree.h"
+#include "../output.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the file tree trie and its renderer
+ */
+
+/* Render tree into a NUL-terminated string allocated from a */
+static char *render(FileTree *tree, Arena *a, int max_depth) {
+    OutputVec out;
+    outvec_init(&out, a);
+    file_tree_render(tree, &out, max_depth);
+    char *text = outvec_flatten(&out, a);
+    outvec_free(&out);
+    return text;
+}
+
+TEST(test_filetree_render_order) {
+    Arena a = arena_create(MiB(4));
+    FileTree tree;
+    file_tree_init(&tree, &a);
+    file_tree_add(&tree, "src/tokenizer_x.c", false);
+    file_tree_add(&tree, "src/tokenizer/a.c", false);
+    file_tree_add(&tree, "src/tokenizer.c", false);
+    file_tree_add(&tree, "README.md", false);
+
+    /* Same order as strcmp() on the full paths: '.' < '/' < '_' */
+    char *text = render(&tree, &a, 3);
+    ASSERT_STR_EQUALS(".\n"
+                      "├── README.md\n"
+                      "└── src\n"
+                      "    ├── tokenizer.c\n"
+                      "    ├── tokenizer\n"
+                      "    │   └── a.c\n"
+                      "    └── tokenizer_x.c\n",
+                      text);
+    arena_destroy(&a);
+}
+
+TEST(test_filetree_common_root) {
+    Arena a = arena_create(MiB(4));
+    FileTree tree;
+    file_tree_init(&tree, &a);
+    file_tree_add(&tree, "/tmp/proj/src/a.c", false);
+    file_tree_add(&tree, "/tmp/proj/src/lib/b.c", false);
+    file_tree_add(&tree, "/tmp/proj/src/lib", true);
+    ASSERT_STR_EQUALS("/tmp/proj/src", file_tree_root(&tree, &a));
+
+    FileTree dotted;
+    file_tree_init(&dotted, &a);
+    file_tree_add(&dotted, "./src/a.c", false);
+    file_tree_add(&dotted, "./src/b.c", false);
+    ASSERT_STR_EQUALS("./src", file_tree_root(&dotted, &a));
+
+    /* A directory entry that is itself the common directory stops the descent */
+    FileTree self;
+    file_tree_init(&self, &a);
+    file_tree_add(&self, "src", true);
+    file_tree_add(&self, "src/a.c", false);
+    ASSERT_STR_EQUALS(".", file_tree_root(&self, &a));
+    arena_destroy(&a);
+}
+
+TEST(test_filetree_dedupe) {
+    Arena a = arena_create(MiB(4));
+    FileTree tree;
+    file_tree_init(&tree, &a);
+    ASSERT("First insert adds", file_tree_add(&tree, "main.c", false));
+    ASSERT("Dot-prefixed spelling is the same entry", !file_tree_add(&tree, "./main.c", false));
+    ASSERT("Trailing slash is the same entry", file_tree_add(&tree, "docs/", true));
+    ASSERT("Contains docs", file_tree_contains(&tree, "docs"));
+    ASSERT("Does not contain unknown", !file_tree_contains(&tree, "docs/x.md"));
+    ASSERT_EQUALS(2, tree.count);
+
+    /* Directories without files are not drawn */
+    char *text = render(&tree, &a, 3);
+    ASSERT_STR_EQUALS(".\n└── main.c\n", text);
+    arena_destroy(&a);
+}
+
+TEST(test_filetree_depth_limit) {
+    Arena a = arena_create(MiB(4));
+    FileTree tree;
+    file_tree_init(&tree, &a);
+    file_tree_add(&tree, "a/b/c/d.txt", false);
+    file_tree_add(&tree, "e.txt", false);
+
+    char *text = render(&tree, &a, 2);
+    ASSERT_STR_EQUALS(".\n├── a\n│   └── b\n└── e.txt\n", text);
+    arena_destroy(&a);
+}
+
+TEST(test_filetree_deep_and_wide) {
+    Arena a = arena_create(MiB(64));
+    FileTree tree;
+    file_tree_init(&tree, &a);
+
+    /* Deep enough that a recursive renderer with per-level arrays would be in trouble */
+    char path[8192];
+    size_t len = 0;
+    for (int i = 0; i < 1000; i++) {
+        len += (size_t)snprintf(path + len, sizeof(path) - len, "d%d/", i % 10);
+    }
+    snprintf(path + len, sizeof(path) - len, "leaf.txt");
+    file_tree_add(&tree, path, false);
+    for (int i = 0; i < 20000; i++) {
+        snprintf(path, sizeof(path), "wide/f%05d.txt", i);
+        file_tree_add(&tree, path, false);
+    }
+    ASSERT_EQUALS(20001, tree.count);
+
+    char *text = render(&tree, &a, 2000);
+    ASSERT("Deep leaf is drawn", strstr(text, "└── leaf.txt\n") != NULL);
+    ASSERT("Wide listing ends with the last file", strstr(text, "    └── f19999.txt\n") != NULL);
+    arena_destroy(&a);
+}
+
+int main(void) {
+    printf("Running file tree tests\n");
+    printf("=======================\n");
+
+    RUN_TEST(test_filetree_render_order);
+    RUN_TEST(test_filetree_common_root);
+    RUN_TEST(test_filetree_dedupe);
+    RUN_TEST(test_filetree_depth_limit);
+    RUN_TEST(test_filetree_deep_and_wide);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
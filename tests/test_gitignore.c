@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include "../gitignore.h"
 #include "test_framework.h"
 
@@ -201,6 +202,134 @@ TEST(test_ignore_precedence_over_negation) {
     ASSERT_EQUALS(0, should_ignore_path("config.ini"));
 }
 
+/* Test that patterns are compiled into the expected match classes */
+TEST(test_pattern_classification) {
+    reset_gitignore_patterns();
+
+    char p1[] = "node_modules/";
+    char p2[] = "*.o";
+    char p3[] = "docs/_site";
+    char p4[] = "test_*.c";
+    char p5[] = "*~";
+    add_ignore_pattern(p1);
+    add_ignore_pattern(p2);
+    add_ignore_pattern(p3);
+    add_ignore_pattern(p4);
+    add_ignore_pattern(p5);
+
+    ASSERT("Plain name is a literal", ignore_patterns[0].kind == IGNORE_LITERAL);
+    ASSERT("*.ext is a suffix", ignore_patterns[1].kind == IGNORE_SUFFIX);
+    ASSERT("Fixed path is a path literal", ignore_patterns[2].kind == IGNORE_PATH);
+    ASSERT("Wildcard name is a glob", ignore_patterns[3].kind == IGNORE_GLOB);
+    ASSERT("Non-dot suffix stays a glob", ignore_patterns[4].kind == IGNORE_GLOB);
+
+    ASSERT_EQUALS(1, should_ignore_entry("src/node_modules", true));
+    ASSERT_EQUALS(0, should_ignore_entry("src/node_modules", false));
+    ASSERT_EQUALS(1, should_ignore_entry("build/x.tar.o", false));
+    ASSERT_EQUALS(0, should_ignore_entry("build/x.os", false));
+    ASSERT_EQUALS(1, should_ignore_entry("docs/_site", true));
+    ASSERT_EQUALS(0, should_ignore_entry("other/docs/_site", true));
+    ASSERT_EQUALS(1, should_ignore_entry("tests/test_walker.c", false));
+    ASSERT_EQUALS(1, should_ignore_entry("notes.txt~", false));
+}
+
+/* Reference matcher: the original linear scan over every pattern */
+static int reference_should_ignore(const char *path, bool is_dir) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    for (int i = num_ignore_patterns - 1; i >= 0; i--) {
+        if (ignore_patterns[i].match_only_dir && !is_dir) {
+            continue;
+        }
+        if (fnmatch(ignore_patterns[i].pattern, path, FNM_PATHNAME) == 0 ||
+            fnmatch(ignore_patterns[i].pattern, base, 0) == 0) {
+            return ignore_patterns[i].is_negation ? 0 : 1;
+        }
+    }
+    return 0;
+}
+
+/* Test that the compiled index agrees with a full fnmatch() scan */
+TEST(test_compiled_matches_reference) {
+    reset_gitignore_patterns();
+
+    const char *patterns[] = {"*.log", "build/", "!keep.log", "src/gen", "*.tar.gz", "foo",
+                              "!src/gen", "cache*", "a/*/c", "!*.md", "README.md", "tmp/",
+                              "[Tt]humbs.db", "*.o", "!main.o", "/abs/path"};
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%s", patterns[i]);
+        add_ignore_pattern(buf);
+    }
+
+    const char *paths[] = {"x.log", "dir/keep.log", "build", "a/build", "src/gen", "gen",
+                           "pkg.tar.gz", "pkg.gz", "foo", "bar/foo", "foo.c", "cache",
+                           "cached/x", "a/b/c", "a/b/b/c", "README.md", "docs/README.md",
+                           "tmp", "Thumbs.db", "thumbs.db", "main.o", "lib/util.o", "/abs/path",
+                           ".log", "a.b.log.txt"};
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        for (int is_dir = 0; is_dir <= 1; is_dir++) {
+            ASSERT_EQUALS(reference_should_ignore(paths[i], is_dir),
+                          should_ignore_entry(paths[i], is_dir));
+        }
+    }
+}
+
+/* Test that the pattern list has no fixed capacity */
+TEST(test_many_patterns) {
+    reset_gitignore_patterns();
+
+    char buf[64];
+    for (int i = 0; i < 3000; i++) {
+        snprintf(buf, sizeof(buf), "generated_%d", i);
+        add_ignore_pattern(buf);
+    }
+
+    ASSERT_EQUALS(3000, num_ignore_patterns);
+    ASSERT_STR_EQUALS("generated_2999", ignore_patterns[2999].pattern);
+    ASSERT_EQUALS(1, should_ignore_entry("src/generated_2999", false));
+    ASSERT_EQUALS(0, should_ignore_entry("src/generated_3000", false));
+}
+
+/* Test that a nested .gitignore applies below its directory, relative to it */
+TEST(test_nested_gitignore_scope) {
+    reset_gitignore_patterns();
+    system("rm -rf " TEST_DIR "/scope && mkdir -p " TEST_DIR "/scope/sub " TEST_DIR "/scope/plain");
+
+    FILE *f = fopen(TEST_DIR "/scope/sub/.gitignore", "w");
+    ASSERT("Should create nested .gitignore", f != NULL);
+    fputs("generated/\n/local.txt\n!keep.log\n", f);
+    fclose(f);
+
+    char root_pattern[] = "*.log";
+    add_ignore_pattern(root_pattern);
+
+    int fd = open(TEST_DIR "/scope/plain", O_RDONLY);
+    ASSERT("Should open directory", fd >= 0);
+    ASSERT("Directory without .gitignore keeps the parent scope",
+           ignore_scope_enter(NULL, TEST_DIR "/scope/plain", fd) == NULL);
+    close(fd);
+
+    fd = open(TEST_DIR "/scope/sub", O_RDONLY);
+    ASSERT("Should open directory", fd >= 0);
+    const IgnoreScope *scope = ignore_scope_enter(NULL, TEST_DIR "/scope/sub", fd);
+    close(fd);
+    ASSERT("Nested .gitignore creates a scope", scope != NULL);
+
+    ASSERT_EQUALS(1, should_ignore_scoped(scope, TEST_DIR "/scope/sub/generated", true));
+    ASSERT_EQUALS(1, should_ignore_scoped(scope, TEST_DIR "/scope/sub/a/generated", true));
+    ASSERT_EQUALS(0, should_ignore_scoped(scope, TEST_DIR "/scope/sub/generated", false));
+    ASSERT_EQUALS(1, should_ignore_scoped(scope, TEST_DIR "/scope/sub/local.txt", false));
+    ASSERT_EQUALS(0, should_ignore_scoped(scope, TEST_DIR "/scope/sub/a/local.txt", false));
+    /* The deeper negation wins over the root list */
+    ASSERT_EQUALS(0, should_ignore_scoped(scope, TEST_DIR "/scope/sub/keep.log", false));
+    ASSERT_EQUALS(1, should_ignore_scoped(scope, TEST_DIR "/scope/sub/other.log", false));
+    /* Outside its directory the scope does not apply */
+    ASSERT_EQUALS(0, should_ignore_scoped(scope, TEST_DIR "/scope/generated", true));
+
+    ignore_scopes_release();
+    system("rm -rf " TEST_DIR "/scope");
+}
 
 int main(void) {
     printf("Running gitignore pattern tests\n");
@@ -220,6 +349,10 @@ int main(void) {
     RUN_TEST(test_negation_override); // This test might be redundant or overlap now
     RUN_TEST(test_negation_precedence_over_ignore); // New test
     RUN_TEST(test_ignore_precedence_over_negation); // New test
+    RUN_TEST(test_pattern_classification);
+    RUN_TEST(test_compiled_matches_reference);
+    RUN_TEST(test_many_patterns);
+    RUN_TEST(test_nested_gitignore_scope);
 
     PRINT_TEST_SUMMARY();
 }
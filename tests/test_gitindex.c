@@ -0,0 +1,232 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../gitindex.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the git index reader and `llm_ctx --git-index`
+ *
+ * Builds a scratch repository with git itself and reads back the index it
+ * writes in each on-disk format.
+ */
+
+static char g_repo[PATH_MAX];
+static char g_exe[PATH_MAX];
+
+/* Run a shell command inside the scratch repository */
+static int in_repo(const char *cmd) {
+    char full[PATH_MAX * 2 + 64];
+    snprintf(full, sizeof(full), "cd '%s' && { %s; } >/dev/null 2>&1", g_repo, cmd);
+    int status = system(full);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* Run llm_ctx in the repository, capturing stdout */
+static void run_llm_ctx(const char *args, char *out, size_t out_size) {
+    char full[PATH_MAX * 3];
+    snprintf(full, sizeof(full),
+             "cd '%s' && LLM_CTX_NO_CONFIG=1 '%s' -o --no-cache %s 2>/dev/null",
+             g_repo, g_exe, args);
+    out[0] = '\0';
+    FILE *pipe = popen(full, "r");
+    if (!pipe) {
+        return;
+    }
+    size_t total = fread(out, 1, out_size - 1, pipe);
+    out[total] = '\0';
+    pclose(pipe);
+}
+
+/* Load the repository's index and join its paths with newlines */
+static bool list_index(char *out, size_t out_size) {
+    GitIndex index;
+    const char *error = NULL;
+    out[0] = '\0';
+    if (!git_index_load(g_repo, &index, &error)) {
+        snprintf(out, out_size, "error: %s", error);
+        return false;
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < index.count && used < out_size; i++) {
+        used += (size_t)snprintf(out + used, out_size - used, "%s\n", index.entries[i].path);
+    }
+    git_index_free(&index);
+    return true;
+}
+
+#define TRACKED ".gitignore\na.c\nign/forced.c\nsrc/b.c\nsrc/deep/c.txt\nsrc/link\n"
+
+TEST(test_git_index_v2) {
+    char list[4096];
+    ASSERT_EQUALS(0, in_repo("git update-index --index-version 2"));
+    ASSERT("v2 index loads", list_index(list, sizeof(list)));
+    ASSERT_STR_EQUALS(TRACKED, list);
+}
+
+TEST(test_git_index_v4_path_compression) {
+    char list[4096];
+    ASSERT_EQUALS(0, in_repo("git update-index --index-version 4"));
+    ASSERT("v4 index loads", list_index(list, sizeof(list)));
+    ASSERT_STR_EQUALS(TRACKED, list);
+    in_repo("git update-index --index-version 2");
+}
+
+TEST(test_git_index_v4_large) {
+    /* Enough names that the name blob is reallocated many times while v4 prefixes point into it */
+    char setup[512];
+    snprintf(setup, sizeof(setup),
+             "cd '%s/..' && rm -rf gitindex_big && mkdir gitindex_big && cd gitindex_big && "
+             "git init -q . && for d in $(seq -w 0 29); do mkdir -p module_$d/src; "
+             "for f in $(seq -w 0 19); do : > module_$d/src/source_file_$f.c; done; done && "
+             "git add . && git update-index --index-version 4",
+             g_repo);
+    char full[sizeof(setup) + 32];
+    snprintf(full, sizeof(full), "{ %s; } >/dev/null 2>&1", setup);
+    ASSERT_EQUALS(0, system(full));
+
+    char root[PATH_MAX + 16];
+    snprintf(root, sizeof(root), "%s/../gitindex_big", g_repo);
+    GitIndex index;
+    const char *error = NULL;
+    ASSERT("Large v4 index loads", git_index_load(root, &index, &error));
+    ASSERT_EQUALS(600, (int)index.count);
+    bool all = index.count == 600;
+    for (size_t i = 0; i < index.count && all; i++) {
+        char expected[64];
+        snprintf(expected, sizeof(expected), "module_%02zu/src/source_file_%02zu.c", i / 20,
+                 i % 20);
+        all = strcmp(index.entries[i].path, expected) == 0;
+    }
+    ASSERT("Every path is rebuilt from its prefix", all);
+    git_index_free(&index);
+    /* Other suites list the test directory; leave them nothing extra */
+    snprintf(full, sizeof(full), "rm -rf '%s'", root);
+    system(full);
+}
+
+TEST(test_git_index_split_index) {
+    char list[4096];
+    ASSERT_EQUALS(0, in_repo("git update-index --split-index"));
+    /* Changes after the split land in the small index: one removal, one addition */
+    ASSERT_EQUALS(0, in_repo("git rm -q --cached src/deep/c.txt && git add later.c"));
+    ASSERT("Split index loads", list_index(list, sizeof(list)));
+    ASSERT_STR_EQUALS(".gitignore\na.c\nign/forced.c\nlater.c\nsrc/b.c\nsrc/link\n", list);
+    in_repo("git update-index --no-split-index && git add src/deep/c.txt && git rm -q --cached later.c");
+    ASSERT("Merged index loads", list_index(list, sizeof(list)));
+    ASSERT_STR_EQUALS(TRACKED, list);
+}
+
+TEST(test_git_index_skips_sparse_entries) {
+    char list[4096];
+    ASSERT_EQUALS(0, in_repo("git update-index --skip-worktree a.c"));
+    ASSERT("Index loads", list_index(list, sizeof(list)));
+    ASSERT("Skip-worktree entries are left out", strstr(list, "a.c") == NULL);
+    in_repo("git update-index --no-skip-worktree a.c");
+}
+
+TEST(test_git_index_lower_bound_and_modes) {
+    GitIndex index;
+    const char *error = NULL;
+    ASSERT("Index loads", git_index_load(g_repo, &index, &error));
+    size_t i = git_index_lower_bound(&index, "src/");
+    ASSERT("Lower bound is inside the index", i < index.count);
+    ASSERT_STR_EQUALS("src/b.c", index.entries[i].path);
+    ASSERT_EQUALS(GIT_MODE_FILE, index.entries[i].mode & GIT_MODE_TYPE_MASK);
+    ASSERT_EQUALS(GIT_MODE_SYMLINK, index.entries[i + 2].mode & GIT_MODE_TYPE_MASK);
+    ASSERT_EQUALS((int)index.count, (int)git_index_lower_bound(&index, "zzz"));
+    ASSERT("Root is the worktree", strstr(index.root, "gitindex_repo") != NULL);
+    git_index_free(&index);
+}
+
+TEST(test_git_index_without_index_fails) {
+    GitIndex index;
+    const char *error = NULL;
+    system("mkdir -p " TEST_DIR "/gitindex_empty/.git");
+    ASSERT("A .git without an index does not load",
+           !git_index_load(TEST_DIR "/gitindex_empty", &index, &error));
+    ASSERT("The failure is explained", error != NULL);
+}
+
+TEST(test_cli_git_index_enumeration) {
+    char out[65536];
+    run_llm_ctx("--git-index -f .", out, sizeof(out));
+    ASSERT("Tracked file is listed", strstr(out, "File: ./src/deep/c.txt") != NULL);
+    ASSERT("Tracked file under an ignored directory is listed",
+           strstr(out, "File: ./ign/forced.c") != NULL);
+    ASSERT("Untracked file is not listed", strstr(out, "untracked.c") == NULL);
+
+    run_llm_ctx("--git-index=untracked -f .", out, sizeof(out));
+    ASSERT("Untracked mode adds untracked files", strstr(out, "File: ./untracked.c") != NULL);
+    ASSERT("Untracked mode keeps tracked files", strstr(out, "File: ./ign/forced.c") != NULL);
+    ASSERT("Ignored untracked files stay out", strstr(out, "ignored.c") == NULL);
+
+    run_llm_ctx("--git-index -x 'src/deep' -f src", out, sizeof(out));
+    ASSERT("Subdirectory is enumerated", strstr(out, "File: src/b.c") != NULL);
+    ASSERT("Excluded directory is pruned", strstr(out, "c.txt") == NULL);
+    ASSERT("Files outside the subdirectory are left out", strstr(out, "a.c") == NULL);
+}
+
+TEST(test_cli_git_index_outside_repo_walks) {
+    char out[65536];
+    char cmd[PATH_MAX * 3];
+    snprintf(cmd, sizeof(cmd),
+             "cd '%s/../gitindex_empty' && echo 'int x;' > plain.c && "
+             "LLM_CTX_NO_CONFIG=1 '%s' -o --no-cache --git-index -f . 2>&1",
+             g_repo, g_exe);
+    FILE *pipe = popen(cmd, "r");
+    size_t total = pipe ? fread(out, 1, sizeof(out) - 1, pipe) : 0;
+    out[total] = '\0';
+    if (pipe) {
+        pclose(pipe);
+    }
+    ASSERT("Falls back to walking", strstr(out, "File: ./plain.c") != NULL);
+    ASSERT("Warns about the fallback", strstr(out, "Warning: --git-index") != NULL);
+}
+
+int main(void) {
+    printf("Running git index tests\n");
+    printf("=======================\n");
+
+    if (system("git --version >/dev/null 2>&1") != 0) {
+        printf("git not found, skipping\n");
+        return 0;
+    }
+
+    system("rm -rf " TEST_DIR "/gitindex_repo " TEST_DIR "/gitindex_empty");
+    system("mkdir -p " TEST_DIR "/gitindex_repo");
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return 1;
+    }
+    snprintf(g_exe, sizeof(g_exe), "%s/llm_ctx", cwd);
+    snprintf(g_repo, sizeof(g_repo), "%s/" TEST_DIR "/gitindex_repo", cwd);
+
+    if (in_repo("git init -q . && mkdir -p src/deep ign && echo 'int a;' > a.c && "
+                "echo 'int b;' > src/b.c && echo text > src/deep/c.txt && ln -s b.c src/link && "
+                "echo 'ign/' > .gitignore && echo 'int f;' > ign/forced.c && "
+                "echo 'int i;' > ign/ignored.c && echo 'int l;' > later.c && "
+                "git add .gitignore a.c src && git add -f ign/forced.c && "
+                "echo 'int u;' > untracked.c") != 0) {
+        printf("could not build a scratch repository, skipping\n");
+        return 0;
+    }
+
+    RUN_TEST(test_git_index_v2);
+    RUN_TEST(test_git_index_v4_path_compression);
+    RUN_TEST(test_git_index_v4_large);
+    RUN_TEST(test_git_index_split_index);
+    RUN_TEST(test_git_index_skips_sparse_entries);
+    RUN_TEST(test_git_index_lower_bound_and_modes);
+    RUN_TEST(test_git_index_without_index_fails);
+    RUN_TEST(test_cli_git_index_enumeration);
+    RUN_TEST(test_cli_git_index_outside_repo_walks);
+
+    system("rm -rf " TEST_DIR "/gitindex_repo " TEST_DIR "/gitindex_empty");
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
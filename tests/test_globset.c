@@ -0,0 +1,189 @@
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../globset.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the compiled glob set
+ *
+ * Every pattern kind is checked against the fnmatch() calls it replaces, and
+ * a multi-pattern run of llm_ctx is checked to read each directory once.
+ */
+
+static const char *g_names[] = {"main.c", ".hidden.c", "c", "Makefile", "a.cc", "x.h",
+                                "notes.txt", ".c", "lib.c.bak", "[odd].c", ""};
+
+static const char *g_paths[] = {"src/main.c", "main.c", "./src/deep/x.h", "build/out.o",
+                                "node_modules/pkg/index.js", "docs/.hidden", "a/b/c/d.txt",
+                                "src/test/foo_test.c", "Makefile", "vendor/x/vendor.c"};
+
+/* The pre-compilation exclude check, kept as the reference */
+static bool reference_exclude(const char *pat, const char *path) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *double_star = strstr(pat, "**");
+    if (!double_star) {
+        return fnmatch(pat, path, FNM_PATHNAME | FNM_PERIOD) == 0 || fnmatch(pat, base, 0) == 0;
+    }
+    size_t prefix_len = double_star - pat;
+    if (prefix_len > 0 && strncmp(path, pat, prefix_len) != 0) {
+        return false;
+    }
+    if (double_star[2] == '\0' || (double_star[2] == '/' && double_star[3] == '\0')) {
+        return true;
+    }
+    if (prefix_len > 0 && pat[prefix_len - 1] == '/') {
+        return true;
+    }
+    const char *suffix = double_star + 2;
+    if (*suffix == '/') {
+        suffix++;
+    }
+    return *suffix && strstr(path + prefix_len, suffix);
+}
+
+TEST(test_glob_set_classifies_patterns) {
+    Arena a = arena_create(MiB(1));
+    GlobSet set;
+    glob_set_init(&set, &a);
+    glob_set_add(&set, "Makefile", GLOB_MATCH_NAME);
+    glob_set_add(&set, "*.c", GLOB_MATCH_NAME);
+    glob_set_add(&set, "*_test.[ch]", GLOB_MATCH_NAME);
+    glob_set_add(&set, "build/**", GLOB_MATCH_EXCLUDE);
+    ASSERT_EQUALS(GLOB_LITERAL, set.patterns[0].kind);
+    ASSERT_EQUALS(GLOB_SUFFIX, set.patterns[1].kind);
+    ASSERT_EQUALS(GLOB_GENERIC, set.patterns[2].kind);
+    ASSERT_EQUALS(GLOB_DOUBLE_STAR, set.patterns[3].kind);
+    arena_destroy(&a);
+}
+
+TEST(test_glob_set_name_matches_fnmatch) {
+    const char *patterns[] = {"*.c", "*", "c", "Makefile", "*.cc", "*.[ch]", "?.h", ".*",
+                              "*.c.bak", "[[]odd].c", "\\[odd].c", "*c"};
+    Arena a = arena_create(MiB(1));
+    int mismatches = 0;
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        GlobSet set;
+        glob_set_init(&set, &a);
+        glob_set_add(&set, patterns[p], GLOB_MATCH_NAME);
+        for (size_t n = 0; n < sizeof(g_names) / sizeof(g_names[0]); n++) {
+            bool expected = fnmatch(patterns[p], g_names[n], FNM_PATHNAME | FNM_PERIOD) == 0;
+            if (glob_set_any(&set, g_names[n]) != expected) {
+                printf("\n  '%s' vs '%s': expected %d", patterns[p], g_names[n], expected);
+                mismatches++;
+            }
+        }
+    }
+    ASSERT_EQUALS(0, mismatches);
+    arena_destroy(&a);
+}
+
+TEST(test_glob_set_exclude_matches_reference) {
+    const char *patterns[] = {"*.o", "main.c", "node_modules/**", "**/vendor.c", "src/**",
+                              "**", "*.txt", ".*", "src/*.c", "Makefile", "build/*",
+                              "src/**/foo*", "a/**/d.txt", "*/main.c", "x.h"};
+    Arena a = arena_create(MiB(1));
+    int mismatches = 0;
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        GlobSet set;
+        glob_set_init(&set, &a);
+        glob_set_add(&set, patterns[p], GLOB_MATCH_EXCLUDE);
+        for (size_t n = 0; n < sizeof(g_paths) / sizeof(g_paths[0]); n++) {
+            bool expected = reference_exclude(patterns[p], g_paths[n]);
+            if (glob_set_any(&set, g_paths[n]) != expected) {
+                printf("\n  '%s' vs '%s': expected %d", patterns[p], g_paths[n], expected);
+                mismatches++;
+            }
+        }
+    }
+    ASSERT_EQUALS(0, mismatches);
+    arena_destroy(&a);
+}
+
+TEST(test_glob_set_reports_every_hit) {
+    Arena a = arena_create(MiB(1));
+    GlobSet set;
+    glob_set_init(&set, &a);
+    glob_set_add(&set, "*.h", GLOB_MATCH_NAME);
+    glob_set_add(&set, "*.c", GLOB_MATCH_NAME);
+    glob_set_add(&set, "main.*", GLOB_MATCH_NAME);
+    glob_set_add(&set, "*.c", GLOB_MATCH_NAME);
+    int hits[4];
+    ASSERT_EQUALS(3, glob_set_match(&set, "main.c", hits));
+    ASSERT_EQUALS(1, hits[0]);
+    ASSERT_EQUALS(2, hits[1]);
+    ASSERT_EQUALS(3, hits[2]);
+    ASSERT_EQUALS(0, glob_set_match(&set, "README", hits));
+    arena_destroy(&a);
+}
+
+TEST(test_glob_set_last_byte_filter) {
+    Arena a = arena_create(MiB(1));
+    GlobSet set;
+    glob_set_init(&set, &a);
+    glob_set_add(&set, "*.c", GLOB_MATCH_NAME);
+    glob_set_add(&set, "Makefile", GLOB_MATCH_NAME);
+    ASSERT("Literal and suffix patterns are filterable", !set.has_unfiltered);
+    ASSERT("Unrelated last byte is rejected", !glob_set_any(&set, "notes.txt"));
+    ASSERT("Empty string is rejected", !glob_set_any(&set, ""));
+    glob_set_add(&set, "*.[ch]", GLOB_MATCH_NAME);
+    ASSERT("Generic patterns disable the filter", set.has_unfiltered);
+    ASSERT("Generic pattern still matches", glob_set_any(&set, "x.h"));
+    arena_destroy(&a);
+}
+
+/* Count directory/file opens reported by llm_ctx --timings=- for args */
+static long count_opens(const char *args) {
+    char cmd[PATH_MAX * 2];
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return -1;
+    }
+    snprintf(cmd, sizeof(cmd),
+             "cd " TEST_DIR "/globset_tree && LLM_CTX_NO_CONFIG=1 "
+             "'%s/llm_ctx' -O -o --no-cache --timings=- -j1 -f %s 2>&1 >/dev/null",
+             cwd, args);
+    FILE *pipe = popen(cmd, "r");
+    if (!pipe) {
+        return -1;
+    }
+    char out[8192];
+    size_t total = fread(out, 1, sizeof(out) - 1, pipe);
+    out[total] = '\0';
+    pclose(pipe);
+    const char *key = strstr(out, "\"open_calls\":");
+    return key ? strtol(key + strlen("\"open_calls\":"), NULL, 10) : -1;
+}
+
+TEST(test_cli_patterns_share_one_walk) {
+    system("mkdir -p " TEST_DIR "/globset_tree/src/a/b " TEST_DIR "/globset_tree/src/c");
+    system("touch " TEST_DIR "/globset_tree/src/a/b/one.c " TEST_DIR "/globset_tree/src/c/two.c");
+    long one = count_opens("'src/**/*.c'");
+    long two = count_opens("'src/**/*.c' 'src/**/*.h'");
+    ASSERT("Counters are reported", one > 0);
+    ASSERT_EQUALS((int)one, (int)two);
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+
+    printf("Running glob set tests\n");
+    printf("======================\n");
+
+    RUN_TEST(test_glob_set_classifies_patterns);
+    RUN_TEST(test_glob_set_name_matches_fnmatch);
+    RUN_TEST(test_glob_set_exclude_matches_reference);
+    RUN_TEST(test_glob_set_reports_every_hit);
+    RUN_TEST(test_glob_set_last_byte_filter);
+    RUN_TEST(test_cli_patterns_share_one_walk);
+
+    system("rm -rf " TEST_DIR "/globset_tree");
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
@@ -0,0 +1,198 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../linediff.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for line-based unified diffs (linediff.c)
+ */
+
+static char *diff_of(const char *a, const char *b, size_t max_edits) {
+    size_t len = 0;
+    char *d = line_diff_unified(a, strlen(a), b, strlen(b), "f.txt", max_edits, &len);
+    if (d && strlen(d) != len) {
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+/* Apply a unified diff to old; returns the new text, or NULL if the diff does not fit old */
+static char *apply(const char *old, const char *diff) {
+    size_t cap = strlen(old) + strlen(diff) + 1;
+    char *out = malloc(cap);
+    size_t used = 0;
+    const char *src = old;
+    size_t src_line = 1;
+    const char *p = strchr(diff, '\n') + 1; /* --- */
+    p = strchr(p, '\n') + 1;                /* +++ */
+    while (*p) {
+        unsigned long from = 0;
+        if (sscanf(p, "@@ -%lu", &from) != 1) {
+            free(out);
+            return NULL;
+        }
+        if (strstr(p, ",0 +") && strstr(p, ",0 +") < strchr(p, '\n')) {
+            from++; /* Insertion only: the range names the line before */
+        }
+        p = strchr(p, '\n') + 1;
+        while (src_line < from) {
+            const char *nl = strchr(src, '\n');
+            size_t n = nl ? (size_t)(nl - src) + 1 : strlen(src);
+            memcpy(out + used, src, n);
+            used += n;
+            src += n;
+            src_line++;
+        }
+        while (*p == ' ' || *p == '-' || *p == '+') {
+            char op = *p++;
+            const char *nl = strchr(p, '\n');
+            size_t n = (size_t)(nl - p) + 1;
+            bool no_eol = strncmp(nl + 1, "\\ No newline at end of file\n", 28) == 0;
+            size_t text_len = no_eol ? n - 1 : n;
+            if (op != '+') {
+                if (strncmp(src, p, text_len) != 0) {
+                    free(out);
+                    return NULL;
+                }
+                src += text_len;
+                src_line++;
+            }
+            if (op != '-') {
+                memcpy(out + used, p, text_len);
+                used += text_len;
+            }
+            p = nl + 1 + (no_eol ? 28 : 0);
+        }
+    }
+    strcpy(out + used, src);
+    return out;
+}
+
+static bool round_trips(const char *a, const char *b) {
+    char *d = diff_of(a, b, 100000);
+    char *got = d ? apply(a, d) : NULL;
+    bool ok = got && strcmp(got, b) == 0;
+    free(got);
+    free(d);
+    return ok;
+}
+
+TEST(test_diff_one_changed_line) {
+    const char *a = "1\n2\n3\n4\n5\n6\n7\n8\n9\n";
+    const char *b = "1\n2\n3\n4\nfive\n6\n7\n8\n9\n";
+    char *d = diff_of(a, b, 100);
+    ASSERT("Diff is made", d != NULL);
+    ASSERT("Diff matches diff -u",
+           d && strcmp(d, "--- a/f.txt\n+++ b/f.txt\n@@ -2,7 +2,7 @@\n 2\n 3\n 4\n-5\n+five\n"
+                          " 6\n 7\n 8\n") == 0);
+    free(d);
+}
+
+TEST(test_diff_separate_hunks) {
+    char a[4096] = "", b[4096] = "";
+    for (int i = 1; i <= 40; i++) {
+        sprintf(a + strlen(a), "%d\n", i);
+        sprintf(b + strlen(b), "%s\n", i == 5 ? "x" : i == 30 ? "y" : "");
+        if (i != 5 && i != 30) {
+            sprintf(b + strlen(b) - 1, "%d\n", i);
+        }
+    }
+    char *d = diff_of(a, b, 100);
+    ASSERT("Far apart changes get a hunk each",
+           d && strstr(d, "@@ -2,7 +2,7 @@") && strstr(d, "@@ -27,7 +27,7 @@"));
+    ASSERT("Hunks apply", round_trips(a, b));
+    free(d);
+
+    /* Changes 6 lines apart share their context and one hunk */
+    const char *c = "1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n12\n";
+    const char *e = "1\nB\n3\n4\n5\n6\n7\n8\nI\n10\n11\n12\n";
+    d = diff_of(c, e, 100);
+    ASSERT("Nearby changes share a hunk", d && strstr(d, "@@ -1,12 +1,12 @@") &&
+                                              !strstr(strstr(d, "@@") + 2, "@@ "));
+    free(d);
+}
+
+TEST(test_diff_insert_and_delete_ends) {
+    const char *a = "a\nb\nc\n";
+    char *d = diff_of(a, "new\na\nb\nc\n", 100);
+    ASSERT("Insertion at the start", d && strstr(d, "@@ -0,0 +1 @@\n+new\n") == NULL &&
+                                         strstr(d, "@@ -1,3 +1,4 @@\n+new\n a\n"));
+    free(d);
+    d = diff_of(a, "", 100);
+    ASSERT("Everything deleted", d && strstr(d, "@@ -1,3 +0,0 @@\n-a\n-b\n-c\n"));
+    free(d);
+    d = diff_of("", "x\n", 100);
+    ASSERT("Everything inserted", d && strstr(d, "@@ -0,0 +1 @@\n+x\n"));
+    free(d);
+    ASSERT("Appended lines apply", round_trips(a, "a\nb\nc\nd\ne\n"));
+    ASSERT("Emptied text applies", round_trips(a, ""));
+}
+
+TEST(test_diff_missing_final_newline) {
+    char *d = diff_of("a\nb", "a\nb\n", 100);
+    ASSERT("Missing newline is marked",
+           d && strstr(d, "-b\n\\ No newline at end of file\n+b\n"));
+    free(d);
+    ASSERT("Newline added applies", round_trips("a\nb", "a\nb\n"));
+    ASSERT("Newline removed applies", round_trips("a\nb\n", "a\nc"));
+}
+
+TEST(test_diff_same_and_rewrites) {
+    ASSERT("Same text has no diff", diff_of("a\nb\n", "a\nb\n", 100) == NULL);
+    ASSERT("Two edits exceed a limit of one", diff_of("a\nb\n", "a\nc\n", 1) == NULL);
+    char *d = diff_of("a\nb\n", "a\nc\n", 2);
+    ASSERT("Two edits fit a limit of two", d != NULL);
+    free(d);
+}
+
+TEST(test_diff_random_edits_apply) {
+    unsigned seed = 7;
+    bool all = true;
+    for (int round = 0; round < 200 && all; round++) {
+        char a[8192] = "", b[8192] = "";
+        int lines = 1 + round % 60;
+        for (int i = 0; i < lines; i++) {
+            seed = seed * 1103515245u + 12345u;
+            int v = (int)((seed >> 16) % 8);
+            sprintf(a + strlen(a), "v%d\n", v);
+            seed = seed * 1103515245u + 12345u;
+            switch ((seed >> 16) % 4) {
+            case 0:
+                break; /* Deleted */
+            case 1:
+                sprintf(b + strlen(b), "v%d\nins%d\n", v, i);
+                break;
+            case 2:
+                sprintf(b + strlen(b), "v%d\n", (v + 1) % 8);
+                break;
+            default:
+                sprintf(b + strlen(b), "v%d\n", v);
+            }
+        }
+        if (round % 3 == 0 && strlen(b) > 0) {
+            b[strlen(b) - 1] = '\0';
+        }
+        if (strcmp(a, b) != 0) {
+            all = round_trips(a, b);
+        }
+    }
+    ASSERT("Every random diff applies", all);
+}
+
+int main(void) {
+    printf("Running line diff tests\n");
+    printf("=======================\n");
+
+    RUN_TEST(test_diff_one_changed_line);
+    RUN_TEST(test_diff_separate_hunks);
+    RUN_TEST(test_diff_insert_and_delete_ends);
+    RUN_TEST(test_diff_missing_final_newline);
+    RUN_TEST(test_diff_same_and_rewrites);
+    RUN_TEST(test_diff_random_edits_apply);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
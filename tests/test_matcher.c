@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../arena.h"
+#include "../matcher.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the multi-needle word matcher
+ */
+
+/* Whitespace-separated word count, the way strtok(" \t\n\r") counts */
+static size_t naive_word_count(const char *buf, size_t len) {
+    size_t words = 0;
+    int in_word = 0;
+    for (size_t i = 0; i < len; i++) {
+        int space = buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\n' || buf[i] == '\r';
+        if (!space && !in_word) {
+            words++;
+        }
+        in_word = !space;
+    }
+    return words;
+}
+
+/* Check the sweep against the per-needle reference for every needle */
+static int scan_matches_reference(const char *const *needles, int count, const char *buf,
+                                  size_t len) {
+    Arena a = arena_create(MiB(1));
+    WordMatcher m;
+    word_matcher_init(&m, &a, needles, count);
+    int hits[16] = {0};
+    size_t words = word_matcher_scan(&m, buf, len, hits);
+
+    int ok = words == naive_word_count(buf, len);
+    for (int i = 0; i < count; i++) {
+        ok = ok && hits[i] == count_word_hits_n(buf, len, m.needles[i], m.lens[i]);
+    }
+    arena_destroy(&a);
+    return ok;
+}
+
+TEST(test_matcher_whole_words) {
+    Arena a = arena_create(MiB(1));
+    const char *needles[] = {"auth", "session"};
+    WordMatcher m;
+    word_matcher_init(&m, &a, needles, 2);
+
+    const char *text = "Auth authorize AUTH_x auth; session(SESSION) reauth auth";
+    int hits[2] = {0};
+    size_t words = word_matcher_scan(&m, text, strlen(text), hits);
+    ASSERT_EQUALS(3, hits[0]);
+    ASSERT_EQUALS(2, hits[1]);
+    ASSERT_EQUALS(7, (int)words);
+
+    arena_destroy(&a);
+}
+
+TEST(test_matcher_punctuated_needle) {
+    Arena a = arena_create(MiB(1));
+    const char *needles[] = {"foo-bar", "foo"};
+    WordMatcher m;
+    word_matcher_init(&m, &a, needles, 2);
+    ASSERT("Punctuated needles are not word needles", !m.is_word[0]);
+
+    const char *text = "foo-bar FOO-BAR xfoo-bar foo-barx foo";
+    int hits[2] = {0};
+    word_matcher_scan(&m, text, strlen(text), hits);
+    ASSERT_EQUALS(2, hits[0]);
+    ASSERT_EQUALS(4, hits[1]);
+
+    arena_destroy(&a);
+}
+
+TEST(test_matcher_block_boundaries) {
+    /* Words straddling every position of the 64-byte blocks, and the tail */
+    const char *needles[] = {"needle", "x", "ab_9"};
+    char buf[300];
+    for (int shift = 0; shift < 70; shift++) {
+        size_t len = 0;
+        for (int i = 0; i < shift; i++) {
+            buf[len++] = (i % 7 == 0) ? ' ' : '-';
+        }
+        while (len + 12 < sizeof(buf)) {
+            memcpy(buf + len, "needle AB_9\tx", 13);
+            len += 12 - (len % 3); /* Overlap to vary the alignment */
+        }
+        if (!scan_matches_reference(needles, 3, buf, len)) {
+            printf("  Mismatch at shift %d\n", shift);
+            ASSERT("Sweep should agree with the reference", 0);
+        }
+    }
+}
+
+TEST(test_matcher_random_text) {
+    const char *needles[] = {"ab", "ba", "a", "abc", "b-a", "_"};
+    const char alphabet[] = "abcAB_ -\n\t\x80\xff.";
+    char buf[2048];
+    srand(7);
+    for (int round = 0; round < 200; round++) {
+        size_t len = (size_t)(rand() % (int)sizeof(buf));
+        for (size_t i = 0; i < len; i++) {
+            buf[i] = alphabet[rand() % (int)(sizeof(alphabet) - 1)];
+        }
+        if (!scan_matches_reference(needles, 6, buf, len)) {
+            printf("  Mismatch in round %d\n", round);
+            ASSERT("Sweep should agree with the reference", 0);
+        }
+    }
+}
+
+TEST(test_matcher_no_needles) {
+    Arena a = arena_create(MiB(1));
+    WordMatcher m;
+    word_matcher_init(&m, &a, NULL, 0);
+    const char *text = "one two  three\n";
+    ASSERT_EQUALS(3, (int)word_matcher_scan(&m, text, strlen(text), NULL));
+    ASSERT_EQUALS(0, (int)word_matcher_scan(&m, "", 0, NULL));
+    arena_destroy(&a);
+}
+
+int main(void) {
+    printf("Running matcher tests\n");
+    printf("=====================\n");
+
+    RUN_TEST(test_matcher_whole_words);
+    RUN_TEST(test_matcher_punctuated_needle);
+    RUN_TEST(test_matcher_block_boundaries);
+    RUN_TEST(test_matcher_random_text);
+    RUN_TEST(test_matcher_no_needles);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../output.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the gathered (iovec) output buffer
+ */
+
+#define OUTPUT_FILE TEST_DIR "/output_body.txt"
+
+static void write_text(const char *path, const char *text) {
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fputs(text, f);
+        fclose(f);
+    }
+}
+
+TEST(test_outvec_printf_coalesces) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+
+    outvec_printf(&out, "File: %s\n", "a.c");
+    outvec_printf(&out, "```\n");
+    ASSERT_EQUALS(1, out.count);
+    ASSERT_EQUALS(14, (int)outvec_size(&out));
+
+    char *flat = outvec_flatten(&out, &a);
+    ASSERT_STR_EQUALS("File: a.c\n```\n", flat);
+
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_outvec_ref_and_gather) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+
+    static const char body[] = "int x;\n";
+    outvec_printf(&out, "head\n");
+    outvec_ref(&out, body, strlen(body));
+    outvec_printf(&out, "tail\n");
+    ASSERT_EQUALS(3, out.count);
+    ASSERT("Referenced segment points at the source", out.iov[1].iov_base == body);
+
+    ASSERT("Byte lookup across segments", outvec_byte_at(&out, 5) == 'i');
+    ASSERT("Byte lookup in last segment", outvec_byte_at(&out, 12) == 't');
+
+    char buf[16] = {0};
+    outvec_gather(&out, 3, 6, buf);
+    ASSERT_STR_EQUALS("d\nint ", buf);
+
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_outvec_append_range) {
+    Arena a = arena_create(MiB(1));
+    OutputVec src, dst;
+    outvec_init(&src, &a);
+    outvec_init(&dst, &a);
+
+    static const char one[] = "11111\n";
+    static const char two[] = "22222\n";
+    outvec_printf(&src, "<a>\n");
+    outvec_ref(&src, one, 6);
+    outvec_ref(&src, two, 6);
+    outvec_printf(&src, "</a>\n");
+
+    /* Skip the first file; keep the framing on either side */
+    outvec_append_range(&dst, &src, 0, 4);
+    outvec_append_range(&dst, &src, 10, outvec_size(&src) - 10);
+    ASSERT_STR_EQUALS("<a>\n22222\n</a>\n", outvec_flatten(&dst, &a));
+
+    outvec_free(&dst);
+    outvec_free(&src);
+    arena_destroy(&a);
+}
+
+TEST(test_outvec_map_and_write_fd) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+
+    write_text(OUTPUT_FILE, "mapped body\n");
+    const char *data;
+    size_t len;
+    ASSERT("Regular file maps", outvec_map_file(&out, OUTPUT_FILE, &data, &len));
+    ASSERT_EQUALS(12, (int)len);
+    outvec_printf(&out, "```\n");
+    outvec_ref(&out, data, len);
+    outvec_printf(&out, "```\n");
+
+    ASSERT("Directories do not map", !outvec_map_file(&out, TEST_DIR, &data, &len));
+    ASSERT("Missing files do not map",
+           !outvec_map_file(&out, TEST_DIR "/missing.txt", &data, &len));
+
+    write_text(TEST_DIR "/output_empty.txt", "");
+    ASSERT("Empty files map", outvec_map_file(&out, TEST_DIR "/output_empty.txt", &data, &len));
+    ASSERT_EQUALS(0, (int)len);
+
+    FILE *f = tmpfile();
+    ASSERT("tmpfile should open", f != NULL);
+    ASSERT("writev should succeed", outvec_write_fd(&out, fileno(f)) == 0);
+    rewind(f);
+    char buf[64] = {0};
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    ASSERT_EQUALS(20, (int)n);
+    ASSERT_STR_EQUALS("```\nmapped body\n```\n", buf);
+
+    outvec_free(&out);
+    ASSERT_EQUALS(0, out.count);
+    unlink(OUTPUT_FILE);
+    unlink(TEST_DIR "/output_empty.txt");
+    arena_destroy(&a);
+}
+
+/* Map a file of size bytes, truncate it to nothing, then read its last byte as tokenizing would */
+static char map_truncate_touch(size_t size) {
+    char *body = malloc(size);
+    memset(body, 'x', size);
+    FILE *f = fopen(OUTPUT_FILE, "w");
+    fwrite(body, 1, size, f);
+    fclose(f);
+    free(body);
+
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    const char *data;
+    size_t len;
+    char last = '\0';
+    if (outvec_map_file(&out, OUTPUT_FILE, &data, &len) && truncate(OUTPUT_FILE, 0) == 0) {
+        last = ((const volatile char *)data)[len - 1];
+    }
+    outvec_free(&out);
+    arena_destroy(&a);
+    return last;
+}
+
+TEST(test_outvec_truncated_source) {
+    ASSERT("A small file is read, so truncating it changes nothing",
+           map_truncate_touch(4096) == 'x');
+
+    /* A large file stays mapped; in a child, its truncation must end in an error, not a crash */
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        if (!freopen("/dev/null", "w", stderr)) {
+            _exit(2);
+        }
+        map_truncate_touch(4 * 1024 * 1024);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    ASSERT("Truncated mapping exits with an error instead of SIGBUS",
+           WIFEXITED(status) && WEXITSTATUS(status) == 1);
+    unlink(OUTPUT_FILE);
+}
+
+TEST(test_outvec_many_segments) {
+    Arena a = arena_create(MiB(4));
+    OutputVec out;
+    outvec_init(&out, &a);
+
+    /* More segments than one writev() batch accepts */
+    static const char piece[] = "0123456789";
+    for (int i = 0; i < 3000; i++) {
+        outvec_ref(&out, piece + (i % 2), 5);
+        outvec_printf(&out, "|");
+    }
+    ASSERT_EQUALS(6000, out.count);
+
+    FILE *f = tmpfile();
+    ASSERT("tmpfile should open", f != NULL);
+    ASSERT("writev should succeed", outvec_write_fd(&out, fileno(f)) == 0);
+    long written = ftell(f);
+    if (written == 0) {
+        fseek(f, 0, SEEK_END);
+        written = ftell(f);
+    }
+    fclose(f);
+    ASSERT_EQUALS(18000, (int)written);
+
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+TEST(test_outvec_write_range_fd) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    outvec_ref(&out, "alpha ", 6);
+    outvec_ref(&out, "beta ", 5);
+    outvec_ref(&out, "gamma", 5);
+
+    /* Ranges that start and end inside segments, written back to back */
+    FILE *f = tmpfile();
+    ASSERT("tmpfile should open", f != NULL);
+    ASSERT("First range", outvec_write_range_fd(&out, 2, 7, fileno(f)) == 0);
+    ASSERT("Empty range", outvec_write_range_fd(&out, 9, 0, fileno(f)) == 0);
+    ASSERT("Last range", outvec_write_range_fd(&out, 12, 4, fileno(f)) == 0);
+    rewind(f);
+    char buf[32] = {0};
+    fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    ASSERT_STR_EQUALS("pha betamma", buf);
+
+    outvec_free(&out);
+    arena_destroy(&a);
+}
+
+int main(void) {
+    printf("Running output tests\n");
+    printf("====================\n");
+
+    system("mkdir -p " TEST_DIR);
+
+    RUN_TEST(test_outvec_printf_coalesces);
+    RUN_TEST(test_outvec_ref_and_gather);
+    RUN_TEST(test_outvec_append_range);
+    RUN_TEST(test_outvec_map_and_write_fd);
+    RUN_TEST(test_outvec_truncated_source);
+    RUN_TEST(test_outvec_many_segments);
+    RUN_TEST(test_outvec_write_range_fd);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../arena.h"
+#include "../packer.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the token budget packer
+ */
+
+/* Exact counts for the fake tokenizer: one token per `per_token[i]` bytes */
+typedef struct
+{
+    const double *per_token;
+    int calls;
+} FakeCounter;
+
+static bool fake_count(PackItem *items, const int *idx, int n, void *user) {
+    FakeCounter *fc = user;
+    fc->calls++;
+    for (int k = 0; k < n; k++) {
+        PackItem *it = &items[idx[k]];
+        it->tokens = (size_t)((double)it->bytes / fc->per_token[idx[k]]);
+        it->counted = true;
+    }
+    return true;
+}
+
+static void set_item(PackItem *it, double score, size_t bytes) {
+    memset(it, 0, sizeof(*it));
+    it->score = score;
+    it->bytes = bytes;
+}
+
+TEST(test_packer_fills_after_misfit) {
+    Arena a = arena_create(MiB(1));
+    const double per_token[] = {3.0, 3.0, 3.0};
+    FakeCounter fc = {per_token, 0};
+    PackItem items[3];
+    set_item(&items[0], 10.0, 240); /* 80 tokens */
+    set_item(&items[1], 9.0, 150);  /* 50 tokens, densest */
+    set_item(&items[2], 1.0, 45);   /* 15 tokens */
+
+    TokenRatio ratio;
+    token_ratio_init(&ratio, "gpt-4o");
+    PackResult r;
+    ASSERT("Packing succeeds", pack_budget(items, 3, 100, &ratio, &a, fake_count, &fc, &r));
+    ASSERT("Densest file is taken", items[1].selected);
+    ASSERT("File that no longer fits is left out", !items[0].selected);
+    ASSERT("Smaller file after the misfit still fills the rest", items[2].selected);
+    ASSERT_EQUALS(2, r.selected);
+    ASSERT_EQUALS(65, (int)r.tokens);
+
+    arena_destroy(&a);
+}
+
+TEST(test_packer_skips_hopeless_unread) {
+    Arena a = arena_create(MiB(1));
+    const double per_token[] = {3.0, 3.0};
+    FakeCounter fc = {per_token, 0};
+    PackItem items[2];
+    set_item(&items[0], 50.0, 300000);
+    set_item(&items[1], 1.0, 30);
+
+    TokenRatio ratio;
+    token_ratio_init(&ratio, "gpt-4o");
+    PackResult r;
+    pack_budget(items, 2, 100, &ratio, &a, fake_count, &fc, &r);
+    ASSERT("Huge file is never counted", !items[0].counted);
+    ASSERT("Huge file is left out", !items[0].selected);
+    ASSERT("Small file is taken", items[1].selected);
+    ASSERT_EQUALS(1, r.skipped_unread);
+    ASSERT_EQUALS(1, r.counted);
+    ASSERT("Estimates exceed the budget when something is left out",
+           items[0].estimate + items[1].estimate > 100);
+
+    arena_destroy(&a);
+}
+
+TEST(test_packer_all_fit_one_batch) {
+    Arena a = arena_create(MiB(1));
+    double per_token[10];
+    PackItem items[10];
+    for (int i = 0; i < 10; i++) {
+        per_token[i] = 2.0 + i * 0.2;
+        set_item(&items[i], 10.0 - i, 300 + 10 * i);
+    }
+    FakeCounter fc = {per_token, 0};
+
+    TokenRatio ratio;
+    token_ratio_init(&ratio, "gpt-4o");
+    PackResult r;
+    pack_budget(items, 10, 100000, &ratio, &a, fake_count, &fc, &r);
+    ASSERT_EQUALS(10, r.selected);
+    ASSERT_EQUALS(1, r.batches);
+    ASSERT_EQUALS(1, fc.calls);
+
+    arena_destroy(&a);
+}
+
+TEST(test_packer_random_invariants) {
+    Arena a = arena_create(MiB(4));
+    enum { N = 200 };
+    static double per_token[N];
+    static PackItem items[N];
+    srand(11);
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < N; i++) {
+            per_token[i] = 1.5 + (rand() % 300) / 100.0;
+            set_item(&items[i], (rand() % 100) - 10, (size_t)(rand() % 20000));
+            if (rand() % 8 == 0) {
+                /* Cached count */
+                items[i].tokens = (size_t)((double)items[i].bytes / per_token[i]);
+                items[i].counted = true;
+            }
+        }
+        FakeCounter fc = {per_token, 0};
+        size_t budget = (size_t)(rand() % 200000);
+        TokenRatio ratio;
+        token_ratio_init(&ratio, "gpt-4o");
+        PackResult r;
+        pack_budget(items, N, budget, &ratio, &a, fake_count, &fc, &r);
+
+        size_t used = 0;
+        size_t estimates = 0;
+        int selected = 0;
+        for (int i = 0; i < N; i++) {
+            estimates += items[i].estimate;
+            if (items[i].selected) {
+                used += items[i].tokens;
+                selected++;
+            }
+        }
+        int ok = used <= budget && used == r.tokens && selected == r.selected;
+        ok = ok && (selected == N || estimates > budget);
+        for (int i = 0; i < N; i++) {
+            /* Greedy is maximal: no counted file left out fits the room left */
+            if (!items[i].selected && items[i].counted && items[i].tokens <= budget - used) {
+                ok = 0;
+            }
+        }
+        if (!ok) {
+            printf("  Invariant broken in round %d\n", round);
+            ASSERT("Packing should respect the budget and stay greedy", 0);
+        }
+    }
+    arena_destroy(&a);
+}
+
+TEST(test_token_ratio_calibrates) {
+    TokenRatio ratio;
+    token_ratio_init(&ratio, "gpt-4o");
+    double prior = token_ratio_bytes_per_token(&ratio);
+    ASSERT("Prior is a sane ratio", prior > 1.0 && prior < 8.0);
+    ASSERT_EQUALS(1000, (int)token_ratio_estimate(&ratio, (size_t)(1000 * prior)));
+
+    token_ratio_observe(&ratio, 1000000, 200000);
+    double calibrated = token_ratio_bytes_per_token(&ratio);
+    ASSERT("Exact counts outweigh the prior", calibrated > 4.9 && calibrated < 5.0);
+    ASSERT("Floor is below the estimate",
+           token_ratio_floor(&ratio, 10000) < token_ratio_estimate(&ratio, 10000));
+}
+
+int main(void) {
+    printf("Running packer tests\n");
+    printf("====================\n");
+
+    RUN_TEST(test_packer_fills_after_misfit);
+    RUN_TEST(test_packer_skips_hopeless_unread);
+    RUN_TEST(test_packer_all_fit_one_batch);
+    RUN_TEST(test_packer_random_invariants);
+    RUN_TEST(test_token_ratio_calibrates);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../arena.h"
+#include "../pathset.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the interned path set
+ */
+
+TEST(test_pathset_insert_contains) {
+    Arena a = arena_create(MiB(1));
+    PathSet set;
+    path_set_init(&set, &a);
+
+    ASSERT("Empty set has nothing", !path_set_contains(&set, "src/a.c", 0, 0));
+
+    const char *first = NULL;
+    ASSERT("New key is added", path_set_insert(&set, "src/a.c", 0, 0, &first));
+    ASSERT("Path is interned as a copy", first && strcmp(first, "src/a.c") == 0);
+    ASSERT("Key is found", path_set_contains(&set, "src/a.c", 0, 0));
+
+    const char *again = NULL;
+    ASSERT("Duplicate is rejected", !path_set_insert(&set, "src/a.c", 0, 0, &again));
+    ASSERT("Duplicate returns the same copy", again == first);
+    ASSERT_EQUALS(1, (int)set.count);
+
+    arena_destroy(&a);
+}
+
+TEST(test_pathset_line_ranges) {
+    Arena a = arena_create(MiB(1));
+    PathSet set;
+    path_set_init(&set, &a);
+
+    ASSERT("Whole file", path_set_insert(&set, "a.c", 0, 0, NULL));
+    ASSERT("Range is a distinct key", path_set_insert(&set, "a.c", 10, 20, NULL));
+    ASSERT("Open range is a distinct key", path_set_insert(&set, "a.c", 10, 0, NULL));
+    ASSERT("Same range is a duplicate", !path_set_insert(&set, "a.c", 10, 20, NULL));
+    ASSERT("Other range is absent", !path_set_contains(&set, "a.c", 20, 10));
+    ASSERT_EQUALS(3, (int)set.count);
+
+    arena_destroy(&a);
+}
+
+TEST(test_pathset_growth) {
+    Arena a = arena_create(MiB(64));
+    PathSet set;
+    path_set_init(&set, &a);
+
+    /* Far beyond the old fixed 4096-file limit */
+    char path[64];
+    int added = 0;
+    for (int i = 0; i < 50000; i++) {
+        snprintf(path, sizeof(path), "dir%d/file%d.c", i % 97, i);
+        added += path_set_insert(&set, path, 0, 0, NULL);
+    }
+    ASSERT_EQUALS(50000, added);
+    ASSERT_EQUALS(50000, (int)set.count);
+
+    int all_found = 1;
+    for (int i = 0; i < 50000; i++) {
+        snprintf(path, sizeof(path), "dir%d/file%d.c", i % 97, i);
+        all_found = all_found && path_set_contains(&set, path, 0, 0);
+    }
+    ASSERT("Every key survives growth", all_found);
+    ASSERT("Unknown key is absent", !path_set_contains(&set, "dir0/file50000.c", 0, 0));
+
+    arena_destroy(&a);
+}
+
+int main(void) {
+    printf("Running path set tests\n");
+    printf("======================\n");
+
+    RUN_TEST(test_pathset_insert_contains);
+    RUN_TEST(test_pathset_line_ranges);
+    RUN_TEST(test_pathset_growth);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
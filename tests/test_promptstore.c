@@ -0,0 +1,369 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../output.h"
+#include "../promptstore.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the content-addressed prompt store and `llm_ctx get`
+ */
+
+#define STORE_DIR TEST_DIR "/promptstore"
+
+static char g_exe[PATH_MAX];
+static char g_xdg[PATH_MAX];
+
+/* A few hundred KiB of source-like text that differs line by line */
+static char *make_body(size_t lines, unsigned seed) {
+    char *body = malloc(lines * 64 + 1);
+    size_t used = 0;
+    for (size_t i = 0; i < lines; i++) {
+        seed = seed * 1103515245u + 12345u;
+        used += (size_t)sprintf(body + used, "    int value_%zu = compute(%u, input[%zu]);\n", i,
+                                (seed >> 16) % 1000, i % 17);
+    }
+    return body;
+}
+
+static bool save(const char *dir, const char *uuid, const OutputVec *content) {
+    PromptMeta meta = {uuid, "llm_ctx -f test.c", time(NULL), 1234, 1, NULL, 0};
+    return prompt_store_save(dir, &meta, content);
+}
+
+/* Save header + body (referenced, not copied) and check it loads back */
+static bool round_trip(const char *dir, const char *uuid, const char *header, const char *body) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    outvec_printf(&out, "%s", header);
+    outvec_ref(&out, body, strlen(body));
+    outvec_write(&out, "\n</end>\n", 8);
+    char *expected = outvec_flatten(&out, &a);
+    bool ok = save(dir, uuid, &out);
+    size_t len = 0;
+    char *loaded = ok ? prompt_store_load(dir, uuid, &len) : NULL;
+    ok = loaded && len == strlen(expected) && strcmp(loaded, expected) == 0;
+    free(loaded);
+    outvec_free(&out);
+    arena_destroy(&a);
+    return ok;
+}
+
+static long command_number(const char *cmd) {
+    FILE *pipe = popen(cmd, "r");
+    long n = -1;
+    if (pipe) {
+        if (fscanf(pipe, "%ld", &n) != 1) {
+            n = -1;
+        }
+        pclose(pipe);
+    }
+    return n;
+}
+
+static long object_count(const char *dir) {
+    char cmd[PATH_MAX + 64];
+    snprintf(cmd, sizeof(cmd), "find '%s/objects' -type f | wc -l", dir);
+    return command_number(cmd);
+}
+
+static long object_bytes(const char *dir) {
+    char cmd[PATH_MAX + 64];
+    snprintf(cmd, sizeof(cmd), "find '%s/objects' -type f -exec cat {} + | wc -c", dir);
+    return command_number(cmd);
+}
+
+static void fresh_store(const char *dir) {
+    char cmd[PATH_MAX + 32];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && mkdir -p '%s'", dir, dir);
+    system(cmd);
+}
+
+TEST(test_store_round_trip) {
+    fresh_store(STORE_DIR "/a");
+    char *body = make_body(8000, 1);
+    ASSERT("Prompt loads back as saved",
+           round_trip(STORE_DIR "/a", "uuid-one-0000000", "head\n", body));
+    ASSERT("Empty prompt loads back", round_trip(STORE_DIR "/a", "uuid-empty-000000", "", ""));
+    ASSERT("Unknown UUID is not found",
+           prompt_store_load(STORE_DIR "/a", "uuid-missing-0000", NULL) == NULL);
+    free(body);
+}
+
+TEST(test_store_dedups_repeated_bodies) {
+    fresh_store(STORE_DIR "/b");
+    char *body = make_body(8000, 2);
+    ASSERT("First prompt saved", round_trip(STORE_DIR "/b", "uuid-first-00000", "<a>\n", body));
+    long first = object_count(STORE_DIR "/b");
+    ASSERT("Body is cut into many chunks", first > 10);
+    ASSERT("Same body under a different header",
+           round_trip(STORE_DIR "/b", "uuid-second-0000", "<instructions>\nx\n</>\n", body));
+    long second = object_count(STORE_DIR "/b");
+    ASSERT("Only the chunks around the change are new", second - first <= 3);
+    free(body);
+}
+
+TEST(test_store_compression) {
+    fresh_store(STORE_DIR "/c");
+    fresh_store(STORE_DIR "/d");
+    char *body = make_body(8000, 3);
+    ASSERT("Saved compressed", round_trip(STORE_DIR "/c", "uuid-zstd-000000", "", body));
+    setenv("LLM_CTX_NO_ZSTD", "1", 1);
+    ASSERT_EQUALS(0, strcmp(prompt_store_codec(), "none"));
+    ASSERT("Saved uncompressed", round_trip(STORE_DIR "/d", "uuid-raw-0000000", "", body));
+    unsetenv("LLM_CTX_NO_ZSTD");
+    long raw = object_bytes(STORE_DIR "/d");
+    ASSERT("Uncompressed chunks hold the whole body", raw >= (long)strlen(body));
+    if (strcmp(prompt_store_codec(), "zstd") == 0) {
+        ASSERT("zstd shrinks the chunks", object_bytes(STORE_DIR "/c") < raw / 2);
+    } else {
+        printf("(libzstd not found; compression not checked) ");
+    }
+    free(body);
+}
+
+TEST(test_store_detects_damage) {
+    fresh_store(STORE_DIR "/e");
+    char *body = make_body(2000, 4);
+    ASSERT("Prompt saved", round_trip(STORE_DIR "/e", "uuid-damaged-000", "", body));
+    /* Flip the last byte of one chunk */
+    system("f=$(find " STORE_DIR "/e/objects -type f | head -1); "
+           "printf 'X' | dd of=\"$f\" bs=1 seek=$(($(wc -c < \"$f\") - 1)) conv=notrunc "
+           "2>/dev/null");
+    ASSERT("Damaged prompt is not returned",
+           prompt_store_load(STORE_DIR "/e", "uuid-damaged-000", NULL) == NULL);
+    free(body);
+}
+
+TEST(test_store_recovers_from_torn_index) {
+    fresh_store(STORE_DIR "/f");
+    char *body = make_body(500, 5);
+    ASSERT("First prompt saved", round_trip(STORE_DIR "/f", "uuid-before-0000", "", body));
+    /* An append cut short by a crash */
+    system("printf 'PPI1\\377\\377' >> " STORE_DIR "/f/index");
+    ASSERT("Earlier prompt still loads",
+           prompt_store_load(STORE_DIR "/f", "uuid-before-0000", NULL) != NULL);
+    ASSERT("Next prompt saved", round_trip(STORE_DIR "/f", "uuid-after-00000", "x", body));
+    ASSERT("Earlier prompt loads after the torn tail is dropped",
+           prompt_store_load(STORE_DIR "/f", "uuid-before-0000", NULL) != NULL);
+    free(body);
+}
+
+/* Save a prompt with a file table of one file whose content is stored, one carried over */
+static bool save_with_files(const char *dir, const char *uuid, const char *body,
+                            const PromptFile *carried) {
+    Arena a = arena_create(MiB(1));
+    OutputVec out;
+    outvec_init(&out, &a);
+    outvec_ref(&out, body, strlen(body));
+    PromptFile files[2] = {{"src/a.c", 0, 0, {1, 2, 3, 4, 5}, {0, 0}, strlen(body), body, NULL, 0},
+                           {"src/b.c", 10, 20, {0, 0, 0, 0, 0}, {0, 0}, 0, NULL, NULL, 0}};
+    if (carried) {
+        files[1] = *carried;
+    }
+    PromptMeta meta = {uuid, "llm_ctx", time(NULL), 1, 2, files, carried ? 2 : 1};
+    bool ok = prompt_store_save(dir, &meta, &out);
+    outvec_free(&out);
+    arena_destroy(&a);
+    return ok;
+}
+
+TEST(test_store_file_table) {
+    fresh_store(STORE_DIR "/g");
+    char *body = make_body(3000, 6);
+    char *other = make_body(200, 7);
+    ASSERT("Prompt with a file saved", save_with_files(STORE_DIR "/g", "uuid-table-00000", other,
+                                                       NULL));
+    PromptFileTable first;
+    ASSERT("Table is read", prompt_store_files(STORE_DIR "/g", "uuid-table-00000", &first));
+    ASSERT("Table is recorded", first.recorded && first.count == 1);
+    ASSERT("Entry is kept", strcmp(first.files[0].path, "src/a.c") == 0 &&
+                                first.files[0].sig.ino == 2 && first.files[0].sig.ctime_ns == 5 &&
+                                first.files[0].len == strlen(other));
+    ASSERT("Content hash is recorded",
+           first.files[0].hash.hi == prompt_store_hash(other, strlen(other)).hi &&
+               first.files[0].hash.lo == prompt_store_hash(other, strlen(other)).lo);
+
+    /* The next prompt stores a new a.c and carries the first one over as b.c */
+    PromptFile carried = first.files[0];
+    carried.path = "src/b.c";
+    carried.start_line = 10;
+    carried.end_line = 20;
+    ASSERT("Next prompt saved",
+           save_with_files(STORE_DIR "/g", "uuid-table-00001", body, &carried));
+    prompt_store_files_free(&first);
+
+    PromptFileTable next;
+    ASSERT("Next table is read", prompt_store_files(STORE_DIR "/g", "uuid-table-00001", &next));
+    ASSERT("Both entries are kept", next.recorded && next.count == 2);
+    char *a = prompt_store_file_content(STORE_DIR "/g", &next.files[0]);
+    char *b = prompt_store_file_content(STORE_DIR "/g", &next.files[1]);
+    ASSERT("Stored content loads back", a && strcmp(a, body) == 0);
+    ASSERT("Carried-over content loads back", b && strcmp(b, other) == 0);
+    ASSERT("Range is kept", next.files[1].start_line == 10 && next.files[1].end_line == 20);
+    free(a);
+    free(b);
+    prompt_store_files_free(&next);
+
+    PromptFileTable none;
+    ASSERT("Unknown UUID has no table",
+           !prompt_store_files(STORE_DIR "/g", "uuid-missing-0000", &none));
+    ASSERT("Prompt without files has an empty table",
+           round_trip(STORE_DIR "/g", "uuid-no-files-000", "", "x\n") &&
+               prompt_store_files(STORE_DIR "/g", "uuid-no-files-000", &none) &&
+               none.recorded && none.count == 0);
+    prompt_store_files_free(&none);
+    free(body);
+    free(other);
+}
+
+TEST(test_store_last) {
+    fresh_store(STORE_DIR "/h");
+    char uuid[64];
+    ASSERT("Empty store has no last prompt",
+           !prompt_store_last(STORE_DIR "/h", uuid, sizeof(uuid)));
+    ASSERT("First saved", round_trip(STORE_DIR "/h", "uuid-last-000000", "", "one\n"));
+    ASSERT("Second saved", round_trip(STORE_DIR "/h", "uuid-last-000001", "", "two\n"));
+    ASSERT("Last prompt is the second",
+           prompt_store_last(STORE_DIR "/h", uuid, sizeof(uuid)) &&
+               strcmp(uuid, "uuid-last-000001") == 0);
+}
+
+/* Run llm_ctx with its config directory at STORE_DIR/xdg */
+static char *run_llm_ctx(const char *args) {
+    static char out[1 << 16];
+    char cmd[PATH_MAX * 3];
+    snprintf(cmd, sizeof(cmd),
+             "cd " STORE_DIR " && XDG_CONFIG_HOME='%s' "
+             "LLM_CTX_NO_CONFIG=1 '%s' %s 2>&1 </dev/null",
+             g_xdg, g_exe, args);
+    out[0] = '\0';
+    FILE *pipe = popen(cmd, "r");
+    if (pipe) {
+        size_t total = fread(out, 1, sizeof(out) - 1, pipe);
+        out[total] = '\0';
+        pclose(pipe);
+    }
+    return out;
+}
+
+TEST(test_cli_get_reads_store) {
+    system("rm -rf " STORE_DIR "/xdg && mkdir -p " STORE_DIR "/xdg");
+    FILE *f = fopen(STORE_DIR "/saved.c", "w");
+    if (f) {
+        fprintf(f, "int saved_function(void) { return 42; }\n");
+        fclose(f);
+    }
+    char *out = run_llm_ctx("-o -c 'Store this' -f saved.c");
+    char uuid[64] = "";
+    char *at = strstr(out, "llm_ctx get ");
+    if (at) {
+        sscanf(at + strlen("llm_ctx get "), "%63s", uuid);
+    }
+    ASSERT("A UUID is reported", uuid[0] != '\0');
+
+    char args[128];
+    snprintf(args, sizeof(args), "get %s --read", uuid);
+    out = run_llm_ctx(args);
+    ASSERT("File list is kept", strstr(out, "<file_list>\nsaved.c\n</file_list>") != NULL);
+    ASSERT("Content is returned", strstr(out, "return 42;") != NULL);
+    ASSERT("Instructions are returned", strstr(out, "Store this") != NULL);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), STORE_DIR "/xdg/llm_ctx/prompts/%s", uuid);
+    ASSERT("No plain copy is written", access(path, F_OK) != 0);
+    ASSERT("Index is written", access(STORE_DIR "/xdg/llm_ctx/prompts/index", F_OK) == 0);
+}
+
+TEST(test_cli_get_reads_legacy_prompt) {
+    system("mkdir -p " STORE_DIR "/xdg/llm_ctx/prompts");
+    FILE *f = fopen(STORE_DIR "/xdg/llm_ctx/prompts/20200101-000000-legacy", "w");
+    if (f) {
+        fprintf(f, "# llm_ctx saved prompt\n# UUID: 20200101-000000-legacy\n#\n");
+        fprintf(f, "<file_list>\nold.c\n</file_list>\n\nold content\n");
+        fclose(f);
+    }
+    char *out = run_llm_ctx("get 20200101-000000-legacy --read");
+    ASSERT("Legacy prompt is returned", strstr(out, "old content") != NULL);
+    ASSERT("Comment header is skipped", strstr(out, "# UUID") == NULL);
+}
+
+static void write_lines(const char *path, int lines, int changed) {
+    FILE *f = fopen(path, "w");
+    if (f) {
+        for (int i = 1; i <= lines; i++) {
+            fprintf(f, i == changed ? "    int changed_line = %d;\n" : "    int line_%d = 0;\n", i);
+        }
+        fclose(f);
+    }
+}
+
+TEST(test_cli_since_sends_changes) {
+    system("rm -rf " STORE_DIR "/xdg " STORE_DIR "/since && mkdir -p " STORE_DIR "/xdg " STORE_DIR
+           "/since");
+    write_lines(STORE_DIR "/since/big.c", 400, 0);
+    write_lines(STORE_DIR "/since/same.c", 50, 0);
+    char *out = run_llm_ctx("-o -f since/big.c since/same.c");
+    ASSERT("First prompt is sent whole", strstr(out, "line_399") != NULL);
+
+    write_lines(STORE_DIR "/since/big.c", 400, 200);
+    out = run_llm_ctx("-o --since last -f since/big.c since/same.c");
+    ASSERT("Unchanged file is listed",
+           strstr(out, "<unchanged_files since=\"") && strstr(out, "\nsince/same.c\n"));
+    ASSERT("Unchanged file is not repeated", strstr(out, "File: since/same.c") == NULL);
+    ASSERT("Changed file is sent as a diff", strstr(out, "File: since/big.c (diff since "));
+    ASSERT("Diff holds the change",
+           strstr(out, "-    int line_200 = 0;\n+    int changed_line = 200;\n"));
+    ASSERT("Diff leaves out the rest", strstr(out, "line_399") == NULL);
+
+    out = run_llm_ctx("-o --since=nope -f since/big.c");
+    ASSERT("Invalid value is rejected", strstr(out, "Error: Invalid --since value: nope"));
+    out = run_llm_ctx("-o --since=20200101-000000-missing0 -f since/big.c");
+    ASSERT("Unknown prompt is rejected", strstr(out, "Error: --since: no saved prompt"));
+
+    FILE *f = fopen(STORE_DIR "/xdg/llm_ctx/prompts/20200101-000000-legacy", "w");
+    if (f) {
+        fprintf(f, "# llm_ctx saved prompt\n# UUID: 20200101-000000-legacy\n#\nold content\n");
+        fclose(f);
+    }
+    out = run_llm_ctx("-o --since=20200101-000000-legacy -f since/big.c");
+    ASSERT("Legacy prompt is accepted with a warning",
+           strstr(out, "Warning: Prompt 20200101-000000-legacy was saved without file signatures"));
+    ASSERT("Every file is sent whole against a legacy prompt", strstr(out, "line_399") != NULL);
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+    system("mkdir -p " STORE_DIR);
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return 1;
+    }
+    snprintf(g_exe, sizeof(g_exe), "%s/llm_ctx", cwd);
+    snprintf(g_xdg, sizeof(g_xdg), "%s/" STORE_DIR "/xdg", cwd);
+
+    printf("Running prompt store tests\n");
+    printf("==========================\n");
+
+    RUN_TEST(test_store_round_trip);
+    RUN_TEST(test_store_dedups_repeated_bodies);
+    RUN_TEST(test_store_compression);
+    RUN_TEST(test_store_detects_damage);
+    RUN_TEST(test_store_recovers_from_torn_index);
+    RUN_TEST(test_store_file_table);
+    RUN_TEST(test_store_last);
+    RUN_TEST(test_cli_get_reads_store);
+    RUN_TEST(test_cli_get_reads_legacy_prompt);
+    RUN_TEST(test_cli_since_sends_changes);
+
+    system("rm -rf " STORE_DIR);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
@@ -432,6 +432,27 @@ TEST(test_stdin_utf8_file) {
     ASSERT("Output contains UTF-8 characters from stdin", string_contains(output, "Stdin 你好 Test"));
 }
 
+/* Test --tail-tokens keeps only the end of a long stream */
+TEST(test_stdin_tail_tokens) {
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "%s/llm_ctx -o --tail-tokens=200", getenv("PWD"));
+    char *output = run_command_with_stdin("seq -f 'log line %g' 1 50000", cmd);
+
+    ASSERT("Output contains stdin_content header", string_contains(output, "File: stdin_content"));
+    ASSERT("Last line of the stream is kept", string_contains(output, "log line 50000\n"));
+    ASSERT("Start of the stream is dropped", !string_contains(output, "log line 1\n"));
+    ASSERT("Dropping is reported", string_contains(output, "dropped the first"));
+}
+
+/* Test --tail-tokens rejects a limit below 1 */
+TEST(test_stdin_tail_tokens_invalid) {
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "%s/llm_ctx -o --tail-tokens=0", getenv("PWD"));
+    char *output = run_command_with_stdin("echo hello", cmd);
+
+    ASSERT("Invalid limit is rejected", string_contains(output, "Invalid --tail-tokens value"));
+}
+
 
 int main(void) {
     printf("Running llm_ctx stdin pipe integration tests\n");
@@ -455,6 +476,8 @@ int main(void) {
     RUN_TEST(test_stdin_binary_image_magic);
     RUN_TEST(test_stdin_empty_file);
     RUN_TEST(test_stdin_utf8_file);
+    RUN_TEST(test_stdin_tail_tokens);
+    RUN_TEST(test_stdin_tail_tokens_invalid);
 
     /* Clean up */
     teardown_test_env();
@@ -0,0 +1,246 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../arena.h"
+#include "../stdinpipe.h"
+#include "../tokenizer.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for pipelined stdin reading (stdinpipe.c)
+ */
+
+#define PIPE_FILE TEST_DIR "/__stdinpipe.txt"
+
+static LLMTokenizer *g_tok;
+
+/* Log-like text with indented lines, '//' lines and blank lines between safe cuts */
+static char *make_input(size_t lines, bool final_newline, size_t *len) {
+    char *text = malloc(lines * 96 + 1);
+    size_t used = 0;
+    for (size_t i = 0; i < lines; i++) {
+        switch (i % 7) {
+        case 3:
+            used += (size_t)sprintf(text + used, "    at handler_%zu (src/app.js:%zu)\n", i,
+                                    i % 300);
+            break;
+        case 5:
+            used += (size_t)sprintf(text + used, "// checkpoint %zu\n\n", i);
+            break;
+        default:
+            used += (size_t)sprintf(text + used,
+                                    "2026-10-14 pod/web-%zu level=info request %zu ok\n", i % 13,
+                                    i * 7919);
+        }
+    }
+    if (!final_newline && used > 0) {
+        used--;
+    }
+    text[used] = '\0';
+    *len = used;
+    return text;
+}
+
+/* Read text through a pipe fed by a child process */
+static bool read_piped(const char *text, size_t len, const StdinPipeOptions *opts, Arena *arena,
+                       StdinPipeResult *out) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = write(fds[1], text + done, len - done > 4096 ? 4096 : len - done);
+            if (n <= 0) {
+                _exit(1);
+            }
+            done += (size_t)n;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    bool ok = stdin_pipe_read(fds[0], opts, arena, out);
+    close(fds[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    /* The writer must never see a closed pipe */
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static size_t count(const char *text, size_t len) {
+    return llm_tokenizer_count_n(g_tok, text, len);
+}
+
+/* The count of the data inside a fragment, derived as the caller does */
+static bool fragment_count_matches(const StdinPipeResult *r) {
+    const char *head = "File: stdin_content\n```\n";
+    const char *foot = "```\n----------------------------------------\n";
+    size_t hl = strlen(head), fl = strlen(foot);
+    char *whole = malloc(hl + r->len + fl + 1);
+    memcpy(whole, head, hl);
+    memcpy(whole + hl, r->data, r->len);
+    memcpy(whole + hl + r->len, foot, fl + 1);
+    size_t expected = count(whole, hl + r->len + fl);
+    size_t derived = count(whole, hl + r->count_from) + r->tokens +
+                     count(whole + hl + r->count_to, r->len - r->count_to + fl);
+    free(whole);
+    return expected == derived;
+}
+
+TEST(test_pipe_whole_read_is_counted) {
+    size_t len;
+    char *text = make_input(60000, false, &len);
+    Arena arena = arena_create_ex(MiB(8), ARENA_FLAG_GROW);
+    StdinPipeOptions opts = {g_tok, 2, 64 * 1024 * 1024, 0, NULL, NULL};
+    StdinPipeResult r;
+    ASSERT("Pipe is read", read_piped(text, len, &opts, &arena, &r));
+    ASSERT("Input arrives whole", r.len == len && memcmp(r.data, text, len) == 0);
+    ASSERT("Data is NUL-terminated", r.data[r.len] == '\0');
+    ASSERT("Input was counted", r.counted);
+    ASSERT("Count covers nearly all of it", r.count_from == 0 && len - r.count_to < 256);
+    ASSERT("Chunk counts sum to one count",
+           r.tokens == count(r.data + r.count_from, r.count_to - r.count_from));
+    ASSERT("Fragment count is exact", fragment_count_matches(&r));
+    arena_destroy(&arena);
+    free(text);
+}
+
+TEST(test_pipe_edges_are_left_to_the_caller) {
+    const char *text = "   starts indented\n// and a comment\nfirst cut\nmiddle\n  trailing";
+    Arena arena = arena_create_ex(MiB(1), ARENA_FLAG_GROW);
+    StdinPipeOptions opts = {g_tok, 1, 1024 * 1024, 0, NULL, NULL};
+    StdinPipeResult r;
+    ASSERT("Pipe is read", read_piped(text, strlen(text), &opts, &arena, &r));
+    ASSERT("Count starts at the first safe cut",
+           r.counted && strncmp(r.data + r.count_from, "first cut", 9) == 0);
+    ASSERT("Count ends at the last safe cut",
+           strcmp(r.data + r.count_to, "middle\n  trailing") == 0);
+    ASSERT("Fragment count is exact", fragment_count_matches(&r));
+    arena_destroy(&arena);
+}
+
+TEST(test_pipe_file_and_truncation) {
+    size_t len;
+    char *text = make_input(5000, true, &len);
+    FILE *f = fopen(PIPE_FILE, "w");
+    fwrite(text, 1, len, f);
+    fclose(f);
+
+    Arena arena = arena_create_ex(MiB(1), ARENA_FLAG_GROW);
+    StdinPipeOptions opts = {NULL, 1, len, 0, NULL, NULL};
+    StdinPipeResult r;
+    f = fopen(PIPE_FILE, "r");
+    ASSERT("File is read", stdin_pipe_read(fileno(f), &opts, &arena, &r));
+    fclose(f);
+    ASSERT("File fits exactly", r.len == len && !r.truncated && memcmp(r.data, text, len) == 0);
+    ASSERT("Nothing is counted without a tokenizer", !r.counted);
+
+    opts.max_bytes = len / 2;
+    f = fopen(PIPE_FILE, "r");
+    ASSERT("File is read", stdin_pipe_read(fileno(f), &opts, &arena, &r));
+    fclose(f);
+    ASSERT("Input past max_bytes is cut", r.len == len / 2 && r.truncated);
+    ASSERT("What is kept is the start", memcmp(r.data, text, r.len) == 0);
+    arena_destroy(&arena);
+    free(text);
+}
+
+static int g_first_block_calls;
+static size_t g_first_block_len;
+
+static bool reject_binary(const char *data, size_t len, void *user) {
+    (void)user;
+    g_first_block_calls++;
+    g_first_block_len = len;
+    return memchr(data, '\0', len) == NULL;
+}
+
+TEST(test_pipe_first_block) {
+    size_t len;
+    char *text = make_input(20000, true, &len);
+    Arena arena = arena_create_ex(MiB(1), ARENA_FLAG_GROW);
+    StdinPipeOptions opts = {g_tok, 1, 64 * 1024 * 1024, 0, reject_binary, NULL};
+    StdinPipeResult r;
+
+    g_first_block_calls = 0;
+    ASSERT("Text is read", read_piped(text, len, &opts, &arena, &r));
+    ASSERT("Classifier runs once on the first block",
+           g_first_block_calls == 1 && g_first_block_len == STDIN_PIPE_FIRST_BLOCK);
+    ASSERT("Text is kept", !r.discarded && r.len == len);
+
+    g_first_block_calls = 0;
+    ASSERT("Short text is read", read_piped("tiny\n", 5, &opts, &arena, &r));
+    ASSERT("Short input is classified whole", g_first_block_calls == 1 && g_first_block_len == 5);
+
+    text[100] = '\0';
+    size_t mark = arena_get_mark(&arena);
+    ASSERT("Binary input is drained without breaking the writer",
+           read_piped(text, len, &opts, &arena, &r));
+    ASSERT("Binary input is discarded", r.discarded && r.len == 0 && r.data[0] == '\0');
+    ASSERT("Its buffer is released", arena_get_mark(&arena) <= mark + 16);
+    arena_destroy(&arena);
+    free(text);
+}
+
+TEST(test_pipe_tail_tokens) {
+    size_t len;
+    char *text = make_input(400000, true, &len);
+    Arena arena = arena_create_ex(MiB(4), ARENA_FLAG_GROW);
+    StdinPipeOptions opts = {g_tok, 2, 64 * 1024 * 1024, 5000, NULL, NULL};
+    StdinPipeResult r;
+    ASSERT("Stream is read", read_piped(text, len, &opts, &arena, &r));
+    ASSERT("Only the end is kept", r.dropped > 0 && r.dropped + r.len == len);
+    ASSERT("Kept text is the end of the input", memcmp(r.data, text + r.dropped, r.len) == 0);
+    ASSERT("Kept text starts on a line", text[r.dropped - 1] == '\n');
+    size_t kept = count(r.data, r.len);
+    ASSERT("Kept text fits", kept <= 5000);
+    ASSERT("Kept text nearly fills the limit", kept > 4900);
+    ASSERT("Count is exact", fragment_count_matches(&r));
+    ASSERT("Arena holds only the tail", arena_high_water(&arena) < MiB(1));
+
+    opts.tail_tokens = 1000000;
+    ASSERT("Short stream is read", read_piped(text, 100000, &opts, &arena, &r));
+    ASSERT("Input under the limit is kept whole", r.dropped == 0 && r.len == 100000);
+
+    const char *long_line = "short\nthe last line is longer than the limit allows\n";
+    opts.tail_tokens = 3;
+    ASSERT("Long line is read", read_piped(long_line, strlen(long_line), &opts, &arena, &r));
+    ASSERT("The last line is always kept",
+           strcmp(r.data, "the last line is longer than the limit allows\n") == 0);
+    arena_destroy(&arena);
+    free(text);
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+    char exe_dir[4096];
+    if (getcwd(exe_dir, sizeof(exe_dir))) {
+        llm_set_executable_dir(exe_dir);
+    }
+
+    printf("Running stdin pipe tests\n");
+    printf("========================\n");
+
+    g_tok = llm_tokenizer_open("gpt-4o");
+    if (!g_tok) {
+        printf("(tokenizer not available; counting tests skipped)\n");
+        RUN_TEST(test_pipe_file_and_truncation);
+    } else {
+        RUN_TEST(test_pipe_whole_read_is_counted);
+        RUN_TEST(test_pipe_edges_are_left_to_the_caller);
+        RUN_TEST(test_pipe_file_and_truncation);
+        RUN_TEST(test_pipe_first_block);
+        RUN_TEST(test_pipe_tail_tokens);
+    }
+
+    unlink(PIPE_FILE);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
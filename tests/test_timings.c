@@ -0,0 +1,108 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../timings.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for phase timings and I/O counters
+ */
+
+#define JSON_FILE TEST_DIR "/timings.json"
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {0, ms * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+static void *count_opens(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 10000; i++) {
+        timing_count(COUNTER_OPEN, 1);
+    }
+    return NULL;
+}
+
+/* Runs first: nothing is recorded before timings_enable() */
+TEST(test_timings_disabled_is_noop) {
+    timing_begin(TIMING_WALK);
+    sleep_ms(2);
+    timing_end(TIMING_WALK);
+    timing_count(COUNTER_BYTES_READ, 100);
+    ASSERT("Disabled spans record nothing", timing_total_us(TIMING_WALK) == 0);
+    ASSERT("Disabled counters record nothing", timing_counter(COUNTER_BYTES_READ) == 0);
+    ASSERT("Disabled elapsed is zero", timing_elapsed_us() == 0);
+}
+
+TEST(test_timings_spans_accumulate) {
+    timings_enable();
+    timing_begin(TIMING_ASSEMBLE);
+    sleep_ms(2);
+    timing_end(TIMING_ASSEMBLE);
+    uint64_t once = timing_total_us(TIMING_ASSEMBLE);
+    timing_begin(TIMING_ASSEMBLE);
+    sleep_ms(2);
+    timing_end(TIMING_ASSEMBLE);
+    ASSERT("A span covers its sleep", once >= 2000);
+    ASSERT("Re-entering a phase adds to it", timing_total_us(TIMING_ASSEMBLE) >= once + 2000);
+    timing_end(TIMING_RANK);
+    ASSERT("An unmatched end is ignored", timing_total_us(TIMING_RANK) == 0);
+    ASSERT("Elapsed covers the spans", timing_elapsed_us() >= timing_total_us(TIMING_ASSEMBLE));
+}
+
+TEST(test_timings_counters_from_threads) {
+    timings_enable();
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, count_opens, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    ASSERT_EQUALS(40000, (int)timing_counter(COUNTER_OPEN));
+}
+
+TEST(test_timings_json_keys) {
+    timings_enable();
+    timing_count(COUNTER_TOKENS, 42);
+    FILE *fp = fopen(JSON_FILE, "w");
+    ArenaStats stats = {.held = 1024, .high_water = 4096, .reserved = 8192, .chunks = 2};
+    timings_write_json(fp, &stats, 512);
+    fclose(fp);
+
+    char line[2048] = "";
+    fp = fopen(JSON_FILE, "r");
+    ASSERT("JSON is one line", fp && fgets(line, sizeof(line), fp) && strchr(line, '\n'));
+    if (fp) {
+        fclose(fp);
+    }
+    for (int p = 0; p < TIMING_PHASE_COUNT; p++) {
+        char key[64];
+        snprintf(key, sizeof(key), "\"%s_us\": ", timing_phase_name((TimingPhase)p));
+        ASSERT("Every phase has a key", strstr(line, key) != NULL);
+    }
+    ASSERT("Total is reported", strstr(line, "\"total_us\": ") != NULL);
+    ASSERT("Counters are reported", strstr(line, "\"tokens\": 42") != NULL);
+    ASSERT("Chunks are reported", strstr(line, "\"arena_chunks\": 2") != NULL);
+    ASSERT("Scratch peak is reported", strstr(line, "\"scratch_high_water\": 512") != NULL);
+    ASSERT("High-water mark is reported", strstr(line, "\"arena_high_water\": 4096}") != NULL);
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+    printf("Running timings tests\n");
+    printf("=====================\n");
+
+    RUN_TEST(test_timings_disabled_is_noop);
+    RUN_TEST(test_timings_spans_accumulate);
+    RUN_TEST(test_timings_counters_from_threads);
+    RUN_TEST(test_timings_json_keys);
+
+    unlink(JSON_FILE);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
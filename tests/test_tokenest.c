@@ -0,0 +1,226 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../matcher.h"
+#include "../tokenest.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for byte-class token estimation and `llm_ctx --estimate`
+ */
+
+static char g_exe[PATH_MAX];
+
+static bool ref_is_word(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static bool ref_is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Byte-at-a-time reference for byte_class_count() */
+static ByteClassCounts reference_counts(const char *buf, size_t len) {
+    ByteClassCounts c;
+    memset(&c, 0, sizeof(c));
+    bool prev_word = false, prev_space = false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char b = (unsigned char)buf[i];
+        bool word = ref_is_word(b), space = ref_is_space(b);
+        c.word_bytes += word;
+        c.word_runs += word && !prev_word;
+        c.space_bytes += space;
+        c.space_runs += space && !prev_space;
+        c.nonascii_bytes += b >= 0x80;
+        c.punct_bytes += !word && !space && b < 0x80;
+        prev_word = word;
+        prev_space = space;
+    }
+    c.bytes = len;
+    return c;
+}
+
+static bool counts_equal(const ByteClassCounts *a, const ByteClassCounts *b) {
+    return a->bytes == b->bytes && a->word_bytes == b->word_bytes &&
+           a->word_runs == b->word_runs && a->space_bytes == b->space_bytes &&
+           a->space_runs == b->space_runs && a->punct_bytes == b->punct_bytes &&
+           a->nonascii_bytes == b->nonascii_bytes;
+}
+
+TEST(test_byte_classes_match_reference) {
+    static const char alphabet[] = "ab_Z09 \t\n\r(){};,.\x80\xc3\xa9\0";
+    static char buf[4099];
+    unsigned seed = 12345;
+    int mismatches = 0;
+    /* Every length around the 64-byte blocks, with runs crossing block edges */
+    for (size_t len = 0; len < sizeof(buf); len += len < 200 ? 1 : 97) {
+        for (size_t i = 0; i < len; i++) {
+            seed = seed * 1103515245u + 12345u;
+            buf[i] = alphabet[(seed >> 16) % (sizeof(alphabet) - 1)];
+        }
+        ByteClassCounts got;
+        memset(&got, 0, sizeof(got));
+        byte_class_count(buf, len, &got);
+        ByteClassCounts want = reference_counts(buf, len);
+        if (!counts_equal(&got, &want)) {
+            printf("\n  mismatch at length %zu", len);
+            mismatches++;
+        }
+    }
+    ASSERT_EQUALS(0, mismatches);
+}
+
+TEST(test_byte_classes_accumulate) {
+    const char *text = "int main(void) { return 0; }\n";
+    ByteClassCounts c;
+    memset(&c, 0, sizeof(c));
+    byte_class_count(text, strlen(text), &c);
+    byte_class_count(text, strlen(text), &c);
+    ASSERT_EQUALS((int)(2 * strlen(text)), (int)c.bytes);
+    ASSERT_EQUALS(10, (int)c.word_runs);
+    ASSERT_EQUALS(12, (int)c.space_bytes);
+    ASSERT_EQUALS(10, (int)c.punct_bytes);
+}
+
+TEST(test_estimator_prior_per_model) {
+    const char *text = "static int count_lines(const char *buf, size_t len)\n{\n    return 0;\n}\n";
+    ByteClassCounts c;
+    memset(&c, 0, sizeof(c));
+    byte_class_count(text, strlen(text), &c);
+    TokenEstimator o200k, gpt2;
+    token_estimator_init(&o200k, "gpt-4o");
+    token_estimator_init(&gpt2, "text-davinci-003");
+    size_t tokens = token_estimator_estimate(&o200k, &c);
+    ASSERT("About 3 bytes per token on C", tokens > strlen(text) / 5 && tokens < strlen(text) / 2);
+    ASSERT("Older vocabularies need more tokens", token_estimator_estimate(&gpt2, &c) > tokens);
+    ASSERT("The prior bound applies before any count",
+           token_estimator_error(&o200k) > 0.1 && token_estimator_error(&o200k) < 0.2);
+}
+
+TEST(test_estimator_calibrates_to_exact_counts) {
+    static char buf[8192];
+    size_t used = 0;
+    for (int i = 0; i < 200; i++) {
+        used += (size_t)snprintf(buf + used, sizeof(buf) - used, "    value_%d = f(x);\n", i);
+    }
+    ByteClassCounts c;
+    memset(&c, 0, sizeof(c));
+    byte_class_count(buf, used, &c);
+
+    TokenEstimator est;
+    token_estimator_init(&est, "gpt-4o");
+    size_t prior = token_estimator_estimate(&est, &c);
+    /* Ten fragments like this one, each counted at twice the prior estimate */
+    for (int i = 0; i < 10; i++) {
+        token_estimator_observe(&est, &c, 2 * prior);
+    }
+    size_t calibrated = token_estimator_estimate(&est, &c);
+    ASSERT("The scale moves towards the exact counts",
+           calibrated > prior * 19 / 10 && calibrated <= 2 * prior);
+    ASSERT("Agreeing counts tighten the bound", token_estimator_error(&est) < 0.05);
+
+    /* Counts that disagree widen it again */
+    token_estimator_observe(&est, &c, prior / 2);
+    token_estimator_observe(&est, &c, 4 * prior);
+    ASSERT("Spread widens the bound", token_estimator_error(&est) > 0.2);
+}
+
+/* Run llm_ctx in the test directory, capturing stderr */
+static void run_llm_ctx(const char *args, char *out, size_t out_size) {
+    char cmd[PATH_MAX * 3];
+    snprintf(cmd, sizeof(cmd),
+             "cd " TEST_DIR "/tokenest_tree && LLM_CTX_NO_CONFIG=1 '%s' -o "
+             "--no-cache --timings=- %s 2>&1 >/dev/null </dev/null",
+             g_exe, args);
+    out[0] = '\0';
+    FILE *pipe = popen(cmd, "r");
+    if (!pipe) {
+        return;
+    }
+    size_t total = fread(out, 1, out_size - 1, pipe);
+    out[total] = '\0';
+    pclose(pipe);
+}
+
+static long tokenizer_calls(const char *out) {
+    const char *key = strstr(out, "\"tokenizer_calls\":");
+    return key ? strtol(key + strlen("\"tokenizer_calls\":"), NULL, 10) : -1;
+}
+
+/* Token total from the "Token usage:" line */
+static long usage_tokens(const char *out) {
+    const char *line = strstr(out, "Token usage: ");
+    if (!line) {
+        return -1;
+    }
+    line += strlen("Token usage: ");
+    return strtol(*line == '~' ? line + 1 : line, NULL, 10);
+}
+
+static void write_tree(void) {
+    system("mkdir -p " TEST_DIR "/tokenest_tree");
+    FILE *f = fopen(TEST_DIR "/tokenest_tree/code.c", "w");
+    if (f) {
+        for (int i = 0; i < 400; i++) {
+            fprintf(f, "static int helper_%d(int x)\n{\n    return x * %d + 1;\n}\n\n", i, i);
+        }
+        fclose(f);
+    }
+}
+
+TEST(test_cli_estimate_far_from_budget) {
+    char out[8192];
+    run_llm_ctx("--estimate -b 1000000 -f code.c", out, sizeof(out));
+    ASSERT("The usage line shows the bound", strstr(out, " +/- ") != NULL);
+    ASSERT("The usage line is marked estimated", strstr(out, "% of budget, estimated)") != NULL);
+    ASSERT_EQUALS(0, (int)tokenizer_calls(out));
+}
+
+TEST(test_cli_estimate_near_budget_counts_exactly) {
+    char out[8192];
+    run_llm_ctx("-f code.c", out, sizeof(out));
+    long exact = usage_tokens(out);
+    ASSERT("The exact count is reported", exact > 0);
+
+    char args[128];
+    snprintf(args, sizeof(args), "--estimate=20 -b %ld -f code.c", exact);
+    run_llm_ctx(args, out, sizeof(out));
+    ASSERT("Near the budget the tokenizer runs", tokenizer_calls(out) > 0);
+    ASSERT("No bound on an exact count", strstr(out, " +/- ") == NULL);
+    ASSERT_EQUALS((int)exact, (int)usage_tokens(out));
+}
+
+TEST(test_cli_estimate_rejects_bad_margin) {
+    char out[4096];
+    run_llm_ctx("--estimate=abc -f code.c", out, sizeof(out));
+    ASSERT("Invalid margin is rejected", strstr(out, "Invalid --estimate value") != NULL);
+}
+
+int main(void) {
+    system("mkdir -p " TEST_DIR);
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return 1;
+    }
+    snprintf(g_exe, sizeof(g_exe), "%s/llm_ctx", cwd);
+    write_tree();
+
+    printf("Running token estimation tests\n");
+    printf("==============================\n");
+
+    RUN_TEST(test_byte_classes_match_reference);
+    RUN_TEST(test_byte_classes_accumulate);
+    RUN_TEST(test_estimator_prior_per_model);
+    RUN_TEST(test_estimator_calibrates_to_exact_counts);
+    RUN_TEST(test_cli_estimate_far_from_budget);
+    RUN_TEST(test_cli_estimate_near_budget_counts_exactly);
+    RUN_TEST(test_cli_estimate_rejects_bad_margin);
+
+    system("rm -rf " TEST_DIR "/tokenest_tree");
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
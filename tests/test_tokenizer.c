@@ -57,6 +57,73 @@ TEST(test_invalid_inputs) {
     ASSERT("NULL model should return SIZE_MAX", tokens == SIZE_MAX);
 }
 
+TEST(test_tokenizer_session) {
+    ASSERT("Tokenizer should be available", llm_tokenizer_available());
+
+    LLMTokenizer *tok = llm_tokenizer_open("gpt-4o");
+    ASSERT("Session should open", tok != NULL);
+
+    /* Same model must reuse the cached encoder */
+    LLMTokenizer *again = llm_tokenizer_open("gpt-4o");
+    ASSERT("Reopening a model should return the same session", again == tok);
+
+    size_t via_session = llm_tokenizer_count(tok, "The quick brown fox jumps over the lazy dog");
+    size_t via_wrapper = llm_count_tokens("The quick brown fox jumps over the lazy dog", "gpt-4o");
+    ASSERT("Session count should not fail", via_session != SIZE_MAX);
+    ASSERT("Session and wrapper counts should agree", via_session == via_wrapper);
+
+    ASSERT("NULL text should return SIZE_MAX", llm_tokenizer_count(tok, NULL) == SIZE_MAX);
+    ASSERT("NULL session should return SIZE_MAX", llm_tokenizer_count(NULL, "hi") == SIZE_MAX);
+    ASSERT("NULL model should not open a session", llm_tokenizer_open(NULL) == NULL);
+
+    llm_tokenizer_close(tok);
+
+    /* A closed session can be reopened */
+    tok = llm_tokenizer_open("gpt-4o");
+    ASSERT("Session should reopen after close", tok != NULL);
+    ASSERT("Reopened session should count", llm_tokenizer_count(tok, "hello world") != SIZE_MAX);
+    llm_tokenizer_close(tok);
+}
+
+TEST(test_tokenizer_count_batch) {
+    ASSERT("Tokenizer should be available", llm_tokenizer_available());
+    LLMTokenizer *tok = llm_tokenizer_open("gpt-4o");
+    ASSERT("Session should open", tok != NULL);
+
+    /* Large enough to take the threaded path */
+    enum { NUM_SPANS = 16, SPAN_BYTES = 8192 };
+    char *text = malloc(NUM_SPANS * SPAN_BYTES + 1);
+    ASSERT("Allocation should succeed", text != NULL);
+    for (int i = 0; i < NUM_SPANS * SPAN_BYTES; i++) {
+        text[i] = (i % 64 == 63) ? '\n' : "abcdefgh "[i % 9];
+    }
+    text[NUM_SPANS * SPAN_BYTES] = '\0';
+
+    TokenSpan spans[NUM_SPANS];
+    for (int i = 0; i < NUM_SPANS; i++) {
+        spans[i].text = text + i * SPAN_BYTES;
+        spans[i].len = SPAN_BYTES - i * 100;
+        spans[i].terminated = false;
+        spans[i].tokens = 0;
+    }
+
+    int rc = llm_tokenizer_count_batch(tok, spans, NUM_SPANS, 4);
+    ASSERT("Batch count should succeed", rc == 0);
+    for (int i = 0; i < NUM_SPANS; i++) {
+        size_t expected = llm_tokenizer_count_n(tok, spans[i].text, spans[i].len);
+        ASSERT("Parallel and serial counts should agree", spans[i].tokens == expected);
+    }
+
+    /* A terminated span is counted in place and must agree with a copy */
+    TokenSpan whole = {.text = text, .len = NUM_SPANS * SPAN_BYTES, .terminated = true};
+    ASSERT("Terminated batch should succeed", llm_tokenizer_count_batch(tok, &whole, 1, 1) == 0);
+    ASSERT("Terminated span count should match",
+           whole.tokens == llm_tokenizer_count_n(tok, text, NUM_SPANS * SPAN_BYTES));
+
+    ASSERT("Empty batch should succeed", llm_tokenizer_count_batch(tok, NULL, 0, 4) == 0);
+    free(text);
+}
+
 TEST(test_token_diagnostics) {
     ASSERT("Tokenizer should be available", llm_tokenizer_available());
     
@@ -92,7 +159,8 @@ TEST(test_token_diagnostics) {
     ASSERT("Failed to open temp file", diag_file != NULL);
     
     /* Generate diagnostics */
-    generate_token_diagnostics(test_content, "gpt-4o", diag_file, &arena);
+    generate_token_diagnostics(test_content, strlen(test_content), "gpt-4o", NULL, diag_file,
+                               &arena);
     
     /* Read back the output */
     fseek(diag_file, 0, SEEK_SET);
@@ -103,7 +171,7 @@ TEST(test_token_diagnostics) {
     
     while (fgets(line, sizeof(line), diag_file)) {
         line_count++;
-        if (strstr(line, "Tokens   File")) found_header = true;
+        if (strstr(line, "Tokens    Share     Cum  File")) found_header = true;
         if (strstr(line, "Total")) found_total = true;
         printf("  %s", line); /* Show output for debugging */
     }
@@ -117,6 +185,147 @@ TEST(test_token_diagnostics) {
     arena_destroy(&arena);
 }
 
+/* Run generate_token_diagnostics() on content[0, len) and return its report */
+static char *diagnostics_report(const char *content, size_t len, const TokenDiagOptions *opts,
+                                Arena *arena) {
+    static char report[1 << 16];
+    FILE *out = tmpfile();
+    report[0] = '\0';
+    if (!out) {
+        return report;
+    }
+    generate_token_diagnostics(content, len, "gpt-4o", opts, out, arena);
+    rewind(out);
+    size_t n = fread(report, 1, sizeof(report) - 1, out);
+    report[n] = '\0';
+    fclose(out);
+    return report;
+}
+
+/* Parse the "Tokens ... Total" table: sum of the rows and the total line */
+static void table_sums(const char *report, size_t *rows, size_t *total, int *row_count) {
+    *rows = *total = 0;
+    *row_count = 0;
+    int separators = 0;
+    for (const char *line = report; *line;) {
+        const char *eol = strchr(line, '\n');
+        size_t n;
+        if (strncmp(line, "  -------", 9) == 0) {
+            separators++;
+        } else if (sscanf(line, " %zu", &n) == 1) {
+            if (separators == 1) {
+                *rows += n;
+                (*row_count)++;
+            } else if (separators == 2) {
+                *total = n;
+            }
+        }
+        if (!eol) {
+            break;
+        }
+        line = eol + 1;
+    }
+}
+
+TEST(test_token_diagnostics_in_place_view) {
+    Arena arena = arena_create(1024 * 1024);
+    const char *prompt =
+        "<user_instructions>\nReview\n</user_instructions>\n"
+        "<file_context>\n"
+        "File: a.c\n```c\nint a;\n```\n"
+        "File: b.c\n```c\nint b;\n```\n"
+        "</file_context>\n";
+    /* The view ends before the trailing "IGNORED"; it is not NUL-terminated */
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%sFile: ignored.c\nIGNORED", prompt);
+    char *report = diagnostics_report(buf, strlen(prompt), NULL, &arena);
+    ASSERT("Files are listed", strstr(report, "a.c\n") && strstr(report, "b.c\n"));
+    ASSERT("Sections are listed", strstr(report, "<user_instructions>") != NULL);
+    ASSERT("Nothing past the view is read", strstr(report, "ignored.c") == NULL);
+
+    size_t rows, total;
+    int row_count;
+    table_sums(report, &rows, &total, &row_count);
+    ASSERT("Rows sum to the total", rows == total && total > 0);
+    ASSERT("Total is the sum of the pieces",
+           total == llm_count_tokens("<user_instructions>\n", "gpt-4o") +
+                        llm_count_tokens("Review\n", "gpt-4o") +
+                        llm_count_tokens("</user_instructions>\n<file_context>\nFile: a.c\n",
+                                         "gpt-4o") +
+                        llm_count_tokens("```c\nint a;\n```\n", "gpt-4o") +
+                        llm_count_tokens("File: b.c\n", "gpt-4o") +
+                        llm_count_tokens("```c\nint b;\n```\n", "gpt-4o") +
+                        llm_count_tokens("</file_context>\n", "gpt-4o"));
+    arena_destroy(&arena);
+}
+
+TEST(test_token_diagnostics_headers_inside_fences) {
+    Arena arena = arena_create(1024 * 1024);
+    const char *prompt =
+        "<file_context>\n"
+        "File: notes.md\n````markdown\nFile: not-a-file.c\n</file_context>\n```\n````\n"
+        "File: real.c\n```c\nint x;\n```\n"
+        "</file_context>\n";
+    char *report = diagnostics_report(prompt, strlen(prompt), NULL, &arena);
+    ASSERT("Fenced header lines are content", strstr(report, "not-a-file.c") == NULL);
+    ASSERT("The file after the fence is found", strstr(report, "real.c") != NULL);
+    arena_destroy(&arena);
+}
+
+TEST(test_token_diagnostics_known_counts_and_many_files) {
+    Arena arena = arena_create(8 * 1024 * 1024);
+    size_t cap = 1 << 20, used = 0;
+    char *prompt = malloc(cap);
+    used += (size_t)snprintf(prompt + used, cap - used, "<file_context>\n");
+    for (int i = 0; i < 1500; i++) {
+        used += (size_t)snprintf(prompt + used, cap - used,
+                                 "File: f%04d.c\n```c\nint v%d;\n```\n", i, i);
+    }
+    used += (size_t)snprintf(prompt + used, cap - used, "</file_context>\n");
+
+    /* The assembly stage counted the first file; that count is used as is */
+    TokenCount known[] = {{"f0000.c", 77777}};
+    TokenDiagOptions opts = {known, 1, 0, 2};
+    char *report = diagnostics_report(prompt, used, &opts, &arena);
+    ASSERT("Known count is reported", strstr(report, "  77777") != NULL);
+    ASSERT("Known file is listed first", strstr(report, "  ------------------------\n    77777"));
+
+    size_t rows, total;
+    int row_count;
+    table_sums(report, &rows, &total, &row_count);
+    ASSERT("Past 1000 files no row is lost", row_count >= 1500);
+    ASSERT("Rows sum to the total", rows == total);
+    free(prompt);
+    arena_destroy(&arena);
+}
+
+TEST(test_token_report_top_and_cumulative) {
+    TokenCount sections[] = {{"file_tree", 50}};
+    TokenCount files[] = {{"small.c", 10}, {"big.c", 300}, {"mid.c", 100}, {"tiny.c", 5},
+                          {"small2.c", 10}};
+    FILE *out = tmpfile();
+    ASSERT("Temp file opens", out != NULL);
+    if (!out) {
+        return;
+    }
+    report_token_diagnostics(sections, 1, files, 5, 500, 3, out);
+    rewind(out);
+    char report[4096];
+    size_t n = fread(report, 1, sizeof(report) - 1, out);
+    report[n] = '\0';
+    fclose(out);
+    printf("\n%s", report);
+
+    const char *big = strstr(report, "big.c"), *mid = strstr(report, "mid.c");
+    const char *tree = strstr(report, "<file_tree>");
+    ASSERT("Rows are sorted by count", big && mid && tree && big < mid && mid < tree);
+    ASSERT("Share and cumulative share", strstr(report, "    300   60.0%   60.0%  big.c"));
+    ASSERT("Third row reaches 90%", strstr(report, "     50   10.0%   90.0%  <file_tree>"));
+    ASSERT("The rest is folded", strstr(report, "     25    5.0%   95.0%  <3 more>"));
+    ASSERT("Unattributed tokens stay last", strstr(report, "     25    5.0%  100.0%  <other>"));
+    ASSERT("Folded rows are not listed", strstr(report, "small.c") == NULL);
+}
+
 int main(void) {
     printf("Running tokenizer unit tests\n");
     printf("============================\n");
@@ -124,7 +333,13 @@ int main(void) {
     RUN_TEST(test_tokenizer_availability);
     RUN_TEST(test_token_counting);
     RUN_TEST(test_invalid_inputs);
+    RUN_TEST(test_tokenizer_session);
+    RUN_TEST(test_tokenizer_count_batch);
     RUN_TEST(test_token_diagnostics);
+    RUN_TEST(test_token_diagnostics_in_place_view);
+    RUN_TEST(test_token_diagnostics_headers_inside_fences);
+    RUN_TEST(test_token_diagnostics_known_counts_and_many_files);
+    RUN_TEST(test_token_report_top_and_cumulative);
     
     printf("\n");
     PRINT_TEST_SUMMARY();
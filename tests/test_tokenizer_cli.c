@@ -135,6 +135,195 @@ TEST(test_token_diagnostics_output) {
     unlink("test2.txt");
 }
 
+TEST(test_token_diagnostics_rows_sum_to_total) {
+    FILE *f1 = fopen("test1.txt", "w");
+    fprintf(f1, "First file content\n");
+    fclose(f1);
+
+    FILE *f2 = fopen("test2.txt", "w");
+    fprintf(f2, "Second file with more content here\n");
+    fclose(f2);
+
+    char stdout_buf[8192] = {0};
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "-o --no-gitignore -c 'sum check' -f %s/test1.txt %s/test2.txt",
+             getenv("PWD"), getenv("PWD"));
+    int exit_code = run_llm_ctx(cmd, stdout_buf, sizeof(stdout_buf));
+    ASSERT("Expected exit code 0", exit_code == 0);
+
+    /* Usage line and diagnostics total come from the same per-fragment counts */
+    size_t usage = 0;
+    const char *usage_line = strstr(stdout_buf, "Token usage: ");
+    ASSERT("Should print token usage", usage_line != NULL);
+    sscanf(usage_line, "Token usage: %zu", &usage);
+
+    size_t rows = 0, total = 0;
+    bool in_table = false;
+    char *save = NULL;
+    for (char *line = strtok_r(stdout_buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        size_t n = 0;
+        char name[512];
+        if (strstr(line, "-------")) {
+            in_table = !in_table;
+            continue;
+        }
+        if (sscanf(line, " %zu %511s", &n, name) != 2)
+            continue;
+        if (in_table)
+            rows += n;
+        else if (strcmp(name, "Total") == 0)
+            total = n;
+    }
+
+    ASSERT("Usage line should be non-zero", usage > 0);
+    ASSERT("Diagnostics total should match usage line", total == usage);
+    ASSERT("Diagnostics rows should sum to the total", rows == total);
+
+    unlink("test1.txt");
+    unlink("test2.txt");
+}
+
+TEST(test_token_stream_matches_buffered) {
+    FILE *f1 = fopen("test_stream1.txt", "w");
+    fprintf(f1, "First streamed file\n");
+    fclose(f1);
+
+    FILE *f2 = fopen("test_stream2.txt", "w");
+    fprintf(f2, "Second streamed file with more content\n");
+    fclose(f2);
+
+    /* The streamed prompt is byte-for-byte the one-shot prompt */
+    char cmd[1024];
+    char stdout_buf[4096] = {0};
+    snprintf(cmd, sizeof(cmd),
+             "-o@test_stream_a.out --no-gitignore -c 'same' -f %s/test_stream*.txt",
+             getenv("PWD"));
+    ASSERT("Buffered run should succeed", run_llm_ctx(cmd, stdout_buf, sizeof(stdout_buf)) == 0);
+    snprintf(cmd, sizeof(cmd),
+             "-o@test_stream_b.out --stream --no-gitignore -c 'same' -f %s/test_stream*.txt",
+             getenv("PWD"));
+    stdout_buf[0] = '\0';
+    ASSERT("Streamed run should succeed", run_llm_ctx(cmd, stdout_buf, sizeof(stdout_buf)) == 0);
+    ASSERT("Streamed run should report the output file",
+           strstr(stdout_buf, "Content written to") != NULL);
+
+    int same = system("cmp -s test_stream_a.out test_stream_b.out");
+    ASSERT("Streamed output should match buffered output",
+           WIFEXITED(same) && WEXITSTATUS(same) == 0);
+
+    unlink("test_stream1.txt");
+    unlink("test_stream2.txt");
+    unlink("test_stream_a.out");
+    unlink("test_stream_b.out");
+}
+
+TEST(test_token_stream_budget_stop) {
+    char name[64];
+    for (int i = 1; i <= 4; i++) {
+        snprintf(name, sizeof(name), "test_stream_budget%d.txt", i);
+        FILE *f = fopen(name, "w");
+        for (int j = 0; j < 15; j++) {
+            fprintf(f, "stream budget words here ");
+        }
+        fprintf(f, "\n");
+        fclose(f);
+    }
+
+    char stdout_buf[8192] = {0};
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd),
+             "-o --stream --no-gitignore -r -c stream -b 250 -f %s/test_stream_budget*.txt",
+             getenv("PWD"));
+    int exit_code = run_llm_ctx(cmd, stdout_buf, sizeof(stdout_buf));
+    ASSERT("Expected exit code 0", exit_code == 0);
+
+    if (strstr(stdout_buf, "tokenizer library not found") == NULL) {
+        size_t usage = 0, budget = 0;
+        const char *usage_line = strstr(stdout_buf, "Token usage: ");
+        ASSERT("Should print token usage", usage_line != NULL);
+        sscanf(usage_line, "Token usage: %zu / %zu", &usage, &budget);
+        ASSERT("Should leave out the files that do not fit",
+               strstr(stdout_buf, "Skipped ") != NULL);
+        ASSERT("Streamed output should stay within the budget", usage <= budget);
+        ASSERT("Streamed output should still be closed",
+               strstr(stdout_buf, "</file_context>") != NULL);
+    }
+
+    for (int i = 1; i <= 4; i++) {
+        snprintf(name, sizeof(name), "test_stream_budget%d.txt", i);
+        unlink(name);
+    }
+}
+
+TEST(test_token_filerank_fills_after_misfit) {
+    /* The most relevant file is far too large; a smaller relevant one still fits */
+    FILE *big = fopen("test_pack_big.txt", "w");
+    for (int j = 0; j < 2000; j++) {
+        fprintf(big, "packing words ");
+    }
+    fprintf(big, "\n");
+    fclose(big);
+
+    FILE *small = fopen("test_pack_small.txt", "w");
+    fprintf(small, "small packing note\n");
+    fclose(small);
+
+    static char stdout_buf[65536];
+    stdout_buf[0] = '\0';
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd),
+             "-o --no-cache --no-gitignore -r -c packing -b 300 -f %s/test_pack_big.txt "
+             "%s/test_pack_small.txt",
+             getenv("PWD"), getenv("PWD"));
+    int exit_code = run_llm_ctx(cmd, stdout_buf, sizeof(stdout_buf));
+    ASSERT("Expected exit code 0", exit_code == 0);
+
+    if (strstr(stdout_buf, "tokenizer library not found") == NULL) {
+        ASSERT("Should select the file that fits", strstr(stdout_buf, "Selected 1 ") != NULL);
+        ASSERT("Small file should be in the context",
+               strstr(stdout_buf, "small packing note") != NULL);
+        ASSERT("Large file should be skipped", strstr(stdout_buf, "Skipped 1 ") != NULL);
+    }
+
+    unlink("test_pack_big.txt");
+    unlink("test_pack_small.txt");
+}
+
+TEST(test_token_filerank_exact_total) {
+    /* Both files are left out, but both are counted on the way: the total is exact */
+    char name[64];
+    for (int i = 1; i <= 2; i++) {
+        snprintf(name, sizeof(name), "test_pack_counted%d.txt", i);
+        FILE *f = fopen(name, "w");
+        for (int j = 0; j < 100; j++) {
+            fprintf(f, "packing words ");
+        }
+        fprintf(f, "\n");
+        fclose(f);
+    }
+
+    static char stdout_buf[65536];
+    stdout_buf[0] = '\0';
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd),
+             "-o --no-cache --no-gitignore -r -c packing -b 300 -f %s/test_pack_counted*.txt",
+             getenv("PWD"));
+    int exit_code = run_llm_ctx(cmd, stdout_buf, sizeof(stdout_buf));
+    ASSERT("Expected exit code 0", exit_code == 0);
+
+    if (strstr(stdout_buf, "tokenizer library not found") == NULL) {
+        ASSERT("Every file should be counted", strstr(stdout_buf, "(0 never tokenized)") != NULL);
+        ASSERT("Total should not be marked as estimated",
+               strstr(stdout_buf, "Token usage: ~") == NULL &&
+                   strstr(stdout_buf, "estimated)") == NULL);
+    }
+
+    for (int i = 1; i <= 2; i++) {
+        snprintf(name, sizeof(name), "test_pack_counted%d.txt", i);
+        unlink(name);
+    }
+}
+
 TEST(test_token_model_option) {
     /* Create a test file */
     FILE *test_file = fopen("test_model.txt", "w");
@@ -154,6 +343,35 @@ TEST(test_token_model_option) {
     unlink("test_model.txt");
 }
 
+TEST(test_token_top_option) {
+    const char *names[] = {"top_a.txt", "top_b.txt", "top_c.txt"};
+    for (int i = 0; i < 3; i++) {
+        FILE *f = fopen(names[i], "w");
+        fprintf(f, "File number %d has some words in it\n", i);
+        fclose(f);
+    }
+
+    char stdout_buf[8192] = {0};
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd),
+             "-o --no-gitignore --token-top=1 -f %s/top_a.txt %s/top_b.txt %s/top_c.txt",
+             getenv("PWD"), getenv("PWD"), getenv("PWD"));
+    int exit_code = run_llm_ctx(cmd, stdout_buf, sizeof(stdout_buf));
+    ASSERT("Expected exit code 0", exit_code == 0);
+    if (strstr(stdout_buf, "tokenizer library not found") == NULL) {
+        ASSERT("Rows past the first are folded", strstr(stdout_buf, " more>") != NULL);
+        ASSERT("Cumulative column is shown", strstr(stdout_buf, "Cum  File") != NULL);
+    }
+
+    exit_code = run_llm_ctx("-o --token-top=-3 -f top_a.txt", stdout_buf, sizeof(stdout_buf));
+    ASSERT("Negative --token-top is rejected", exit_code != 0);
+    ASSERT("Error names the option", strstr(stdout_buf, "Invalid --token-top value") != NULL);
+
+    for (int i = 0; i < 3; i++) {
+        unlink(names[i]);
+    }
+}
+
 TEST(test_missing_tokenizer_library) {
     /* This test checks behavior when tokenizer library is not available */
     /* The actual behavior depends on whether the library is built */
@@ -197,7 +415,13 @@ int main(void) {
     RUN_TEST(test_token_budget_exceeded);
     RUN_TEST(test_token_budget_within_limit);
     RUN_TEST(test_token_diagnostics_output);
+    RUN_TEST(test_token_diagnostics_rows_sum_to_total);
+    RUN_TEST(test_token_stream_matches_buffered);
+    RUN_TEST(test_token_stream_budget_stop);
+    RUN_TEST(test_token_filerank_fills_after_misfit);
+    RUN_TEST(test_token_filerank_exact_total);
     RUN_TEST(test_token_model_option);
+    RUN_TEST(test_token_top_option);
     RUN_TEST(test_missing_tokenizer_library);
     
     printf("\n");
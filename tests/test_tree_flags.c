@@ -176,6 +176,27 @@ TEST(test_t_flag_with_patterns) {
     cleanup_test_files();
 }
 
+/* Test that -t on a single file roots the tree at that file's directory */
+TEST(test_t_flag_single_file_root) {
+    setup_test_files();
+    mkdir("test_tree_dir/src/sub", 0755);
+    FILE *f = fopen("test_tree_dir/src/sub/deep.c", "w");
+    if (f) {
+        fprintf(f, "void deep() {}\n");
+        fclose(f);
+    }
+
+    char *output = run_command("../llm_ctx -t -o --no-gitignore -f test_tree_dir/src/sub/deep.c");
+
+    ASSERT("Tree is rooted at the file's directory", string_contains(output, "<file_tree>\ntest_tree_dir/src/sub\n"));
+    ASSERT("Output should contain deep.c", string_contains(output, "deep.c"));
+    ASSERT("Output should NOT contain main.c (outside the root)", !string_contains(output, "main.c"));
+
+    unlink("test_tree_dir/src/sub/deep.c");
+    rmdir("test_tree_dir/src/sub");
+    cleanup_test_files();
+}
+
 /* Test that -T with patterns shows filtered tree (only matched files) */
 TEST(test_T_flag_with_patterns) {
     setup_test_files();
@@ -279,6 +300,7 @@ int main(void) {
     RUN_TEST(test_t_flag_full_tree);
     RUN_TEST(test_T_flag_filtered_tree);
     RUN_TEST(test_t_flag_with_patterns);
+    RUN_TEST(test_t_flag_single_file_root);
     RUN_TEST(test_T_flag_with_patterns);
     RUN_TEST(test_tree_flags_no_content);
     RUN_TEST(test_tree_flags_with_content);
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "../walker.h"
+#include "test_framework.h"
+
+/**
+ * Test suite for the parallel directory walker
+ */
+
+#define WALK_ROOT TEST_DIR "/walker"
+
+static void write_file(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fputs("x\n", f);
+        fclose(f);
+    }
+}
+
+static void setup_tree(void) {
+    system("rm -rf " WALK_ROOT);
+    system("mkdir -p " WALK_ROOT "/src/deep/deeper " WALK_ROOT "/docs " WALK_ROOT "/.git/objects "
+           WALK_ROOT "/skip/inner");
+    write_file(WALK_ROOT "/b.txt");
+    write_file(WALK_ROOT "/a.txt");
+    write_file(WALK_ROOT "/src/main.c");
+    write_file(WALK_ROOT "/src/deep/util.c");
+    write_file(WALK_ROOT "/src/deep/deeper/leaf.c");
+    write_file(WALK_ROOT "/docs/readme.md");
+    write_file(WALK_ROOT "/.git/HEAD");
+    write_file(WALK_ROOT "/skip/inner/hidden.c");
+    symlink("a.txt", WALK_ROOT "/link.txt");
+}
+
+static void cleanup_tree(void) {
+    system("rm -rf " WALK_ROOT);
+}
+
+static bool reject_skip_dir(const char *path, WalkKind kind, void *dir_ctx, void *user) {
+    (void)dir_ctx;
+    (void)user;
+    const char *base = strrchr(path, '/');
+    return !(kind == WALK_DIR && base && strcmp(base + 1, "skip") == 0);
+}
+
+static const WalkEntry *find_entry(const WalkResult *r, const char *path) {
+    for (size_t i = 0; i < r->count; i++) {
+        if (strcmp(r->entries[i].path, path) == 0) {
+            return &r->entries[i];
+        }
+    }
+    return NULL;
+}
+
+TEST(test_walk_finds_all_entries_sorted) {
+    setup_tree();
+
+    WalkResult r;
+    ASSERT("Walk should succeed", walk_tree(WALK_ROOT, 1, NULL, &r) == 0);
+
+    /* a.txt b.txt docs docs/readme.md link.txt skip skip/inner skip/inner/hidden.c
+     * src src/deep src/deep/deeper src/deep/deeper/leaf.c src/deep/util.c src/main.c */
+    ASSERT_EQUALS(14, (int)r.count);
+    for (size_t i = 1; i < r.count; i++) {
+        ASSERT("Entries should be sorted by path", strcmp(r.entries[i - 1].path, r.entries[i].path) < 0);
+    }
+    ASSERT_STR_EQUALS(WALK_ROOT "/a.txt", r.entries[0].path);
+    ASSERT_STR_EQUALS("a.txt", r.entries[0].name);
+
+    walk_result_free(&r);
+    cleanup_tree();
+}
+
+TEST(test_walk_reports_kinds) {
+    setup_tree();
+
+    WalkResult r;
+    ASSERT("Walk should succeed", walk_tree(WALK_ROOT, 2, NULL, &r) == 0);
+
+    const WalkEntry *e = find_entry(&r, WALK_ROOT "/src/deep");
+    ASSERT("Directory should be found", e != NULL);
+    ASSERT("Directory kind", e->kind == WALK_DIR);
+    e = find_entry(&r, WALK_ROOT "/src/deep/util.c");
+    ASSERT("File should be found", e != NULL);
+    ASSERT("File kind", e->kind == WALK_FILE);
+    e = find_entry(&r, WALK_ROOT "/link.txt");
+    ASSERT("Symlink should be found", e != NULL);
+    ASSERT("Symlinks are not followed", e->kind == WALK_OTHER);
+
+    walk_result_free(&r);
+    cleanup_tree();
+}
+
+TEST(test_walk_skips_git_dir) {
+    setup_tree();
+
+    WalkResult r;
+    ASSERT("Walk should succeed", walk_tree(WALK_ROOT, 1, NULL, &r) == 0);
+    for (size_t i = 0; i < r.count; i++) {
+        ASSERT(".git must never be reported", strstr(r.entries[i].path, "/.git") == NULL);
+    }
+
+    walk_result_free(&r);
+    cleanup_tree();
+}
+
+TEST(test_walk_filter_prunes_directories) {
+    setup_tree();
+
+    WalkOptions opts = {.filter = reject_skip_dir};
+    WalkResult r;
+    ASSERT("Walk should succeed", walk_tree(WALK_ROOT, 4, &opts, &r) == 0);
+    ASSERT_EQUALS(11, (int)r.count);
+    ASSERT("Rejected directory is not reported", find_entry(&r, WALK_ROOT "/skip") == NULL);
+    ASSERT("Rejected directory is not descended",
+           find_entry(&r, WALK_ROOT "/skip/inner/hidden.c") == NULL);
+
+    walk_result_free(&r);
+    cleanup_tree();
+}
+
+/* enter_dir tags each directory with its depth; the filter sees the parent's tag */
+static int depth_tags[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+static void *depth_enter_dir(const char *path, int dir_fd, void *parent_ctx, void *user) {
+    (void)path;
+    (void)dir_fd;
+    (void)user;
+    return (int *)parent_ctx + 1;
+}
+
+static bool depth_filter(const char *path, WalkKind kind, void *dir_ctx, void *user) {
+    (void)kind;
+    (void)user;
+    int slashes = 0;
+    for (const char *p = path + strlen(WALK_ROOT); *p; p++) {
+        slashes += (*p == '/');
+    }
+    /* Entries directly under the root have one slash and depth 1 */
+    return *(int *)dir_ctx == slashes;
+}
+
+TEST(test_walk_enter_dir_context) {
+    setup_tree();
+
+    WalkOptions opts = {.filter = depth_filter, .enter_dir = depth_enter_dir, .root_ctx = depth_tags};
+    WalkResult r;
+    ASSERT("Walk should succeed", walk_tree(WALK_ROOT, 3, &opts, &r) == 0);
+    ASSERT_EQUALS(14, (int)r.count);
+
+    walk_result_free(&r);
+    cleanup_tree();
+}
+
+TEST(test_walk_parallel_matches_serial) {
+    setup_tree();
+    /* Enough directories to give idle workers something to steal */
+    char path[512];
+    for (int i = 0; i < 40; i++) {
+        snprintf(path, sizeof(path), WALK_ROOT "/wide/d%02d", i);
+        mkdir(WALK_ROOT "/wide", 0755);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), WALK_ROOT "/wide/d%02d/f.c", i);
+        write_file(path);
+    }
+
+    WalkResult serial, parallel;
+    ASSERT("Serial walk should succeed", walk_tree(WALK_ROOT, 1, NULL, &serial) == 0);
+    ASSERT("Parallel walk should succeed", walk_tree(WALK_ROOT, 8, NULL, &parallel) == 0);
+    ASSERT_EQUALS((int)serial.count, (int)parallel.count);
+    for (size_t i = 0; i < serial.count; i++) {
+        ASSERT_STR_EQUALS(serial.entries[i].path, parallel.entries[i].path);
+        ASSERT("Kinds should agree", serial.entries[i].kind == parallel.entries[i].kind);
+    }
+
+    walk_result_free(&serial);
+    walk_result_free(&parallel);
+    cleanup_tree();
+}
+
+TEST(test_walk_missing_root) {
+    WalkResult r;
+    ASSERT("Missing root is not an error", walk_tree(WALK_ROOT "/nope", 2, NULL, &r) == 0);
+    ASSERT_EQUALS(0, (int)r.count);
+    walk_result_free(&r);
+}
+
+int main(void) {
+    printf("Running walker tests\n");
+    printf("====================\n");
+
+    system("mkdir -p " TEST_DIR);
+
+    RUN_TEST(test_walk_finds_all_entries_sorted);
+    RUN_TEST(test_walk_reports_kinds);
+    RUN_TEST(test_walk_skips_git_dir);
+    RUN_TEST(test_walk_filter_prunes_directories);
+    RUN_TEST(test_walk_enter_dir_context);
+    RUN_TEST(test_walk_parallel_matches_serial);
+    RUN_TEST(test_walk_missing_root);
+
+    printf("\n");
+    PRINT_TEST_SUMMARY();
+}
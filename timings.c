@@ -0,0 +1,121 @@
+#include "timings.h"
+#include <time.h>
+
+bool g_timings_enabled = false;
+uint64_t g_timing_counters[COUNTER_COUNT];
+
+static uint64_t g_origin_ns;
+static uint64_t g_start_ns[TIMING_PHASE_COUNT];
+static uint64_t g_total_ns[TIMING_PHASE_COUNT];
+
+static const char* const k_phase_names[TIMING_PHASE_COUNT] = {
+    "config",   "gitignore",   "walk",        "rank",      "assemble",
+    "tokenize", "diagnostics", "save_prompt", "clipboard",
+};
+
+static const char* const k_counter_names[COUNTER_COUNT] = {
+    "lstat_calls",     "open_calls", "bytes_read", "bytes_written",
+    "tokenizer_calls", "tokens",     "io_queue_depth", "io_uring_ops",
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void timings_enable(void)
+{
+    if (!g_timings_enabled)
+    {
+        g_origin_ns = now_ns();
+        g_timings_enabled = true;
+    }
+}
+
+bool timings_enabled(void)
+{
+    return g_timings_enabled;
+}
+
+void timing_begin(TimingPhase phase)
+{
+    if (g_timings_enabled)
+    {
+        g_start_ns[phase] = now_ns();
+    }
+}
+
+void timing_end(TimingPhase phase)
+{
+    if (g_timings_enabled && g_start_ns[phase] != 0)
+    {
+        g_total_ns[phase] += now_ns() - g_start_ns[phase];
+        g_start_ns[phase] = 0;
+    }
+}
+
+uint64_t timing_total_us(TimingPhase phase)
+{
+    return g_total_ns[phase] / 1000;
+}
+
+uint64_t timing_elapsed_us(void)
+{
+    return g_timings_enabled ? (now_ns() - g_origin_ns) / 1000 : 0;
+}
+
+uint64_t timing_counter(TimingCounter counter)
+{
+    return __atomic_load_n(&g_timing_counters[counter], __ATOMIC_RELAXED);
+}
+
+const char* timing_phase_name(TimingPhase phase)
+{
+    return k_phase_names[phase];
+}
+
+const char* timing_counter_name(TimingCounter counter)
+{
+    return k_counter_names[counter];
+}
+
+void timings_write_json(FILE* out, const ArenaStats* arena, size_t scratch_high_water)
+{
+    fputc('{', out);
+    for (int p = 0; p < TIMING_PHASE_COUNT; p++)
+    {
+        fprintf(out, "\"%s_us\": %llu, ", k_phase_names[p],
+                (unsigned long long)timing_total_us((TimingPhase)p));
+    }
+    fprintf(out, "\"total_us\": %llu", (unsigned long long)timing_elapsed_us());
+    for (int c = 0; c < COUNTER_COUNT; c++)
+    {
+        fprintf(out, ", \"%s\": %llu", k_counter_names[c],
+                (unsigned long long)timing_counter((TimingCounter)c));
+    }
+    fprintf(out, ", \"arena_chunks\": %u, \"arena_reserved\": %zu", arena->chunks, arena->reserved);
+    fprintf(out, ", \"scratch_high_water\": %zu", scratch_high_water);
+    fprintf(out, ", \"arena_high_water\": %zu}\n", arena->high_water);
+}
+
+void timings_write_text(FILE* out, const ArenaStats* arena, size_t scratch_high_water)
+{
+    fprintf(out, "Timings:\n");
+    for (int p = 0; p < TIMING_PHASE_COUNT; p++)
+    {
+        fprintf(out, "  %-18s %10.2f ms\n", k_phase_names[p],
+                timing_total_us((TimingPhase)p) / 1000.0);
+    }
+    fprintf(out, "  %-18s %10.2f ms\n", "total", timing_elapsed_us() / 1000.0);
+    fprintf(out, "Counters:\n");
+    for (int c = 0; c < COUNTER_COUNT; c++)
+    {
+        fprintf(out, "  %-18s %10llu\n", k_counter_names[c],
+                (unsigned long long)timing_counter((TimingCounter)c));
+    }
+    fprintf(out, "  %-18s %10zu\n", "arena_high_water", arena->high_water);
+    fprintf(out, "  %-18s %10u\n", "arena_chunks", arena->chunks);
+    fprintf(out, "  %-18s %10zu\n", "scratch_high_water", scratch_high_water);
+}
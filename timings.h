@@ -0,0 +1,91 @@
+#ifndef TIMINGS_H
+#define TIMINGS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "arena.h"
+
+/**
+ * Phase timings and I/O counters
+ *
+ * Monotonic-clock totals for the phases of a run. A phase may be entered any
+ * number of times (streaming interleaves assembly and counting); its time is
+ * the sum of its spans. Counters tally system calls, bytes and tokenizer work
+ * from any thread. Everything is a no-op until timings_enable(), so the calls
+ * can stay on hot paths. Spans are not thread-safe: time phases from one
+ * thread.
+ */
+typedef enum
+{
+    TIMING_CONFIG,      /* Config file lookup and parsing */
+    TIMING_GITIGNORE,   /* Loading .gitignore files */
+    TIMING_WALK,        /* Collecting files from the arguments */
+    TIMING_RANK,        /* FileRank scoring and ordering */
+    TIMING_ASSEMBLE,    /* Rendering file fragments into the output */
+    TIMING_TOKENIZE,    /* Exact token counting */
+    TIMING_DIAGNOSTICS, /* The token diagnostics report */
+    TIMING_SAVE_PROMPT, /* Saving the prompt for `llm_ctx get` */
+    TIMING_CLIPBOARD,   /* Handing the output to the clipboard tool */
+    TIMING_PHASE_COUNT
+} TimingPhase;
+
+typedef enum
+{
+    COUNTER_LSTAT,           /* lstat()/fstatat() calls on input paths */
+    COUNTER_OPEN,            /* Input files and directories opened */
+    COUNTER_BYTES_READ,      /* Input bytes read or mapped */
+    COUNTER_BYTES_WRITTEN,   /* Output bytes written (stdout, files, clipboard, prompts) */
+    COUNTER_TOKENIZER_CALLS, /* Encoder invocations */
+    COUNTER_TOKENS,          /* Tokens those invocations produced */
+    COUNTER_IO_QUEUE_DEPTH,  /* Files the batch loader keeps in flight; 0 loads on first use */
+    COUNTER_IO_URING_OPS,    /* Opens, statx() calls and reads submitted through io_uring */
+    COUNTER_COUNT
+} TimingCounter;
+
+/* Read by the inline counter; use timings_enable() to set */
+extern bool g_timings_enabled;
+extern uint64_t g_timing_counters[COUNTER_COUNT];
+
+void timings_enable(void);
+bool timings_enabled(void);
+
+void timing_begin(TimingPhase phase);
+void timing_end(TimingPhase phase);
+
+/** Add n to a counter; safe from worker threads */
+static inline void timing_count(TimingCounter counter, uint64_t n)
+{
+    if (g_timings_enabled)
+    {
+        __atomic_fetch_add(&g_timing_counters[counter], n, __ATOMIC_RELAXED);
+    }
+}
+
+/** Total time spent in phase, in microseconds */
+uint64_t timing_total_us(TimingPhase phase);
+
+/** Microseconds since timings_enable() */
+uint64_t timing_elapsed_us(void);
+
+uint64_t timing_counter(TimingCounter counter);
+
+/** Stable lowercase name of a phase, used as its JSON key */
+const char* timing_phase_name(TimingPhase phase);
+
+/** Stable lowercase name of a counter, used as its JSON key */
+const char* timing_counter_name(TimingCounter counter);
+
+/**
+ * Write {"<phase>_us": N, ..., "total_us": N, "<counter>": N, ...} on one line
+ *
+ * The main arena's stats and the scratch arenas' peak follow the counters as
+ * "arena_chunks", "arena_reserved", "scratch_high_water" and, last,
+ * "arena_high_water".
+ */
+void timings_write_json(FILE* out, const ArenaStats* arena, size_t scratch_high_water);
+
+/** Write a human-readable table of phases and counters */
+void timings_write_text(FILE* out, const ArenaStats* arena, size_t scratch_high_water);
+
+#endif /* TIMINGS_H */
@@ -0,0 +1,55 @@
+#ifndef TOKENEST_H
+#define TOKENEST_H
+
+#include <stddef.h>
+#include "matcher.h"
+
+/**
+ * Token estimation from byte-class histograms
+ *
+ * A fragment's tokens are estimated as a per-model linear function of its
+ * byte classes: BPE spends about one token per word run plus a share of its
+ * length, merges whitespace runs, and splits punctuation and non-ASCII text
+ * finely. The weights are priors per vocabulary family; every exact count
+ * seen during the run (e.g. cached counts of unchanged files) recalibrates
+ * the estimate's scale and its error bound against the real tokenizer.
+ */
+
+/** Tokens per unit of each byte class */
+typedef struct
+{
+    double word_run;
+    double word_byte;
+    double space_run;
+    double space_byte;
+    double punct_byte;
+    double nonascii_byte;
+} TokenClassWeights;
+
+typedef struct
+{
+    const TokenClassWeights* weights;
+    double prior_error; /* Relative error of an estimate before anything is observed */
+    double raw;         /* Uncalibrated estimates of the observed fragments */
+    double exact;       /* Their exact tokens */
+    double exact_sq;    /* Sum of exact^2 / raw over them, for the spread */
+    int observed;
+} TokenEstimator;
+
+void token_estimator_init(TokenEstimator* est, const char* model);
+
+/** Fold the exact count of a fragment with the given byte classes into the estimator */
+void token_estimator_observe(TokenEstimator* est, const ByteClassCounts* counts, size_t tokens);
+
+/** Expected tokens of a fragment with the given byte classes */
+size_t token_estimator_estimate(const TokenEstimator* est, const ByteClassCounts* counts);
+
+/**
+ * Relative error a total of estimates stays within, e.g. 0.15 for 15%
+ *
+ * Starts from the model's prior and tightens or widens with the spread of
+ * the observed fragments around the calibrated scale.
+ */
+double token_estimator_error(const TokenEstimator* est);
+
+#endif /* TOKENEST_H */
@@ -1,4 +1,5 @@
 #include "tokenizer.h"
+#include "timings.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,7 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
 
 /* Types from tiktoken-c */
 typedef void CoreBPE;
@@ -164,21 +166,61 @@ static void ensure_tokenizer_ready(void)
     }
 }
 
-size_t llm_count_tokens(const char* text, const char* model)
+/* One encoder per model, built on first use and kept until closed. Building the
+ * BPE rank table dominates the cost of a count, so it must happen once per run. */
+#define MAX_TOKENIZER_SESSIONS 8
+
+struct LLMTokenizer
 {
-    if (!text || !model)
+    char model[256];
+    CoreBPE* bpe;
+};
+
+static LLMTokenizer g_sessions[MAX_TOKENIZER_SESSIONS];
+static int g_session_count = 0;
+
+LLMTokenizer* llm_tokenizer_open(const char* model)
+{
+    if (!model)
     {
-        return SIZE_MAX;
+        return NULL;
     }
 
-    /* Ensure library is loaded */
-    ensure_tokenizer_ready();
-
     /* Validate model string */
-    assert(model != NULL);
     assert(strlen(model) > 0);
     assert(strlen(model) < 256); /* Reasonable model name length */
 
+    for (int i = 0; i < g_session_count; i++)
+    {
+        if (g_sessions[i].bpe && strcmp(g_sessions[i].model, model) == 0)
+        {
+            return &g_sessions[i];
+        }
+    }
+
+    /* Ensure library is loaded */
+    ensure_tokenizer_ready();
+
+    LLMTokenizer* slot = NULL;
+    for (int i = 0; i < g_session_count; i++)
+    {
+        if (!g_sessions[i].bpe)
+        {
+            slot = &g_sessions[i];
+            break;
+        }
+    }
+    if (!slot)
+    {
+        if (g_session_count >= MAX_TOKENIZER_SESSIONS)
+        {
+            fprintf(stderr, "fatal: too many tokenizer models in use (max %d)\n",
+                    MAX_TOKENIZER_SESSIONS);
+            exit(EXIT_FAILURE);
+        }
+        slot = &g_sessions[g_session_count++];
+    }
+
     /* Get the BPE encoder for the model */
     CoreBPE* bpe = g_get_bpe_from_model(model);
     if (!bpe)
@@ -188,12 +230,23 @@ size_t llm_count_tokens(const char* text, const char* model)
         exit(EXIT_FAILURE);
     }
 
-    /* Validate BPE encoder */
-    assert(bpe != NULL);
+    snprintf(slot->model, sizeof(slot->model), "%s", model);
+    slot->bpe = bpe;
+    return slot;
+}
+
+size_t llm_tokenizer_count(LLMTokenizer* tok, const char* text)
+{
+    if (!tok || !tok->bpe || !text)
+    {
+        return SIZE_MAX;
+    }
 
     /* Encode the text */
     size_t num_tokens = 0;
-    Rank* tokens = g_encode_ordinary(bpe, text, &num_tokens);
+    Rank* tokens = g_encode_ordinary(tok->bpe, text, &num_tokens);
+    timing_count(COUNTER_TOKENIZER_CALLS, 1);
+    timing_count(COUNTER_TOKENS, num_tokens);
 
     /* Assert that we got a reasonable token count */
     if (num_tokens > 0 && num_tokens < SIZE_MAX)
@@ -217,11 +270,190 @@ size_t llm_count_tokens(const char* text, const char* model)
     {
         free(tokens);
     }
-    g_destroy_corebpe(bpe);
 
     return num_tokens;
 }
 
+size_t llm_tokenizer_count_n(LLMTokenizer* tok, const char* text, size_t len)
+{
+    if (!tok || !text)
+    {
+        return SIZE_MAX;
+    }
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    /* tiktoken-c only accepts NUL-terminated input, so views are copied */
+    char* copy = malloc(len + 1);
+    if (!copy)
+    {
+        return SIZE_MAX;
+    }
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+
+    size_t num_tokens = llm_tokenizer_count(tok, copy);
+    free(copy);
+    return num_tokens;
+}
+
+/* Below this many bytes a batch is counted on the calling thread; spawning
+ * workers costs more than it saves. */
+#define PARALLEL_COUNT_MIN_BYTES (64 * 1024)
+
+typedef struct
+{
+    LLMTokenizer* tok;
+    TokenSpan* spans;
+    size_t* order; /* Span indices, largest first, so stragglers are small */
+    size_t count;
+    size_t next;   /* Next position in order[], claimed atomically */
+    int failed;
+} CountBatch;
+
+/** Count one span, skipping the copy when it is already NUL-terminated */
+static size_t count_span(LLMTokenizer* tok, const TokenSpan* span)
+{
+    if (span->terminated && span->len > 0)
+    {
+        return llm_tokenizer_count(tok, span->text);
+    }
+    return llm_tokenizer_count_n(tok, span->text, span->len);
+}
+
+static void* count_batch_worker(void* arg)
+{
+    CountBatch* batch = (CountBatch*)arg;
+    for (;;)
+    {
+        size_t pos = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (pos >= batch->count)
+        {
+            break;
+        }
+        TokenSpan* span = &batch->spans[batch->order[pos]];
+        span->tokens = count_span(batch->tok, span);
+        if (span->tokens == SIZE_MAX)
+        {
+            __atomic_store_n(&batch->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+static TokenSpan* g_sort_spans = NULL;
+
+static int compare_span_len_desc(const void* a, const void* b)
+{
+    size_t la = g_sort_spans[*(const size_t*)a].len;
+    size_t lb = g_sort_spans[*(const size_t*)b].len;
+    return (la < lb) - (la > lb);
+}
+
+int llm_tokenizer_count_batch(LLMTokenizer* tok, TokenSpan* spans, size_t count, int jobs)
+{
+    if (!tok || (!spans && count > 0))
+    {
+        return -1;
+    }
+
+    size_t total_bytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        total_bytes += spans[i].len;
+    }
+
+    if (jobs < 1)
+    {
+        jobs = 1;
+    }
+    if ((size_t)jobs > count)
+    {
+        jobs = (int)count;
+    }
+
+    size_t* order = NULL;
+    if (jobs > 1 && total_bytes >= PARALLEL_COUNT_MIN_BYTES)
+    {
+        order = malloc(count * sizeof(size_t));
+    }
+
+    if (!order)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            spans[i].tokens = count_span(tok, &spans[i]);
+            if (spans[i].tokens == SIZE_MAX)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        order[i] = i;
+    }
+    g_sort_spans = spans;
+    qsort(order, count, sizeof(size_t), compare_span_len_desc);
+    g_sort_spans = NULL;
+
+    CountBatch batch = {.tok = tok, .spans = spans, .order = order, .count = count};
+
+    /* The calling thread is one of the workers */
+    pthread_t* threads = malloc((size_t)(jobs - 1) * sizeof(pthread_t));
+    int started = 0;
+    if (threads)
+    {
+        for (int i = 0; i < jobs - 1; i++)
+        {
+            if (pthread_create(&threads[i], NULL, count_batch_worker, &batch) != 0)
+            {
+                break;
+            }
+            started++;
+        }
+    }
+
+    count_batch_worker(&batch);
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(order);
+
+    return batch.failed ? -1 : 0;
+}
+
+void llm_tokenizer_close(LLMTokenizer* tok)
+{
+    if (!tok || !tok->bpe)
+    {
+        return;
+    }
+
+    assert(tok >= g_sessions && tok < g_sessions + MAX_TOKENIZER_SESSIONS);
+    g_destroy_corebpe(tok->bpe);
+    tok->bpe = NULL;
+    tok->model[0] = '\0';
+}
+
+size_t llm_count_tokens(const char* text, const char* model)
+{
+    if (!text || !model)
+    {
+        return SIZE_MAX;
+    }
+
+    /* Reuses the cached encoder for this model; see llm_tokenizer_open() */
+    return llm_tokenizer_count(llm_tokenizer_open(model), text);
+}
+
 int llm_tokenizer_available(void)
 {
     load_tokenizer_lib();
@@ -1,16 +1,72 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 
 /* Lazy-loaded tiktoken integration - tokens counted on demand */
 struct Arena;
 
+/* Tokenizer session: the encoder for a model is built once and reused by every
+ * count until llm_tokenizer_close(). Opening the same model twice returns the
+ * same handle. */
+typedef struct LLMTokenizer LLMTokenizer;
+
+LLMTokenizer* llm_tokenizer_open(const char* model);
+size_t llm_tokenizer_count(LLMTokenizer* tok, const char* text);
+size_t llm_tokenizer_count_n(LLMTokenizer* tok, const char* text, size_t len);
+void llm_tokenizer_close(LLMTokenizer* tok);
+
+/* Independent slice of text to count; tokens is filled in by the batch call */
+typedef struct
+{
+    const char* text;
+    size_t len;
+    bool terminated; /* text[len] is '\0', so the span is counted without a copy */
+    size_t tokens;
+} TokenSpan;
+
+/* Count every span, spreading the work over up to `jobs` threads (the caller
+ * included). Encoders are safe to share once opened. Returns 0 on success,
+ * -1 if any span failed to encode. */
+int llm_tokenizer_count_batch(LLMTokenizer* tok, TokenSpan* spans, size_t count, int jobs);
+
 size_t llm_count_tokens(const char* text, const char* model);
 int llm_tokenizer_available(void);
 void llm_set_executable_dir(const char* dir);
-void generate_token_diagnostics(const char* content, const char* model, FILE* out,
-                                struct Arena* arena);
+
+/* Row of a diagnostics report whose count is already known */
+typedef struct
+{
+    const char* name;
+    size_t tokens;
+} TokenCount;
+
+/* Rows listed before the rest are folded into one, unless told otherwise */
+#define TOKEN_DIAG_DEFAULT_TOP 20
+
+typedef struct
+{
+    const TokenCount* known; /* Counts already taken for files, matched by "File:" label */
+    size_t known_count;
+    size_t top;              /* Rows to list before folding the rest; 0 lists every row */
+    int jobs;                /* Threads for counting what is not known */
+} TokenDiagOptions;
+
+/* Parse an assembled prompt in place and print its token breakdown. Only
+ * sections, files without a known count, and the text between them are
+ * tokenized, each once; the total is the sum of those pieces. opts may be
+ * NULL. */
+void generate_token_diagnostics(const char* content, size_t len, const char* model,
+                                const TokenDiagOptions* opts, FILE* out, struct Arena* arena);
+
+/* Print a diagnostics report from counts gathered during assembly: rows by
+ * descending count with their share and cumulative share of the total, the
+ * rows past `top` (unless it is 0) folded into one, and tokens not attributed to any
+ * section or file reported as <other>. */
+void report_token_diagnostics(const TokenCount* sections, size_t section_count,
+                              const TokenCount* files, size_t file_count, size_t total_tokens,
+                              size_t top, FILE* out);
 
 #endif /* TOKENIZER_H */
\ No newline at end of file
@@ -3,208 +3,164 @@
 #include <string.h>
 #include <stddef.h>
 #include <stdbool.h>
-#include <ctype.h>
+#include <stdint.h>
 #include "tokenizer.h"
 #include "arena.h"
 
-typedef struct
+typedef enum
 {
-    const char* filename;
-    size_t tokens;
-} FileTokenCount;
+    STATE_TOP_LEVEL,
+    STATE_IN_FILE_CONTEXT,
+    STATE_IN_SECTION
+} ParserState;
 
+typedef enum
+{
+    ROW_SECTION,
+    ROW_FILE,
+    ROW_GAP /* Text between rows: tags, file headers, separators */
+} RowKind;
+
+/* Span of the prompt and what it counts towards */
 typedef struct
 {
+    RowKind kind;
     const char* name;
+    size_t start;
+    size_t end;
     size_t tokens;
-} SectionTokenCount;
+    bool known;
+} DiagRow;
 
-typedef enum
+/* Top-level sections the breakdown reports on their own */
+static const struct
 {
-    STATE_TOP_LEVEL,
-    STATE_IN_FILE_TREE,
-    STATE_IN_FILE_CONTEXT,
-    STATE_IN_FILE,
-    STATE_IN_CODE_BLOCK,
-    STATE_IN_USER_INSTRUCTIONS,
-    STATE_IN_SYSTEM_INSTRUCTIONS,
-    STATE_IN_RESPONSE_GUIDE,
-    STATE_IN_OTHER_SECTION
-} ParserState;
+    const char* open;
+    const char* close;
+    const char* name;
+} k_sections[] = {
+    {"<file_tree>", "</file_tree>", "file_tree"},
+    {"<user_instructions>", "</user_instructions>", "user_instructions"},
+    {"<system_instructions>", "</system_instructions>", "system_instructions"},
+    {"<response_guide>", "</response_guide>", "response_guide"},
+};
 
 typedef struct
 {
+    const char* text;
+    const TokenDiagOptions* opts;
+    const TokenCount** known_by_name; /* opts->known sorted by name */
+    DiagRow* rows;
+    size_t row_count;
+    size_t row_cap;
+    size_t covered; /* End of the last row; what lies before the next one is a gap */
     ParserState state;
-    const char* section_name;
-    const char* start_pos;
-} StateStackEntry;
-
-typedef struct
-{
-    StateStackEntry stack[32];
-    int stack_depth;
-    const char* current_file_name;
-    const char* current_file_start;
-    bool in_code_fence;
-    int code_fence_backticks;
-    FileTokenCount* files;
-    SectionTokenCount* sections;
-    size_t file_count;
-    size_t section_count;
-    size_t max_files;
-    size_t max_sections;
+    int section;
+    size_t section_start;
+    const char* file_name;
+    size_t file_start;
+    int fence; /* Backticks of the open code fence of the current file, 0 outside one */
+    Arena* arena;
 } ParserContext;
 
-static void parser_init(ParserContext* ctx, FileTokenCount* files, size_t max_files,
-                        SectionTokenCount* sections, size_t max_sections)
-{
-    memset(ctx, 0, sizeof(*ctx));
-    ctx->files = files;
-    ctx->sections = sections;
-    ctx->max_files = max_files;
-    ctx->max_sections = max_sections;
-    ctx->stack[0].state = STATE_TOP_LEVEL;
-    ctx->stack[0].section_name = NULL;
-    ctx->stack[0].start_pos = NULL;
-    ctx->stack_depth = 1;
-}
-
-static void parser_push_state(ParserContext* ctx, ParserState state, const char* section_name,
-                              const char* start_pos)
+static int compare_known_by_name(const void* a, const void* b)
 {
-    if (ctx->stack_depth < 32)
-    {
-        ctx->stack[ctx->stack_depth].state = state;
-        ctx->stack[ctx->stack_depth].section_name = section_name;
-        ctx->stack[ctx->stack_depth].start_pos = start_pos;
-        ctx->stack_depth++;
-    }
+    return strcmp((*(const TokenCount* const*)a)->name, (*(const TokenCount* const*)b)->name);
 }
 
-static void parser_pop_state(ParserContext* ctx)
+/** Count the assembly stage already took for the file labelled name, or NULL */
+static const TokenCount* find_known(const ParserContext* ctx, const char* name)
 {
-    if (ctx->stack_depth > 1)
+    if (!ctx->known_by_name)
     {
-        ctx->stack_depth--;
+        return NULL;
     }
+    TokenCount key = {name, 0};
+    const TokenCount* key_ptr = &key;
+    const TokenCount** hit = bsearch(&key_ptr, ctx->known_by_name, ctx->opts->known_count,
+                                     sizeof(*ctx->known_by_name), compare_known_by_name);
+    return hit ? *hit : NULL;
 }
 
-static ParserState parser_current_state(ParserContext* ctx)
-{
-    return ctx->stack[ctx->stack_depth - 1].state;
-}
-
-/* Save a section with its token count */
-static void save_section(ParserContext* ctx, const char* name, const char* start, const char* end,
-                         const char* model, Arena* arena)
+static void add_row(ParserContext* ctx, RowKind kind, const char* name, size_t start, size_t end)
 {
-    if (ctx->section_count >= ctx->max_sections)
-        return;
-
-    size_t len = end - start;
-    char* content = arena_push_array_safe(arena, char, len + 1);
-    if (!content)
-        return;
-
-    memcpy(content, start, len);
-    content[len] = '\0';
-
-    size_t tokens = llm_count_tokens(content, model);
-    if (tokens == SIZE_MAX)
+    if (ctx->row_count == ctx->row_cap)
     {
-        fprintf(stderr, "fatal: tokenizer failed while counting section '%s'\n", name);
-        exit(EXIT_FAILURE);
+        size_t cap = ctx->row_cap ? ctx->row_cap * 2 : 64;
+        DiagRow* grown = realloc(ctx->rows, cap * sizeof(DiagRow));
+        if (!grown)
+        {
+            fprintf(stderr, "fatal: out of memory while generating diagnostics\n");
+            exit(EXIT_FAILURE);
+        }
+        ctx->rows = grown;
+        ctx->row_cap = cap;
     }
-
-    char* name_copy = arena_strdup_safe(arena, name);
-    if (name_copy)
+    DiagRow* row = &ctx->rows[ctx->row_count++];
+    memset(row, 0, sizeof(*row));
+    row->kind = kind;
+    row->name = name;
+    row->start = start;
+    row->end = end;
+    const TokenCount* known = kind == ROW_FILE ? find_known(ctx, name) : NULL;
+    if (known)
     {
-        ctx->sections[ctx->section_count].name = name_copy;
-        ctx->sections[ctx->section_count].tokens = tokens;
-        ctx->section_count++;
+        row->tokens = known->tokens;
+        row->known = true;
     }
 }
 
-/* Save a file with its token count */
-static void save_file(ParserContext* ctx, const char* filename, const char* start, const char* end,
-                      const char* model, Arena* arena)
+/** Record [start, end) as a section or file, and what preceded it as a gap */
+static void save_row(ParserContext* ctx, RowKind kind, const char* name, size_t start,
+                     size_t end)
 {
-    if (ctx->file_count >= ctx->max_files)
-        return;
-
-    size_t len = end - start;
-    char* content = arena_push_array_safe(arena, char, len + 1);
-    if (!content)
-        return;
-
-    memcpy(content, start, len);
-    content[len] = '\0';
-
-    size_t tokens = llm_count_tokens(content, model);
-    if (tokens == SIZE_MAX)
+    if (start > ctx->covered)
     {
-        fprintf(stderr, "fatal: tokenizer failed while counting file '%s'\n", filename);
-        exit(EXIT_FAILURE);
+        add_row(ctx, ROW_GAP, NULL, ctx->covered, start);
     }
+    add_row(ctx, kind, name, start, end);
+    ctx->covered = end;
+}
 
-    char* name_copy = arena_strdup_safe(arena, filename);
-    if (name_copy)
-    {
-        ctx->files[ctx->file_count].filename = name_copy;
-        ctx->files[ctx->file_count].tokens = tokens;
-        ctx->file_count++;
-    }
+/** First non-blank byte of the line [line, end) */
+static const char* skip_blanks(const char* line, const char* end)
+{
+    while (line < end && (*line == ' ' || *line == '\t' || *line == '\r'))
+        line++;
+    return line;
 }
 
 /* Check if a line starts with a tag */
-static bool line_starts_with_tag(const char* line, const char* tag)
+static bool line_starts_with_tag(const char* line, const char* end, const char* tag)
 {
-    /* Skip leading whitespace */
-    while (*line && isspace(*line))
-        line++;
-    return strncmp(line, tag, strlen(tag)) == 0;
+    line = skip_blanks(line, end);
+    size_t len = strlen(tag);
+    return (size_t)(end - line) >= len && memcmp(line, tag, len) == 0;
 }
 
 /* Extract filename from "File: filename" line */
-static char* extract_filename(const char* line, Arena* arena)
+static const char* extract_filename(const char* line, const char* end, Arena* arena)
 {
-    /* Skip leading whitespace */
-    while (*line && isspace(*line))
-        line++;
-
-    if (strncmp(line, "File:", 5) != 0)
-        return NULL;
-
-    line += 5;
-    while (*line && isspace(*line))
-        line++;
-
-    /* Find end of line */
-    const char* end = line;
-    while (*end && *end != '\n' && *end != '\r')
-        end++;
-
-    size_t len = end - line;
+    line = skip_blanks(line, end) + strlen("File:");
+    line = skip_blanks(line, end);
+    while (end > line && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    size_t len = (size_t)(end - line);
     if (len == 0)
         return NULL;
 
     char* filename = arena_push_array_safe(arena, char, len + 1);
-    if (!filename)
-        return NULL;
-
     memcpy(filename, line, len);
     filename[len] = '\0';
-
     return filename;
 }
 
 /* Count backticks at start of line */
-static int count_backticks(const char* line)
+static int count_backticks(const char* line, const char* end)
 {
+    line = skip_blanks(line, end);
     int count = 0;
-    while (*line && isspace(*line))
-        line++;
-    while (*line == '`')
+    while (line < end && *line == '`')
     {
         count++;
         line++;
@@ -212,201 +168,296 @@ static int count_backticks(const char* line)
     return count;
 }
 
-// Generate token breakdown by file and section
-void generate_token_diagnostics(const char* content, const char* model, FILE* out, Arena* arena)
+/** Whether the line closes a fence of `fence` backticks: as many or more, then blanks */
+static bool closes_fence(const char* line, const char* end, int fence)
 {
-    if (!content || !model || !out)
-        return;
-
-    size_t total_tokens = llm_count_tokens(content, model);
-    if (total_tokens == SIZE_MAX)
+    line = skip_blanks(line, end);
+    int count = 0;
+    while (line < end && *line == '`')
     {
-        fprintf(stderr, "fatal: tokenizer failed while generating diagnostics\n");
-        exit(EXIT_FAILURE);
+        count++;
+        line++;
     }
+    return count >= fence && skip_blanks(line, end) == end;
+}
 
-    FileTokenCount* files = arena_push_array_safe(arena, FileTokenCount, 1000);
-    SectionTokenCount* sections = arena_push_array_safe(arena, SectionTokenCount, 20);
-    if (!files || !sections)
-        return;
-
-    ParserContext ctx;
-    parser_init(&ctx, files, 1000, sections, 20);
-
-    const char* pos = content;
-    const char* line_start = content;
-
-    while (*pos)
+static void end_file(ParserContext* ctx, size_t at)
+{
+    if (ctx->file_name)
     {
-        const char* line_end = pos;
-        while (*line_end && *line_end != '\n')
-            line_end++;
-
-        size_t line_len = line_end - line_start;
-        char* line = arena_push_array_safe(arena, char, line_len + 1);
-        if (!line)
-            break;
-
-        memcpy(line, line_start, line_len);
-        line[line_len] = '\0';
+        save_row(ctx, ROW_FILE, ctx->file_name, ctx->file_start, at);
+        ctx->file_name = NULL;
+    }
+    ctx->fence = 0;
+}
 
-        ParserState state = parser_current_state(&ctx);
+/** Advance the parser over the line [line, end); next is the start of the line after it */
+static void parse_line(ParserContext* ctx, const char* line, const char* end, const char* next,
+                       const char* limit)
+{
+    size_t line_pos = (size_t)(line - ctx->text);
+    size_t next_pos = (size_t)(next - ctx->text);
 
-        switch (state)
+    switch (ctx->state)
+    {
+    case STATE_TOP_LEVEL:
+        if (line_starts_with_tag(line, end, "<file_context>"))
         {
-        case STATE_TOP_LEVEL:
-            if (line_starts_with_tag(line, "<file_tree>"))
-            {
-                parser_push_state(&ctx, STATE_IN_FILE_TREE, "file_tree", line_end + 1);
-            }
-            else if (line_starts_with_tag(line, "<file_context>"))
-            {
-                parser_push_state(&ctx, STATE_IN_FILE_CONTEXT, "file_context", line_end + 1);
-            }
-            else if (line_starts_with_tag(line, "<user_instructions>"))
-            {
-                parser_push_state(&ctx, STATE_IN_USER_INSTRUCTIONS, "user_instructions",
-                                  line_end + 1);
-            }
-            else if (line_starts_with_tag(line, "<system_instructions>"))
-            {
-                parser_push_state(&ctx, STATE_IN_SYSTEM_INSTRUCTIONS, "system_instructions",
-                                  line_end + 1);
-            }
-            else if (line_starts_with_tag(line, "<response_guide>"))
+            ctx->state = STATE_IN_FILE_CONTEXT;
+            return;
+        }
+        for (size_t i = 0; i < sizeof(k_sections) / sizeof(k_sections[0]); i++)
+        {
+            if (line_starts_with_tag(line, end, k_sections[i].open))
             {
-                parser_push_state(&ctx, STATE_IN_RESPONSE_GUIDE, "response_guide", line_end + 1);
+                ctx->state = STATE_IN_SECTION;
+                ctx->section = (int)i;
+                ctx->section_start = next_pos;
+                return;
             }
-            break;
+        }
+        break;
 
-        case STATE_IN_FILE_TREE:
-            if (line_starts_with_tag(line, "</file_tree>"))
-            {
-                StateStackEntry* entry = &ctx.stack[ctx.stack_depth - 1];
-                save_section(&ctx, entry->section_name, entry->start_pos, line_start, model, arena);
-                parser_pop_state(&ctx);
-            }
-            break;
+    case STATE_IN_SECTION:
+        if (line_starts_with_tag(line, end, k_sections[ctx->section].close))
+        {
+            save_row(ctx, ROW_SECTION, k_sections[ctx->section].name, ctx->section_start,
+                     line_pos);
+            ctx->state = STATE_TOP_LEVEL;
+        }
+        break;
 
-        case STATE_IN_FILE_CONTEXT:
-            if (line_starts_with_tag(line, "</file_context>"))
-            {
-                if (ctx.current_file_name && ctx.current_file_start)
-                {
-                    save_file(&ctx, ctx.current_file_name, ctx.current_file_start, line_start,
-                              model, arena);
-                    ctx.current_file_name = NULL;
-                    ctx.current_file_start = NULL;
-                }
-                parser_pop_state(&ctx);
-            }
-            else if (line_starts_with_tag(line, "File:"))
-            {
-                if (ctx.current_file_name && ctx.current_file_start)
-                {
-                    save_file(&ctx, ctx.current_file_name, ctx.current_file_start, line_start,
-                              model, arena);
-                }
-
-                ctx.current_file_name = extract_filename(line, arena);
-                ctx.current_file_start = line_end + 1;
-
-                const char* next_line = line_end + 1;
-                if (*next_line)
-                {
-                    int backticks = count_backticks(next_line);
-                    if (backticks >= 3)
-                    {
-                        ctx.in_code_fence = true;
-                        ctx.code_fence_backticks = backticks;
-                    }
-                }
-            }
-            else if (ctx.in_code_fence)
+    case STATE_IN_FILE_CONTEXT:
+        /* WHY: Inside a file's code fence, lines that look like headers or
+         * the closing tag are that file's content. */
+        if (ctx->fence > 0)
+        {
+            if (closes_fence(line, end, ctx->fence))
             {
-                int backticks = count_backticks(line);
-                if (backticks >= ctx.code_fence_backticks)
-                {
-                    ctx.in_code_fence = false;
-                    ctx.code_fence_backticks = 0;
-                }
+                ctx->fence = 0;
             }
-            break;
-
-        case STATE_IN_USER_INSTRUCTIONS:
-            if (line_starts_with_tag(line, "</user_instructions>"))
+        }
+        else if (line_starts_with_tag(line, end, "</file_context>"))
+        {
+            end_file(ctx, line_pos);
+            ctx->state = STATE_TOP_LEVEL;
+        }
+        else if (line_starts_with_tag(line, end, "File:"))
+        {
+            end_file(ctx, line_pos);
+            ctx->file_name = extract_filename(line, end, ctx->arena);
+            ctx->file_start = next_pos;
+            if (next < limit)
             {
-                StateStackEntry* entry = &ctx.stack[ctx.stack_depth - 1];
-                save_section(&ctx, entry->section_name, entry->start_pos, line_start, model, arena);
-                parser_pop_state(&ctx);
+                /* The fence opens on the line after the header */
+                const char* fence_end = memchr(next, '\n', (size_t)(limit - next));
+                int backticks = count_backticks(next, fence_end ? fence_end : limit);
+                ctx->fence = backticks >= 3 ? -backticks : 0;
             }
-            break;
+        }
+        else if (ctx->fence < 0)
+        {
+            ctx->fence = -ctx->fence; /* This line is the opening fence itself */
+        }
+        break;
+    }
+}
 
-        case STATE_IN_SYSTEM_INSTRUCTIONS:
-            if (line_starts_with_tag(line, "</system_instructions>"))
-            {
-                StateStackEntry* entry = &ctx.stack[ctx.stack_depth - 1];
-                save_section(&ctx, entry->section_name, entry->start_pos, line_start, model, arena);
-                parser_pop_state(&ctx);
-            }
-            break;
+// Generate token breakdown by file and section
+void generate_token_diagnostics(const char* content, size_t len, const char* model,
+                                const TokenDiagOptions* opts, FILE* out, Arena* arena)
+{
+    if (!content || !model || !out)
+        return;
 
-        case STATE_IN_RESPONSE_GUIDE:
-            if (line_starts_with_tag(line, "</response_guide>"))
-            {
-                StateStackEntry* entry = &ctx.stack[ctx.stack_depth - 1];
-                save_section(&ctx, entry->section_name, entry->start_pos, line_start, model, arena);
-                parser_pop_state(&ctx);
-            }
-            break;
+    TokenDiagOptions defaults = {NULL, 0, TOKEN_DIAG_DEFAULT_TOP, 1};
+    ParserContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.text = content;
+    ctx.opts = opts ? opts : &defaults;
+    ctx.arena = arena;
+    ctx.state = STATE_TOP_LEVEL;
 
-        default:
-            break;
+    if (ctx.opts->known_count > 0)
+    {
+        ctx.known_by_name = arena_push_array_safe(arena, const TokenCount*, ctx.opts->known_count);
+        for (size_t i = 0; i < ctx.opts->known_count; i++)
+        {
+            ctx.known_by_name[i] = &ctx.opts->known[i];
         }
+        qsort(ctx.known_by_name, ctx.opts->known_count, sizeof(*ctx.known_by_name),
+              compare_known_by_name);
+    }
 
-        pos = (*line_end) ? line_end + 1 : line_end;
-        line_start = pos;
+    /* WHY: Lines are classified where they lie; nothing is copied but the
+     * file names the report prints. */
+    const char* limit = content + len;
+    const char* line = content;
+    while (line < limit)
+    {
+        const char* nl = memchr(line, '\n', (size_t)(limit - line));
+        const char* end = nl ? nl : limit;
+        const char* next = nl ? nl + 1 : limit;
+        parse_line(&ctx, line, end, next, limit);
+        line = next;
     }
 
-    while (ctx.stack_depth > 1)
+    /* Sections left open run to the end */
+    if (ctx.state == STATE_IN_FILE_CONTEXT)
     {
-        ParserState state = parser_current_state(&ctx);
-        StateStackEntry* entry = &ctx.stack[ctx.stack_depth - 1];
+        end_file(&ctx, len);
+    }
+    else if (ctx.state == STATE_IN_SECTION)
+    {
+        save_row(&ctx, ROW_SECTION, k_sections[ctx.section].name, ctx.section_start, len);
+    }
+    if (len > ctx.covered)
+    {
+        add_row(&ctx, ROW_GAP, NULL, ctx.covered, len);
+    }
 
-        if (state == STATE_IN_FILE_CONTEXT && ctx.current_file_name && ctx.current_file_start)
+    /* Count every piece without a known count, each exactly once */
+    TokenSpan* spans = arena_push_array_safe(arena, TokenSpan, ctx.row_count + 1);
+    size_t* span_row = arena_push_array_safe(arena, size_t, ctx.row_count + 1);
+    size_t span_count = 0;
+    for (size_t i = 0; i < ctx.row_count; i++)
+    {
+        const DiagRow* row = &ctx.rows[i];
+        if (row->known || row->end == row->start)
         {
-            save_file(&ctx, ctx.current_file_name, ctx.current_file_start, pos, model, arena);
+            continue;
         }
-        else if (entry->start_pos)
+        spans[span_count].text = content + row->start;
+        spans[span_count].len = row->end - row->start;
+        spans[span_count].terminated = false;
+        spans[span_count].tokens = 0;
+        span_row[span_count++] = i;
+    }
+    if (span_count > 0)
+    {
+        LLMTokenizer* tok = llm_tokenizer_open(model);
+        if (!tok || llm_tokenizer_count_batch(tok, spans, span_count, ctx.opts->jobs) != 0)
         {
-            save_section(&ctx, entry->section_name, entry->start_pos, pos, model, arena);
+            fprintf(stderr, "fatal: tokenizer failed while generating diagnostics\n");
+            exit(EXIT_FAILURE);
         }
+        for (size_t i = 0; i < span_count; i++)
+        {
+            ctx.rows[span_row[i]].tokens = spans[i].tokens;
+        }
+    }
 
-        parser_pop_state(&ctx);
+    size_t section_count = 0, file_count = 0, total_tokens = 0;
+    for (size_t i = 0; i < ctx.row_count; i++)
+    {
+        total_tokens += ctx.rows[i].tokens;
+        section_count += ctx.rows[i].kind == ROW_SECTION;
+        file_count += ctx.rows[i].kind == ROW_FILE;
+    }
+    TokenCount* sections = arena_push_array_safe(arena, TokenCount, section_count + 1);
+    TokenCount* files = arena_push_array_safe(arena, TokenCount, file_count + 1);
+    section_count = file_count = 0;
+    for (size_t i = 0; i < ctx.row_count; i++)
+    {
+        const DiagRow* row = &ctx.rows[i];
+        if (row->kind == ROW_SECTION)
+        {
+            sections[section_count].name = row->name;
+            sections[section_count++].tokens = row->tokens;
+        }
+        else if (row->kind == ROW_FILE)
+        {
+            /* A "File:" header without a name still counts towards its tokens */
+            files[file_count].name = row->name ? row->name : "(unnamed)";
+            files[file_count++].tokens = row->tokens;
+        }
     }
+    free(ctx.rows);
 
-    fprintf(out, "  Tokens   File\n");
-    fprintf(out, "  -------  ------------------------\n");
+    report_token_diagnostics(sections, section_count, files, file_count, total_tokens,
+                             ctx.opts->top, out);
+}
+
+typedef struct
+{
+    const TokenCount* count;
+    bool section;
+    size_t order;
+} ReportRow;
+
+/* By descending count; sections first, then input order, among equals */
+static int compare_report_rows(const void* a, const void* b)
+{
+    const ReportRow* ra = a;
+    const ReportRow* rb = b;
+    if (ra->count->tokens != rb->count->tokens)
+        return ra->count->tokens < rb->count->tokens ? 1 : -1;
+    if (ra->section != rb->section)
+        return ra->section ? -1 : 1;
+    return (ra->order > rb->order) - (ra->order < rb->order);
+}
+
+static double share_of(size_t tokens, size_t total)
+{
+    return total > 0 ? 100.0 * (double)tokens / (double)total : 0.0;
+}
+
+void report_token_diagnostics(const TokenCount* sections, size_t section_count,
+                              const TokenCount* files, size_t file_count, size_t total_tokens,
+                              size_t top, FILE* out)
+{
+    if (!out)
+        return;
+
+    size_t row_count = section_count + file_count;
+    ReportRow* rows = malloc((row_count ? row_count : 1) * sizeof(ReportRow));
+    if (!rows)
+        return;
+    for (size_t i = 0; i < section_count; i++)
+    {
+        rows[i] = (ReportRow){&sections[i], true, i};
+    }
+    for (size_t i = 0; i < file_count; i++)
+    {
+        rows[section_count + i] = (ReportRow){&files[i], false, i};
+    }
+    qsort(rows, row_count, sizeof(ReportRow), compare_report_rows);
+
+    fprintf(out, "  Tokens    Share     Cum  File\n");
+    fprintf(out, "  -------  ------  ------  ------------------------\n");
 
     size_t accounted_tokens = 0;
-    for (size_t i = 0; i < ctx.section_count; i++)
+    size_t listed = top > 0 && top < row_count ? top : row_count;
+    for (size_t i = 0; i < listed; i++)
     {
-        fprintf(out, "  %7zu  <%s>\n", ctx.sections[i].tokens, ctx.sections[i].name);
-        accounted_tokens += ctx.sections[i].tokens;
+        const TokenCount* row = rows[i].count;
+        accounted_tokens += row->tokens;
+        fprintf(out, "  %7zu  %5.1f%%  %5.1f%%  %s%s%s\n", row->tokens,
+                share_of(row->tokens, total_tokens), share_of(accounted_tokens, total_tokens),
+                rows[i].section ? "<" : "", row->name, rows[i].section ? ">" : "");
     }
 
-    for (size_t i = 0; i < ctx.file_count; i++)
+    if (listed < row_count)
     {
-        fprintf(out, "  %7zu  %s\n", ctx.files[i].tokens, ctx.files[i].filename);
-        accounted_tokens += ctx.files[i].tokens;
+        size_t folded = 0;
+        for (size_t i = listed; i < row_count; i++)
+        {
+            folded += rows[i].count->tokens;
+        }
+        accounted_tokens += folded;
+        fprintf(out, "  %7zu  %5.1f%%  %5.1f%%  <%zu more>\n", folded,
+                share_of(folded, total_tokens), share_of(accounted_tokens, total_tokens),
+                row_count - listed);
     }
+    free(rows);
 
-    size_t unaccounted = total_tokens - accounted_tokens;
+    size_t unaccounted = total_tokens > accounted_tokens ? total_tokens - accounted_tokens : 0;
     if (unaccounted > 0)
     {
-        fprintf(out, "  %7zu  <other>\n", unaccounted);
+        fprintf(out, "  %7zu  %5.1f%%  %5.1f%%  <other>\n", unaccounted,
+                share_of(unaccounted, total_tokens), 100.0);
     }
 
-    fprintf(out, "  -------  ------------------------\n");
-    fprintf(out, "  %7zu  Total\n", total_tokens);
+    fprintf(out, "  -------  ------  ------  ------------------------\n");
+    fprintf(out, "  %7zu                  Total\n", total_tokens);
 }
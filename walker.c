@@ -0,0 +1,485 @@
+#include "walker.h"
+#include "timings.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/* Paths are packed into blocks owned by the worker that discovered them, so
+ * entries never need an individual malloc and pointers stay stable. */
+#define WALK_BLOCK_SIZE (64 * 1024)
+
+typedef struct WalkBlock
+{
+    struct WalkBlock* next;
+    size_t used;
+    size_t cap;
+    char data[];
+} WalkBlock;
+
+/** A directory still to be read, with the context of its parent */
+typedef struct
+{
+    char* path;
+    void* parent_ctx;
+} DirItem;
+
+/** Directories waiting to be read; the owner works the back, thieves the front */
+typedef struct
+{
+    pthread_mutex_t lock;
+    DirItem* dirs;
+    size_t head;
+    size_t tail;
+    size_t cap;
+} DirDeque;
+
+typedef struct Walker Walker;
+
+typedef struct
+{
+    Walker* walker;
+    int id;
+    DirDeque deque;
+    WalkEntry* entries;
+    size_t count;
+    size_t cap;
+    WalkBlock* blocks;
+} WalkWorker;
+
+struct Walker
+{
+    WalkWorker* workers;
+    int num_workers;
+    size_t pending; /* Directories queued or being read; zero means the walk is done */
+    int failed;
+    WalkOptions opts;
+};
+
+static char* worker_alloc(WalkWorker* w, size_t size)
+{
+    WalkBlock* b = w->blocks;
+    if (!b || b->cap - b->used < size)
+    {
+        size_t cap = size > WALK_BLOCK_SIZE ? size : WALK_BLOCK_SIZE;
+        b = malloc(sizeof(WalkBlock) + cap);
+        if (!b)
+        {
+            return NULL;
+        }
+        b->next = w->blocks;
+        b->used = 0;
+        b->cap = cap;
+        w->blocks = b;
+    }
+    char* p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+/** Give back the most recent worker_alloc() (used when the filter rejects an entry) */
+static void worker_unalloc(WalkWorker* w, size_t size)
+{
+    w->blocks->used -= size;
+}
+
+static bool deque_push(DirDeque* q, DirItem dir)
+{
+    bool ok = true;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->cap)
+    {
+        if (q->head > 0)
+        {
+            memmove(q->dirs, q->dirs + q->head, (q->tail - q->head) * sizeof(DirItem));
+            q->tail -= q->head;
+            q->head = 0;
+        }
+        else
+        {
+            size_t cap = q->cap ? q->cap * 2 : 64;
+            DirItem* dirs = realloc(q->dirs, cap * sizeof(DirItem));
+            if (dirs)
+            {
+                q->dirs = dirs;
+                q->cap = cap;
+            }
+            else
+            {
+                ok = false;
+            }
+        }
+    }
+    if (ok)
+    {
+        q->dirs[q->tail++] = dir;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+static bool deque_pop_back(DirDeque* q, DirItem* dir)
+{
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head)
+    {
+        *dir = q->dirs[--q->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static bool deque_steal_front(DirDeque* q, DirItem* dir)
+{
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head)
+    {
+        *dir = q->dirs[q->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static bool worker_add_entry(WalkWorker* w, const char* path, const char* name, WalkKind kind)
+{
+    if (w->count == w->cap)
+    {
+        size_t cap = w->cap ? w->cap * 2 : 256;
+        WalkEntry* entries = realloc(w->entries, cap * sizeof(WalkEntry));
+        if (!entries)
+        {
+            return false;
+        }
+        w->entries = entries;
+        w->cap = cap;
+    }
+    w->entries[w->count].path = path;
+    w->entries[w->count].name = name;
+    w->entries[w->count].kind = kind;
+    w->count++;
+    return true;
+}
+
+static WalkKind kind_from_mode(mode_t mode)
+{
+    if (S_ISDIR(mode))
+        return WALK_DIR;
+    if (S_ISREG(mode))
+        return WALK_FILE;
+    return WALK_OTHER;
+}
+
+static void walk_fail(Walker* walker)
+{
+    __atomic_store_n(&walker->failed, 1, __ATOMIC_RELAXED);
+}
+
+/** Read one directory, recording its entries and queueing its subdirectories */
+static void worker_read_dir(WalkWorker* w, const DirItem* item)
+{
+    Walker* walker = w->walker;
+    const WalkOptions* opts = &walker->opts;
+    const char* dir_path = item->path;
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    timing_count(COUNTER_OPEN, 1);
+    if (fd < 0)
+    {
+        return;
+    }
+    DIR* dir = fdopendir(fd);
+    if (!dir)
+    {
+        close(fd);
+        return;
+    }
+
+    void* ctx = item->parent_ctx;
+    if (opts->enter_dir)
+    {
+        ctx = opts->enter_dir(dir_path, dirfd(dir), ctx, opts->user);
+    }
+
+    size_t dir_len = strlen(dir_path);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            continue;
+        /* Always skip the .git directory to mirror Git's behavior */
+        if (strcmp(name, ".git") == 0)
+            continue;
+
+        WalkKind kind = WALK_OTHER;
+        bool known = false;
+#ifdef DT_DIR
+        switch (entry->d_type)
+        {
+        case DT_DIR:
+            kind = WALK_DIR;
+            known = true;
+            break;
+        case DT_REG:
+            kind = WALK_FILE;
+            known = true;
+            break;
+        case DT_UNKNOWN:
+            break;
+        default:
+            known = true;
+            break;
+        }
+#endif
+        if (!known)
+        {
+            struct stat statbuf;
+            timing_count(COUNTER_LSTAT, 1);
+            if (fstatat(dirfd(dir), name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+            kind = kind_from_mode(statbuf.st_mode);
+        }
+
+        size_t name_len = strlen(name);
+        size_t size = dir_len + 1 + name_len + 1;
+        char* path = worker_alloc(w, size);
+        if (!path)
+        {
+            walk_fail(walker);
+            break;
+        }
+        memcpy(path, dir_path, dir_len);
+        path[dir_len] = '/';
+        memcpy(path + dir_len + 1, name, name_len + 1);
+
+        if (opts->filter && !opts->filter(path, kind, ctx, opts->user))
+        {
+            worker_unalloc(w, size);
+            continue;
+        }
+
+        if (!worker_add_entry(w, path, path + dir_len + 1, kind))
+        {
+            walk_fail(walker);
+            break;
+        }
+
+        if (kind == WALK_DIR)
+        {
+            __atomic_fetch_add(&walker->pending, 1, __ATOMIC_ACQ_REL);
+            DirItem child = {.path = path, .parent_ctx = ctx};
+            if (!deque_push(&w->deque, child))
+            {
+                __atomic_fetch_sub(&walker->pending, 1, __ATOMIC_ACQ_REL);
+                walk_fail(walker);
+                break;
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+static void* walk_worker_main(void* arg)
+{
+    WalkWorker* w = (WalkWorker*)arg;
+    Walker* walker = w->walker;
+
+    for (;;)
+    {
+        DirItem dir;
+        bool found = deque_pop_back(&w->deque, &dir);
+        for (int i = 1; !found && i < walker->num_workers; i++)
+        {
+            found =
+                deque_steal_front(&walker->workers[(w->id + i) % walker->num_workers].deque, &dir);
+        }
+
+        if (!found)
+        {
+            /* WHY: a directory is only retired after its children are queued,
+             * so pending hits zero exactly when no work can appear again. */
+            if (__atomic_load_n(&walker->pending, __ATOMIC_ACQUIRE) == 0)
+                break;
+            sched_yield();
+            continue;
+        }
+
+        if (!__atomic_load_n(&walker->failed, __ATOMIC_RELAXED))
+        {
+            worker_read_dir(w, &dir);
+        }
+        __atomic_fetch_sub(&walker->pending, 1, __ATOMIC_ACQ_REL);
+    }
+    return NULL;
+}
+
+static int compare_walk_entries(const void* a, const void* b)
+{
+    return strcmp(((const WalkEntry*)a)->path, ((const WalkEntry*)b)->path);
+}
+
+static void free_blocks(WalkBlock* b)
+{
+    while (b)
+    {
+        WalkBlock* next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+int walk_tree(const char* root, int jobs, const WalkOptions* opts, WalkResult* out)
+{
+    out->entries = NULL;
+    out->count = 0;
+    out->blocks = NULL;
+
+    if (jobs < 1)
+    {
+        jobs = 1;
+    }
+
+    Walker walker = {.num_workers = jobs};
+    if (opts)
+    {
+        walker.opts = *opts;
+    }
+    walker.workers = calloc((size_t)jobs, sizeof(WalkWorker));
+    if (!walker.workers)
+    {
+        return -1;
+    }
+    for (int i = 0; i < jobs; i++)
+    {
+        walker.workers[i].walker = &walker;
+        walker.workers[i].id = i;
+        pthread_mutex_init(&walker.workers[i].deque.lock, NULL);
+    }
+
+    size_t root_len = strlen(root);
+    char* root_copy = worker_alloc(&walker.workers[0], root_len + 1);
+    if (root_copy)
+    {
+        memcpy(root_copy, root, root_len + 1);
+        walker.pending = 1;
+        DirItem root_item = {.path = root_copy, .parent_ctx = walker.opts.root_ctx};
+        if (!deque_push(&walker.workers[0].deque, root_item))
+        {
+            walker.pending = 0;
+            walker.failed = 1;
+        }
+    }
+    else
+    {
+        walker.failed = 1;
+    }
+
+    /* The calling thread is worker 0 */
+    pthread_t* threads = NULL;
+    int started = 0;
+    if (jobs > 1 && !walker.failed)
+    {
+        threads = malloc((size_t)(jobs - 1) * sizeof(pthread_t));
+        for (int i = 1; threads && i < jobs; i++)
+        {
+            if (pthread_create(&threads[started], NULL, walk_worker_main, &walker.workers[i]) != 0)
+                break;
+            started++;
+        }
+    }
+
+    walk_worker_main(&walker.workers[0]);
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    size_t total = 0;
+    for (int i = 0; i < jobs; i++)
+    {
+        total += walker.workers[i].count;
+    }
+
+    WalkEntry* entries = NULL;
+    if (!walker.failed && total > 0)
+    {
+        entries = malloc(total * sizeof(WalkEntry));
+        if (!entries)
+        {
+            walker.failed = 1;
+        }
+    }
+
+    size_t pos = 0;
+    for (int i = 0; i < jobs; i++)
+    {
+        WalkWorker* w = &walker.workers[i];
+        if (entries && w->count > 0) /* An idle worker's list is NULL */
+        {
+            memcpy(entries + pos, w->entries, w->count * sizeof(WalkEntry));
+            pos += w->count;
+        }
+        free(w->entries);
+        free(w->deque.dirs);
+        pthread_mutex_destroy(&w->deque.lock);
+
+        /* Hand every worker's path storage over to the result */
+        WalkBlock* last = w->blocks;
+        while (last && last->next)
+        {
+            last = last->next;
+        }
+        if (last)
+        {
+            last->next = out->blocks;
+            out->blocks = w->blocks;
+        }
+    }
+    free(walker.workers);
+
+    if (walker.failed)
+    {
+        free(entries);
+        free_blocks(out->blocks);
+        out->blocks = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* WHY: workers finish in nondeterministic order; sorting restores a stable output */
+    if (entries)
+    {
+        qsort(entries, total, sizeof(WalkEntry), compare_walk_entries);
+    }
+    out->entries = entries;
+    out->count = total;
+    return 0;
+}
+
+void walk_result_free(WalkResult* result)
+{
+    if (!result)
+    {
+        return;
+    }
+    free(result->entries);
+    free_blocks(result->blocks);
+    result->entries = NULL;
+    result->count = 0;
+    result->blocks = NULL;
+}
@@ -0,0 +1,78 @@
+#ifndef WALKER_H
+#define WALKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Parallel directory walker
+ *
+ * Directories are spread over a pool of worker threads, each owning a deque
+ * of directories still to be read. A worker pops from the back of its own
+ * deque and, when that runs dry, steals from the front of another worker's.
+ * Entry types come from readdir's d_type; only filesystems that report
+ * DT_UNKNOWN cost one fstatat() relative to the open directory, so every
+ * entry is stat'd at most once.
+ */
+
+/** Entry kind as reported by d_type (or lstat semantics: symlinks are not followed) */
+typedef enum
+{
+    WALK_OTHER = 0, /* Symlink, fifo, socket, device */
+    WALK_FILE,
+    WALK_DIR
+} WalkKind;
+
+typedef struct
+{
+    const char* path; /* "<root>/<name>/...", owned by the WalkResult */
+    const char* name; /* Basename, points into path */
+    WalkKind kind;
+} WalkEntry;
+
+/**
+ * Decide whether an entry is kept. Rejected directories are not descended.
+ * dir_ctx is the context returned by enter_dir for the containing directory.
+ * WHY: called concurrently from worker threads; implementations must only
+ * read state that is fixed for the duration of the walk.
+ */
+typedef bool (*WalkFilter)(const char* path, WalkKind kind, void* dir_ctx, void* user);
+
+/**
+ * Called once per directory, with the directory open as dir_fd, before its
+ * entries are read. Returns the context its entries and subdirectories see;
+ * parent_ctx is the context of the enclosing directory (root_ctx for the root).
+ * Context lifetime is owned by the caller and must outlast the walk.
+ */
+typedef void* (*WalkEnterDir)(const char* path, int dir_fd, void* parent_ctx, void* user);
+
+typedef struct
+{
+    WalkFilter filter;       /* NULL keeps everything */
+    WalkEnterDir enter_dir;  /* NULL passes root_ctx everywhere */
+    void* root_ctx;
+    void* user;
+} WalkOptions;
+
+struct WalkBlock;
+
+typedef struct
+{
+    WalkEntry* entries; /* Sorted by strcmp() on path */
+    size_t count;
+    struct WalkBlock* blocks; /* Path storage backing entries */
+} WalkResult;
+
+/**
+ * Walk everything below root (root itself is not reported).
+ * ".git" directories are always skipped; unreadable directories are skipped
+ * silently. jobs < 1 is treated as 1, which walks on the calling thread.
+ * opts may be NULL.
+ * Returns 0 on success, -1 on allocation failure (out is left empty).
+ */
+int walk_tree(const char* root, int jobs, const WalkOptions* opts, WalkResult* out);
+
+/** Release all memory owned by a WalkResult */
+void walk_result_free(WalkResult* result);
+
+#endif /* WALKER_H */